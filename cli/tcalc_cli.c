@@ -11,15 +11,85 @@
 #include <limits.h>
 #include <inttypes.h>
 
-tcalc_token globalTokenBuffer[TCALC_KIBI(512)];
-int32_t globalTokenBufferCapacity = (int32_t)TCALC_ARRAY_SIZE(globalTokenBuffer);
+// Both buffers start out empty and are grown by tcalc_cli_reserve_buffers to
+// fit each expression before it is tokenized or parsed.
+tcalc_token* globalTokenBuffer = NULL;
+int32_t globalTokenBufferCapacity = 0;
 int32_t globalTokenBufferLen = 0;
 
-tcalc_exprtree globalTreeNodeBuffer[TCALC_KIBI(512)];
-int32_t globalTreeNodeBufferCapacity = (int32_t)TCALC_ARRAY_SIZE(globalTreeNodeBuffer);
+tcalc_exprtree* globalTreeNodeBuffer = NULL;
+int32_t globalTreeNodeBufferCapacity = 0;
 int32_t globalTreeNodeBufferLen = 0;
 int32_t globalTreeNodeBufferRootIndex = -1;
 
+// there are never more frames in use than operator nodes in the tree, so this
+// is grown to the tree's size, and the depth of a tree is only limited by memory
+tcalc_evalframe* globalEvalFrameBuffer = NULL;
+int32_t globalEvalFrameBufferCapacity = 0;
+
+#define TCALC_CLI_MIN_BUFFER_CAPACITY 64
+
+// grows *buffer to hold at least needed elements of elementSize bytes
+static tcalc_err tcalc_cli_grow_buffer(void** buffer, int32_t* capacity, int32_t needed, size_t elementSize) {
+  if (needed <= *capacity) return TCALC_ERR_OK;
+
+  // at least double, so that a REPL session reallocates only a few times
+  int32_t newCapacity = *capacity > INT32_MAX / 2 ? INT32_MAX : 2 * *capacity;
+  if (newCapacity < needed) newCapacity = needed;
+  if (newCapacity < TCALC_CLI_MIN_BUFFER_CAPACITY) newCapacity = TCALC_CLI_MIN_BUFFER_CAPACITY;
+  if ((size_t)newCapacity > SIZE_MAX / elementSize) return TCALC_ERR_NOMEM;
+
+  void* grown = realloc(*buffer, elementSize * (size_t)newCapacity);
+  if (grown == NULL) return TCALC_ERR_NOMEM;
+  *buffer = grown;
+  *capacity = newCapacity;
+  return TCALC_ERR_OK;
+}
+
+tcalc_err tcalc_cli_reserve_buffers(const char* expr, int32_t exprLen) {
+  tcalc_err err = TCALC_ERR_OK;
+  int32_t tokenCount = 0, treeNodeCount = 0;
+  ret_on_err(err, tcalc_measure_infix(expr, exprLen, &tokenCount, &treeNodeCount));
+  ret_on_err(err, tcalc_cli_grow_buffer(
+    (void**)&globalTokenBuffer, &globalTokenBufferCapacity, tokenCount, sizeof(tcalc_token)
+  ));
+  ret_on_err(err, tcalc_cli_grow_buffer(
+    (void**)&globalTreeNodeBuffer, &globalTreeNodeBufferCapacity, treeNodeCount, sizeof(tcalc_exprtree)
+  ));
+  return TCALC_ERR_OK;
+}
+
+tcalc_err tcalc_cli_eval_expr(const char* expr, int32_t exprLen, const tcalc_ctx* ctx, tcalc_val* out) {
+  tcalc_err err = TCALC_ERR_OK;
+  ret_on_err(err, tcalc_cli_reserve_buffers(expr, exprLen));
+  ret_on_err(err, tcalc_tokenize_infix(
+    expr, exprLen, globalTokenBuffer, globalTokenBufferCapacity, &globalTokenBufferLen
+  ));
+  ret_on_err(err, tcalc_create_exprtree_infix_wctx(
+    expr, exprLen, globalTokenBuffer, globalTokenBufferLen, ctx, globalTreeNodeBuffer,
+    globalTreeNodeBufferCapacity, &globalTreeNodeBufferLen, &globalTreeNodeBufferRootIndex
+  ));
+  ret_on_err(err, tcalc_cli_grow_buffer(
+    (void**)&globalEvalFrameBuffer, &globalEvalFrameBufferCapacity, globalTreeNodeBufferLen, sizeof(tcalc_evalframe)
+  ));
+  return tcalc_eval_exprtree_stk(
+    expr, exprLen, globalTreeNodeBuffer, globalTreeNodeBufferLen, globalTreeNodeBufferRootIndex,
+    globalTokenBuffer, globalTokenBufferLen, ctx, globalEvalFrameBuffer, globalEvalFrameBufferCapacity, out
+  );
+}
+
+void tcalc_cli_free_buffers(void) {
+  free(globalTokenBuffer);
+  globalTokenBuffer = NULL;
+  globalTokenBufferCapacity = 0;
+  free(globalTreeNodeBuffer);
+  globalTreeNodeBuffer = NULL;
+  globalTreeNodeBufferCapacity = 0;
+  free(globalEvalFrameBuffer);
+  globalEvalFrameBuffer = NULL;
+  globalEvalFrameBufferCapacity = 0;
+}
+
 
 const char* TCALC_HELP_MESSAGE = "tcalc usage: tcalc [-h] expression \n"
 "\n"
@@ -28,7 +98,9 @@ const char* TCALC_HELP_MESSAGE = "tcalc usage: tcalc [-h] expression \n"
 "    --exprtree: Print the expression tree of the given expression\n"
 "    --tokens: Print the tokens of the given expression\n"
 "    --degrees: Set trigonometric functions to be defined with degrees\n"
-"    --radians: Set trigonometric functions to be defined with radians\n";
+"    --radians: Set trigonometric functions to be defined with radians\n"
+"    --shortest: Print numbers as the shortest decimal that reads back exactly,\n"
+"        instead of with six decimal places\n";
 
 enum tcalc_cli_action {
   TCALC_CLI_PRINT_EXPRTREE,
@@ -42,11 +114,12 @@ enum tcalc_cli_action {
 #define arg_tokens 43112
 #define arg_degrees 43115
 #define arg_radians 43116
+#define arg_shortest 43117
 
 
 int main(int argc, char** argv) {
   enum tcalc_cli_action action = TCALC_CLI_EVALUATE;
-  struct eval_opts eval_opts = { .use_rads = true };
+  struct eval_opts eval_opts = { .use_rads = true, .numfmt = TCALC_NUMFMT_FIXED };
 
   static struct option const longopts[] = {
     {"help", no_argument, NULL, 'h'},
@@ -54,6 +127,7 @@ int main(int argc, char** argv) {
     {"tokens", no_argument, NULL, arg_tokens},
     {"degrees", no_argument, NULL, arg_degrees},
     {"radians", no_argument, NULL, arg_radians},
+    {"shortest", no_argument, NULL, arg_shortest},
     {NULL, 0, NULL, 0},
   };
 
@@ -68,6 +142,7 @@ int main(int argc, char** argv) {
       case arg_tokens: action = TCALC_CLI_PRINT_TOKENS; break;
       case arg_degrees: eval_opts.use_rads = false; break;
       case arg_radians: eval_opts.use_rads = true; break;
+      case arg_shortest: eval_opts.numfmt = TCALC_NUMFMT_SHORTEST; break;
       default: {
         fputs(TCALC_HELP_MESSAGE, stderr);
         return EXIT_FAILURE;
@@ -75,7 +150,11 @@ int main(int argc, char** argv) {
     }
   }
 
-  if (optind >= argc) return tcalc_repl();
+  if (optind >= argc) {
+    const int status = tcalc_repl(eval_opts);
+    tcalc_cli_free_buffers();
+    return status;
+  }
   char* expression = argv[optind];
   size_t expressionLenSizeT = strlen(expression);
   if (expressionLenSizeT > INT32_MAX)
@@ -90,14 +169,19 @@ int main(int argc, char** argv) {
 
   const int32_t expressionLen = (int32_t)expressionLenSizeT;
 
+  int status = EXIT_SUCCESS;
   switch (action) {
     case TCALC_CLI_PRINT_EXPRTREE:
-      return tcalc_cli_print_exprtree(expression, expressionLen);
+      status = tcalc_cli_print_exprtree(expression, expressionLen);
+      break;
     case TCALC_CLI_PRINT_TOKENS:
-      return tcalc_cli_infix_tokenizer(expression, expressionLen);
+      status = tcalc_cli_infix_tokenizer(expression, expressionLen);
+      break;
     case TCALC_CLI_EVALUATE:
     default:
-      return tcalc_cli_eval(expression, expressionLen, eval_opts);
+      status = tcalc_cli_eval(expression, expressionLen, eval_opts);
+      break;
   }
-  return EXIT_SUCCESS;
+  tcalc_cli_free_buffers();
+  return status;
 }
@@ -3,18 +3,30 @@
 
 #include "tcalc.h"
 
-#include <stdio.h>
 #include <stdio.h>
 
-extern tcalc_token globalTokenBuffer[];
+extern tcalc_token* globalTokenBuffer;
 extern int32_t globalTokenBufferCapacity;
 extern int32_t globalTokenBufferLen;
 
-extern tcalc_exprtree globalTreeNodeBuffer[];
+extern tcalc_exprtree* globalTreeNodeBuffer;
 extern int32_t globalTreeNodeBufferCapacity;
 extern int32_t globalTreeNodeBufferLen;
 extern int32_t globalTreeNodeBufferRootIndex;
 
+/**
+ * Grow the global token and tree node buffers to fit expr, which is measured
+ * with tcalc_measure_infix. Lexing errors in expr are returned as they are.
+*/
+tcalc_err tcalc_cli_reserve_buffers(const char* expr, int32_t exprLen);
+
+/**
+ * Evaluate expr in the global buffers, growing them to whatever expr needs
+*/
+tcalc_err tcalc_cli_eval_expr(const char* expr, int32_t exprLen, const tcalc_ctx* ctx, tcalc_val* out);
+
+void tcalc_cli_free_buffers(void);
+
 #define TCALC_CLI_CHECK_ERR(err, ...) \
   if (err) { \
     fprintf(stderr, __VA_ARGS__); \
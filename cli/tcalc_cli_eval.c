@@ -9,24 +9,11 @@
 
 int tcalc_cli_eval(const char* expr, int32_t exprLen, struct eval_opts eval_opts) {
   tcalc_val ans;
-  tcalc_ctx* ctx = NULL;
-  tcalc_err err = tcalc_ctx_alloc_default(&ctx);
-  TCALC_CLI_CHECK_ERR(err, "[%s] TCalc error while allocating evaluation context: %s\n", __func__, tcalc_strerrcode(err));
-
-  if (!eval_opts.use_rads) {
-    err = tcalc_ctx_addtrigdeg(ctx);
-    TCALC_CLI_CHECK_ERR(err, "[%s] TCalc error while switching to degree-trig functions: %s\n ", __func__, tcalc_strerrcode(err));
-  }
-
-  int32_t treeNodeCount = 0, tokenCount = 0;
-  err = tcalc_eval_wctx(
-    expr, exprLen, globalTreeNodeBuffer, globalTreeNodeBufferCapacity,
-    globalTokenBuffer, globalTokenBufferCapacity, ctx, &ans,
-    &treeNodeCount, &tokenCount
-  );
+  const tcalc_ctx* ctx = eval_opts.use_rads ? tcalc_ctx_default() : tcalc_ctx_default_deg();
 
+  tcalc_err err = tcalc_cli_eval_expr(expr, exprLen, ctx, &ans);
   TCALC_CLI_CHECK_ERR(err, "[%s] TCalc error while evaluating expression: %s\n ", __func__, tcalc_strerrcode(err));
 
-  tcalc_val_fputline(stdout, ans);
+  tcalc_val_fputline_fmt(stdout, ans, eval_opts.numfmt);
   return EXIT_SUCCESS;
 }
@@ -7,7 +7,9 @@
 #include <stdlib.h>
 
 int tcalc_cli_infix_tokenizer(const char* expr, int32_t exprLen) {
-  tcalc_err err = tcalc_tokenize_infix(expr, exprLen, globalTokenBuffer, globalTokenBufferCapacity, &globalTokenBufferLen);
+  tcalc_err err = tcalc_cli_reserve_buffers(expr, exprLen);
+  TCALC_CLI_CHECK_ERR(err, "[%s] tcalc error: %s\n ", __func__, tcalc_strerrcode(err));
+  err = tcalc_tokenize_infix(expr, exprLen, globalTokenBuffer, globalTokenBufferCapacity, &globalTokenBufferLen);
   TCALC_CLI_CHECK_ERR(err, "[%s] tcalc error: %s\n ", __func__, tcalc_strerrcode(err));
 
   for (int32_t i = 0; i < globalTokenBufferLen; i++) {
@@ -15,7 +17,7 @@ int tcalc_cli_infix_tokenizer(const char* expr, int32_t exprLen) {
       stdout,
       "{ type: %s, value: '%.*s' }, ",
       tcalc_token_type_str(globalTokenBuffer[i].type),
-      TCALC_TOKEN_PRINTF_VARARG(expr, globalTokenBuffer[i])
+      TCALC_TOKEN_PRINTF_VARARG(expr, exprLen, globalTokenBuffer[i])
     );
   }
   fputc('\n', stdout);
@@ -26,7 +28,7 @@ int tcalc_cli_infix_tokenizer(const char* expr, int32_t exprLen) {
     fprintf(
       stdout,
       "'%.*s'%s",
-      TCALC_TOKEN_PRINTF_VARARG(expr, globalTokenBuffer[i]),
+      TCALC_TOKEN_PRINTF_VARARG(expr, exprLen, globalTokenBuffer[i]),
       i == globalTokenBufferLen - 1 ? "" : ", "
     );
   }
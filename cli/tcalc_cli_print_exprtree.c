@@ -11,7 +11,7 @@
 #define TCALC_EXPRTREE_PRINT_MAX_DEPTH 20
 
 static void tcalc_exprtree_fdump_preorder(
-  FILE* file, const char* expr, tcalc_exprtree* treeBuf, int32_t treeBufLen,
+  FILE* file, const char* expr, int32_t exprLen, tcalc_exprtree* treeBuf, int32_t treeBufLen,
   tcalc_token* tokenBuf, int32_t tokenBufLen, int32_t exprNodeInd, int depth
 );
 
@@ -20,6 +20,9 @@ int tcalc_cli_print_exprtree(const char* expr, int32_t exprLen) {
   tcalc_err err = tcalc_ctx_alloc_default(&ctx);
   TCALC_CLI_CHECK_ERR(err, "[%s] tcalc error while initializing tcalc_ctx: %s\n", __func__, tcalc_strerrcode(err));
 
+  err = tcalc_cli_reserve_buffers(expr, exprLen);
+  TCALC_CLI_CHECK_ERR(err, "[%s] tcalc error while lexing and parsing in tcalc_ctx: %s\n", __func__, tcalc_strerrcode(err));
+
   err = tcalc_lex_parse(
     expr, exprLen, globalTokenBuffer, globalTokenBufferCapacity,
     globalTreeNodeBuffer, globalTreeNodeBufferCapacity,
@@ -33,7 +36,7 @@ int tcalc_cli_print_exprtree(const char* expr, int32_t exprLen) {
   TCALC_CLI_CHECK_ERR(err, "[%s] tcalc error: %s\n", __func__, tcalc_strerrcode(err));
 
   tcalc_exprtree_fdump_preorder(
-    stdout, expr, globalTreeNodeBuffer, globalTreeNodeBufferLen, globalTokenBuffer,
+    stdout, expr, exprLen, globalTreeNodeBuffer, globalTreeNodeBufferLen, globalTokenBuffer,
     globalTokenBufferLen, globalTreeNodeBufferRootIndex, 0
   );
   return EXIT_SUCCESS;
@@ -48,7 +51,7 @@ static tcalc_token tcalc_token_from_binary_token_ind(
     return (tcalc_token){
       .type = TCALC_TOK_BINOP,
       .start = tokenBuf[-binNodeTokenInd].start,
-      .xend = tokenBuf[-binNodeTokenInd].start,
+      .len = 0,
     };
   }
   assert(binNodeTokenInd < tokenBufLen);
@@ -56,7 +59,7 @@ static tcalc_token tcalc_token_from_binary_token_ind(
 }
 
 static void tcalc_exprtree_fdump_preorder(
-  FILE* file, const char* expr, tcalc_exprtree* treeBuf, int32_t treeBufLen,
+  FILE* file, const char* expr, int32_t exprLen, tcalc_exprtree* treeBuf, int32_t treeBufLen,
   tcalc_token* tokenBuf, int32_t tokenBufLen, int32_t exprNodeInd, int depth
 ) {
   for (int i = 0; i < depth; i++)
@@ -69,7 +72,7 @@ static void tcalc_exprtree_fdump_preorder(
         fprintf(
           file, "%.*s\n",
           TCALC_TOKEN_PRINTF_VARARG(
-            expr,
+            expr, exprLen,
             tcalc_token_from_binary_token_ind(
               tokenBuf, tokenBufLen,
               treeBuf[exprNodeInd].as.binary.tokenIndOImplMult
@@ -78,12 +81,12 @@ static void tcalc_exprtree_fdump_preorder(
         );
 
         tcalc_exprtree_fdump_preorder(
-          file, expr, treeBuf, treeBufLen, tokenBuf,
+          file, expr, exprLen, treeBuf, treeBufLen, tokenBuf,
           tokenBufLen, treeBuf[exprNodeInd].as.binary.leftTreeInd, depth + 1
         );
 
         tcalc_exprtree_fdump_preorder(
-          file, expr, treeBuf, treeBufLen, tokenBuf,
+          file, expr, exprLen, treeBuf, treeBufLen, tokenBuf,
           tokenBufLen, treeBuf[exprNodeInd].as.binary.rightTreeInd, depth + 1
         );
       }
@@ -93,12 +96,12 @@ static void tcalc_exprtree_fdump_preorder(
         fprintf(
           file, "%.*s\n",
           TCALC_TOKEN_PRINTF_VARARG(
-            expr, tokenBuf[treeBuf[exprNodeInd].as.unary.tokenInd]
+            expr, exprLen, tokenBuf[treeBuf[exprNodeInd].as.unary.tokenInd]
           )
         );
 
         tcalc_exprtree_fdump_preorder(
-          file, expr, treeBuf, treeBufLen, tokenBuf,
+          file, expr, exprLen, treeBuf, treeBufLen, tokenBuf,
           tokenBufLen, treeBuf[exprNodeInd].as.unary.childTreeInd, depth + 1
         );
       }
@@ -108,7 +111,7 @@ static void tcalc_exprtree_fdump_preorder(
         fprintf(
           file, "%.*s\n",
           TCALC_TOKEN_PRINTF_VARARG(
-            expr, tokenBuf[treeBuf[exprNodeInd].as.value.tokenInd]
+            expr, exprLen, tokenBuf[treeBuf[exprNodeInd].as.value.tokenInd]
           )
         );
       }
@@ -117,7 +120,7 @@ static void tcalc_exprtree_fdump_preorder(
         fprintf(
           file, "%.*s\n",
           TCALC_TOKEN_PRINTF_VARARG(
-            expr, tokenBuf[treeBuf[exprNodeInd].as.value.tokenInd]
+            expr, exprLen, tokenBuf[treeBuf[exprNodeInd].as.value.tokenInd]
           )
         );
 
@@ -126,7 +129,7 @@ static void tcalc_exprtree_fdump_preorder(
         {
           assert(treeBuf[funcArgNodeInd].type == TCALC_EXPRTREE_NODE_TYPE_FUNCARG);
           tcalc_exprtree_fdump_preorder(
-            file, expr, treeBuf, treeBufLen, tokenBuf,
+            file, expr, exprLen, treeBuf, treeBufLen, tokenBuf,
             tokenBufLen, funcArgNodeInd, depth + 1
           );
           funcArgNodeInd = treeBuf[funcArgNodeInd].as.funcarg.nextArgInd;
@@ -136,11 +139,20 @@ static void tcalc_exprtree_fdump_preorder(
       case TCALC_EXPRTREE_NODE_TYPE_FUNCARG:
       {
         tcalc_exprtree_fdump_preorder(
-          file, expr, treeBuf, treeBufLen, tokenBuf,
+          file, expr, exprLen, treeBuf, treeBufLen, tokenBuf,
           tokenBufLen, treeBuf[exprNodeInd].as.funcarg.exprInd, depth + 1
         );
       }
       break;
+      case TCALC_EXPRTREE_NODE_TYPE_CONST:
+      {
+        const tcalc_val val = treeBuf[exprNodeInd].as.constant.val;
+        if (val.type == TCALC_VALTYPE_NUM)
+          fprintf(file, "%g\n", val.as.num);
+        else
+          fprintf(file, "%s\n", val.as.boolean ? "true" : "false");
+      }
+      break;
     }
   } else {
     fputs("...\n", stdout);
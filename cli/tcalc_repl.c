@@ -6,9 +6,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 
-#define TCALC_REPL_INPUT_BUFFER_SIZE TCALC_KIBI(128)
-char globalInputBuffer[TCALC_REPL_INPUT_BUFFER_SIZE];
+// grown by getline to fit the longest line read so far
+char* globalInputBuffer = NULL;
+size_t globalInputBufferCapacity = 0;
 
 const char* repl_entrance_text = ""
 "tcalc REPL begun:\n"
@@ -26,24 +28,27 @@ const char* repl_help = ""
 "  \"variables\": Print all defined variables\n"
 "  \"functions\": Print all defined functions\n";
 
-int tcalc_repl() {
+int tcalc_repl(struct eval_opts eval_opts) {
   fputs(repl_entrance_text, stdout);
   const char* quit_strings[3] = {"quit", "exit", "end"};
 
+  // the REPL only ever defines variables (ans), so they go in an overlay on
+  // top of the default context instead of a copy of it
   tcalc_ctx* ctx = NULL;
-  tcalc_err err = tcalc_ctx_alloc_default(&ctx);
+  const tcalc_ctx* base = eval_opts.use_rads ? tcalc_ctx_default() : tcalc_ctx_default_deg();
+  tcalc_err err = tcalc_ctx_alloc_overlay(base, &ctx);
   TCALC_CLI_CLEANUP_ERR(err, "[%s] Failed to allocate ctx for REPL... exiting: %s", __func__, tcalc_strerrcode(err))
 
   err = tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("ans"), TCALC_VAL_INIT_NUM(0.0));
   TCALC_CLI_CLEANUP_ERR(err, "[%s] Failed to set ans variable on tcalc ctx.. exiting: %s", __func__, tcalc_strerrcode(err))
 
-  while (!tcalc_str_list_has(globalInputBuffer, quit_strings, TCALC_ARRAY_SIZE(quit_strings))) {
+  while (true) {
     fputs("> ", stdout);
-    char* input = fgets(globalInputBuffer, TCALC_REPL_INPUT_BUFFER_SIZE, stdin);
-    if (input == NULL) {
+    if (getline(&globalInputBuffer, &globalInputBufferCapacity, stdin) < 0) {
       fprintf(stderr, "Error reading from stdin: Exiting\n");
       goto cleanup;
     }
+    char* input = globalInputBuffer;
 
 
     input[strcspn(input, "\r\n")] = '\0';
@@ -63,48 +68,51 @@ int tcalc_repl() {
       continue;
     }
     else if (strcmp(input, "variables") == 0) {
-      for (size_t i = 0; i < ctx->vars.len; i++) {
-        const tcalc_vardef var = ctx->vars.arr[i];
-        fputs(var.id, stdout);
-        fputs(" = ", stdout);
-        tcalc_val_fputline(stdout, var.val);
+      // the default context's constants, then the REPL's own variables
+      const tcalc_ctx* scopes[2] = { ctx->parent, ctx };
+      for (size_t s = 0; s < TCALC_ARRAY_SIZE(scopes); s++) {
+        for (size_t i = 0; i < scopes[s]->vars.len; i++) {
+          const tcalc_vardef var = scopes[s]->vars.arr[i];
+          fputs(var.id, stdout);
+          fputs(" = ", stdout);
+          tcalc_val_fputline_fmt(stdout, var.val, eval_opts.numfmt);
+        }
       }
       continue;
     }
     else if (strcmp(input, "functions") == 0) {
-      for (size_t i = 0; i < ctx->unfuncs.len; i++) {
-        printf("%s%s", ctx->unfuncs.arr[i].id, i == ctx->unfuncs.len - 1 ? "" : ", ");
+      const tcalc_ctx* funcs = ctx->parent;
+      for (size_t i = 0; i < funcs->unfuncs.len; i++) {
+        printf("%s%s", funcs->unfuncs.arr[i].id, i == funcs->unfuncs.len - 1 ? "" : ", ");
       }
 
-      for (size_t i = 0; i < ctx->binfuncs.len; i++) {
-        printf("%s%s", ctx->binfuncs.arr[i].id, i == ctx->binfuncs.len - 1 ? "" : ", ");
+      for (size_t i = 0; i < funcs->binfuncs.len; i++) {
+        printf("%s%s", funcs->binfuncs.arr[i].id, i == funcs->binfuncs.len - 1 ? "" : ", ");
       }
       fputs("\n", stdout);
       continue;
     }
 
-    int32_t treeNodeCount = 0, tokenCount = 0;
     tcalc_val ans = { 0 };
-    tcalc_err err = tcalc_eval_wctx(
-      input, inputLen, globalTreeNodeBuffer, globalTreeNodeBufferCapacity,
-      globalTokenBuffer, globalTokenBufferCapacity, ctx, &ans,
-      &treeNodeCount, &tokenCount
-    );
+    tcalc_err err = tcalc_cli_eval_expr(input, inputLen, ctx, &ans);
 
     if (err) {
       fprintf(stderr, "tcalc error: %s\n", tcalc_strerrcode(err));
       tcalc_errstk_fdump(stderr);
     } else {
-      tcalc_val_fputline(stdout, ans);
+      tcalc_val_fputline_fmt(stdout, ans, eval_opts.numfmt);
     }
 
     fputs("\n", stdout);
     cleanup_on_err(err, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("ans"), ans));
   }
 
+  tcalc_ctx_free(ctx);
+  free(globalInputBuffer);
   return EXIT_SUCCESS;
 
   cleanup:
     tcalc_ctx_free(ctx);
+    free(globalInputBuffer);
     return EXIT_FAILURE;
 }
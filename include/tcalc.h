@@ -52,7 +52,13 @@
  * As an extra note, if the function contains any type of allocation,
  * it should return tcalc_err, as an allocation failure is always possible.
  *
- * The global error string is generally only set when actual lexical, syntactical, or semantical
+ * Each thread has its own error stack, so expressions can be evaluated from
+ * several threads at once without the error messages of one thread showing up
+ * in another. Building for a compiler without thread-local storage fails
+ * unless TCALC_THREAD_LOCAL is defined, which can be defined as nothing to
+ * share a single error stack between all threads.
+ *
+ * The error stack is generally only added to when actual lexical, syntactical, or semantical
  * errors are encountered. This is so code isn't cluttered with reporting error strings
  * for error code's like TCALC_ERR_NOMEM or TCALC_ERR_OUT_OF_BOUNDS, which generally
  * are more so exceptional than actual errors, as they are
@@ -74,9 +80,18 @@ int tcalc_errstkpop();
 void tcalc_errstk_fdump(FILE* file);
 
 
+// Both of these format their message immediately. Prefer the structured
+// tcalc_errstkadd_* functions below on paths which may fail often.
 bool tcalc_errstkadd(const char* funcname, const char* errstr);
 bool tcalc_errstkaddf(const char* funcname, const char* format, ...) TCALC_FORMAT_ATTRIB(printf, 2, 3);
 
+/**
+ * Write the message of the error on top of the calling thread's error stack
+ * into out as a null-terminated string, formatting it if it was recorded by
+ * one of the structured tcalc_errstkadd_* functions.
+ *
+ * @returns the length of the string written to out, or 0 if the stack is empty
+*/
 int32_t tcalc_errstkpeek(char* out, int32_t dsize);
 
 /**
@@ -123,6 +138,8 @@ typedef enum tcalc_err {
   TCALC_ERR_FUNC_TOO_MANY_ARGS,
   TCALC_ERR_BAD_CAST,
   TCALC_ERR_UNPROCESSED_INPUT,
+  TCALC_ERR_IMMUTABLE,
+  TCALC_ERR_MAX_DEPTH,
 
   // add new errors above this
   TCALC_ERR_UNIMPLEMENTED,
@@ -266,6 +283,64 @@ void* tcalc_xcalloc(size_t, size_t);
 void* tcalc_xrealloc(void*, size_t);
 
 /**
+ * A tcalc_allocator supplies the memory for a context and for everything
+ * allocated on behalf of it, like the bytecode, prepared expressions and
+ * variable stores compiled or built from it. user is passed to each function.
+ *
+ * alloc returns NULL when it cannot allocate size bytes. realloc is never
+ * given a NULL ptr, and returns NULL (leaving ptr allocated) when it cannot
+ * resize it. realloc and free are given the size that ptr was allocated or
+ * last resized with, so allocators which do not track sizes themselves, like
+ * arenas or wrappers counting the memory used, do not have to.
+ *
+ * A NULL tcalc_allocator* stands for tcalc_allocator_default(), which uses
+ * malloc, realloc and free.
+*/
+typedef struct tcalc_allocator {
+  void* (*alloc)(void* user, size_t size);
+  void* (*realloc)(void* user, void* ptr, size_t oldSize, size_t newSize);
+  void (*free)(void* user, void* ptr, size_t size);
+  void* user;
+} tcalc_allocator;
+
+const tcalc_allocator* tcalc_allocator_default(void);
+
+/**
+ * Allocate, resize and free memory with an allocator. tcalc_calloc zeroes the
+ * memory it allocates and returns NULL if nmemb * size overflows.
+ * tcalc_realloc allocates when ptr is NULL, and tcalc_free does nothing when
+ * ptr is NULL.
+*/
+void* tcalc_alloc(const tcalc_allocator* allocator, size_t size);
+void* tcalc_calloc(const tcalc_allocator* allocator, size_t nmemb, size_t size);
+void* tcalc_realloc(const tcalc_allocator* allocator, void* ptr, size_t oldSize, size_t newSize);
+void tcalc_free(const tcalc_allocator* allocator, void* ptr, size_t size);
+
+/**
+ * A tcalc_arena bump-allocates memory out of chunks which it gets from a
+ * backing allocator (NULL for the default one), growing by chunks of at least
+ * chunkSize bytes, each twice as large as the last.
+ *
+ * tcalc_arena_reset makes all of the arena's memory available again in
+ * constant time, without giving any chunks back, so an arena which is reset
+ * after every job stops allocating once it has grown to fit the largest one.
+ * Memory is handed out aligned to 16 bytes, and tcalc_arena_push returns NULL
+ * when the backing allocator fails.
+ *
+ * tcalc_arena_allocator is a tcalc_allocator which allocates from the arena.
+ * Its free only gives memory back if it was the last block allocated, and its
+ * realloc resizes the last block in place.
+*/
+typedef struct tcalc_arena tcalc_arena;
+
+tcalc_err tcalc_arena_alloc(const tcalc_allocator* backing, size_t chunkSize, tcalc_arena** out);
+void tcalc_arena_free(tcalc_arena* arena);
+void tcalc_arena_reset(tcalc_arena* arena);
+void* tcalc_arena_push(tcalc_arena* arena, size_t size);
+const tcalc_allocator* tcalc_arena_allocator(tcalc_arena* arena);
+
+/**
+ * allocator: The tcalc_allocator* the array was allocated with, or NULL
  * arr: The pointer to the array to perform possible growth on
  * size: The size to which the array should fit into
  * capacity: The current capacity of the array
@@ -277,14 +352,14 @@ void* tcalc_xrealloc(void*, size_t);
  * the arr variable will be altered, if reallocated, to point to the reallocated
  * data
 */
-#define TCALC_DARR_GROW(arr, size, capacity, err) do { \
+#define TCALC_DARR_GROW_A(allocator, arr, size, capacity, err) do { \
     if ((size) > (capacity)) { \
       const size_t grow_func_res = TCALC_ALLOC_NR(capacity); \
-      if (grow_func_res < (size)) { \
+      const size_t new_capacity = grow_func_res < (size) ? (size) : grow_func_res; \
+      if (grow_func_res < (capacity) || new_capacity > SIZE_MAX / sizeof(*(arr))) { \
         err = TCALC_ERR_OVERFLOW; \
       } else { \
-        const size_t new_capacity = grow_func_res < (size) ? (size) : grow_func_res; \
-        void* realloced = realloc((arr), sizeof(*(arr)) * new_capacity); \
+        void* realloced = tcalc_realloc((allocator), (arr), sizeof(*(arr)) * (capacity), sizeof(*(arr)) * new_capacity); \
         if (realloced == NULL) { \
           err = TCALC_ERR_NOMEM; \
         } else { \
@@ -297,6 +372,8 @@ void* tcalc_xrealloc(void*, size_t);
     } \
   } while (0)
 
+#define TCALC_DARR_GROW(arr, size, capacity, err) TCALC_DARR_GROW_A(NULL, arr, size, capacity, err)
+
 /**
  * arr: The pointer to the array to push val onto
  * size: The current size of the array
@@ -304,13 +381,15 @@ void* tcalc_xrealloc(void*, size_t);
  * val: The value to add to the array
  * err: a tcalc_err variable that will be set upon any errors
 */
-#define TCALC_DARR_PUSH(arr, size, capacity, val, err) do { \
-    TCALC_DARR_GROW(arr, (size) + 1, capacity, err); \
+#define TCALC_DARR_PUSH_A(allocator, arr, size, capacity, val, err) do { \
+    TCALC_DARR_GROW_A(allocator, arr, (size) + 1, capacity, err); \
     if ((err) == TCALC_ERR_OK) { \
       (arr)[(size)++] = (val); \
     } \
   } while (0)
 
+#define TCALC_DARR_PUSH(arr, size, capacity, val, err) TCALC_DARR_PUSH_A(NULL, arr, size, capacity, val, err)
+
 /**
  * arr: The pointer to the array to perform possible growth on
  * size: The current size of the array
@@ -397,6 +476,19 @@ void* tcalc_xrealloc(void*, size_t);
 #define TCALC_VEC_PUSH(vec, item, err) TCALC_DARR_PUSH(vec.arr, vec.len, vec.cap, item, err)
 #define TCALC_VEC_INSERT(vec, item, index, err) TCALC_DARR_INSERT(vec.arr, vec.len, vec.cap, item, index, err)
 #define TCALC_VEC_GROW(vec, res_size, err) TCALC_DARR_GROW(vec.arr, res_size, vec.cap, err)
+
+/**
+ * The same as TCALC_VEC_PUSH, TCALC_VEC_GROW and TCALC_VEC_FREE, for vectors
+ * allocated with a tcalc_allocator
+*/
+#define TCALC_VEC_PUSH_A(allocator, vec, item, err) TCALC_DARR_PUSH_A(allocator, vec.arr, vec.len, vec.cap, item, err)
+#define TCALC_VEC_GROW_A(allocator, vec, res_size, err) TCALC_DARR_GROW_A(allocator, vec.arr, res_size, vec.cap, err)
+#define TCALC_VEC_FREE_A(allocator, vec) do { \
+    tcalc_free((allocator), (vec).arr, sizeof(*(vec).arr) * (vec).cap); \
+    (vec).arr = NULL; \
+    (vec).len = 0; \
+    (vec).cap = 0; \
+  } while (0)
 #define TCALC_VEC_FOREACH(vec, iname) for (size_t iname = 0; iname < vec.len; iname++)
 
 #define TCALC_VEC_FREE_F(vec, freefn) do { \
@@ -448,9 +540,18 @@ typedef struct tcalc_val {
     } \
   }
 
+typedef enum tcalc_numfmt {
+  TCALC_NUMFMT_FIXED, // printf's "%f", with six digits after the decimal point
+  TCALC_NUMFMT_SHORTEST // the shortest string that reads back exactly, see tcalc_doubletostr
+} tcalc_numfmt;
+
 void tcalc_val_fput(FILE* file, const struct tcalc_val val);
 void tcalc_val_fputline(FILE* file, const struct tcalc_val val);
 
+// tcalc_val_fput and tcalc_val_fputline print numbers with TCALC_NUMFMT_FIXED
+void tcalc_val_fput_fmt(FILE* file, const struct tcalc_val val, tcalc_numfmt numfmt);
+void tcalc_val_fputline_fmt(FILE* file, const struct tcalc_val val, tcalc_numfmt numfmt);
+
 typedef tcalc_err (*tcalc_unfunc)(double, double*);
 typedef tcalc_err (*tcalc_binfunc)(double, double, double*);
 typedef bool (*tcalc_relfunc)(double, double);
@@ -561,6 +662,58 @@ tcalc_err tcalc_mod(double a, double b, double* out);
 
 tcalc_err tcalc_pow(double a, double b, double* out);
 
+/**
+ * Array kernels
+ *
+ * Apply an operation element-wise over n values, using the widest SIMD
+ * instructions the running CPU supports. out may be the same array as a or b.
+ * Bool arrays hold one 0 or 1 byte per element.
+ *
+ * The kernels that can fail stop writing to out at an unspecified point and
+ * return the same error the scalar function would for the first failing element.
+*/
+
+tcalc_err tcalc_add_arr(const double* a, const double* b, double* out, size_t n);
+tcalc_err tcalc_subtract_arr(const double* a, const double* b, double* out, size_t n);
+tcalc_err tcalc_multiply_arr(const double* a, const double* b, double* out, size_t n);
+tcalc_err tcalc_divide_arr(const double* a, const double* b, double* out, size_t n);
+tcalc_err tcalc_mod_arr(const double* a, const double* b, double* out, size_t n);
+tcalc_err tcalc_pow_arr(const double* a, const double* b, double* out, size_t n);
+tcalc_err tcalc_negate_arr(const double* a, double* out, size_t n);
+
+tcalc_err tcalc_lt_arr(const double* a, const double* b, bool* out, size_t n);
+tcalc_err tcalc_lteq_arr(const double* a, const double* b, bool* out, size_t n);
+tcalc_err tcalc_gt_arr(const double* a, const double* b, bool* out, size_t n);
+tcalc_err tcalc_gteq_arr(const double* a, const double* b, bool* out, size_t n);
+tcalc_err tcalc_equals_arr(const double* a, const double* b, bool* out, size_t n);
+tcalc_err tcalc_nequals_arr(const double* a, const double* b, bool* out, size_t n);
+
+tcalc_err tcalc_and_arr(const bool* a, const bool* b, bool* out, size_t n);
+tcalc_err tcalc_or_arr(const bool* a, const bool* b, bool* out, size_t n);
+tcalc_err tcalc_not_arr(const bool* a, bool* out, size_t n);
+
+/**
+ * The instruction sets the array kernels are compiled for. Only
+ * TCALC_SIMD_ISA_SCALAR is available outside of x86 with GCC or clang.
+*/
+typedef enum tcalc_simd_isa {
+  TCALC_SIMD_ISA_SCALAR,
+  TCALC_SIMD_ISA_SSE2,
+  TCALC_SIMD_ISA_AVX2,
+  TCALC_SIMD_ISA_AVX512
+} tcalc_simd_isa;
+
+/**
+ * Get the instruction set the array kernels run with, which is the widest one
+ * the running CPU supports unless tcalc_simd_setisa picked another.
+ *
+ * tcalc_simd_setisa makes every later kernel call use isa, failing with
+ * TCALC_ERR_INVALID_ARG if the running CPU does not support it. This is
+ * mostly useful to test or benchmark each set of kernels on one machine.
+*/
+tcalc_simd_isa tcalc_simd_getisa(void);
+tcalc_err tcalc_simd_setisa(tcalc_simd_isa isa);
+
 
 typedef tcalc_err (*tcalc_val_unfunc)(tcalc_val, double*);
 typedef tcalc_err (*tcalc_val_binfunc)(tcalc_val, tcalc_val, double*);
@@ -679,8 +832,45 @@ int32_t tcalc_strcpy_lblb(char *dst, int32_t dstCapacity, const char *src, int32
 int32_t tcalc_strcpy_lblb_ntdst(char* dst, int32_t dstCapacity, const char* src, int32_t srcLen);
 
 bool tcalc_lpstrisdouble(const char*, size_t);
+
+/**
+ * Decode a decimal number, with an optional sign, decimal point and exponent
+ * ("-12", ".5", "6.02e23", "1E-9"), to the nearest double. Ties are rounded to
+ * even.
+ *
+ * Returns TCALC_ERR_INVALID_ARG if str is not entirely a number, and
+ * TCALC_ERR_OVERFLOW if the number is too large to be a finite double. Numbers
+ * too small for a double decode to zero.
+*/
 enum tcalc_err tcalc_lpstrtodouble(const char*, size_t, double*);
 
+// Large enough for every string written by tcalc_doubletostr, such as
+// "-2.2250738585072014e-308", along with its null terminator
+#define TCALC_DOUBLESTR_MAX_SIZE 32
+
+/**
+ * Write the shortest decimal which reads back as exactly num into dest, null
+ * terminated. Numbers from 1e-6 up to 1e21 are written out in full ("0.001",
+ * "12.5", "300"), and the rest in scientific notation ("1e-9", "6.02e23").
+ * Infinities and NaN are written as "inf", "-inf", and "nan".
+ *
+ * Returns TCALC_ERR_NOMEM if the string and its null terminator do not fit in
+ * destCapacity characters, which TCALC_DOUBLESTR_MAX_SIZE always does.
+*/
+tcalc_err tcalc_doubletostr(double num, char* dest, int32_t destCapacity, int32_t* outLen);
+
+typedef struct tcalc_u128 {
+  uint64_t hi;
+  uint64_t lo;
+} tcalc_u128;
+
+#define TCALC_POW10_MIN_EXP10 (-348)
+#define TCALC_POW10_MAX_EXP10 347
+
+// tcalc_pow10_128[e - TCALC_POW10_MIN_EXP10] is 10^e, normalized to 128 bits
+// and rounded down
+extern const tcalc_u128 tcalc_pow10_128[];
+
 bool tcalc_str_list_has(const char* input, const char** list, size_t count);
 
 bool tcalc_strhaspre(const char* prefix, const char* str);
@@ -739,27 +929,85 @@ typedef enum tcalc_token_type {
 
 const char* tcalc_token_type_str(tcalc_token_type token_type);
 
+/**
+ * The operator spelled out by a token, assigned by the tokenizer so that the
+ * parser can match operators without comparing token text. "+" and "-" have
+ * the same kind whether they are unary or binary, the token type tells those
+ * apart.
+*/
+typedef enum tcalc_opkind {
+  TCALC_OPKIND_NONE, // not an operator
+  TCALC_OPKIND_PLUS, // "+"
+  TCALC_OPKIND_MINUS, // "-"
+  TCALC_OPKIND_STAR, // "*"
+  TCALC_OPKIND_SLASH, // "/"
+  TCALC_OPKIND_PERCENT, // "%"
+  TCALC_OPKIND_CARET, // "^"
+  TCALC_OPKIND_STARSTAR, // "**"
+  TCALC_OPKIND_BANG, // "!"
+  TCALC_OPKIND_EQ, // "="
+  TCALC_OPKIND_EQEQ, // "=="
+  TCALC_OPKIND_BANGEQ, // "!="
+  TCALC_OPKIND_LT, // "<"
+  TCALC_OPKIND_LTEQ, // "<="
+  TCALC_OPKIND_GT, // ">"
+  TCALC_OPKIND_GTEQ, // ">="
+  TCALC_OPKIND_AMPAMP, // "&&"
+  TCALC_OPKIND_PIPEPIPE, // "||"
+  TCALC_OPKIND_COUNT
+} tcalc_opkind;
+
+// Single bit for an operator kind, so sets of kinds can be tested with one mask
+#define TCALC_OPKIND_BIT(kind) (UINT32_C(1) << (kind))
+
 // Data that a token can contain:
 // Type
 // Starting Offset
-// Ending Offset
-// Instead of a pointer to the string, provide a starting and ending index.
+// Length
+// Instead of a pointer to the string, provide a starting index and a length.
 // This would allow for the area around strings in the data to be easily
 // displayed if necessary.
 // Line data can just be calculated later by iterating over the source string
 // if it is needed. Line data should not be needed unless an error occurs, so
 // there's no good reason to store it.
+//
+// Tokens are packed into 8 bytes, as token arrays of large expressions take
+// up as much memory as the expression itself several times over. The length
+// only has 16 bits, and a token too long for them stores TCALC_TOKEN_LONG_LEN
+// instead, its real length being read again from the expression by
+// tcalc_token_len. Only numbers and identifiers can get that long. This is why
+// tcalc_token_len and everything built on it take the length of the
+// expression along with it.
+
+#define TCALC_TOKEN_LONG_LEN INT32_C(0xFFFF)
 
 typedef struct tcalc_token {
-  tcalc_token_type type;
   int32_t start;
-  int32_t xend;
+  uint8_t type; // tcalc_token_type
+  uint8_t opkind; // tcalc_opkind, TCALC_OPKIND_NONE unless the token is an operator
+  uint16_t len; // see tcalc_token_len
 } tcalc_token;
 
+/**
+ * The length of a token that is at least TCALC_TOKEN_LONG_LEN bytes long,
+ * found by lexing it again from its start in the strLen bytes of str
+*/
+int32_t tcalc_token_longlen(const char* str, int32_t strLen, tcalc_token tok);
+
 inline static const char* tcalc_token_startcp(const char* str, tcalc_token tok) { return str + tok.start; }
 inline static char* tcalc_token_startp(char* str, tcalc_token tok) { return str + tok.start; }
-inline static int32_t tcalc_token_len(tcalc_token tok) { return tok.xend - tok.start; }
+inline static int32_t tcalc_token_len(const char* str, int32_t strLen, tcalc_token tok) {
+  return tok.len != TCALC_TOKEN_LONG_LEN ? (int32_t)tok.len : tcalc_token_longlen(str, strLen, tok);
+}
+inline static int32_t tcalc_token_xend(const char* str, int32_t strLen, tcalc_token tok) { return tok.start + tcalc_token_len(str, strLen, tok); }
 
+/**
+ * Tokenize expr into destBuffer.
+ *
+ * If expr has more than destCapacity tokens, TCALC_ERR_NOMEM is returned and
+ * *outDestLength is set to the number of tokens expr has, so that the caller
+ * can retry with a buffer of exactly that size.
+*/
 tcalc_err tcalc_tokenize_infix(
   const char* expr,
   int32_t exprLen,
@@ -768,9 +1016,25 @@ tcalc_err tcalc_tokenize_infix(
   int32_t* outDestLength
 );
 
+/**
+ * Count the tokens of expr and the tree nodes that they parse into, without
+ * storing either. This is a single lexing pass, and returns the same errors
+ * as tcalc_tokenize_infix. The node count is exact for expressions that parse
+ * successfully, and never too small for ones that do not.
+*/
+tcalc_err tcalc_measure_infix(
+  const char* expr, int32_t exprLen, int32_t* outTokenCount, int32_t* outTreeNodeCount
+);
+
+/**
+ * The number of tree nodes that tokens parse into, counted the same way as by
+ * tcalc_measure_infix.
+*/
+int32_t tcalc_exprtree_nodecount(const tcalc_token* tokens, int32_t tokensLen);
+
 #define TCALC_TOKEN_IMPLICIT_MULT_PRINTF_STR ("*")
 
-#define TCALC_TOKEN_IS_IMPLICIT_MULT(token) ((token).type == TCALC_TOK_BINOP && tcalc_token_len((token)) == 0)
+#define TCALC_TOKEN_IS_IMPLICIT_MULT(token) ((token).type == TCALC_TOK_BINOP && (token).len == 0)
 
 // Must use %.*s with tokens. This macro simplifies adding the token length
 // and string information into the variable arguments section of printf formats.
@@ -778,8 +1042,8 @@ tcalc_err tcalc_tokenize_infix(
 // should be, which is easy to forget
 //
 // Handles printing implicit multiplication
-#define TCALC_TOKEN_PRINTF_VARARG(expr, token) \
-  (TCALC_TOKEN_IS_IMPLICIT_MULT(token) ? (int)TCALC_STRLIT_LEN(TCALC_TOKEN_IMPLICIT_MULT_PRINTF_STR) : (int)tcalc_token_len((token))), \
+#define TCALC_TOKEN_PRINTF_VARARG(expr, exprLen, token) \
+  (TCALC_TOKEN_IS_IMPLICIT_MULT(token) ? (int)TCALC_STRLIT_LEN(TCALC_TOKEN_IMPLICIT_MULT_PRINTF_STR) : (int)tcalc_token_len((expr), (exprLen), (token))), \
   (TCALC_TOKEN_IS_IMPLICIT_MULT(token) ? (TCALC_TOKEN_IMPLICIT_MULT_PRINTF_STR) : tcalc_token_startcp((expr), (token)))
 
 // Must use %.*s with tokens. This macro simplifies adding the token length
@@ -788,8 +1052,37 @@ tcalc_err tcalc_tokenize_infix(
 // should be, which is easy to forget
 //
 // Implicit multiplication is not handled as a special case.
-#define TCALC_TOKEN_PRINTF_VARARG_EXACT(expr, token) \
-  (int)tcalc_token_len((token)), tcalc_token_startcp((expr), (token))
+#define TCALC_TOKEN_PRINTF_VARARG_EXACT(expr, exprLen, token) \
+  (int)tcalc_token_len((expr), (exprLen), (token)), tcalc_token_startcp((expr), (token))
+
+/**
+ * Structured additions to the calling thread's error stack. These only store
+ * the error code, the message and their arguments; nothing is formatted until
+ * the error is read with tcalc_errstkpeek or tcalc_errstk_fdump, which keeps
+ * rejecting bad input cheap.
+ *
+ * funcname, msg and format are stored by pointer and must outlive the record,
+ * which string literals and __func__ always do. The token text given to
+ * tcalc_errstkadd_tok is copied, so expr does not have to.
+ *
+ * tcalc_errstkadd_i32's format must consume exactly two int32_t arguments
+ * (e.g. with PRId32).
+ *
+ * @returns false if the error stack is full and the error was dropped
+*/
+bool tcalc_errstkadd_msg(const char* funcname, tcalc_err code, const char* msg);
+bool tcalc_errstkadd_i32(const char* funcname, tcalc_err code, const char* format, int32_t a, int32_t b);
+bool tcalc_errstkadd_tok(const char* funcname, tcalc_err code, const char* msg, const char* expr, int32_t exprLen, tcalc_token token);
+
+/**
+ * Get the error code and the offending token's offsets of the error on top of
+ * the calling thread's error stack. The code is TCALC_ERR_OK and the offsets
+ * are -1 for errors added with tcalc_errstkadd or tcalc_errstkaddf, and the
+ * offsets are -1 for errors which do not refer to a token.
+ *
+ * @returns false if the error stack is empty
+*/
+bool tcalc_errstkpeekinfo(tcalc_err* outCode, int32_t* outStart, int32_t* outEnd);
 
 struct tcalc_ctx;
 struct tcalc_val;
@@ -823,6 +1116,7 @@ typedef struct tcalc_exprtree_unary_node {
 // TCALC_TOK_NUM: Numerical string
 typedef struct tcalc_exprtree_value_node {
   int32_t tokenInd;
+  double num; // TCALC_TOK_NUM only, the number decoded by the parser
 } tcalc_exprtree_value_node;
 
 typedef struct tcalc_exprtree_func_node
@@ -837,12 +1131,19 @@ typedef struct tcalc_exprtree_funcarg_node
   int32_t nextArgInd;
 } tcalc_exprtree_funcarg_node;
 
+// A precomputed value, which has replaced a constant subtree after
+// tcalc_fold_exprtree
+typedef struct tcalc_exprtree_const_node {
+  struct tcalc_val val;
+} tcalc_exprtree_const_node;
+
 enum tcalc_exprtree_node_type {
   TCALC_EXPRTREE_NODE_TYPE_BINARY,
   TCALC_EXPRTREE_NODE_TYPE_UNARY,
   TCALC_EXPRTREE_NODE_TYPE_VALUE,
   TCALC_EXPRTREE_NODE_TYPE_FUNC,
-  TCALC_EXPRTREE_NODE_TYPE_FUNCARG
+  TCALC_EXPRTREE_NODE_TYPE_FUNCARG,
+  TCALC_EXPRTREE_NODE_TYPE_CONST
 };
 
 struct tcalc_exprtree_node {
@@ -853,9 +1154,17 @@ struct tcalc_exprtree_node {
     tcalc_exprtree_value_node value;
     tcalc_exprtree_func_node func;
     tcalc_exprtree_funcarg_node funcarg;
+    tcalc_exprtree_const_node constant;
   } as;
 };
 
+/**
+ * Tokenize and parse expr into tokenBuffer and treeBuffer.
+ *
+ * If either buffer is too small, TCALC_ERR_NOMEM is returned and
+ * *outTokenCount and *outTreeNodeCount are set to the sizes that the buffers
+ * need. tcalc_eval and tcalc_eval_wctx report their buffer sizes the same way.
+*/
 tcalc_err tcalc_lex_parse(
   const char* expr, int32_t exprLen, tcalc_token *tokenBuffer,
   int32_t tokenBufferCapacity, tcalc_exprtree *treeBuffer,
@@ -869,15 +1178,189 @@ tcalc_err tcalc_create_exprtree_infix(
   int32_t* outDestLength, int32_t* outExprRootInd
 );
 
-// tcalc_err tcalc_create_exprtree_infix(const char* expr, const struct tcalc_ctx* ctx, tcalc_exprtree** out);
+/**
+ * Parse tokens into a tree, taking the precedence and associativity of every
+ * operator from its definition in ctx. TCALC_ERR_UNKNOWN_TOKEN is returned for
+ * an operator which ctx does not define. If destBuffer is too small,
+ * TCALC_ERR_NOMEM is returned and *outDestLength is set to the number of nodes
+ * it needs.
+ *
+ * tcalc_create_exprtree_infix parses with the operators of tcalc_ctx_default.
+*/
+tcalc_err tcalc_create_exprtree_infix_wctx(
+  const char* expr, int32_t exprLen, tcalc_token *tokens, int32_t tokensLen,
+  const struct tcalc_ctx* ctx, tcalc_exprtree *destBuffer, int32_t destCapacity,
+  int32_t* outDestLength, int32_t* outExprRootInd
+);
 
+/**
+ * tcalc_create_exprtree_infix_wctx, with the scratch memory which parsing a
+ * long expression needs coming from scratch rather than ctx's allocator
+*/
+tcalc_err tcalc_create_exprtree_infix_walloc(
+  const char* expr, int32_t exprLen, tcalc_token *tokens, int32_t tokensLen,
+  const struct tcalc_ctx* ctx, const tcalc_allocator* scratch,
+  tcalc_exprtree *destBuffer, int32_t destCapacity,
+  int32_t* outDestLength, int32_t* outExprRootInd
+);
+
+/**
+ * Tokenize and parse expr into token and tree arrays allocated from arena,
+ * which are exactly as large as expr needs. Scratch memory used while parsing
+ * comes from arena as well. The arrays stay valid until arena is reset.
+*/
+tcalc_err tcalc_create_exprtree_infix_arena(
+  const char* expr, int32_t exprLen, const struct tcalc_ctx* ctx, tcalc_arena* arena,
+  tcalc_token** outTokens, int32_t* outTokensLen, tcalc_exprtree** outTree,
+  int32_t* outTreeLen, int32_t* outExprRootInd
+);
+
+/**
+ * One node on the work stack of tcalc_exprtree_walk. The fields are private
+ * to the walker.
+*/
+typedef struct tcalc_exprtree_walkframe {
+  int32_t nodeInd;
+  int32_t next; // children of the node walked so far
+  int32_t* slot; // the field of the parent referring to the node
+} tcalc_exprtree_walkframe;
+
+/**
+ * Called by tcalc_exprtree_walk on reaching the node at nodeInd. slot is the
+ * field of the parent which refers to the node, or NULL for the root, and may
+ * be changed to make the parent refer to another node. Setting *outDescend to
+ * false skips the children of the node and its leave call.
+*/
+typedef tcalc_err (*tcalc_exprtree_enterfn)(void* user, int32_t nodeInd, int32_t* slot, bool* outDescend);
+
+/**
+ * Called by tcalc_exprtree_walk once every child of the node at nodeInd has
+ * been walked
+*/
+typedef tcalc_err (*tcalc_exprtree_leavefn)(void* user, int32_t nodeInd, int32_t* slot);
+
+/**
+ * Walk the tree below exprNodeInd in post-order, with frames as the work stack
+ * rather than recursion so that trees of any depth can be walked.
+ *
+ * The children of a node are walked in evaluation order: both sides of a
+ * binary node, the child of a unary node, the first argument of a function
+ * node, and the expression and then the next argument of an argument node.
+ * enter and leave are called for every node reached, the root included, and
+ * either may be NULL. Walking stops at the first error either returns.
+ *
+ * A node is never its own ancestor, even once tcalc_cse_exprtree has shared
+ * it between several parents, so a node is on the stack at most once and
+ * frames needs at most as many frames as the tree has nodes.
+*/
+tcalc_err tcalc_exprtree_walk(
+  tcalc_exprtree* exprtree, int32_t exprNodeInd, tcalc_exprtree_walkframe* frames,
+  tcalc_exprtree_enterfn enter, tcalc_exprtree_leavefn leave, void* user
+);
 
+/**
+ * One level of work for tcalc_eval_exprtree_stk. The fields are private to
+ * the evaluator.
+*/
+typedef struct tcalc_evalframe {
+  int32_t nodeInd;
+  int32_t state;
+  struct tcalc_val operand; // evaluated left operand or first argument
+  union {
+    const struct tcalc_unfuncdef* unfunc;
+    const struct tcalc_binfuncdef* binfunc;
+  } def;
+} tcalc_evalframe;
+
+/**
+ * The number of frames tcalc_eval_exprtree keeps on the C stack. Larger trees
+ * have their frames allocated instead.
+*/
+#define TCALC_EVAL_STACK_FRAMES 1024
+
+/**
+ * Evaluate a tree without recursion, using frames as the work stack.
+ *
+ * Every operator or function node on the path from the root to the deepest
+ * leaf takes one frame, while leaves and function argument nodes take none.
+ * TCALC_ERR_MAX_DEPTH is returned if framesCapacity is not enough.
+*/
+tcalc_err tcalc_eval_exprtree_stk(
+  const char* expr, int32_t exprLen, tcalc_exprtree* exprtree,
+  int32_t exprTreeLen, int32_t exprNodeInd, tcalc_token *tokens,
+  int32_t tokensLen, const struct tcalc_ctx* ctx,
+  tcalc_evalframe* frames, int32_t framesCapacity, struct tcalc_val* out
+);
+
+/**
+ * tcalc_eval_exprtree_stk with as many frames as the tree could need, so
+ * that TCALC_ERR_MAX_DEPTH is never returned. Trees of up to
+ * TCALC_EVAL_STACK_FRAMES nodes are evaluated without allocating, while the
+ * frames of larger ones come from the allocator of ctx.
+*/
 tcalc_err tcalc_eval_exprtree(
   const char* expr, int32_t exprLen, tcalc_exprtree* exprtree,
   int32_t exprTreeLen, int32_t exprNodeInd, tcalc_token *tokens,
   int32_t tokensLen, const struct tcalc_ctx* ctx, struct tcalc_val* out
 );
 
+/**
+ * Collapse every subtree which only depends on number literals and immutable
+ * variables of ctx into a single TCALC_EXPRTREE_NODE_TYPE_CONST node holding
+ * its value. The tree is changed in place, and nodes which are no longer
+ * reachable are left in the array.
+ *
+ * The functions and operators of ctx are assumed to always return the same
+ * result for the same arguments. A subtree which fails to evaluate is left
+ * as it is, so that evaluating the folded tree still returns its error.
+*/
+tcalc_err tcalc_fold_exprtree(
+  const char* expr, int32_t exprLen, tcalc_exprtree* exprtree,
+  int32_t exprTreeLen, int32_t exprNodeInd, tcalc_token *tokens,
+  int32_t tokensLen, const struct tcalc_ctx* ctx
+);
+
+/**
+ * tcalc_fold_exprtree, with its work stack allocated from scratch rather than
+ * with the allocator of ctx
+*/
+tcalc_err tcalc_fold_exprtree_walloc(
+  const char* expr, int32_t exprLen, tcalc_exprtree* exprtree,
+  int32_t exprTreeLen, int32_t exprNodeInd, tcalc_token *tokens,
+  int32_t tokensLen, const struct tcalc_ctx* ctx,
+  const tcalc_allocator* scratch
+);
+
+/**
+ * Merge structurally identical subtrees into one shared node, turning the tree
+ * into a DAG. Like tcalc_fold_exprtree, the tree is changed in place and
+ * nodes which are no longer reachable are left in the array.
+ *
+ * tcalc_eval_exprtree keeps no result for any node, so it evaluates a shared
+ * node once for every parent. Nested sharing multiplies, and a DAG where each
+ * level uses the one below it twice takes time exponential in its depth.
+ * tcalc_bytecode_compile (and so tcalc_prepared and batch evaluation) computes
+ * each shared node once per evaluation and reuses the result.
+ *
+ * @param outEliminated if not NULL, set to the number of nodes which were
+ * replaced by an identical node
+*/
+tcalc_err tcalc_cse_exprtree(
+  const char* expr, int32_t exprLen, tcalc_exprtree* exprtree,
+  int32_t exprTreeLen, int32_t exprNodeInd, const tcalc_token *tokens,
+  int32_t tokensLen, int32_t* outEliminated
+);
+
+/**
+ * tcalc_cse_exprtree, with its scratch tables allocated from scratch rather
+ * than with malloc
+*/
+tcalc_err tcalc_cse_exprtree_walloc(
+  const char* expr, int32_t exprLen, tcalc_exprtree* exprtree,
+  int32_t exprTreeLen, int32_t exprNodeInd, const tcalc_token *tokens,
+  int32_t tokensLen, const tcalc_allocator* scratch, int32_t* outEliminated
+);
+
 tcalc_err tcalc_eval(
   const char* expr, int32_t exprLen,
   tcalc_exprtree* treeNodesBuffer, int32_t treeNodesBufferCapacity,
@@ -894,6 +1377,16 @@ tcalc_err tcalc_eval_wctx(
   struct tcalc_val* out, int32_t *outTreeNodesCount, int32_t *outTokensCount
 );
 
+/**
+ * Evaluate expr with ctx, taking every buffer it needs from arena, so that
+ * there is no capacity to guess. The memory is left in arena, which should be
+ * reset once the caller is done with the expression.
+*/
+tcalc_err tcalc_eval_arena(
+  const char* expr, int32_t exprLen, const struct tcalc_ctx* ctx,
+  tcalc_arena* arena, struct tcalc_val* out
+);
+
 /**
  * Notes on precedence:
  *
@@ -1002,6 +1495,7 @@ typedef struct tcalc_binlopdef {
 typedef struct tcalc_vardef {
   char id[TCALC_IDDEF_MAX_STR_SIZE];
   struct tcalc_val val;
+  bool immutable; // see tcalc_ctx_addconst
 } tcalc_vardef;
 
 
@@ -1015,6 +1509,31 @@ typedef struct tcalc_binfuncdef {
   tcalc_val_binfunc func;
 } tcalc_binfuncdef;
 
+/**
+ * An open-addressing hash index over one of the definition tables of a
+ * tcalc_ctx, mapping the hash of each definition's id to its position in the
+ * table. The index is kept at most half full, and since definitions are never
+ * removed from a context it needs no tombstones.
+ *
+ * A table whose index has a capacity of 0 has not been indexed, and lookups
+ * into it fall back to a linear scan.
+*/
+typedef struct tcalc_ctx_index_slot {
+  uint32_t hash;
+  uint32_t pos; // position in the table plus one, or 0 for an empty slot
+} tcalc_ctx_index_slot;
+
+typedef struct tcalc_ctx_index {
+  tcalc_ctx_index_slot* slots;
+  size_t cap; // 0 or a power of 2
+} tcalc_ctx_index;
+
+/**
+ * The FNV-1a hash that indexes are keyed by. The bytecode compiler indexes
+ * the variables of an expression by name with the same slots.
+*/
+uint32_t tcalc_ctx_hash(const char* name, size_t name_len);
+
 typedef struct tcalc_ctx {
 #if 0
   tcalc_unfuncdef unfuncs[32];
@@ -1043,17 +1562,170 @@ typedef struct tcalc_ctx {
   TCALC_VEC(tcalc_relopdef) relops; // Defined Relational (Binary) Operators
   TCALC_VEC(tcalc_unlopdef) unlops; // Defined Logical Unary Operators
   TCALC_VEC(tcalc_binlopdef) binlops; // Defined Logical Binary Operators
+
+  tcalc_ctx_index unfuncsIndex;
+  tcalc_ctx_index binfuncsIndex;
+  tcalc_ctx_index varsIndex;
+  tcalc_ctx_index unopsIndex;
+  tcalc_ctx_index binopsIndex;
+  tcalc_ctx_index relopsIndex;
+  tcalc_ctx_index unlopsIndex;
+  tcalc_ctx_index binlopsIndex;
+
+  bool frozen; // see tcalc_ctx_freeze
+  const struct tcalc_ctx* parent; // see tcalc_ctx_alloc_child
+  const void* image; // see tcalc_ctx_image_open
+  const tcalc_allocator* allocator; // see tcalc_ctx_alloc_empty_with
 } tcalc_ctx;
 
 tcalc_err tcalc_ctx_alloc_empty(tcalc_ctx** out);
+
+/**
+ * Allocate an empty context whose memory, and the memory of everything
+ * compiled or built from it, comes from allocator. allocator must outlive the
+ * context and everything built from it. A NULL allocator is the default one.
+ *
+ * Contexts made by tcalc_ctx_freeze use the allocator of the context they
+ * were frozen from.
+*/
+tcalc_err tcalc_ctx_alloc_empty_with(const tcalc_allocator* allocator, tcalc_ctx** out);
+
+/**
+ * Allocate a copy of the default context, which can then be modified.
+*/
 tcalc_err tcalc_ctx_alloc_default(tcalc_ctx** out);
 
+/**
+ * Get the read-only default context, using either radians or degrees in its
+ * trigonometric functions.
+ *
+ * The default contexts are built into tcalc as constant data, so they never
+ * have to be allocated or freed and can be shared freely between threads.
+ * Use tcalc_ctx_alloc_default to get a default context that can be modified.
+*/
+const tcalc_ctx* tcalc_ctx_default(void);
+const tcalc_ctx* tcalc_ctx_default_deg(void);
+
+/**
+ * tcalc_ctx and threads
+ *
+ * Looking things up in a context never writes to it, so any number of threads
+ * can evaluate with the same context as long as nothing adds definitions to it
+ * in the meantime. Freezing a context makes sure that nothing does.
+ *
+ * tcalc_ctx_freeze allocates a frozen copy of ctx, with every one of its
+ * tables indexed. Adding any definition to a frozen context fails with
+ * TCALC_ERR_IMMUTABLE, so a frozen context can be shared between threads
+ * without locks for as long as it lives. The default contexts are frozen too,
+ * but being constant data they are not indexed, and lookups into their short
+ * tables are linear scans.
+ *
+ * tcalc_ctx_alloc_overlay is tcalc_ctx_alloc_child for a frozen parent, and
+ * fails with TCALC_ERR_INVALID_ARG if parent is not frozen. Each thread can
+ * keep its own bindings in an overlay without copying any of the frozen
+ * context's tables.
+*/
+tcalc_err tcalc_ctx_freeze(const tcalc_ctx* ctx, tcalc_ctx** out);
+tcalc_err tcalc_ctx_alloc_overlay(const tcalc_ctx* frozen, tcalc_ctx** out);
+
+/**
+ * Allocate an empty child context of parent. A child holds only the
+ * definitions added to it, and lookups which miss them continue into parent
+ * (and its own parent, and so on). Creating a child copies nothing, so a
+ * child costs a single small allocation plus whatever is defined in it.
+ *
+ * Definitions in a child shadow parent's definitions of the same name, except
+ * that parent's immutable variables cannot be redefined in a child
+ * (TCALC_ERR_IMMUTABLE). parent is never modified through the child, and must
+ * outlive it. Definitions added to parent later are seen by the child.
+*/
+tcalc_err tcalc_ctx_alloc_child(const tcalc_ctx* parent, tcalc_ctx** out);
+
+/**
+ * tcalc_ctx_alloc_child with the memory of the child coming from allocator,
+ * as with tcalc_ctx_alloc_empty_with. tcalc_ctx_alloc_child uses the default
+ * allocator, whatever parent uses.
+*/
+tcalc_err tcalc_ctx_alloc_child_with(const tcalc_ctx* parent, const tcalc_allocator* allocator, tcalc_ctx** out);
+
+/**
+ * Add every definition in src to ctx, replacing definitions in ctx which have
+ * the same names. If src is a child context, the definitions it sees through
+ * its parents are added too.
+*/
+tcalc_err tcalc_ctx_addall(tcalc_ctx* ctx, const tcalc_ctx* src);
+
+/**
+ * Any function which can be defined in a context, for tables of functions of
+ * mixed types. TCALC_ANYFUNC converts a function to a tcalc_anyfunc.
+*/
+typedef void (*tcalc_anyfunc)(void);
+#define TCALC_ANYFUNC(f) ((tcalc_anyfunc)(f))
+
+/**
+ * Context images
+ *
+ * tcalc_ctx_image_write serializes everything ctx sees, including through its
+ * parents, into a single relocatable block of memory, which can be saved to a
+ * file and later mapped or read back in. The size of the image is written to
+ * outSize, and if dest is NULL or destCapacity is smaller than the image,
+ * nothing is written and TCALC_ERR_NOMEM is returned, so the size can be
+ * queried first.
+ *
+ * Functions cannot be stored in an image by address. Those of tcalc's own
+ * default contexts are found automatically, and any other function defined
+ * in ctx must appear in funcs, or TCALC_ERR_NOT_FOUND is returned.
+ *
+ * tcalc_ctx_image_open opens an image as a frozen context without copying or
+ * rehashing its variables or indexes, which are used in place, so opening an
+ * image is nearly free no matter how large it is. image must be aligned to 16
+ * bytes (as memory from malloc and mmap is), must outlive the context, and is
+ * never written to, so read-only mapped pages can be shared between processes.
+ * funcs must list the same functions, in the same order, as when the image
+ * was written.
+ *
+ * tcalc_ctx_image_open returns TCALC_ERR_INVALID_ARG for memory which is not
+ * an image written by this build of tcalc on the same kind of machine, whose
+ * tables do not fit in size, whose indexes refer outside of their tables or
+ * have no empty slot, or whose variable ids are not terminated. Beyond that,
+ * images are trusted, so they should never be opened from untrusted sources.
+*/
+tcalc_err tcalc_ctx_image_write(
+  const tcalc_ctx* ctx, const tcalc_anyfunc* funcs, int32_t funcCount,
+  void* dest, size_t destCapacity, size_t* outSize
+);
+tcalc_err tcalc_ctx_image_open(
+  const void* image, size_t size, const tcalc_anyfunc* funcs, int32_t funcCount, tcalc_ctx** out
+);
+
 tcalc_err tcalc_ctx_addtrigrad(tcalc_ctx* ctx);
 tcalc_err tcalc_ctx_addtrigdeg(tcalc_ctx* ctx);
 
 void tcalc_ctx_free(tcalc_ctx* ctx);
 
+/**
+ * Returns TCALC_ERR_IMMUTABLE if name is already an immutable variable
+*/
 tcalc_err tcalc_ctx_addvar(tcalc_ctx* ctx, const char* name, size_t name_len, struct tcalc_val val);
+
+/**
+ * Add a variable which can never be redefined, like "pi" or "true" in the
+ * default context. tcalc_fold_exprtree replaces immutable variables with their
+ * values.
+*/
+tcalc_err tcalc_ctx_addconst(tcalc_ctx* ctx, const char* name, size_t name_len, struct tcalc_val val);
+
+/**
+ * Add count variables at once, as if by calling tcalc_ctx_addvar on each of
+ * them in order, but growing the variable table and its index a single time
+ * up front. Loading N variables this way takes O(N) time.
+ *
+ * If adding a variable fails, the variables before it stay added.
+*/
+tcalc_err tcalc_ctx_addvars(
+  tcalc_ctx* ctx, const char* const* names, const size_t* nameLens,
+  const struct tcalc_val* vals, size_t count
+);
 tcalc_err tcalc_ctx_addunfunc(tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_val_unfunc func);
 tcalc_err tcalc_ctx_addbinfunc(tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_val_binfunc func);
 tcalc_err tcalc_ctx_addunop(tcalc_ctx* ctx, const char* name, size_t name_len, int prec, tcalc_assoc assoc, tcalc_val_unfunc func);
@@ -1101,6 +1773,26 @@ tcalc_err tcalc_ctx_getrelop(const tcalc_ctx* ctx, const char* name, size_t name
 tcalc_err tcalc_ctx_getunlop(const tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_unlopdef* out);
 tcalc_err tcalc_ctx_getbinlop(const tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_binlopdef* out);
 
+/**
+ * tcalc_ctx_find_x functions look up a definition with a single probe of the
+ * context's index, returning NULL if there is no definition with the given
+ * name. Prefer them over calling tcalc_ctx_has_x and then tcalc_ctx_get_x,
+ * which looks the name up twice.
+ *
+ * The returned pointer points into the context or one of its parents, and is
+ * invalidated by any later call which adds a definition to that context.
+*/
+const tcalc_vardef* tcalc_ctx_findvar(const tcalc_ctx* ctx, const char* name, size_t name_len);
+
+const tcalc_unfuncdef* tcalc_ctx_findunfunc(const tcalc_ctx* ctx, const char* name, size_t name_len);
+const tcalc_binfuncdef* tcalc_ctx_findbinfunc(const tcalc_ctx* ctx, const char* name, size_t name_len);
+
+const tcalc_unopdef* tcalc_ctx_findunop(const tcalc_ctx* ctx, const char* name, size_t name_len);
+const tcalc_binopdef* tcalc_ctx_findbinop(const tcalc_ctx* ctx, const char* name, size_t name_len);
+const tcalc_relopdef* tcalc_ctx_findrelop(const tcalc_ctx* ctx, const char* name, size_t name_len);
+const tcalc_unlopdef* tcalc_ctx_findunlop(const tcalc_ctx* ctx, const char* name, size_t name_len);
+const tcalc_binlopdef* tcalc_ctx_findbinlop(const tcalc_ctx* ctx, const char* name, size_t name_len);
+
 /**
  * Note that since a variable symbol can be defined as multiple different operator
  * types, such as unary and binary "+", having a general function to fetch
@@ -1109,4 +1801,226 @@ tcalc_err tcalc_ctx_getbinlop(const tcalc_ctx* ctx, const char* name, size_t nam
 */
 // tcalc_err tcalc_ctx_getopdata(const tcalc_ctx* ctx, const char* name, tcalc_opdata* out);
 
+/**
+ * tcalc_bytecode - Flat instruction streams compiled from expression trees
+ *
+ * tcalc_bytecode_compile turns a tcalc_exprtree into postfix code for a small
+ * stack machine, resolving every operator and function in the tree against a
+ * tcalc_ctx as it goes. Running the code with tcalc_bytecode_eval costs a
+ * single dispatch per operation, compared to the string comparisons, context
+ * lookups, and recursion done for every node by tcalc_eval_exprtree.
+ *
+ * Variables are not resolved at compile time. Every distinct identifier used as
+ * a variable is given a numbered slot instead, and the value of every slot is
+ * passed into tcalc_bytecode_eval as the vars array.
+*/
+typedef struct tcalc_bytecode tcalc_bytecode;
+
+tcalc_err tcalc_bytecode_compile(
+  const char* expr, int32_t exprLen, const tcalc_exprtree* exprtree,
+  int32_t exprTreeLen, int32_t exprNodeInd, const tcalc_token* tokens,
+  int32_t tokensLen, const struct tcalc_ctx* ctx, tcalc_bytecode** out
+);
+
+/**
+ * tcalc_bytecode_compile, with the scratch memory used while compiling coming
+ * from scratch. The bytecode itself is allocated with ctx's allocator.
+*/
+tcalc_err tcalc_bytecode_compile_walloc(
+  const char* expr, int32_t exprLen, const tcalc_exprtree* exprtree,
+  int32_t exprTreeLen, int32_t exprNodeInd, const tcalc_token* tokens,
+  int32_t tokensLen, const struct tcalc_ctx* ctx, const tcalc_allocator* scratch,
+  tcalc_bytecode** out
+);
+
+void tcalc_bytecode_free(tcalc_bytecode* bc);
+
+/**
+ * The number of values that the stack passed into tcalc_bytecode_eval must
+ * be able to hold, including room for the results of shared nodes
+*/
+int32_t tcalc_bytecode_stacksize(const tcalc_bytecode* bc);
+
+int32_t tcalc_bytecode_varcount(const tcalc_bytecode* bc);
+
+tcalc_err tcalc_bytecode_getvarslot(const tcalc_bytecode* bc, const char* name, size_t name_len, int32_t* outSlot);
+
+/**
+ * Note that the returned name is not null-terminated
+*/
+tcalc_err tcalc_bytecode_getvarname(const tcalc_bytecode* bc, int32_t slot, const char** outName, int32_t* outNameLen);
+
+/**
+ * Run compiled code
+ *
+ * @param vars the value of each variable slot, tcalc_bytecode_varcount(bc) long
+ * @param stack scratch space for the stack machine. Returns
+ * TCALC_ERR_OUT_OF_BOUNDS if stackCapacity is less than
+ * tcalc_bytecode_stacksize(bc)
+*/
+tcalc_err tcalc_bytecode_eval(
+  const tcalc_bytecode* bc, const struct tcalc_val* vars,
+  struct tcalc_val* stack, int32_t stackCapacity, struct tcalc_val* out
+);
+
+/**
+ * tcalc batch evaluation - One expression evaluated over many rows
+ *
+ * Each variable of the expression is bound to a column of row values, and
+ * the result for every row is written into an output column. Rows are run
+ * through the code a tile at a time, so the cost of dispatching each
+ * instruction and looking up each variable is paid once per tile instead of
+ * once per row.
+ *
+ * Since every row of a column has the same type, the output type is known
+ * ahead of time (a number unless the expression ends in a relation or logical
+ * operation). TCALC_ERR_BAD_CAST is returned if out.type does not match it.
+ *
+ * Evaluation stops at the first row that fails, and the contents of the output
+ * column are unspecified in that case.
+*/
+
+typedef struct tcalc_column {
+  const char* name; // not null-terminated, ignored by tcalc_bytecode_eval_batch
+  size_t name_len;
+  enum tcalc_valtype type;
+  union {
+    const double* nums;
+    const bool* bools;
+  } as;
+} tcalc_column;
+
+typedef struct tcalc_outcolumn {
+  enum tcalc_valtype type;
+  union {
+    double* nums;
+    bool* bools;
+  } as;
+} tcalc_outcolumn;
+
+/**
+ * Run compiled code over rowCount rows
+ *
+ * @param vars one column per variable slot, tcalc_bytecode_varcount(bc) long.
+ * A column whose data pointer is NULL reads the matching entry of scalars for
+ * every row instead.
+ * @param scalars one value per variable slot, only read for NULL columns. May
+ * be NULL if no column is NULL.
+*/
+tcalc_err tcalc_bytecode_eval_batch(
+  const tcalc_bytecode* bc, const tcalc_column* vars,
+  const struct tcalc_val* scalars, size_t rowCount, tcalc_outcolumn out
+);
+
+/**
+ * Evaluate an expression tree over rowCount rows
+ *
+ * Each variable is read from the column in columns with the same name, or
+ * else from the variable of the same name in ctx, which is then used for
+ * every row.
+*/
+tcalc_err tcalc_eval_exprtree_batch(
+  const char* expr, int32_t exprLen, const tcalc_exprtree* exprtree,
+  int32_t exprTreeLen, int32_t exprNodeInd, const tcalc_token* tokens,
+  int32_t tokensLen, const struct tcalc_ctx* ctx, const tcalc_column* columns,
+  int32_t columnCount, size_t rowCount, tcalc_outcolumn out
+);
+
+/**
+ * tcalc_prepared - Expressions compiled once and evaluated many times
+ *
+ * tcalc_prepared_compile lexes and parses an expression and resolves every
+ * operator and function in it against a tcalc_ctx a single time. Evaluating
+ * the result afterwards does no lexing, parsing, or name lookups, and the
+ * context does not have to outlive the prepared expression.
+ *
+ * Every distinct identifier used as a variable in the expression is given a
+ * numbered slot. A slot starts out bound to the value of the variable with
+ * the same name in the compiling context, if there is one, and can be rebound
+ * with tcalc_prepared_setvar between evaluations. Evaluating an expression
+ * which reads an unbound slot returns TCALC_ERR_UNKNOWN_ID.
+ *
+ * Prepared expressions run as tcalc_bytecode on a stack that they own, so a
+ * single tcalc_prepared should not be evaluated from multiple threads at once.
+*/
+typedef struct tcalc_prepared tcalc_prepared;
+
+tcalc_err tcalc_prepared_compile(
+  const char* expr, int32_t exprLen, const tcalc_ctx* ctx, tcalc_prepared** out
+);
+
+/**
+ * tcalc_prepared_compile, with the tokens, tree and other scratch memory
+ * needed while compiling coming from arena. The prepared expression itself is
+ * allocated with ctx's allocator and outlives resets of arena.
+*/
+tcalc_err tcalc_prepared_compile_arena(
+  const char* expr, int32_t exprLen, const tcalc_ctx* ctx, tcalc_arena* arena,
+  tcalc_prepared** out
+);
+
+void tcalc_prepared_free(tcalc_prepared* prep);
+
+/**
+ * Evaluate a prepared expression with the current values of its slots. prep
+ * is not const because evaluation may keep working state inside it, so one
+ * prepared expression must not be evaluated by several threads at once.
+*/
+tcalc_err tcalc_prepared_eval(tcalc_prepared* prep, struct tcalc_val* out);
+
+int32_t tcalc_prepared_varcount(const tcalc_prepared* prep);
+
+/**
+ * Get the slot of the variable named name, returning TCALC_ERR_NOT_FOUND if
+ * the expression never reads a variable with that name.
+*/
+tcalc_err tcalc_prepared_getvarslot(const tcalc_prepared* prep, const char* name, size_t name_len, int32_t* outSlot);
+tcalc_err tcalc_prepared_setvar(tcalc_prepared* prep, int32_t slot, struct tcalc_val val);
+
+/**
+ * tcalc_varstore - Variables which can be updated while they are being read
+ *
+ * A tcalc_varstore holds the values of a fixed set of variables, taken from
+ * the mutable variables of a tcalc_ctx (and its parents) when the store is
+ * allocated, each in a numbered slot. Any number of threads may read values
+ * out of the store while other threads write to it, without locks:
+ *
+ * - Writers never block readers. Writes to the store are serialized among
+ *   themselves, and tcalc_varstore_setmany updates several values at once.
+ * - Readers never write to the store, so they do not slow each other down.
+ *   tcalc_varstore_read copies a set of values which were all current at the
+ *   same moment, retrying if a write lands in the middle of the copy.
+ *
+ * Evaluations see a consistent snapshot of the store by reading from it once
+ * up front: tcalc_varstore_snapshot adds every value of the store to a
+ * context (usually a per-thread overlay), and a tcalc_prepared bound to a
+ * store with tcalc_prepared_bindstore reads the values of the variables it
+ * uses before each evaluation. The store must outlive anything bound to it.
+ *
+ * Slots are looked up by name with tcalc_varstore_getslot, which returns
+ * TCALC_ERR_NOT_FOUND for names the store does not hold. A NULL slots array
+ * given to tcalc_varstore_read reads slots 0 to count - 1.
+*/
+typedef struct tcalc_varstore tcalc_varstore;
+
+tcalc_err tcalc_varstore_alloc(const tcalc_ctx* ctx, tcalc_varstore** out);
+void tcalc_varstore_free(tcalc_varstore* store);
+
+int32_t tcalc_varstore_count(const tcalc_varstore* store);
+tcalc_err tcalc_varstore_getslot(const tcalc_varstore* store, const char* name, size_t name_len, int32_t* outSlot);
+
+tcalc_err tcalc_varstore_set(tcalc_varstore* store, int32_t slot, struct tcalc_val val);
+tcalc_err tcalc_varstore_setmany(tcalc_varstore* store, const int32_t* slots, const struct tcalc_val* vals, int32_t count);
+
+tcalc_err tcalc_varstore_read(const tcalc_varstore* store, const int32_t* slots, struct tcalc_val* out, int32_t count);
+tcalc_err tcalc_varstore_snapshot(const tcalc_varstore* store, tcalc_ctx* ctx);
+
+/**
+ * Bind every slot of prep whose variable is held by store to the store, so
+ * that each tcalc_prepared_eval reads their values from it first. Values set
+ * on those slots with tcalc_prepared_setvar are overwritten by the next
+ * evaluation. Binding a NULL store unbinds prep from its store.
+*/
+tcalc_err tcalc_prepared_bindstore(tcalc_prepared* prep, const tcalc_varstore* store);
+
 #endif
@@ -0,0 +1,148 @@
+#include "tcalc.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * A tcalc_arena is a list of chunks which memory is bumped off of, front to
+ * back. Resetting the arena only moves it back to the start of its first
+ * chunk, and chunks further down the list are reused as the arena reaches them
+ * again, so once an arena has grown to what its largest job needs, it never
+ * allocates again.
+*/
+
+#define TCALC_ARENA_ALIGN 16
+#define TCALC_ARENA_MIN_CHUNK_SIZE 256
+
+typedef struct tcalc_arena_chunk {
+  struct tcalc_arena_chunk* next;
+  size_t cap;
+  size_t used;
+} tcalc_arena_chunk;
+
+struct tcalc_arena {
+  tcalc_allocator allocator; // hands out memory from this arena
+  const tcalc_allocator* backing; // where chunks come from
+  tcalc_arena_chunk* head;
+  tcalc_arena_chunk* cur; // the chunk being bumped off of, or NULL before the first
+  size_t chunkSize; // capacity of the next chunk allocated
+};
+
+#define TCALC_ARENA_ALIGNUP(n) (((n) + TCALC_ARENA_ALIGN - 1) & ~(size_t)(TCALC_ARENA_ALIGN - 1))
+#define TCALC_ARENA_CHUNK_HEADER TCALC_ARENA_ALIGNUP(sizeof(tcalc_arena_chunk))
+
+static char* tcalc_arena_chunk_data(tcalc_arena_chunk* chunk) {
+  return (char*)chunk + TCALC_ARENA_CHUNK_HEADER;
+}
+
+static void* tcalc_arena_allocator_alloc(void* user, size_t size) {
+  return tcalc_arena_push((tcalc_arena*)user, size);
+}
+
+// whether ptr, of size bytes, was the last thing pushed onto the arena
+static bool tcalc_arena_islast(const tcalc_arena* arena, const void* ptr, size_t size) {
+  return arena->cur != NULL &&
+    (const char*)ptr + TCALC_ARENA_ALIGNUP(size) == tcalc_arena_chunk_data(arena->cur) + arena->cur->used;
+}
+
+static void* tcalc_arena_allocator_realloc(void* user, void* ptr, size_t oldSize, size_t newSize) {
+  tcalc_arena* arena = (tcalc_arena*)user;
+  if (newSize <= SIZE_MAX - TCALC_ARENA_ALIGN && tcalc_arena_islast(arena, ptr, oldSize)) {
+    // the last block can grow or shrink in place while it fits in its chunk
+    const size_t start = (size_t)((char*)ptr - tcalc_arena_chunk_data(arena->cur));
+    if (TCALC_ARENA_ALIGNUP(newSize) <= arena->cur->cap - start) {
+      arena->cur->used = start + TCALC_ARENA_ALIGNUP(newSize);
+      return ptr;
+    }
+  }
+
+  void* moved = tcalc_arena_push(arena, newSize);
+  if (moved == NULL) return NULL;
+  memcpy(moved, ptr, oldSize < newSize ? oldSize : newSize);
+  return moved;
+}
+
+static void tcalc_arena_allocator_free(void* user, void* ptr, size_t size) {
+  tcalc_arena* arena = (tcalc_arena*)user;
+  // only the last block can be given back before the arena is reset
+  if (tcalc_arena_islast(arena, ptr, size))
+    arena->cur->used = (size_t)((char*)ptr - tcalc_arena_chunk_data(arena->cur));
+}
+
+tcalc_err tcalc_arena_alloc(const tcalc_allocator* backing, size_t chunkSize, tcalc_arena** out) {
+  assert(out != NULL);
+  tcalc_arena* arena = (tcalc_arena*)tcalc_calloc(backing, 1, sizeof(tcalc_arena));
+  if (arena == NULL) return TCALC_ERR_NOMEM;
+
+  arena->allocator.alloc = tcalc_arena_allocator_alloc;
+  arena->allocator.realloc = tcalc_arena_allocator_realloc;
+  arena->allocator.free = tcalc_arena_allocator_free;
+  arena->allocator.user = arena;
+  arena->backing = backing;
+  arena->chunkSize = chunkSize < TCALC_ARENA_MIN_CHUNK_SIZE ? TCALC_ARENA_MIN_CHUNK_SIZE : chunkSize;
+
+  *out = arena;
+  return TCALC_ERR_OK;
+}
+
+void tcalc_arena_free(tcalc_arena* arena) {
+  if (arena == NULL) return;
+  tcalc_arena_chunk* chunk = arena->head;
+  while (chunk != NULL) {
+    tcalc_arena_chunk* next = chunk->next;
+    tcalc_free(arena->backing, chunk, TCALC_ARENA_CHUNK_HEADER + chunk->cap);
+    chunk = next;
+  }
+  tcalc_free(arena->backing, arena, sizeof(tcalc_arena));
+}
+
+void tcalc_arena_reset(tcalc_arena* arena) {
+  arena->cur = arena->head;
+  if (arena->cur != NULL)
+    arena->cur->used = 0;
+}
+
+void* tcalc_arena_push(tcalc_arena* arena, size_t size) {
+  if (size > SIZE_MAX - TCALC_ARENA_CHUNK_HEADER - TCALC_ARENA_ALIGN) return NULL;
+  size = TCALC_ARENA_ALIGNUP(size);
+
+  for (;;) {
+    tcalc_arena_chunk* cur = arena->cur;
+    if (cur != NULL && cur->cap - cur->used >= size) {
+      void* ptr = tcalc_arena_chunk_data(cur) + cur->used;
+      cur->used += size;
+      return ptr;
+    }
+
+    // reuse the chunks left over from before the last reset
+    tcalc_arena_chunk* next = cur != NULL ? cur->next : arena->head;
+    if (next != NULL && next->cap >= size) {
+      next->used = 0;
+      arena->cur = next;
+      continue;
+    }
+
+    const size_t cap = arena->chunkSize < size ? size : arena->chunkSize;
+    tcalc_arena_chunk* chunk = (tcalc_arena_chunk*)tcalc_alloc(arena->backing, TCALC_ARENA_CHUNK_HEADER + cap);
+    if (chunk == NULL) return NULL;
+    chunk->cap = cap;
+    chunk->used = 0;
+    chunk->next = next;
+    if (cur != NULL) {
+      cur->next = chunk;
+    } else {
+      arena->head = chunk;
+    }
+    arena->cur = chunk;
+    if (arena->chunkSize <= (SIZE_MAX - TCALC_ARENA_CHUNK_HEADER) / 2)
+      arena->chunkSize *= 2;
+  }
+}
+
+const tcalc_allocator* tcalc_arena_allocator(tcalc_arena* arena) {
+  return &(arena->allocator);
+}
@@ -0,0 +1,1054 @@
+#include "tcalc.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * tcalc bytecode is a flat postfix instruction stream which is run on a stack
+ * of tcalc_vals. Every instruction pops its operands off the top of the stack
+ * and pushes its result, so a well formed program always leaves exactly one
+ * value on the stack when it finishes.
+ *
+ * Operators which are defined in a context by the standard tcalc_val_*
+ * functions are compiled to dedicated opcodes, which do the same type checking
+ * as those functions but operate on the stack in place. Anything else,
+ * including every function, is compiled to a call through the function
+ * pointer that the context defined it with.
+*/
+
+enum tcalc_bc_op {
+  TCALC_BC_OP_NUM, // push as.num
+  TCALC_BC_OP_BOOL, // push arg as a bool
+  TCALC_BC_OP_VAR, // push variable slot arg
+  TCALC_BC_OP_STORE_TMP, // copy the top of the stack into temporary arg
+  TCALC_BC_OP_LOAD_TMP, // push temporary arg
+
+  TCALC_BC_OP_POS,
+  TCALC_BC_OP_NEG,
+  TCALC_BC_OP_ADD,
+  TCALC_BC_OP_SUB,
+  TCALC_BC_OP_MUL,
+  TCALC_BC_OP_DIV,
+  TCALC_BC_OP_MOD,
+  TCALC_BC_OP_POW,
+  TCALC_BC_OP_LT,
+  TCALC_BC_OP_LTEQ,
+  TCALC_BC_OP_GT,
+  TCALC_BC_OP_GTEQ,
+  TCALC_BC_OP_EQ, // numeric or logical equality, depending on the operands
+  TCALC_BC_OP_NEQ, // numeric or logical inequality, depending on the operands
+  TCALC_BC_OP_NOT,
+  TCALC_BC_OP_AND,
+  TCALC_BC_OP_OR,
+
+  TCALC_BC_OP_CALL_UN, // call as.unfunc
+  TCALC_BC_OP_CALL_BIN, // call as.binfunc
+  TCALC_BC_OP_CALL_REL, // call as.relfunc
+  TCALC_BC_OP_CALL_UNL, // call as.unlfunc
+  TCALC_BC_OP_CALL_BINL, // call as.binlfunc
+
+  // Call as.relfunc on numeric operands, or the as.binlfunc of the
+  // TCALC_BC_OP_EXT instruction directly after it on logical operands.
+  // Either function may be NULL if the context did not define it.
+  TCALC_BC_OP_CALL_EQ,
+  TCALC_BC_OP_EXT // extra operand of the previous instruction, never executed
+};
+
+typedef struct tcalc_bc_instr {
+  enum tcalc_bc_op op;
+  int32_t arg;
+  union {
+    double num;
+    tcalc_val_unfunc unfunc;
+    tcalc_val_binfunc binfunc;
+    tcalc_val_relfunc relfunc;
+    tcalc_val_unlfunc unlfunc;
+    tcalc_val_binlfunc binlfunc;
+  } as;
+} tcalc_bc_instr;
+
+typedef struct tcalc_bc_var {
+  int32_t nameStart; // offset of the variable's name in tcalc_bytecode.expr
+  int32_t nameLen;
+} tcalc_bc_var;
+
+struct tcalc_bytecode {
+  const tcalc_allocator* allocator; // that of the context compiled with
+  char* expr; // owned copy of the compiled expression, used for variable names
+  int32_t exprLen;
+  int32_t stackSize; // deepest the stack gets while running code
+  int32_t tmpCount; // results of shared nodes, kept right after the stack
+  TCALC_VEC(tcalc_bc_instr) code;
+  TCALC_VEC(tcalc_bc_var) vars;
+  tcalc_ctx_index varsIndex; // slots of vars by name, at most half full
+};
+
+typedef struct tcalc_bc_cctx {
+  const char* expr;
+  int32_t exprLen;
+  const tcalc_token* tokens;
+  const tcalc_exprtree* tree;
+  const tcalc_ctx* ctx;
+  tcalc_bytecode* bc;
+  int32_t depth; // stack depth after the instructions emitted so far
+  int32_t* refs; // number of parents of each node reachable from the root
+  int32_t* tmps; // temporary holding the result of each node, or -1
+  tcalc_bc_instr* calls; // resolved calls of the functions being compiled
+  int32_t callsLen;
+} tcalc_bc_cctx;
+
+static tcalc_err tcalc_bc_addref_enter(void* user, int32_t treeInd, int32_t* slot, bool* outDescend);
+static tcalc_err tcalc_bc_compile_enter(void* user, int32_t treeInd, int32_t* slot, bool* outDescend);
+static tcalc_err tcalc_bc_compile_leave(void* user, int32_t treeInd, int32_t* slot);
+
+tcalc_err tcalc_bytecode_compile(
+  const char* expr, int32_t exprLen, const tcalc_exprtree* exprtree,
+  int32_t exprTreeLen, int32_t exprNodeInd, const tcalc_token* tokens,
+  int32_t tokensLen, const struct tcalc_ctx* ctx, tcalc_bytecode** out
+) {
+  assert(ctx != NULL);
+  return tcalc_bytecode_compile_walloc(
+    expr, exprLen, exprtree, exprTreeLen, exprNodeInd, tokens, tokensLen, ctx,
+    ctx->allocator, out
+  );
+}
+
+tcalc_err tcalc_bytecode_compile_walloc(
+  const char* expr, int32_t exprLen, const tcalc_exprtree* exprtree,
+  int32_t exprTreeLen, int32_t exprNodeInd, const tcalc_token* tokens,
+  int32_t tokensLen, const struct tcalc_ctx* ctx, const tcalc_allocator* scratch,
+  tcalc_bytecode** out
+) {
+  assert(expr != NULL);
+  assert(exprtree != NULL);
+  assert(tokens != NULL);
+  assert(ctx != NULL);
+  assert(out != NULL);
+  assert(exprNodeInd >= 0 && exprNodeInd < exprTreeLen);
+  (void)tokensLen;
+  *out = NULL;
+
+  tcalc_err err = TCALC_ERR_OK;
+  tcalc_exprtree_walkframe* frames = NULL;
+  int32_t* refs = NULL;
+  int32_t* tmps = NULL;
+  tcalc_bc_instr* calls = NULL;
+  const tcalc_allocator* allocator = ctx->allocator;
+  tcalc_bytecode* bc = (tcalc_bytecode*)tcalc_calloc(allocator, 1, sizeof(tcalc_bytecode));
+  cleanup_if(err, bc == NULL, TCALC_ERR_NOMEM);
+  bc->allocator = allocator;
+
+  refs = (int32_t*)tcalc_calloc(scratch, (size_t)exprTreeLen, sizeof(int32_t));
+  cleanup_if(err, refs == NULL, TCALC_ERR_NOMEM);
+  tmps = (int32_t*)tcalc_alloc(scratch, sizeof(int32_t) * (size_t)exprTreeLen);
+  cleanup_if(err, tmps == NULL, TCALC_ERR_NOMEM);
+  memset(tmps, -1, sizeof(int32_t) * (size_t)exprTreeLen);
+  calls = (tcalc_bc_instr*)tcalc_alloc(scratch, sizeof(tcalc_bc_instr) * (size_t)exprTreeLen);
+  cleanup_if(err, calls == NULL, TCALC_ERR_NOMEM);
+  frames = (tcalc_exprtree_walkframe*)tcalc_alloc(scratch, sizeof(tcalc_exprtree_walkframe) * (size_t)exprTreeLen);
+  cleanup_if(err, frames == NULL, TCALC_ERR_NOMEM);
+
+  bc->expr = (char*)tcalc_alloc(allocator, (size_t)exprLen + 1);
+  cleanup_if(err, bc->expr == NULL, TCALC_ERR_NOMEM);
+  memcpy(bc->expr, expr, (size_t)exprLen);
+  bc->expr[exprLen] = '\0';
+  bc->exprLen = exprLen;
+
+  tcalc_bc_cctx cctx = {
+    .expr = expr,
+    .exprLen = exprLen,
+    .tokens = tokens,
+    .tree = exprtree,
+    .ctx = ctx,
+    .bc = bc,
+    .depth = 0,
+    .refs = refs,
+    .tmps = tmps,
+    .calls = calls,
+    .callsLen = 0
+  };
+
+  // the walks never change the tree, even though they could through the
+  // slots they are given
+  tcalc_exprtree* tree = (tcalc_exprtree*)exprtree;
+  cleanup_on_err(err, tcalc_exprtree_walk(tree, exprNodeInd, frames, tcalc_bc_addref_enter, NULL, &cctx));
+  cleanup_on_err(err, tcalc_exprtree_walk(tree, exprNodeInd, frames, tcalc_bc_compile_enter, tcalc_bc_compile_leave, &cctx));
+  assert(cctx.depth == 1);
+
+  tcalc_free(scratch, frames, sizeof(tcalc_exprtree_walkframe) * (size_t)exprTreeLen);
+  tcalc_free(scratch, calls, sizeof(tcalc_bc_instr) * (size_t)exprTreeLen);
+  tcalc_free(scratch, tmps, sizeof(int32_t) * (size_t)exprTreeLen);
+  tcalc_free(scratch, refs, sizeof(int32_t) * (size_t)exprTreeLen);
+  *out = bc;
+  return TCALC_ERR_OK;
+
+  cleanup:
+    tcalc_free(scratch, frames, sizeof(tcalc_exprtree_walkframe) * (size_t)exprTreeLen);
+    tcalc_free(scratch, calls, sizeof(tcalc_bc_instr) * (size_t)exprTreeLen);
+    tcalc_free(scratch, tmps, sizeof(int32_t) * (size_t)exprTreeLen);
+    tcalc_free(scratch, refs, sizeof(int32_t) * (size_t)exprTreeLen);
+    tcalc_bytecode_free(bc);
+    return err;
+}
+
+void tcalc_bytecode_free(tcalc_bytecode* bc) {
+  if (bc == NULL) return;
+  TCALC_VEC_FREE_A(bc->allocator, bc->code);
+  TCALC_VEC_FREE_A(bc->allocator, bc->vars);
+  tcalc_free(bc->allocator, bc->varsIndex.slots, sizeof(tcalc_ctx_index_slot) * bc->varsIndex.cap);
+  tcalc_free(bc->allocator, bc->expr, (size_t)bc->exprLen + 1);
+  tcalc_free(bc->allocator, bc, sizeof(tcalc_bytecode));
+}
+
+int32_t tcalc_bytecode_stacksize(const tcalc_bytecode* bc) {
+  return bc->stackSize + bc->tmpCount;
+}
+
+int32_t tcalc_bytecode_varcount(const tcalc_bytecode* bc) {
+  return (int32_t)bc->vars.len;
+}
+
+/**
+ * Find the slot of the variable named name with the given hash, or -1
+*/
+static int32_t tcalc_bc_findvar(const tcalc_bytecode* bc, const char* name, size_t name_len, uint32_t hash) {
+  if (bc->varsIndex.cap == 0) return -1; // no variables
+  const size_t mask = bc->varsIndex.cap - 1;
+  for (size_t i = hash & mask; bc->varsIndex.slots[i].pos != 0; i = (i + 1) & mask) {
+    const tcalc_ctx_index_slot slot = bc->varsIndex.slots[i];
+    const tcalc_bc_var var = bc->vars.arr[slot.pos - 1];
+    if (slot.hash == hash && (size_t)var.nameLen == name_len &&
+        memcmp(bc->expr + var.nameStart, name, name_len) == 0)
+      return (int32_t)(slot.pos - 1);
+  }
+  return -1;
+}
+
+tcalc_err tcalc_bytecode_getvarslot(
+  const tcalc_bytecode* bc, const char* name, size_t name_len, int32_t* outSlot
+) {
+  *outSlot = tcalc_bc_findvar(bc, name, name_len, tcalc_ctx_hash(name, name_len));
+  return *outSlot >= 0 ? TCALC_ERR_OK : TCALC_ERR_NOT_FOUND;
+}
+
+tcalc_err tcalc_bytecode_getvarname(
+  const tcalc_bytecode* bc, int32_t slot, const char** outName, int32_t* outNameLen
+) {
+  if (slot < 0 || (size_t)slot >= bc->vars.len)
+    return TCALC_ERR_OUT_OF_BOUNDS;
+  *outName = bc->expr + bc->vars.arr[slot].nameStart;
+  *outNameLen = bc->vars.arr[slot].nameLen;
+  return TCALC_ERR_OK;
+}
+
+/**
+ * Append an instruction which changes the depth of the stack by stackEffect
+*/
+static tcalc_err tcalc_bc_emit(tcalc_bc_cctx* cctx, tcalc_bc_instr instr, int32_t stackEffect) {
+  tcalc_err err = TCALC_ERR_OK;
+  ret_on_macerr(err, TCALC_VEC_PUSH_A(cctx->bc->allocator, cctx->bc->code, instr, err));
+  cctx->depth += stackEffect;
+  if (cctx->depth > cctx->bc->stackSize)
+    cctx->bc->stackSize = cctx->depth;
+  return TCALC_ERR_OK;
+}
+
+static void tcalc_bc_index_put(tcalc_ctx_index_slot* slots, size_t cap, uint32_t hash, size_t pos) {
+  const size_t mask = cap - 1;
+  size_t i = hash & mask;
+  while (slots[i].pos != 0)
+    i = (i + 1) & mask;
+  slots[i].hash = hash;
+  slots[i].pos = (uint32_t)pos + 1;
+}
+
+/**
+ * Find or create the slot for the variable named by token. Variables are
+ * indexed by name like the tables of a context, so that compiling stays
+ * linear in the number of distinct variables.
+*/
+static tcalc_err tcalc_bc_slot_for_token(tcalc_bc_cctx* cctx, tcalc_token token, int32_t* outSlot) {
+  tcalc_err err = TCALC_ERR_OK;
+  tcalc_bytecode* bc = cctx->bc;
+  const char* name = tcalc_token_startcp(cctx->expr, token);
+  const int32_t nameLen = tcalc_token_len(cctx->expr, cctx->exprLen, token);
+  const uint32_t hash = tcalc_ctx_hash(name, (size_t)nameLen);
+
+  *outSlot = tcalc_bc_findvar(bc, name, (size_t)nameLen, hash);
+  if (*outSlot >= 0) return TCALC_ERR_OK;
+
+  if ((bc->vars.len + 1) * 2 > bc->varsIndex.cap) {
+    const size_t newCap = bc->varsIndex.cap == 0 ? 16 : bc->varsIndex.cap * 2;
+    tcalc_ctx_index_slot* slots = (tcalc_ctx_index_slot*)tcalc_calloc(bc->allocator, newCap, sizeof(tcalc_ctx_index_slot));
+    reterr_on_true(err, slots == NULL, TCALC_ERR_NOMEM);
+    for (size_t i = 0; i < bc->varsIndex.cap; i++) {
+      const tcalc_ctx_index_slot slot = bc->varsIndex.slots[i];
+      if (slot.pos != 0) tcalc_bc_index_put(slots, newCap, slot.hash, slot.pos - 1);
+    }
+    tcalc_free(bc->allocator, bc->varsIndex.slots, sizeof(tcalc_ctx_index_slot) * bc->varsIndex.cap);
+    bc->varsIndex.slots = slots;
+    bc->varsIndex.cap = newCap;
+  }
+
+  const tcalc_bc_var var = { .nameStart = token.start, .nameLen = nameLen };
+  ret_on_macerr(err, TCALC_VEC_PUSH_A(bc->allocator, bc->vars, var, err));
+  *outSlot = (int32_t)bc->vars.len - 1;
+  tcalc_bc_index_put(bc->varsIndex.slots, bc->varsIndex.cap, hash, (size_t)*outSlot);
+  return TCALC_ERR_OK;
+}
+
+static tcalc_bc_instr tcalc_bc_unfunc_instr(tcalc_val_unfunc func) {
+  tcalc_bc_instr instr = { .op = TCALC_BC_OP_CALL_UN, .arg = 0 };
+  if (func == tcalc_val_unary_plus) instr.op = TCALC_BC_OP_POS;
+  else if (func == tcalc_val_unary_minus) instr.op = TCALC_BC_OP_NEG;
+  else instr.as.unfunc = func;
+  return instr;
+}
+
+static tcalc_bc_instr tcalc_bc_binfunc_instr(tcalc_val_binfunc func) {
+  tcalc_bc_instr instr = { .op = TCALC_BC_OP_CALL_BIN, .arg = 0 };
+  if (func == tcalc_val_add) instr.op = TCALC_BC_OP_ADD;
+  else if (func == tcalc_val_subtract) instr.op = TCALC_BC_OP_SUB;
+  else if (func == tcalc_val_multiply) instr.op = TCALC_BC_OP_MUL;
+  else if (func == tcalc_val_divide) instr.op = TCALC_BC_OP_DIV;
+  else if (func == tcalc_val_mod) instr.op = TCALC_BC_OP_MOD;
+  else if (func == tcalc_val_pow) instr.op = TCALC_BC_OP_POW;
+  else instr.as.binfunc = func;
+  return instr;
+}
+
+static tcalc_bc_instr tcalc_bc_relfunc_instr(tcalc_val_relfunc func) {
+  tcalc_bc_instr instr = { .op = TCALC_BC_OP_CALL_REL, .arg = 0 };
+  if (func == tcalc_val_lt) instr.op = TCALC_BC_OP_LT;
+  else if (func == tcalc_val_lteq) instr.op = TCALC_BC_OP_LTEQ;
+  else if (func == tcalc_val_gt) instr.op = TCALC_BC_OP_GT;
+  else if (func == tcalc_val_gteq) instr.op = TCALC_BC_OP_GTEQ;
+  else instr.as.relfunc = func;
+  return instr;
+}
+
+static tcalc_bc_instr tcalc_bc_unlfunc_instr(tcalc_val_unlfunc func) {
+  tcalc_bc_instr instr = { .op = TCALC_BC_OP_CALL_UNL, .arg = 0 };
+  if (func == tcalc_val_not) instr.op = TCALC_BC_OP_NOT;
+  else instr.as.unlfunc = func;
+  return instr;
+}
+
+static tcalc_bc_instr tcalc_bc_binlfunc_instr(tcalc_val_binlfunc func) {
+  tcalc_bc_instr instr = { .op = TCALC_BC_OP_CALL_BINL, .arg = 0 };
+  if (func == tcalc_val_and) instr.op = TCALC_BC_OP_AND;
+  else if (func == tcalc_val_or) instr.op = TCALC_BC_OP_OR;
+  else instr.as.binlfunc = func;
+  return instr;
+}
+
+static tcalc_err tcalc_bc_compile_eqop(
+  tcalc_bc_cctx* cctx, const char* opName, size_t opNameLen
+) {
+  tcalc_err err = TCALC_ERR_OK;
+
+  // Which definition applies depends on the operand types, which are only
+  // known at evaluation time, so keep whichever of the two is defined.
+  tcalc_relopdef relopdef = { 0 };
+  tcalc_binlopdef binlopdef = { 0 };
+  tcalc_ctx_getrelop(cctx->ctx, opName, opNameLen, &relopdef);
+  tcalc_ctx_getbinlop(cctx->ctx, opName, opNameLen, &binlopdef);
+
+  if (relopdef.func == tcalc_val_equals && binlopdef.func == tcalc_val_equals_l)
+    return tcalc_bc_emit(cctx, (tcalc_bc_instr){ .op = TCALC_BC_OP_EQ }, -1);
+  if (relopdef.func == tcalc_val_nequals && binlopdef.func == tcalc_val_nequals_l)
+    return tcalc_bc_emit(cctx, (tcalc_bc_instr){ .op = TCALC_BC_OP_NEQ }, -1);
+
+  tcalc_bc_instr call = { .op = TCALC_BC_OP_CALL_EQ };
+  call.as.relfunc = relopdef.func;
+  tcalc_bc_instr ext = { .op = TCALC_BC_OP_EXT };
+  ext.as.binlfunc = binlopdef.func;
+  ret_on_err(err, tcalc_bc_emit(cctx, call, -1));
+  return tcalc_bc_emit(cctx, ext, 0);
+}
+
+/**
+ * Emit the operator of a binary node, once both of its operands are compiled
+*/
+static tcalc_err tcalc_bc_emit_binary(tcalc_bc_cctx* cctx, tcalc_exprtree_binary_node binnode) {
+  tcalc_err err = TCALC_ERR_OK;
+
+  if (binnode.tokenIndOImplMult < 0) {
+    tcalc_binopdef binopdef;
+    ret_on_err(err, tcalc_ctx_getbinop(cctx->ctx, TCALC_STRLIT_PTR_LEN(""), &binopdef));
+    return tcalc_bc_emit(cctx, tcalc_bc_binfunc_instr(binopdef.func), -1);
+  }
+
+  const tcalc_token opToken = cctx->tokens[binnode.tokenIndOImplMult];
+  const char* opName = tcalc_token_startcp(cctx->expr, opToken);
+  const size_t opNameLen = (size_t)tcalc_token_len(cctx->expr, cctx->exprLen, opToken);
+
+  switch (opToken.type) {
+    case TCALC_TOK_BINOP: {
+      tcalc_binopdef binopdef;
+      ret_on_err(err, tcalc_ctx_getbinop(cctx->ctx, opName, opNameLen, &binopdef));
+      return tcalc_bc_emit(cctx, tcalc_bc_binfunc_instr(binopdef.func), -1);
+    }
+    case TCALC_TOK_BINLOP: {
+      tcalc_binlopdef binlopdef;
+      ret_on_err(err, tcalc_ctx_getbinlop(cctx->ctx, opName, opNameLen, &binlopdef));
+      return tcalc_bc_emit(cctx, tcalc_bc_binlfunc_instr(binlopdef.func), -1);
+    }
+    case TCALC_TOK_RELOP: {
+      tcalc_relopdef relopdef;
+      ret_on_err(err, tcalc_ctx_getrelop(cctx->ctx, opName, opNameLen, &relopdef));
+      return tcalc_bc_emit(cctx, tcalc_bc_relfunc_instr(relopdef.func), -1);
+    }
+    case TCALC_TOK_EQOP:
+      return tcalc_bc_compile_eqop(cctx, opName, opNameLen);
+    default: {
+      return TCALC_ERR_INVALID_ARG;
+    }
+  }
+}
+
+/**
+ * Emit the operator of a unary node, once its operand is compiled
+*/
+static tcalc_err tcalc_bc_emit_unary(tcalc_bc_cctx* cctx, tcalc_exprtree_unary_node unnode) {
+  tcalc_err err = TCALC_ERR_OK;
+
+  const tcalc_token opToken = cctx->tokens[unnode.tokenInd];
+  const char* opName = tcalc_token_startcp(cctx->expr, opToken);
+  const size_t opNameLen = (size_t)tcalc_token_len(cctx->expr, cctx->exprLen, opToken);
+
+  switch (opToken.type) {
+    case TCALC_TOK_UNOP: {
+      tcalc_unopdef unopdef;
+      ret_on_err(err, tcalc_ctx_getunop(cctx->ctx, opName, opNameLen, &unopdef));
+      return tcalc_bc_emit(cctx, tcalc_bc_unfunc_instr(unopdef.func), 0);
+    }
+    case TCALC_TOK_UNLOP: {
+      tcalc_unlopdef unlopdef;
+      ret_on_err(err, tcalc_ctx_getunlop(cctx->ctx, opName, opNameLen, &unlopdef));
+      return tcalc_bc_emit(cctx, tcalc_bc_unlfunc_instr(unlopdef.func), 0);
+    }
+    default: {
+      return TCALC_ERR_INVALID_ARG;
+    }
+  }
+}
+
+/**
+ * Resolve the function a function node calls, checking its arity before any
+ * of its arguments are compiled
+*/
+static tcalc_err tcalc_bc_resolve_func(tcalc_bc_cctx* cctx, tcalc_exprtree_func_node funcnode, tcalc_bc_instr* outCall) {
+  tcalc_err err = TCALC_ERR_OK;
+  const tcalc_token nameToken = cctx->tokens[funcnode.tokenInd];
+  const char* name = tcalc_token_startcp(cctx->expr, nameToken);
+  const size_t nameLen = (size_t)tcalc_token_len(cctx->expr, cctx->exprLen, nameToken);
+
+  int32_t argCount = 0;
+  for (int32_t argInd = funcnode.funcArgHeadInd; argInd >= 0; argInd = cctx->tree[argInd].as.funcarg.nextArgInd)
+    argCount++;
+
+  tcalc_unfuncdef unfuncdef;
+  tcalc_binfuncdef binfuncdef;
+  if (tcalc_ctx_getunfunc(cctx->ctx, name, nameLen, &unfuncdef) == TCALC_ERR_OK) {
+    reterr_on_true(err, argCount != 1, TCALC_ERR_WRONG_ARITY);
+    *outCall = (tcalc_bc_instr){ .op = TCALC_BC_OP_CALL_UN };
+    outCall->as.unfunc = unfuncdef.func;
+    return TCALC_ERR_OK;
+  } else if (tcalc_ctx_getbinfunc(cctx->ctx, name, nameLen, &binfuncdef) == TCALC_ERR_OK) {
+    reterr_on_true(err, argCount != 2, TCALC_ERR_WRONG_ARITY);
+    *outCall = (tcalc_bc_instr){ .op = TCALC_BC_OP_CALL_BIN };
+    outCall->as.binfunc = binfuncdef.func;
+    return TCALC_ERR_OK;
+  }
+
+  return TCALC_ERR_UNKNOWN_ID;
+}
+
+/**
+ * Count the parents of every node reachable from the root. A tree which went
+ * through tcalc_cse_exprtree can have nodes with more than one parent, whose
+ * children are only counted the first time. Argument list nodes are not
+ * counted, as their arguments are compiled directly under the function.
+*/
+static tcalc_err tcalc_bc_addref_enter(void* user, int32_t treeInd, int32_t* slot, bool* outDescend) {
+  (void)slot;
+  tcalc_bc_cctx* cctx = (tcalc_bc_cctx*)user;
+  *outDescend = cctx->tree[treeInd].type == TCALC_EXPRTREE_NODE_TYPE_FUNCARG ||
+    cctx->refs[treeInd]++ == 0;
+  return TCALC_ERR_OK;
+}
+
+/**
+ * Emit the instruction of a leaf node
+*/
+static tcalc_err tcalc_bc_emit_leaf(tcalc_bc_cctx* cctx, tcalc_exprtree treeNode) {
+  tcalc_err err = TCALC_ERR_OK;
+
+  if (treeNode.type == TCALC_EXPRTREE_NODE_TYPE_CONST) {
+    const tcalc_val val = treeNode.as.constant.val;
+    tcalc_bc_instr instr = { .op = TCALC_BC_OP_NUM };
+    if (val.type == TCALC_VALTYPE_NUM) {
+      instr.as.num = val.as.num;
+    } else {
+      instr.op = TCALC_BC_OP_BOOL;
+      instr.arg = val.as.boolean;
+    }
+    return tcalc_bc_emit(cctx, instr, 1);
+  }
+
+  assert(treeNode.type == TCALC_EXPRTREE_NODE_TYPE_VALUE);
+  const tcalc_token token = cctx->tokens[treeNode.as.value.tokenInd];
+  tcalc_bc_instr instr = { 0 };
+  switch (token.type) {
+    case TCALC_TOK_NUM: {
+      instr.op = TCALC_BC_OP_NUM;
+      instr.as.num = treeNode.as.value.num;
+    } break;
+    case TCALC_TOK_ID: {
+      instr.op = TCALC_BC_OP_VAR;
+      ret_on_err(err, tcalc_bc_slot_for_token(cctx, token, &(instr.arg)));
+    } break;
+    default: {
+      return TCALC_ERR_INVALID_ARG;
+    }
+  }
+  return tcalc_bc_emit(cctx, instr, 1);
+}
+
+/**
+ * Start compiling the node at treeInd. A node which was already compiled is
+ * loaded from its temporary, and a leaf is emitted straight away; anything
+ * else has its children compiled first.
+*/
+static tcalc_err tcalc_bc_compile_enter(void* user, int32_t treeInd, int32_t* slot, bool* outDescend) {
+  (void)slot;
+  tcalc_err err = TCALC_ERR_OK;
+  tcalc_bc_cctx* cctx = (tcalc_bc_cctx*)user;
+  *outDescend = false;
+  if (cctx->tmps[treeInd] >= 0)
+    return tcalc_bc_emit(cctx, (tcalc_bc_instr){ .op = TCALC_BC_OP_LOAD_TMP, .arg = cctx->tmps[treeInd] }, 1);
+
+  const tcalc_exprtree treeNode = cctx->tree[treeInd];
+  switch (treeNode.type) {
+    case TCALC_EXPRTREE_NODE_TYPE_VALUE:
+    case TCALC_EXPRTREE_NODE_TYPE_CONST:
+      // a leaf is a single instruction, so it is as cheap to push again as
+      // to keep in a temporary
+      return tcalc_bc_emit_leaf(cctx, treeNode);
+    case TCALC_EXPRTREE_NODE_TYPE_FUNC:
+      ret_on_err(err, tcalc_bc_resolve_func(cctx, treeNode.as.func, &(cctx->calls[cctx->callsLen])));
+      cctx->callsLen++;
+      break;
+    default:
+      break;
+  }
+  *outDescend = true;
+  return TCALC_ERR_OK;
+}
+
+/**
+ * Emit the instruction of the node at treeInd once its children are
+ * compiled. The first time a node with several parents is compiled its result
+ * is saved into a temporary, which every later use loads instead of computing
+ * it again.
+*/
+static tcalc_err tcalc_bc_compile_leave(void* user, int32_t treeInd, int32_t* slot) {
+  (void)slot;
+  tcalc_err err = TCALC_ERR_OK;
+  tcalc_bc_cctx* cctx = (tcalc_bc_cctx*)user;
+  const tcalc_exprtree treeNode = cctx->tree[treeInd];
+
+  switch (treeNode.type) {
+    case TCALC_EXPRTREE_NODE_TYPE_BINARY:
+      ret_on_err(err, tcalc_bc_emit_binary(cctx, treeNode.as.binary));
+      break;
+    case TCALC_EXPRTREE_NODE_TYPE_UNARY:
+      ret_on_err(err, tcalc_bc_emit_unary(cctx, treeNode.as.unary));
+      break;
+    case TCALC_EXPRTREE_NODE_TYPE_FUNC: {
+      const tcalc_bc_instr call = cctx->calls[--cctx->callsLen];
+      ret_on_err(err, tcalc_bc_emit(cctx, call, call.op == TCALC_BC_OP_CALL_BIN ? -1 : 0));
+    } break;
+    case TCALC_EXPRTREE_NODE_TYPE_FUNCARG:
+      return TCALC_ERR_OK; // holds no value of its own, and is never counted as shared
+    case TCALC_EXPRTREE_NODE_TYPE_VALUE:
+    case TCALC_EXPRTREE_NODE_TYPE_CONST:
+      assert(0); // leaves are never descended into
+      return TCALC_ERR_INVALID_ARG;
+  }
+
+  if (cctx->refs[treeInd] > 1) {
+    cctx->tmps[treeInd] = cctx->bc->tmpCount++;
+    return tcalc_bc_emit(cctx, (tcalc_bc_instr){ .op = TCALC_BC_OP_STORE_TMP, .arg = cctx->tmps[treeInd] }, 0);
+  }
+  return TCALC_ERR_OK;
+}
+
+// Operand type checks for the dedicated opcodes. top points one past the
+// topmost value on the stack.
+#define TCALC_BC_NUM1(top) ((top)[-1].type == TCALC_VALTYPE_NUM)
+#define TCALC_BC_NUM2(top) ((top)[-2].type == TCALC_VALTYPE_NUM && (top)[-1].type == TCALC_VALTYPE_NUM)
+#define TCALC_BC_BOOL1(top) ((top)[-1].type == TCALC_VALTYPE_BOOL)
+#define TCALC_BC_BOOL2(top) ((top)[-2].type == TCALC_VALTYPE_BOOL && (top)[-1].type == TCALC_VALTYPE_BOOL)
+
+tcalc_err tcalc_bytecode_eval(
+  const tcalc_bytecode* bc, const struct tcalc_val* vars,
+  struct tcalc_val* stack, int32_t stackCapacity, struct tcalc_val* out
+) {
+  assert(bc != NULL);
+  assert(vars != NULL || bc->vars.len == 0);
+  assert(stack != NULL);
+  assert(out != NULL);
+
+  tcalc_err err = TCALC_ERR_OK;
+  reterr_on_true(err, stackCapacity < tcalc_bytecode_stacksize(bc), TCALC_ERR_OUT_OF_BOUNDS);
+
+  tcalc_val* top = stack; // one past the topmost value
+  tcalc_val* const tmps = stack + bc->stackSize;
+  const tcalc_bc_instr* ip = bc->code.arr;
+  const tcalc_bc_instr* const end = bc->code.arr + bc->code.len;
+
+  for (; ip != end; ip++) {
+    switch (ip->op) {
+      case TCALC_BC_OP_NUM: {
+        top->type = TCALC_VALTYPE_NUM;
+        top->as.num = ip->as.num;
+        top++;
+      } break;
+      case TCALC_BC_OP_BOOL: {
+        top->type = TCALC_VALTYPE_BOOL;
+        top->as.boolean = ip->arg != 0;
+        top++;
+      } break;
+      case TCALC_BC_OP_VAR: {
+        *top++ = vars[ip->arg];
+      } break;
+      case TCALC_BC_OP_STORE_TMP: {
+        tmps[ip->arg] = top[-1];
+      } break;
+      case TCALC_BC_OP_LOAD_TMP: {
+        *top++ = tmps[ip->arg];
+      } break;
+      case TCALC_BC_OP_POS: {
+        reterr_on_true(err, !TCALC_BC_NUM1(top), TCALC_ERR_BAD_CAST);
+      } break;
+      case TCALC_BC_OP_NEG: {
+        reterr_on_true(err, !TCALC_BC_NUM1(top), TCALC_ERR_BAD_CAST);
+        top[-1].as.num = -top[-1].as.num;
+      } break;
+      case TCALC_BC_OP_ADD: {
+        reterr_on_true(err, !TCALC_BC_NUM2(top), TCALC_ERR_BAD_CAST);
+        top[-2].as.num += top[-1].as.num;
+        top--;
+      } break;
+      case TCALC_BC_OP_SUB: {
+        reterr_on_true(err, !TCALC_BC_NUM2(top), TCALC_ERR_BAD_CAST);
+        top[-2].as.num -= top[-1].as.num;
+        top--;
+      } break;
+      case TCALC_BC_OP_MUL: {
+        reterr_on_true(err, !TCALC_BC_NUM2(top), TCALC_ERR_BAD_CAST);
+        top[-2].as.num *= top[-1].as.num;
+        top--;
+      } break;
+      case TCALC_BC_OP_DIV: {
+        reterr_on_true(err, !TCALC_BC_NUM2(top), TCALC_ERR_BAD_CAST);
+        ret_on_err(err, tcalc_divide(top[-2].as.num, top[-1].as.num, &(top[-2].as.num)));
+        top--;
+      } break;
+      case TCALC_BC_OP_MOD: {
+        reterr_on_true(err, !TCALC_BC_NUM2(top), TCALC_ERR_BAD_CAST);
+        ret_on_err(err, tcalc_mod(top[-2].as.num, top[-1].as.num, &(top[-2].as.num)));
+        top--;
+      } break;
+      case TCALC_BC_OP_POW: {
+        reterr_on_true(err, !TCALC_BC_NUM2(top), TCALC_ERR_BAD_CAST);
+        ret_on_err(err, tcalc_pow(top[-2].as.num, top[-1].as.num, &(top[-2].as.num)));
+        top--;
+      } break;
+      case TCALC_BC_OP_LT:
+      case TCALC_BC_OP_LTEQ:
+      case TCALC_BC_OP_GT:
+      case TCALC_BC_OP_GTEQ: {
+        reterr_on_true(err, !TCALC_BC_NUM2(top), TCALC_ERR_BAD_CAST);
+        const double a = top[-2].as.num, b = top[-1].as.num;
+        bool res = false;
+        switch (ip->op) {
+          case TCALC_BC_OP_LT: res = tcalc_lt(a, b); break;
+          case TCALC_BC_OP_LTEQ: res = tcalc_lteq(a, b); break;
+          case TCALC_BC_OP_GT: res = tcalc_gt(a, b); break;
+          default: res = tcalc_gteq(a, b); break;
+        }
+        top[-2].type = TCALC_VALTYPE_BOOL;
+        top[-2].as.boolean = res;
+        top--;
+      } break;
+      case TCALC_BC_OP_EQ:
+      case TCALC_BC_OP_NEQ: {
+        bool res = false;
+        if (TCALC_BC_NUM2(top))
+          res = tcalc_equals(top[-2].as.num, top[-1].as.num);
+        else if (TCALC_BC_BOOL2(top))
+          res = tcalc_equals_l(top[-2].as.boolean, top[-1].as.boolean);
+        else
+          return TCALC_ERR_BAD_CAST;
+        top[-2].type = TCALC_VALTYPE_BOOL;
+        top[-2].as.boolean = ip->op == TCALC_BC_OP_EQ ? res : !res;
+        top--;
+      } break;
+      case TCALC_BC_OP_NOT: {
+        reterr_on_true(err, !TCALC_BC_BOOL1(top), TCALC_ERR_BAD_CAST);
+        top[-1].as.boolean = !top[-1].as.boolean;
+      } break;
+      case TCALC_BC_OP_AND: {
+        reterr_on_true(err, !TCALC_BC_BOOL2(top), TCALC_ERR_BAD_CAST);
+        top[-2].as.boolean = top[-2].as.boolean && top[-1].as.boolean;
+        top--;
+      } break;
+      case TCALC_BC_OP_OR: {
+        reterr_on_true(err, !TCALC_BC_BOOL2(top), TCALC_ERR_BAD_CAST);
+        top[-2].as.boolean = top[-2].as.boolean || top[-1].as.boolean;
+        top--;
+      } break;
+      case TCALC_BC_OP_CALL_UN: {
+        const tcalc_val a = top[-1];
+        top[-1].type = TCALC_VALTYPE_NUM;
+        ret_on_err(err, ip->as.unfunc(a, &(top[-1].as.num)));
+      } break;
+      case TCALC_BC_OP_CALL_BIN: {
+        const tcalc_val a = top[-2], b = top[-1];
+        top[-2].type = TCALC_VALTYPE_NUM;
+        ret_on_err(err, ip->as.binfunc(a, b, &(top[-2].as.num)));
+        top--;
+      } break;
+      case TCALC_BC_OP_CALL_REL: {
+        const tcalc_val a = top[-2], b = top[-1];
+        top[-2].type = TCALC_VALTYPE_BOOL;
+        ret_on_err(err, ip->as.relfunc(a, b, &(top[-2].as.boolean)));
+        top--;
+      } break;
+      case TCALC_BC_OP_CALL_UNL: {
+        const tcalc_val a = top[-1];
+        top[-1].type = TCALC_VALTYPE_BOOL;
+        ret_on_err(err, ip->as.unlfunc(a, &(top[-1].as.boolean)));
+      } break;
+      case TCALC_BC_OP_CALL_BINL: {
+        const tcalc_val a = top[-2], b = top[-1];
+        top[-2].type = TCALC_VALTYPE_BOOL;
+        ret_on_err(err, ip->as.binlfunc(a, b, &(top[-2].as.boolean)));
+        top--;
+      } break;
+      case TCALC_BC_OP_CALL_EQ: {
+        const tcalc_val a = top[-2], b = top[-1];
+        const tcalc_val_relfunc relfunc = ip->as.relfunc;
+        const tcalc_val_binlfunc binlfunc = (++ip)->as.binlfunc;
+        top[-2].type = TCALC_VALTYPE_BOOL;
+        if (a.type == TCALC_VALTYPE_NUM && b.type == TCALC_VALTYPE_NUM) {
+          reterr_on_true(err, relfunc == NULL, TCALC_ERR_NOT_FOUND);
+          ret_on_err(err, relfunc(a, b, &(top[-2].as.boolean)));
+        } else if (a.type == TCALC_VALTYPE_BOOL && b.type == TCALC_VALTYPE_BOOL) {
+          reterr_on_true(err, binlfunc == NULL, TCALC_ERR_NOT_FOUND);
+          ret_on_err(err, binlfunc(a, b, &(top[-2].as.boolean)));
+        } else {
+          return TCALC_ERR_BAD_CAST;
+        }
+        top--;
+      } break;
+      case TCALC_BC_OP_EXT: {
+        assert(0); // consumed by the instruction before it
+        return TCALC_ERR_INVALID_OP;
+      }
+    }
+  }
+
+  assert(top == stack + 1);
+  *out = stack[0];
+  return TCALC_ERR_OK;
+}
+
+/**
+ * Batch evaluation
+ *
+ * tcalc_bytecode_eval_batch runs code over TCALC_BC_TILE_ROWS rows at a time.
+ * Every value on the stack becomes a tile holding that value for each row in
+ * the current tile, and each instruction is run over a whole tile before
+ * moving on to the next one. The stack of tiles for a typical expression fits
+ * in L1, and instructions are dispatched once per tile rather than once per
+ * row.
+*/
+
+#define TCALC_BC_TILE_ROWS 256
+
+typedef struct tcalc_bc_tile {
+  enum tcalc_valtype type;
+  union {
+    double nums[TCALC_BC_TILE_ROWS];
+    bool bools[TCALC_BC_TILE_ROWS];
+  } as;
+} tcalc_bc_tile;
+
+/**
+ * Load rows of col into tile, or *scalar into every row if col has no data
+*/
+static void tcalc_bc_tile_load(
+  tcalc_bc_tile* tile, const tcalc_column* col, const struct tcalc_val* scalar,
+  size_t rowStart, size_t n
+) {
+  tile->type = col->type;
+  if (col->type == TCALC_VALTYPE_NUM) {
+    if (col->as.nums != NULL) {
+      memcpy(tile->as.nums, col->as.nums + rowStart, n * sizeof(double));
+    } else {
+      for (size_t i = 0; i < n; i++) tile->as.nums[i] = scalar->as.num;
+    }
+  } else {
+    if (col->as.bools != NULL) {
+      memcpy(tile->as.bools, col->as.bools + rowStart, n * sizeof(bool));
+    } else {
+      for (size_t i = 0; i < n; i++) tile->as.bools[i] = scalar->as.boolean;
+    }
+  }
+}
+
+static void tcalc_bc_tile_copy(tcalc_bc_tile* dst, const tcalc_bc_tile* src, size_t n) {
+  dst->type = src->type;
+  if (src->type == TCALC_VALTYPE_NUM)
+    memcpy(dst->as.nums, src->as.nums, n * sizeof(double));
+  else
+    memcpy(dst->as.bools, src->as.bools, n * sizeof(bool));
+}
+
+/**
+ * Call a tcalc_val_* function pointer once for every row of a tile, leaving the
+ * results in a. A result can be wider than the operand stored in the same
+ * place, such as a number computed from a bool, so they go through scratch.
+*/
+#define TCALC_BC_TILE_CALL1(err, func, a, scratch, outField, n) do { \
+    const enum tcalc_valtype atype = (a)->type; \
+    for (size_t i = 0; i < (n); i++) { \
+      const tcalc_val av = atype == TCALC_VALTYPE_NUM ? TCALC_VAL_INIT_NUM((a)->as.nums[i]) : TCALC_VAL_INIT_BOOL((a)->as.bools[i]); \
+      ret_on_err(err, func(av, &((scratch)->as.outField[i]))); \
+    } \
+    memcpy((a)->as.outField, (scratch)->as.outField, (n) * sizeof(*(scratch)->as.outField)); \
+  } while (0)
+
+#define TCALC_BC_TILE_CALL2(err, func, a, b, scratch, outField, n) do { \
+    const enum tcalc_valtype atype = (a)->type, btype = (b)->type; \
+    for (size_t i = 0; i < (n); i++) { \
+      const tcalc_val av = atype == TCALC_VALTYPE_NUM ? TCALC_VAL_INIT_NUM((a)->as.nums[i]) : TCALC_VAL_INIT_BOOL((a)->as.bools[i]); \
+      const tcalc_val bv = btype == TCALC_VALTYPE_NUM ? TCALC_VAL_INIT_NUM((b)->as.nums[i]) : TCALC_VAL_INIT_BOOL((b)->as.bools[i]); \
+      ret_on_err(err, func(av, bv, &((scratch)->as.outField[i]))); \
+    } \
+    memcpy((a)->as.outField, (scratch)->as.outField, (n) * sizeof(*(scratch)->as.outField)); \
+  } while (0)
+
+/**
+ * Run code over the n rows of a single tile, leaving the result in stack[0]
+*/
+static tcalc_err tcalc_bc_eval_tile(
+  const tcalc_bytecode* bc, const tcalc_column* vars,
+  const struct tcalc_val* scalars, tcalc_bc_tile* stack,
+  tcalc_bc_tile* scratch, size_t rowStart, size_t n
+) {
+  tcalc_err err = TCALC_ERR_OK;
+  tcalc_bc_tile* top = stack; // one past the topmost tile
+  tcalc_bc_tile* const tmps = stack + bc->stackSize;
+  const tcalc_bc_instr* ip = bc->code.arr;
+  const tcalc_bc_instr* const end = bc->code.arr + bc->code.len;
+
+  for (; ip != end; ip++) {
+    tcalc_bc_tile* const a = top - 2; // left operand of binary instructions
+    tcalc_bc_tile* const b = top - 1; // right operand, or the operand of unary ones
+
+    switch (ip->op) {
+      case TCALC_BC_OP_NUM: {
+        top->type = TCALC_VALTYPE_NUM;
+        for (size_t i = 0; i < n; i++) top->as.nums[i] = ip->as.num;
+        top++;
+      } break;
+      case TCALC_BC_OP_BOOL: {
+        top->type = TCALC_VALTYPE_BOOL;
+        memset(top->as.bools, ip->arg != 0, n * sizeof(bool));
+        top++;
+      } break;
+      case TCALC_BC_OP_VAR: {
+        tcalc_bc_tile_load(top, &(vars[ip->arg]), scalars != NULL ? scalars + ip->arg : NULL, rowStart, n);
+        top++;
+      } break;
+      case TCALC_BC_OP_STORE_TMP: {
+        tcalc_bc_tile_copy(&(tmps[ip->arg]), b, n);
+      } break;
+      case TCALC_BC_OP_LOAD_TMP: {
+        tcalc_bc_tile_copy(top, &(tmps[ip->arg]), n);
+        top++;
+      } break;
+      case TCALC_BC_OP_POS: {
+        reterr_on_true(err, b->type != TCALC_VALTYPE_NUM, TCALC_ERR_BAD_CAST);
+      } break;
+      case TCALC_BC_OP_NEG: {
+        reterr_on_true(err, b->type != TCALC_VALTYPE_NUM, TCALC_ERR_BAD_CAST);
+        tcalc_negate_arr(b->as.nums, b->as.nums, n);
+      } break;
+      case TCALC_BC_OP_ADD: {
+        reterr_on_true(err, a->type != TCALC_VALTYPE_NUM || b->type != TCALC_VALTYPE_NUM, TCALC_ERR_BAD_CAST);
+        ret_on_err(err, tcalc_add_arr(a->as.nums, b->as.nums, a->as.nums, n));
+        top--;
+      } break;
+      case TCALC_BC_OP_SUB: {
+        reterr_on_true(err, a->type != TCALC_VALTYPE_NUM || b->type != TCALC_VALTYPE_NUM, TCALC_ERR_BAD_CAST);
+        ret_on_err(err, tcalc_subtract_arr(a->as.nums, b->as.nums, a->as.nums, n));
+        top--;
+      } break;
+      case TCALC_BC_OP_MUL: {
+        reterr_on_true(err, a->type != TCALC_VALTYPE_NUM || b->type != TCALC_VALTYPE_NUM, TCALC_ERR_BAD_CAST);
+        ret_on_err(err, tcalc_multiply_arr(a->as.nums, b->as.nums, a->as.nums, n));
+        top--;
+      } break;
+      case TCALC_BC_OP_DIV: {
+        reterr_on_true(err, a->type != TCALC_VALTYPE_NUM || b->type != TCALC_VALTYPE_NUM, TCALC_ERR_BAD_CAST);
+        ret_on_err(err, tcalc_divide_arr(a->as.nums, b->as.nums, a->as.nums, n));
+        top--;
+      } break;
+      case TCALC_BC_OP_MOD: {
+        reterr_on_true(err, a->type != TCALC_VALTYPE_NUM || b->type != TCALC_VALTYPE_NUM, TCALC_ERR_BAD_CAST);
+        ret_on_err(err, tcalc_mod_arr(a->as.nums, b->as.nums, a->as.nums, n));
+        top--;
+      } break;
+      case TCALC_BC_OP_POW: {
+        reterr_on_true(err, a->type != TCALC_VALTYPE_NUM || b->type != TCALC_VALTYPE_NUM, TCALC_ERR_BAD_CAST);
+        ret_on_err(err, tcalc_pow_arr(a->as.nums, b->as.nums, a->as.nums, n));
+        top--;
+      } break;
+      case TCALC_BC_OP_LT:
+      case TCALC_BC_OP_LTEQ:
+      case TCALC_BC_OP_GT:
+      case TCALC_BC_OP_GTEQ: {
+        reterr_on_true(err, a->type != TCALC_VALTYPE_NUM || b->type != TCALC_VALTYPE_NUM, TCALC_ERR_BAD_CAST);
+        // a->as.bools shares storage with the nums being read, so the result
+        // goes through scratch
+        switch (ip->op) {
+          case TCALC_BC_OP_LT: tcalc_lt_arr(a->as.nums, b->as.nums, scratch->as.bools, n); break;
+          case TCALC_BC_OP_LTEQ: tcalc_lteq_arr(a->as.nums, b->as.nums, scratch->as.bools, n); break;
+          case TCALC_BC_OP_GT: tcalc_gt_arr(a->as.nums, b->as.nums, scratch->as.bools, n); break;
+          default: tcalc_gteq_arr(a->as.nums, b->as.nums, scratch->as.bools, n); break;
+        }
+        memcpy(a->as.bools, scratch->as.bools, n * sizeof(bool));
+        a->type = TCALC_VALTYPE_BOOL;
+        top--;
+      } break;
+      case TCALC_BC_OP_EQ:
+      case TCALC_BC_OP_NEQ: {
+        const bool eq = ip->op == TCALC_BC_OP_EQ;
+        if (a->type == TCALC_VALTYPE_NUM && b->type == TCALC_VALTYPE_NUM) {
+          if (eq) tcalc_equals_arr(a->as.nums, b->as.nums, scratch->as.bools, n);
+          else tcalc_nequals_arr(a->as.nums, b->as.nums, scratch->as.bools, n);
+          memcpy(a->as.bools, scratch->as.bools, n * sizeof(bool));
+        } else if (a->type == TCALC_VALTYPE_BOOL && b->type == TCALC_VALTYPE_BOOL) {
+          for (size_t i = 0; i < n; i++) {
+            const bool res = tcalc_equals_l(a->as.bools[i], b->as.bools[i]);
+            a->as.bools[i] = eq ? res : !res;
+          }
+        } else {
+          return TCALC_ERR_BAD_CAST;
+        }
+        a->type = TCALC_VALTYPE_BOOL;
+        top--;
+      } break;
+      case TCALC_BC_OP_NOT: {
+        reterr_on_true(err, b->type != TCALC_VALTYPE_BOOL, TCALC_ERR_BAD_CAST);
+        tcalc_not_arr(b->as.bools, b->as.bools, n);
+      } break;
+      case TCALC_BC_OP_AND: {
+        reterr_on_true(err, a->type != TCALC_VALTYPE_BOOL || b->type != TCALC_VALTYPE_BOOL, TCALC_ERR_BAD_CAST);
+        tcalc_and_arr(a->as.bools, b->as.bools, a->as.bools, n);
+        top--;
+      } break;
+      case TCALC_BC_OP_OR: {
+        reterr_on_true(err, a->type != TCALC_VALTYPE_BOOL || b->type != TCALC_VALTYPE_BOOL, TCALC_ERR_BAD_CAST);
+        tcalc_or_arr(a->as.bools, b->as.bools, a->as.bools, n);
+        top--;
+      } break;
+      case TCALC_BC_OP_CALL_UN: {
+        TCALC_BC_TILE_CALL1(err, ip->as.unfunc, b, scratch, nums, n);
+        b->type = TCALC_VALTYPE_NUM;
+      } break;
+      case TCALC_BC_OP_CALL_BIN: {
+        TCALC_BC_TILE_CALL2(err, ip->as.binfunc, a, b, scratch, nums, n);
+        a->type = TCALC_VALTYPE_NUM;
+        top--;
+      } break;
+      case TCALC_BC_OP_CALL_REL: {
+        TCALC_BC_TILE_CALL2(err, ip->as.relfunc, a, b, scratch, bools, n);
+        a->type = TCALC_VALTYPE_BOOL;
+        top--;
+      } break;
+      case TCALC_BC_OP_CALL_UNL: {
+        TCALC_BC_TILE_CALL1(err, ip->as.unlfunc, b, scratch, bools, n);
+        b->type = TCALC_VALTYPE_BOOL;
+      } break;
+      case TCALC_BC_OP_CALL_BINL: {
+        TCALC_BC_TILE_CALL2(err, ip->as.binlfunc, a, b, scratch, bools, n);
+        a->type = TCALC_VALTYPE_BOOL;
+        top--;
+      } break;
+      case TCALC_BC_OP_CALL_EQ: {
+        const tcalc_val_relfunc relfunc = ip->as.relfunc;
+        const tcalc_val_binlfunc binlfunc = (++ip)->as.binlfunc;
+        if (a->type == TCALC_VALTYPE_NUM && b->type == TCALC_VALTYPE_NUM) {
+          reterr_on_true(err, relfunc == NULL, TCALC_ERR_NOT_FOUND);
+          TCALC_BC_TILE_CALL2(err, relfunc, a, b, scratch, bools, n);
+        } else if (a->type == TCALC_VALTYPE_BOOL && b->type == TCALC_VALTYPE_BOOL) {
+          reterr_on_true(err, binlfunc == NULL, TCALC_ERR_NOT_FOUND);
+          TCALC_BC_TILE_CALL2(err, binlfunc, a, b, scratch, bools, n);
+        } else {
+          return TCALC_ERR_BAD_CAST;
+        }
+        a->type = TCALC_VALTYPE_BOOL;
+        top--;
+      } break;
+      case TCALC_BC_OP_EXT: {
+        assert(0); // consumed by the instruction before it
+        return TCALC_ERR_INVALID_OP;
+      }
+    }
+  }
+
+  assert(top == stack + 1);
+  return TCALC_ERR_OK;
+}
+
+tcalc_err tcalc_bytecode_eval_batch(
+  const tcalc_bytecode* bc, const tcalc_column* vars,
+  const struct tcalc_val* scalars, size_t rowCount, tcalc_outcolumn out
+) {
+  assert(bc != NULL);
+  assert(vars != NULL || bc->vars.len == 0);
+  tcalc_err err = TCALC_ERR_OK;
+
+  // the stack, then the temporaries, then one extra tile of scratch space
+  const size_t tileCount = (size_t)tcalc_bytecode_stacksize(bc) + 1;
+  tcalc_bc_tile* stack = (tcalc_bc_tile*)tcalc_alloc(bc->allocator, sizeof(tcalc_bc_tile) * tileCount);
+  reterr_on_true(err, stack == NULL, TCALC_ERR_NOMEM);
+
+  for (size_t rowStart = 0; rowStart < rowCount; rowStart += TCALC_BC_TILE_ROWS) {
+    const size_t n = TCALC_MIN_UNSAFE(rowCount - rowStart, (size_t)TCALC_BC_TILE_ROWS);
+    cleanup_on_err(err, tcalc_bc_eval_tile(bc, vars, scalars, stack, stack + tileCount - 1, rowStart, n));
+    cleanup_if(err, stack[0].type != out.type, TCALC_ERR_BAD_CAST);
+
+    if (out.type == TCALC_VALTYPE_NUM)
+      memcpy(out.as.nums + rowStart, stack[0].as.nums, n * sizeof(double));
+    else
+      memcpy(out.as.bools + rowStart, stack[0].as.bools, n * sizeof(bool));
+  }
+
+  tcalc_free(bc->allocator, stack, sizeof(tcalc_bc_tile) * tileCount);
+  return TCALC_ERR_OK;
+
+  cleanup:
+    tcalc_free(bc->allocator, stack, sizeof(tcalc_bc_tile) * tileCount);
+    return err;
+}
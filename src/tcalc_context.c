@@ -1,86 +1,336 @@
 #include "tcalc.h"
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
 // TODO: Many weird strcpy casts from size_t to int32_t
 
+/**
+ * Every definition table in a tcalc_ctx holds structs whose first member is
+ * their null-terminated id, so the index functions below work on any of them
+ * given the size of a single definition.
+*/
+
+#define TCALC_CTX_INDEX_MIN_CAP 16
+
+uint32_t tcalc_ctx_hash(const char* name, size_t name_len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < name_len; i++) {
+    hash ^= (unsigned char)name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * Find the position of the definition named name in a table, or -1 if there
+ * is no such definition. Tables which have no index are scanned linearly.
+*/
+static ptrdiff_t tcalc_ctx_index_find(
+  const tcalc_ctx_index* index, const void* arr, size_t elemSize, size_t len,
+  const char* name, size_t name_len
+) {
+  const char* defs = (const char*)arr;
+
+  if (index->cap == 0) {
+    // ids are short, so it pays to check their first character before
+    // comparing the rest of them
+    const char first = name_len > 0 ? name[0] : '\0';
+    for (size_t i = 0; i < len; i++) {
+      const char* id = defs + i * elemSize;
+      if (id[0] == first && tcalc_streq_ntlb(id, name, (int32_t)name_len))
+        return (ptrdiff_t)i;
+    }
+    return -1;
+  }
+
+  // the index is never more than half full, so probing always hits an empty slot
+  const size_t mask = index->cap - 1;
+  const uint32_t hash = tcalc_ctx_hash(name, name_len);
+  for (size_t i = hash & mask; index->slots[i].pos != 0; i = (i + 1) & mask) {
+    const tcalc_ctx_index_slot slot = index->slots[i];
+    if (slot.hash == hash && tcalc_streq_ntlb(defs + (slot.pos - 1) * elemSize, name, (int32_t)name_len))
+      return (ptrdiff_t)(slot.pos - 1);
+  }
+  return -1;
+}
+
+static void tcalc_ctx_index_put(tcalc_ctx_index_slot* slots, size_t cap, uint32_t hash, size_t pos) {
+  const size_t mask = cap - 1;
+  size_t i = hash & mask;
+  while (slots[i].pos != 0)
+    i = (i + 1) & mask;
+  slots[i].hash = hash;
+  slots[i].pos = (uint32_t)pos + 1;
+}
+
+/**
+ * Add the last definition of a table to the table's index, rebuilding the
+ * index at double the size whenever it would become more than half full
+*/
+static tcalc_err tcalc_ctx_index_addlast(
+  const tcalc_allocator* allocator, tcalc_ctx_index* index, const void* arr, size_t elemSize, size_t len
+) {
+  assert(len > 0);
+  const char* defs = (const char*)arr;
+  if (len >= UINT32_MAX) return TCALC_ERR_OVERFLOW;
+
+  if (len * 2 > index->cap) {
+    const size_t newCap = index->cap == 0 ? TCALC_CTX_INDEX_MIN_CAP : index->cap * 2;
+    assert(len * 2 <= newCap);
+    tcalc_ctx_index_slot* slots = (tcalc_ctx_index_slot*)tcalc_calloc(allocator, newCap, sizeof(tcalc_ctx_index_slot));
+    if (slots == NULL) return TCALC_ERR_NOMEM;
+
+    for (size_t i = 0; i < len; i++) {
+      const char* id = defs + i * elemSize;
+      tcalc_ctx_index_put(slots, newCap, tcalc_ctx_hash(id, strlen(id)), i);
+    }
+
+    tcalc_free(allocator, index->slots, sizeof(tcalc_ctx_index_slot) * index->cap);
+    index->slots = slots;
+    index->cap = newCap;
+    return TCALC_ERR_OK;
+  }
+
+  const char* id = defs + (len - 1) * elemSize;
+  tcalc_ctx_index_put(index->slots, index->cap, tcalc_ctx_hash(id, strlen(id)), len - 1);
+  return TCALC_ERR_OK;
+}
+
+/**
+ * Make room in a table's index for the table to hold wantLen definitions
+ * without the index having to be rebuilt, rebuilding it once now if needed
+*/
+static tcalc_err tcalc_ctx_index_reserve(
+  const tcalc_allocator* allocator, tcalc_ctx_index* index, const void* arr,
+  size_t elemSize, size_t len, size_t wantLen
+) {
+  const char* defs = (const char*)arr;
+  if (wantLen >= UINT32_MAX) return TCALC_ERR_OVERFLOW;
+  if (wantLen * 2 <= index->cap) return TCALC_ERR_OK;
+
+  size_t newCap = TCALC_CTX_INDEX_MIN_CAP;
+  while (newCap < wantLen * 2)
+    newCap *= 2;
+  tcalc_ctx_index_slot* slots = (tcalc_ctx_index_slot*)tcalc_calloc(allocator, newCap, sizeof(tcalc_ctx_index_slot));
+  if (slots == NULL) return TCALC_ERR_NOMEM;
+
+  for (size_t i = 0; i < len; i++) {
+    const char* id = defs + i * elemSize;
+    tcalc_ctx_index_put(slots, newCap, tcalc_ctx_hash(id, strlen(id)), i);
+  }
+
+  tcalc_free(allocator, index->slots, sizeof(tcalc_ctx_index_slot) * index->cap);
+  index->slots = slots;
+  index->cap = newCap;
+  return TCALC_ERR_OK;
+}
+
+static void tcalc_ctx_index_free(const tcalc_allocator* allocator, tcalc_ctx_index* index) {
+  tcalc_free(allocator, index->slots, sizeof(tcalc_ctx_index_slot) * index->cap);
+  index->slots = NULL;
+  index->cap = 0;
+}
+
+#define tcalc_ctx_findpos(vec, index, name, name_len) \
+  tcalc_ctx_index_find(&(index), (vec).arr, sizeof(*(vec).arr), (vec).len, (name), (name_len))
+
+/**
+ * Push def onto vec of ctx and index it, leaving vec untouched and setting err
+ * if either step fails
+*/
+#define tcalc_ctx_pushdef(ctx, vec, index, def, err) do { \
+    TCALC_VEC_PUSH_A((ctx)->allocator, vec, def, err); \
+    if (err) break; \
+    (err) = tcalc_ctx_index_addlast((ctx)->allocator, &(index), (vec).arr, sizeof(*(vec).arr), (vec).len); \
+    if (err) (vec).len--; \
+  } while (0)
+
 tcalc_err tcalc_ctx_alloc_empty(tcalc_ctx** out) {
+  return tcalc_ctx_alloc_empty_with(NULL, out);
+}
+
+tcalc_err tcalc_ctx_alloc_empty_with(const tcalc_allocator* allocator, tcalc_ctx** out) {
   // use of calloc is important here! We have to null all of the TCALC_VEC
   // structs inside the ctx.
-  tcalc_ctx* ctx = (tcalc_ctx*)calloc(1, sizeof(tcalc_ctx));
+  tcalc_ctx* ctx = (tcalc_ctx*)tcalc_calloc(allocator, 1, sizeof(tcalc_ctx));
   if (ctx == NULL) return TCALC_ERR_NOMEM;
 
+  ctx->allocator = allocator;
   *out = ctx;
   return TCALC_ERR_OK;
 }
 
+/**
+ * Default definitions
+ *
+ * The default contexts are built at compile time out of the constant tables
+ * below, so that evaluating with them never has to allocate anything. They
+ * have no hash indexes, and lookups into them scan their (short) tables
+ * linearly instead.
+ *
+ * The tables are in the same order that tcalc_ctx_alloc_default has always
+ * defined things in, which is also the order that they are listed in by the
+ * REPL.
+*/
+
+#define TCALC_TRIG_UNFUNCDEFS(_sfx_) \
+  { "sin", tcalc_val_sin##_sfx_ }, \
+  { "cos", tcalc_val_cos##_sfx_ }, \
+  { "tan", tcalc_val_tan##_sfx_ }, \
+  { "sec", tcalc_val_sec##_sfx_ }, \
+  { "csc", tcalc_val_csc##_sfx_ }, \
+  { "cot", tcalc_val_cot##_sfx_ }, \
+  { "asin", tcalc_val_asin##_sfx_ }, \
+  { "arcsin", tcalc_val_asin##_sfx_ }, \
+  { "acos", tcalc_val_acos##_sfx_ }, \
+  { "arccos", tcalc_val_acos##_sfx_ }, \
+  { "atan", tcalc_val_atan##_sfx_ }, \
+  { "arctan", tcalc_val_atan##_sfx_ }, \
+  { "asec", tcalc_val_asec##_sfx_ }, \
+  { "arcsec", tcalc_val_asec##_sfx_ }, \
+  { "acsc", tcalc_val_acsc##_sfx_ }, \
+  { "arccsc", tcalc_val_acsc##_sfx_ }, \
+  { "acot", tcalc_val_acot##_sfx_ }, \
+  { "arccot", tcalc_val_acot##_sfx_ }, \
+  { "sinh", tcalc_val_sinh##_sfx_ }, \
+  { "cosh", tcalc_val_cosh##_sfx_ }, \
+  { "tanh", tcalc_val_tanh##_sfx_ }, \
+  { "asinh", tcalc_val_asinh##_sfx_ }, \
+  { "arcsinh", tcalc_val_asinh##_sfx_ }, \
+  { "acosh", tcalc_val_acosh##_sfx_ }, \
+  { "arccosh", tcalc_val_acosh##_sfx_ }, \
+  { "atanh", tcalc_val_atanh##_sfx_ }, \
+  { "arctanh", tcalc_val_atanh##_sfx_ }
+
+#define TCALC_TRIG_BINFUNCDEFS(_sfx_) \
+  { "atan2", tcalc_val_atan2##_sfx_ }
+
+#define TCALC_DEFAULT_UNFUNCDEFS \
+  { "log", tcalc_val_log }, \
+  { "ln", tcalc_val_ln }, \
+  { "exp", tcalc_val_exp }, \
+  { "sqrt", tcalc_val_sqrt }, \
+  { "cbrt", tcalc_val_cbrt }, \
+  { "ceil", tcalc_val_ceil }, \
+  { "floor", tcalc_val_floor }, \
+  { "round", tcalc_val_round }, \
+  { "abs", tcalc_val_abs }
+
+#define TCALC_DEFAULT_BINFUNCDEFS \
+  { "pow", tcalc_val_pow }
+
+static const tcalc_unfuncdef tcalc_trig_unfuncs_rad[] = { TCALC_TRIG_UNFUNCDEFS() };
+static const tcalc_unfuncdef tcalc_trig_unfuncs_deg[] = { TCALC_TRIG_UNFUNCDEFS(_deg) };
+static const tcalc_binfuncdef tcalc_trig_binfuncs_rad[] = { TCALC_TRIG_BINFUNCDEFS() };
+static const tcalc_binfuncdef tcalc_trig_binfuncs_deg[] = { TCALC_TRIG_BINFUNCDEFS(_deg) };
+
+static const tcalc_unfuncdef tcalc_default_unfuncs_rad[] = {
+  TCALC_TRIG_UNFUNCDEFS(),
+  TCALC_DEFAULT_UNFUNCDEFS
+};
+
+static const tcalc_unfuncdef tcalc_default_unfuncs_deg[] = {
+  TCALC_TRIG_UNFUNCDEFS(_deg),
+  TCALC_DEFAULT_UNFUNCDEFS
+};
+
+static const tcalc_binfuncdef tcalc_default_binfuncs_rad[] = {
+  TCALC_TRIG_BINFUNCDEFS(),
+  TCALC_DEFAULT_BINFUNCDEFS
+};
+
+static const tcalc_binfuncdef tcalc_default_binfuncs_deg[] = {
+  TCALC_TRIG_BINFUNCDEFS(_deg),
+  TCALC_DEFAULT_BINFUNCDEFS
+};
+
+static const tcalc_vardef tcalc_default_vars[] = {
+  { "pi", { .type = TCALC_VALTYPE_NUM, .as = { .num = TCALC_PI } }, true },
+  { "e", { .type = TCALC_VALTYPE_NUM, .as = { .num = TCALC_E } }, true },
+  { "true", { .type = TCALC_VALTYPE_BOOL, .as = { .boolean = true } }, true },
+  { "false", { .type = TCALC_VALTYPE_BOOL, .as = { .boolean = false } }, true }
+};
+
+static const tcalc_unlopdef tcalc_default_unlops[] = {
+  { "!", 10, TCALC_RIGHT_ASSOC, tcalc_val_not }
+};
+
+static const tcalc_unopdef tcalc_default_unops[] = {
+  { "+", 10, TCALC_RIGHT_ASSOC, tcalc_val_unary_plus },
+  { "-", 10, TCALC_RIGHT_ASSOC, tcalc_val_unary_minus }
+};
+
+static const tcalc_binopdef tcalc_default_binops[] = {
+  { "**", 10, TCALC_RIGHT_ASSOC, tcalc_val_pow },
+  { "^", 10, TCALC_RIGHT_ASSOC, tcalc_val_pow },
+  { "", 9, TCALC_LEFT_ASSOC, tcalc_val_multiply }, // implicit multiplication (0-length binary operation)
+  { "*", 9, TCALC_LEFT_ASSOC, tcalc_val_multiply },
+  { "/", 9, TCALC_LEFT_ASSOC, tcalc_val_divide },
+  { "%", 9, TCALC_LEFT_ASSOC, tcalc_val_mod },
+  { "+", 8, TCALC_LEFT_ASSOC, tcalc_val_add },
+  { "-", 8, TCALC_LEFT_ASSOC, tcalc_val_subtract }
+};
+
+static const tcalc_relopdef tcalc_default_relops[] = {
+  { "<", 6, TCALC_LEFT_ASSOC, tcalc_val_lt },
+  { "<=", 6, TCALC_LEFT_ASSOC, tcalc_val_lteq },
+  { ">", 6, TCALC_LEFT_ASSOC, tcalc_val_gt },
+  { ">=", 6, TCALC_LEFT_ASSOC, tcalc_val_gteq },
+  { "=", 5, TCALC_LEFT_ASSOC, tcalc_val_equals },
+  { "==", 5, TCALC_LEFT_ASSOC, tcalc_val_equals },
+  { "!=", 5, TCALC_LEFT_ASSOC, tcalc_val_nequals }
+};
+
+static const tcalc_binlopdef tcalc_default_binlops[] = {
+  { "=", 5, TCALC_LEFT_ASSOC, tcalc_val_equals_l },
+  { "==", 5, TCALC_LEFT_ASSOC, tcalc_val_equals_l },
+  { "!=", 5, TCALC_LEFT_ASSOC, tcalc_val_nequals_l },
+  { "&&", 4, TCALC_LEFT_ASSOC, tcalc_val_and },
+  { "||", 3, TCALC_LEFT_ASSOC, tcalc_val_or }
+};
+
+// The definitions are never written through these pointers, since the
+// contexts that hold them are only ever handed out as const.
+#define TCALC_CONST_VEC_INIT(_arr_) { \
+    .arr = (void*)(_arr_), \
+    .len = TCALC_ARRAY_SIZE(_arr_), \
+    .cap = TCALC_ARRAY_SIZE(_arr_) \
+  }
+
+#define TCALC_DEFAULT_CTX_INIT(_unfuncs_, _binfuncs_) { \
+    .unfuncs = TCALC_CONST_VEC_INIT(_unfuncs_), \
+    .binfuncs = TCALC_CONST_VEC_INIT(_binfuncs_), \
+    .vars = TCALC_CONST_VEC_INIT(tcalc_default_vars), \
+    .unops = TCALC_CONST_VEC_INIT(tcalc_default_unops), \
+    .binops = TCALC_CONST_VEC_INIT(tcalc_default_binops), \
+    .relops = TCALC_CONST_VEC_INIT(tcalc_default_relops), \
+    .unlops = TCALC_CONST_VEC_INIT(tcalc_default_unlops), \
+    .binlops = TCALC_CONST_VEC_INIT(tcalc_default_binlops), \
+    .frozen = true \
+  }
+
+static const tcalc_ctx tcalc_default_ctx_rad = TCALC_DEFAULT_CTX_INIT(tcalc_default_unfuncs_rad, tcalc_default_binfuncs_rad);
+static const tcalc_ctx tcalc_default_ctx_deg = TCALC_DEFAULT_CTX_INIT(tcalc_default_unfuncs_deg, tcalc_default_binfuncs_deg);
+
+const tcalc_ctx* tcalc_ctx_default(void) {
+  return &tcalc_default_ctx_rad;
+}
+
+const tcalc_ctx* tcalc_ctx_default_deg(void) {
+  return &tcalc_default_ctx_deg;
+}
+
 tcalc_err tcalc_ctx_alloc_default(tcalc_ctx** out) {
   tcalc_ctx* ctx;
   tcalc_err err = tcalc_ctx_alloc_empty(&ctx);
   if (err) return err;
 
-  // trigonometric functions
-  cleanup_on_err(err, tcalc_ctx_addtrigrad(ctx));
-
-  // Default Unary Functions:
-  cleanup_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("log"), tcalc_val_log));
-  cleanup_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("ln"), tcalc_val_ln));
-  cleanup_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("exp"), tcalc_val_exp));
-  cleanup_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("sqrt"), tcalc_val_sqrt));
-  cleanup_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("cbrt"), tcalc_val_cbrt));
-  cleanup_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("ceil"), tcalc_val_ceil));
-  cleanup_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("floor"), tcalc_val_floor));
-  cleanup_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("round"), tcalc_val_round));
-  cleanup_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("abs"), tcalc_val_abs));
-
-  // Default Binary Functions:
-  cleanup_on_err(err, tcalc_ctx_addbinfunc(ctx, TCALC_STRLIT_PTR_LEN("pow"), tcalc_val_pow));
-
-  // Default Variables:
-  cleanup_on_err(err, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("pi"), TCALC_VAL_INIT_NUM(TCALC_PI)));
-  cleanup_on_err(err, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("e"), TCALC_VAL_INIT_NUM(TCALC_E)));
-
-  // Default Logical Variables:
-  cleanup_on_err(err, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("true"), TCALC_VAL_INIT_BOOL(1)));
-  cleanup_on_err(err, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("false"), TCALC_VAL_INIT_BOOL(0)));
-
-  // Default Logical Unary Operators:
-  cleanup_on_err(err, tcalc_ctx_addunlop(ctx, TCALC_STRLIT_PTR_LEN("!"), 10, TCALC_RIGHT_ASSOC, tcalc_val_not));
-
-  // Default Unary Operators:
-  cleanup_on_err(err, tcalc_ctx_addunop(ctx, TCALC_STRLIT_PTR_LEN("+"), 10, TCALC_RIGHT_ASSOC, tcalc_val_unary_plus));
-  cleanup_on_err(err, tcalc_ctx_addunop(ctx, TCALC_STRLIT_PTR_LEN("-"), 10, TCALC_RIGHT_ASSOC, tcalc_val_unary_minus));
-
-  // Default Binary Operators:
-  cleanup_on_err(err, tcalc_ctx_addbinop(ctx, TCALC_STRLIT_PTR_LEN("**"), 10, TCALC_RIGHT_ASSOC, tcalc_val_pow));
-  cleanup_on_err(err, tcalc_ctx_addbinop(ctx, TCALC_STRLIT_PTR_LEN("^"), 10, TCALC_RIGHT_ASSOC, tcalc_val_pow));
-  cleanup_on_err(err, tcalc_ctx_addbinop(ctx, TCALC_STRLIT_PTR_LEN(""), 9, TCALC_LEFT_ASSOC, tcalc_val_multiply)); // implicit multiplication (0-length binary operation)
-  cleanup_on_err(err, tcalc_ctx_addbinop(ctx, TCALC_STRLIT_PTR_LEN("*"), 9, TCALC_LEFT_ASSOC, tcalc_val_multiply));
-  cleanup_on_err(err, tcalc_ctx_addbinop(ctx, TCALC_STRLIT_PTR_LEN("/"), 9, TCALC_LEFT_ASSOC, tcalc_val_divide));
-  cleanup_on_err(err, tcalc_ctx_addbinop(ctx, TCALC_STRLIT_PTR_LEN("%"), 9, TCALC_LEFT_ASSOC, tcalc_val_mod));
-  cleanup_on_err(err, tcalc_ctx_addbinop(ctx, TCALC_STRLIT_PTR_LEN("+"), 8, TCALC_LEFT_ASSOC, tcalc_val_add));
-  cleanup_on_err(err, tcalc_ctx_addbinop(ctx, TCALC_STRLIT_PTR_LEN("-"), 8, TCALC_LEFT_ASSOC, tcalc_val_subtract));
-
-  // Default Relational Binary Operators:
-  cleanup_on_err(err, tcalc_ctx_addrelop(ctx, TCALC_STRLIT_PTR_LEN("<"), 6, TCALC_LEFT_ASSOC, tcalc_val_lt));
-  cleanup_on_err(err, tcalc_ctx_addrelop(ctx, TCALC_STRLIT_PTR_LEN("<="), 6, TCALC_LEFT_ASSOC, tcalc_val_lteq));
-  cleanup_on_err(err, tcalc_ctx_addrelop(ctx, TCALC_STRLIT_PTR_LEN(">"), 6, TCALC_LEFT_ASSOC, tcalc_val_gt));
-  cleanup_on_err(err, tcalc_ctx_addrelop(ctx, TCALC_STRLIT_PTR_LEN(">="), 6, TCALC_LEFT_ASSOC, tcalc_val_gteq));
-  cleanup_on_err(err, tcalc_ctx_addrelop(ctx, TCALC_STRLIT_PTR_LEN("="), 5, TCALC_RIGHT_ASSOC, tcalc_val_equals));
-  cleanup_on_err(err, tcalc_ctx_addrelop(ctx, TCALC_STRLIT_PTR_LEN("=="), 5, TCALC_RIGHT_ASSOC, tcalc_val_equals));
-  cleanup_on_err(err, tcalc_ctx_addrelop(ctx, TCALC_STRLIT_PTR_LEN("!="), 5, TCALC_RIGHT_ASSOC, tcalc_val_nequals));
-
-
-
-  // Default Logical Binary Operators:
-  cleanup_on_err(err, tcalc_ctx_addbinlop(ctx, TCALC_STRLIT_PTR_LEN("="), 5, TCALC_RIGHT_ASSOC, tcalc_val_equals_l));
-  cleanup_on_err(err, tcalc_ctx_addbinlop(ctx, TCALC_STRLIT_PTR_LEN("=="), 5, TCALC_RIGHT_ASSOC, tcalc_val_equals_l));
-  cleanup_on_err(err, tcalc_ctx_addbinlop(ctx, TCALC_STRLIT_PTR_LEN("!="), 5, TCALC_RIGHT_ASSOC, tcalc_val_nequals_l));
-  cleanup_on_err(err, tcalc_ctx_addbinlop(ctx, TCALC_STRLIT_PTR_LEN("&&"), 4, TCALC_RIGHT_ASSOC, tcalc_val_and));
-  cleanup_on_err(err, tcalc_ctx_addbinlop(ctx, TCALC_STRLIT_PTR_LEN("||"), 3, TCALC_RIGHT_ASSOC, tcalc_val_or));
+  cleanup_on_err(err, tcalc_ctx_addall(ctx, tcalc_ctx_default()));
 
   *out = ctx;
   return err;
@@ -90,171 +340,297 @@ tcalc_err tcalc_ctx_alloc_default(tcalc_ctx** out) {
     return err;
 }
 
+tcalc_err tcalc_ctx_freeze(const tcalc_ctx* ctx, tcalc_ctx** out) {
+  tcalc_ctx* frozen;
+  tcalc_err err = tcalc_ctx_alloc_empty_with(ctx->allocator, &frozen);
+  if (err) return err;
+
+  // every definition is pushed through tcalc_ctx_pushdef, which indexes it
+  cleanup_on_err(err, tcalc_ctx_addall(frozen, ctx));
+  frozen->frozen = true;
+
+  *out = frozen;
+  return err;
+
+  cleanup:
+    tcalc_ctx_free(frozen);
+    return err;
+}
+
+tcalc_err tcalc_ctx_alloc_overlay(const tcalc_ctx* frozen, tcalc_ctx** out) {
+  if (!frozen->frozen) return TCALC_ERR_INVALID_ARG;
+  return tcalc_ctx_alloc_child(frozen, out);
+}
+
+tcalc_err tcalc_ctx_alloc_child(const tcalc_ctx* parent, tcalc_ctx** out) {
+  return tcalc_ctx_alloc_child_with(parent, NULL, out);
+}
+
+tcalc_err tcalc_ctx_alloc_child_with(const tcalc_ctx* parent, const tcalc_allocator* allocator, tcalc_ctx** out) {
+  tcalc_ctx* child;
+  tcalc_err err = tcalc_ctx_alloc_empty_with(allocator, &child);
+  if (err) return err;
+
+  child->parent = parent;
+  *out = child;
+  return err;
+}
+
 tcalc_err tcalc_ctx_addtrigrad(tcalc_ctx* ctx) {
   tcalc_err err = TCALC_ERR_OK;
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("sin"), tcalc_val_sin));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("cos"), tcalc_val_cos));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("tan"), tcalc_val_tan));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("sec"), tcalc_val_sec));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("csc"), tcalc_val_csc));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("cot"), tcalc_val_cot));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("asin"), tcalc_val_asin));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arcsin"), tcalc_val_asin));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("acos"), tcalc_val_acos));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arccos"), tcalc_val_acos));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("atan"), tcalc_val_atan));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arctan"), tcalc_val_atan));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("asec"), tcalc_val_asec));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arcsec"), tcalc_val_asec));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("acsc"), tcalc_val_acsc));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arccsc"), tcalc_val_acsc));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("acot"), tcalc_val_acot));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arccot"), tcalc_val_acot));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("sinh"), tcalc_val_sinh));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("cosh"), tcalc_val_cosh));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("tanh"), tcalc_val_tanh));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("asinh"), tcalc_val_asinh));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arcsinh"), tcalc_val_asinh));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("acosh"), tcalc_val_acosh));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arccosh"), tcalc_val_acosh));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("atanh"), tcalc_val_atanh));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arctanh"), tcalc_val_atanh));
-  ret_on_err(err, tcalc_ctx_addbinfunc(ctx, TCALC_STRLIT_PTR_LEN("atan2"), tcalc_val_atan2));
+  for (size_t i = 0; i < TCALC_ARRAY_SIZE(tcalc_trig_unfuncs_rad); i++) {
+    const tcalc_unfuncdef def = tcalc_trig_unfuncs_rad[i];
+    ret_on_err(err, tcalc_ctx_addunfunc(ctx, def.id, strlen(def.id), def.func));
+  }
+  for (size_t i = 0; i < TCALC_ARRAY_SIZE(tcalc_trig_binfuncs_rad); i++) {
+    const tcalc_binfuncdef def = tcalc_trig_binfuncs_rad[i];
+    ret_on_err(err, tcalc_ctx_addbinfunc(ctx, def.id, strlen(def.id), def.func));
+  }
   return err;
 }
 
 tcalc_err tcalc_ctx_addtrigdeg(tcalc_ctx* ctx) {
   tcalc_err err = TCALC_ERR_OK;
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("sin"), tcalc_val_sin_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("cos"), tcalc_val_cos_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("tan"), tcalc_val_tan_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("sec"), tcalc_val_sec_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("csc"), tcalc_val_csc_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("cot"), tcalc_val_cot_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("asin"), tcalc_val_asin_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arcsin"), tcalc_val_asin_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("acos"), tcalc_val_acos_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arccos"), tcalc_val_acos_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("atan"), tcalc_val_atan_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arctan"), tcalc_val_atan_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("asec"), tcalc_val_asec_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arcsec"), tcalc_val_asec_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("acsc"), tcalc_val_acsc_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arccsc"), tcalc_val_acsc_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("acot"), tcalc_val_acot_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arccot"), tcalc_val_acot_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("sinh"), tcalc_val_sinh_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("cosh"), tcalc_val_cosh_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("tanh"), tcalc_val_tanh_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("asinh"), tcalc_val_asinh_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arcsinh"), tcalc_val_asinh_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("acosh"), tcalc_val_acosh_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arccosh"), tcalc_val_acosh_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("atanh"), tcalc_val_atanh_deg));
-  ret_on_err(err, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("arctanh"), tcalc_val_atanh_deg));
-  ret_on_err(err, tcalc_ctx_addbinfunc(ctx, TCALC_STRLIT_PTR_LEN("atan2"), tcalc_val_atan2_deg));
+  for (size_t i = 0; i < TCALC_ARRAY_SIZE(tcalc_trig_unfuncs_deg); i++) {
+    const tcalc_unfuncdef def = tcalc_trig_unfuncs_deg[i];
+    ret_on_err(err, tcalc_ctx_addunfunc(ctx, def.id, strlen(def.id), def.func));
+  }
+  for (size_t i = 0; i < TCALC_ARRAY_SIZE(tcalc_trig_binfuncs_deg); i++) {
+    const tcalc_binfuncdef def = tcalc_trig_binfuncs_deg[i];
+    ret_on_err(err, tcalc_ctx_addbinfunc(ctx, def.id, strlen(def.id), def.func));
+  }
+  return err;
+}
+
+tcalc_err tcalc_ctx_addall(tcalc_ctx* ctx, const tcalc_ctx* src) {
+  tcalc_err err = TCALC_ERR_OK;
+  if (src->parent != NULL)
+    ret_on_err(err, tcalc_ctx_addall(ctx, src->parent));
+
+  TCALC_VEC_FOREACH(src->unfuncs, i) {
+    const tcalc_unfuncdef def = src->unfuncs.arr[i];
+    ret_on_err(err, tcalc_ctx_addunfunc(ctx, def.id, strlen(def.id), def.func));
+  }
+  TCALC_VEC_FOREACH(src->binfuncs, i) {
+    const tcalc_binfuncdef def = src->binfuncs.arr[i];
+    ret_on_err(err, tcalc_ctx_addbinfunc(ctx, def.id, strlen(def.id), def.func));
+  }
+  TCALC_VEC_FOREACH(src->vars, i) {
+    const tcalc_vardef def = src->vars.arr[i];
+    if (def.immutable) {
+      ret_on_err(err, tcalc_ctx_addconst(ctx, def.id, strlen(def.id), def.val));
+    } else {
+      ret_on_err(err, tcalc_ctx_addvar(ctx, def.id, strlen(def.id), def.val));
+    }
+  }
+  TCALC_VEC_FOREACH(src->unlops, i) {
+    const tcalc_unlopdef def = src->unlops.arr[i];
+    ret_on_err(err, tcalc_ctx_addunlop(ctx, def.id, strlen(def.id), def.prec, def.assoc, def.func));
+  }
+  TCALC_VEC_FOREACH(src->unops, i) {
+    const tcalc_unopdef def = src->unops.arr[i];
+    ret_on_err(err, tcalc_ctx_addunop(ctx, def.id, strlen(def.id), def.prec, def.assoc, def.func));
+  }
+  TCALC_VEC_FOREACH(src->binops, i) {
+    const tcalc_binopdef def = src->binops.arr[i];
+    ret_on_err(err, tcalc_ctx_addbinop(ctx, def.id, strlen(def.id), def.prec, def.assoc, def.func));
+  }
+  TCALC_VEC_FOREACH(src->relops, i) {
+    const tcalc_relopdef def = src->relops.arr[i];
+    ret_on_err(err, tcalc_ctx_addrelop(ctx, def.id, strlen(def.id), def.prec, def.assoc, def.func));
+  }
+  TCALC_VEC_FOREACH(src->binlops, i) {
+    const tcalc_binlopdef def = src->binlops.arr[i];
+    ret_on_err(err, tcalc_ctx_addbinlop(ctx, def.id, strlen(def.id), def.prec, def.assoc, def.func));
+  }
   return err;
 }
 
 void tcalc_ctx_free(tcalc_ctx* ctx) {
   if (ctx == NULL) return;
-  TCALC_VEC_FREE(ctx->binfuncs);
-  TCALC_VEC_FREE(ctx->unfuncs);
-  TCALC_VEC_FREE(ctx->vars);
-  TCALC_VEC_FREE(ctx->unops);
-  TCALC_VEC_FREE(ctx->binops);
-  TCALC_VEC_FREE(ctx->relops);
-  TCALC_VEC_FREE(ctx->unlops);
-  TCALC_VEC_FREE(ctx->binlops);
+  TCALC_VEC_FREE_A(ctx->allocator, ctx->binfuncs);
+  TCALC_VEC_FREE_A(ctx->allocator, ctx->unfuncs);
+  TCALC_VEC_FREE_A(ctx->allocator, ctx->unops);
+  TCALC_VEC_FREE_A(ctx->allocator, ctx->binops);
+  TCALC_VEC_FREE_A(ctx->allocator, ctx->relops);
+  TCALC_VEC_FREE_A(ctx->allocator, ctx->unlops);
+  TCALC_VEC_FREE_A(ctx->allocator, ctx->binlops);
+
+  // the variables and indexes of a context opened from an image live in the image
+  if (ctx->image == NULL) {
+    TCALC_VEC_FREE_A(ctx->allocator, ctx->vars);
+    tcalc_ctx_index_free(ctx->allocator, &(ctx->unfuncsIndex));
+    tcalc_ctx_index_free(ctx->allocator, &(ctx->binfuncsIndex));
+    tcalc_ctx_index_free(ctx->allocator, &(ctx->varsIndex));
+    tcalc_ctx_index_free(ctx->allocator, &(ctx->unopsIndex));
+    tcalc_ctx_index_free(ctx->allocator, &(ctx->binopsIndex));
+    tcalc_ctx_index_free(ctx->allocator, &(ctx->relopsIndex));
+    tcalc_ctx_index_free(ctx->allocator, &(ctx->unlopsIndex));
+    tcalc_ctx_index_free(ctx->allocator, &(ctx->binlopsIndex));
+  }
 
-  free(ctx);
+  tcalc_free(ctx->allocator, ctx, sizeof(tcalc_ctx));
 }
 
-tcalc_err tcalc_ctx_addvar(tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_val val) {
+static tcalc_err tcalc_ctx_addvardef(tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_val val, bool immutable) {
   tcalc_err err = TCALC_ERR_OK;
-  for (size_t i = 0; i < ctx->vars.len; i++) {
-    if (tcalc_streq_ntlb(ctx->vars.arr[i].id, name, name_len)) {
-      ctx->vars.arr[i].val = val;
-      return TCALC_ERR_OK;
-    }
+  reterr_on_true(err, ctx->frozen, TCALC_ERR_IMMUTABLE);
+  if (ctx->parent != NULL) {
+    const tcalc_vardef* inherited = tcalc_ctx_findvar(ctx->parent, name, name_len);
+    reterr_on_true(err, inherited != NULL && inherited->immutable, TCALC_ERR_IMMUTABLE);
+  }
+
+  const ptrdiff_t pos = tcalc_ctx_findpos(ctx->vars, ctx->varsIndex, name, name_len);
+  if (pos >= 0) {
+    reterr_on_true(err, ctx->vars.arr[pos].immutable, TCALC_ERR_IMMUTABLE);
+    ctx->vars.arr[pos].val = val;
+    ctx->vars.arr[pos].immutable = immutable;
+    return TCALC_ERR_OK;
   }
 
   tcalc_vardef def = { 0 };
   tcalc_strcpy_lblb_ntdst(def.id, TCALC_IDDEF_MAX_STR_SIZE, name, (int32_t)name_len);
   def.val = val;
+  def.immutable = immutable;
 
-  ret_on_macerr(err, TCALC_VEC_PUSH(ctx->vars, def, err));
+  ret_on_macerr(err, tcalc_ctx_pushdef(ctx, ctx->vars, ctx->varsIndex, def, err));
   return TCALC_ERR_OK;
 }
 
-tcalc_err tcalc_ctx_addunfunc(tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_val_unfunc func) {
+tcalc_err tcalc_ctx_addvar(tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_val val) {
+  return tcalc_ctx_addvardef(ctx, name, name_len, val, false);
+}
+
+tcalc_err tcalc_ctx_addconst(tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_val val) {
+  return tcalc_ctx_addvardef(ctx, name, name_len, val, true);
+}
+
+tcalc_err tcalc_ctx_addvars(
+  tcalc_ctx* ctx, const char* const* names, const size_t* nameLens,
+  const tcalc_val* vals, size_t count
+) {
   tcalc_err err = TCALC_ERR_OK;
-  for (size_t i = 0; i < ctx->unfuncs.len; i++) {
-    if (tcalc_streq_ntlb(ctx->unfuncs.arr[i].id, name, name_len)) {
-      ctx->unfuncs.arr[i].func = func;
-      return TCALC_ERR_OK;
+  reterr_on_true(err, ctx->frozen, TCALC_ERR_IMMUTABLE);
+  reterr_on_true(err, count > SIZE_MAX - ctx->vars.len, TCALC_ERR_OVERFLOW);
+  if (count == 0) return TCALC_ERR_OK;
+
+  TCALC_VEC_GROW_A(ctx->allocator, ctx->vars, ctx->vars.len + count, err);
+  if (err) return err;
+  ret_on_err(err, tcalc_ctx_index_reserve(
+    ctx->allocator, &(ctx->varsIndex), ctx->vars.arr, sizeof(tcalc_vardef), ctx->vars.len, ctx->vars.len + count
+  ));
+
+  for (size_t i = 0; i < count; i++) {
+    if (ctx->parent != NULL) {
+      const tcalc_vardef* inherited = tcalc_ctx_findvar(ctx->parent, names[i], nameLens[i]);
+      reterr_on_true(err, inherited != NULL && inherited->immutable, TCALC_ERR_IMMUTABLE);
     }
+
+    // a single probe both looks for a duplicate and finds the empty slot for
+    // the new definition
+    tcalc_ctx_index_slot* slots = ctx->varsIndex.slots;
+    const size_t mask = ctx->varsIndex.cap - 1;
+    const uint32_t hash = tcalc_ctx_hash(names[i], nameLens[i]);
+    size_t slotInd = hash & mask;
+    for (; slots[slotInd].pos != 0; slotInd = (slotInd + 1) & mask) {
+      const tcalc_ctx_index_slot slot = slots[slotInd];
+      if (slot.hash == hash && tcalc_streq_ntlb(ctx->vars.arr[slot.pos - 1].id, names[i], (int32_t)nameLens[i]))
+        break;
+    }
+
+    if (slots[slotInd].pos != 0) {
+      tcalc_vardef* def = &(ctx->vars.arr[slots[slotInd].pos - 1]);
+      reterr_on_true(err, def->immutable, TCALC_ERR_IMMUTABLE);
+      def->val = vals[i];
+      continue;
+    }
+
+    // both the table and its index already have room for the definition
+    tcalc_vardef* def = &(ctx->vars.arr[ctx->vars.len]);
+    memset(def, 0, sizeof(tcalc_vardef));
+    tcalc_strcpy_lblb_ntdst(def->id, TCALC_IDDEF_MAX_STR_SIZE, names[i], (int32_t)nameLens[i]);
+    def->val = vals[i];
+    if (nameLens[i] < TCALC_IDDEF_MAX_STR_SIZE) {
+      slots[slotInd].hash = hash;
+      slots[slotInd].pos = (uint32_t)ctx->vars.len + 1;
+    } else {
+      // the id was truncated, and is indexed by its own hash like tcalc_ctx_addvar does
+      tcalc_ctx_index_put(slots, ctx->varsIndex.cap, tcalc_ctx_hash(def->id, strlen(def->id)), ctx->vars.len);
+    }
+    ctx->vars.len++;
+  }
+
+  return TCALC_ERR_OK;
+}
+
+tcalc_err tcalc_ctx_addunfunc(tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_val_unfunc func) {
+  tcalc_err err = TCALC_ERR_OK;
+  reterr_on_true(err, ctx->frozen, TCALC_ERR_IMMUTABLE);
+  const ptrdiff_t pos = tcalc_ctx_findpos(ctx->unfuncs, ctx->unfuncsIndex, name, name_len);
+  if (pos >= 0) {
+    ctx->unfuncs.arr[pos].func = func;
+    return TCALC_ERR_OK;
   }
 
   tcalc_unfuncdef def = { 0 };
   tcalc_strcpy_lblb_ntdst(def.id, TCALC_IDDEF_MAX_STR_SIZE, name, (int32_t)name_len);
   def.func = func;
-  ret_on_macerr(err, TCALC_VEC_PUSH(ctx->unfuncs, def, err));
+  ret_on_macerr(err, tcalc_ctx_pushdef(ctx, ctx->unfuncs, ctx->unfuncsIndex, def, err));
   return TCALC_ERR_OK;
 }
 
 tcalc_err tcalc_ctx_addbinfunc(tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_val_binfunc func) {
   tcalc_err err = TCALC_ERR_OK;
-  for (size_t i = 0; i < ctx->binfuncs.len; i++) {
-    if (tcalc_streq_ntlb(ctx->binfuncs.arr[i].id, name, name_len)) {
-      ctx->binfuncs.arr[i].func = func;
-      return TCALC_ERR_OK;
-    }
+  reterr_on_true(err, ctx->frozen, TCALC_ERR_IMMUTABLE);
+  const ptrdiff_t pos = tcalc_ctx_findpos(ctx->binfuncs, ctx->binfuncsIndex, name, name_len);
+  if (pos >= 0) {
+    ctx->binfuncs.arr[pos].func = func;
+    return TCALC_ERR_OK;
   }
 
   tcalc_binfuncdef def = { 0 };
   tcalc_strcpy_lblb_ntdst(def.id, TCALC_IDDEF_MAX_STR_SIZE, name, (int32_t)name_len);
   def.func = func;
-  ret_on_macerr(err, TCALC_VEC_PUSH(ctx->binfuncs, def, err));
+  ret_on_macerr(err, tcalc_ctx_pushdef(ctx, ctx->binfuncs, ctx->binfuncsIndex, def, err));
   return TCALC_ERR_OK;
 }
 
-#define tcalc_ctx_addxop(vec, opid, prec_, assoc_, funcptr, deftype) \
+#define tcalc_ctx_addxop(vec, index, opid, prec_, assoc_, funcptr, deftype) \
   tcalc_err err = TCALC_ERR_OK; \
-  for (size_t i = 0; i < vec.len; i++) { \
-    if (tcalc_streq_ntlb(vec.arr[i].id, opid, name_len)) { \
-      vec.arr[i].prec = prec_; \
-      vec.arr[i].assoc = assoc_; \
-      vec.arr[i].func = funcptr; \
-      return TCALC_ERR_OK; \
-    } \
+  reterr_on_true(err, ctx->frozen, TCALC_ERR_IMMUTABLE); \
+  const ptrdiff_t pos = tcalc_ctx_findpos(vec, index, opid, name_len); \
+  if (pos >= 0) { \
+    vec.arr[pos].prec = prec_; \
+    vec.arr[pos].assoc = assoc_; \
+    vec.arr[pos].func = funcptr; \
+    return TCALC_ERR_OK; \
   } \
   deftype def = { 0 }; \
-  tcalc_strcpy_lblb_ntdst(def.id, TCALC_IDDEF_MAX_STR_SIZE, opid, (int32_t)name_len); \
+  tcalc_strcpy_lblb_ntdst(def.id, TCALC_OPDEF_MAX_STR_SIZE, opid, (int32_t)name_len); \
   def.prec = prec_; \
   def.assoc = assoc_; \
   def.func = funcptr; \
-  ret_on_macerr(err, TCALC_VEC_PUSH(vec, def, err)); \
+  ret_on_macerr(err, tcalc_ctx_pushdef(ctx, vec, index, def, err)); \
   return TCALC_ERR_OK;
 
 tcalc_err tcalc_ctx_addunop(tcalc_ctx* ctx, const char* name, size_t name_len, int prec, tcalc_assoc assoc, tcalc_val_unfunc func) {
-  tcalc_ctx_addxop(ctx->unops, name, prec, assoc, func, tcalc_unopdef);
+  tcalc_ctx_addxop(ctx->unops, ctx->unopsIndex, name, prec, assoc, func, tcalc_unopdef);
 }
 
 tcalc_err tcalc_ctx_addbinop(tcalc_ctx* ctx, const char* name, size_t name_len, int prec, tcalc_assoc assoc, tcalc_val_binfunc func) {
-  tcalc_ctx_addxop(ctx->binops, name, prec, assoc, func, tcalc_binopdef);
+  tcalc_ctx_addxop(ctx->binops, ctx->binopsIndex, name, prec, assoc, func, tcalc_binopdef);
 }
 
 tcalc_err tcalc_ctx_addrelop(tcalc_ctx* ctx,const char* name, size_t name_len, int prec, tcalc_assoc assoc, tcalc_val_relfunc func) {
-  tcalc_ctx_addxop(ctx->relops, name, prec, assoc, func, tcalc_relopdef);
+  tcalc_ctx_addxop(ctx->relops, ctx->relopsIndex, name, prec, assoc, func, tcalc_relopdef);
 }
 
 tcalc_err tcalc_ctx_addunlop(tcalc_ctx* ctx, const char* name, size_t name_len, int prec, tcalc_assoc assoc, tcalc_val_unlfunc func) {
-  tcalc_ctx_addxop(ctx->unlops, name, prec, assoc, func, tcalc_unlopdef);
+  tcalc_ctx_addxop(ctx->unlops, ctx->unlopsIndex, name, prec, assoc, func, tcalc_unlopdef);
 }
 
 tcalc_err tcalc_ctx_addbinlop(tcalc_ctx* ctx, const char* name, size_t name_len, int prec, tcalc_assoc assoc, tcalc_val_binlfunc func) {
-  tcalc_ctx_addxop(ctx->binlops, name, prec, assoc, func, tcalc_binlopdef);
+  tcalc_ctx_addxop(ctx->binlops, ctx->binlopsIndex, name, prec, assoc, func, tcalc_binlopdef);
 }
 
 bool tcalc_ctx_hasid(const tcalc_ctx* ctx, const char* name, size_t name_len) {
@@ -271,147 +647,34 @@ bool tcalc_ctx_hasop(const tcalc_ctx* ctx, const char* name, size_t name_len) {
   tcalc_ctx_hasbinlop(ctx, name, name_len);
 }
 
-bool tcalc_ctx_hasunfunc(const tcalc_ctx* ctx, const char* name, size_t name_len) {
-  for (size_t i = 0; i < ctx->unfuncs.len; i++) {
-    if (tcalc_streq_ntlb(ctx->unfuncs.arr[i].id, name, name_len))
-      return true;
-  }
-  return false;
-}
-
-bool tcalc_ctx_hasbinfunc(const tcalc_ctx* ctx, const char* name, size_t name_len) {
-  for (size_t i = 0; i < ctx->binfuncs.len; i++) {
-    if (tcalc_streq_ntlb(ctx->binfuncs.arr[i].id, name, name_len))
-      return true;
-  }
-  return false;
-}
-
-bool tcalc_ctx_hasvar(const tcalc_ctx* ctx, const char* name, size_t name_len) {
-  for (size_t i = 0; i < ctx->vars.len; i++) {
-    assert(ctx->vars.arr[i].id[TCALC_OPDEF_MAX_STR_SIZE - 1] == '\0');
-    if (tcalc_streq_ntlb(ctx->vars.arr[i].id, name, name_len))
-      return true;
-  }
-  return false;
-}
-
-bool tcalc_ctx_hasunop(const tcalc_ctx* ctx, const char* name, size_t name_len) {
-  for (size_t i = 0; i < ctx->unops.len; i++) {
-    if (tcalc_streq_ntlb(ctx->unops.arr[i].id, name, name_len))
-      return true;
-  }
-  return false;
-}
-
-bool tcalc_ctx_hasbinop(const tcalc_ctx* ctx, const char* name, size_t name_len) {
-  for (size_t i = 0; i < ctx->binops.len; i++) {
-    if (tcalc_streq_ntlb(ctx->binops.arr[i].id, name, name_len))
-      return true;
-  }
-  return false;
-}
-
-bool tcalc_ctx_hasrelop(const tcalc_ctx* ctx, const char* name, size_t name_len) {
-  for (size_t i = 0; i < ctx->relops.len; i++) {
-    if (tcalc_streq_ntlb(ctx->relops.arr[i].id, name, name_len))
-      return true;
-  }
-  return false;
-}
-
-bool tcalc_ctx_hasunlop(const tcalc_ctx* ctx, const char* name, size_t name_len) {
-  for (size_t i = 0; i < ctx->unlops.len; i++) {
-    if (tcalc_streq_ntlb(ctx->unlops.arr[i].id, name, name_len))
-      return true;
-  }
-  return false;
-}
-
-bool tcalc_ctx_hasbinlop(const tcalc_ctx* ctx, const char* name, size_t name_len) {
-  for (size_t i = 0; i < ctx->binlops.len; i++) {
-    if (tcalc_streq_ntlb(ctx->binlops.arr[i].id, name, name_len))
-      return true;
-  }
-  return false;
-}
-
-tcalc_err tcalc_ctx_getvar(const tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_vardef* out) {
-  for (size_t i = 0; i < ctx->vars.len; i++) {
-    if (tcalc_streq_ntlb(ctx->vars.arr[i].id, name, name_len)) {
-      *out = ctx->vars.arr[i];
-      return TCALC_ERR_OK;
-    }
-  }
-  return TCALC_ERR_NOT_FOUND;
-}
-
-tcalc_err tcalc_ctx_getunfunc(const tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_unfuncdef* out) {
-  for (size_t i = 0; i < ctx->unfuncs.len; i++) {
-    if (tcalc_streq_ntlb(ctx->unfuncs.arr[i].id, name, name_len)) {
-      *out = ctx->unfuncs.arr[i];
-      return TCALC_ERR_OK;
-    }
-  }
-  return TCALC_ERR_NOT_FOUND;
-}
-
-tcalc_err tcalc_ctx_getbinfunc(const tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_binfuncdef* out) {
-  for (size_t i = 0; i < ctx->binfuncs.len; i++) {
-    if (tcalc_streq_ntlb(ctx->binfuncs.arr[i].id, name, name_len)) {
-      *out = ctx->binfuncs.arr[i];
-      return TCALC_ERR_OK;
-    }
-  }
-  return TCALC_ERR_NOT_FOUND;
-}
-
-tcalc_err tcalc_ctx_getunop(const tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_unopdef* out) {
-  for (size_t i = 0; i < ctx->unops.len; i++) {
-    if (tcalc_streq_ntlb(ctx->unops.arr[i].id, name, name_len)) {
-      *out = ctx->unops.arr[i];
-      return TCALC_ERR_OK;
-    }
-  }
-  return TCALC_ERR_NOT_FOUND;
-}
-
-tcalc_err tcalc_ctx_getbinop(const tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_binopdef* out) {
-  for (size_t i = 0; i < ctx->binops.len; i++) {
-    if (tcalc_streq_ntlb(ctx->binops.arr[i].id, name, name_len)) {
-      *out = ctx->binops.arr[i];
-      return TCALC_ERR_OK;
-    }
-  }
-  return TCALC_ERR_NOT_FOUND;
-}
-
-tcalc_err tcalc_ctx_getrelop(const tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_relopdef* out) {
-  for (size_t i = 0; i < ctx->relops.len; i++) {
-    if (tcalc_streq_ntlb(ctx->relops.arr[i].id, name, name_len)) {
-      *out = ctx->relops.arr[i];
-      return TCALC_ERR_OK;
-    }
-  }
-  return TCALC_ERR_NOT_FOUND;
-}
-
-tcalc_err tcalc_ctx_getunlop(const tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_unlopdef* out) {
-  for (size_t i = 0; i < ctx->unlops.len; i++) {
-    if (tcalc_streq_ntlb(ctx->unlops.arr[i].id, name, name_len)) {
-      *out = ctx->unlops.arr[i];
-      return TCALC_ERR_OK;
-    }
+/**
+ * Define the find, has, and get functions for the table vec of a tcalc_ctx.
+ * has and get are both a single lookup through find, which continues into
+ * the parent context when the context's own table misses.
+*/
+#define tcalc_ctx_lookup_impl(_suffix_, _deftype_, _vec_) \
+  const _deftype_* tcalc_ctx_find##_suffix_(const tcalc_ctx* ctx, const char* name, size_t name_len) { \
+    const ptrdiff_t pos = tcalc_ctx_findpos(ctx->_vec_, ctx->_vec_##Index, name, name_len); \
+    if (pos >= 0) return &(ctx->_vec_.arr[pos]); \
+    return ctx->parent != NULL ? tcalc_ctx_find##_suffix_(ctx->parent, name, name_len) : NULL; \
+  } \
+  \
+  bool tcalc_ctx_has##_suffix_(const tcalc_ctx* ctx, const char* name, size_t name_len) { \
+    return tcalc_ctx_find##_suffix_(ctx, name, name_len) != NULL; \
+  } \
+  \
+  tcalc_err tcalc_ctx_get##_suffix_(const tcalc_ctx* ctx, const char* name, size_t name_len, _deftype_* out) { \
+    const _deftype_* def = tcalc_ctx_find##_suffix_(ctx, name, name_len); \
+    if (def == NULL) return TCALC_ERR_NOT_FOUND; \
+    *out = *def; \
+    return TCALC_ERR_OK; \
   }
-  return TCALC_ERR_NOT_FOUND;
-}
 
-tcalc_err tcalc_ctx_getbinlop(const tcalc_ctx* ctx, const char* name, size_t name_len, tcalc_binlopdef* out) {
-  for (size_t i = 0; i < ctx->binlops.len; i++) {
-    if (tcalc_streq_ntlb(ctx->binlops.arr[i].id, name, name_len)) {
-      *out = ctx->binlops.arr[i];
-      return TCALC_ERR_OK;
-    }
-  }
-  return TCALC_ERR_NOT_FOUND;
-}
+tcalc_ctx_lookup_impl(var, tcalc_vardef, vars)
+tcalc_ctx_lookup_impl(unfunc, tcalc_unfuncdef, unfuncs)
+tcalc_ctx_lookup_impl(binfunc, tcalc_binfuncdef, binfuncs)
+tcalc_ctx_lookup_impl(unop, tcalc_unopdef, unops)
+tcalc_ctx_lookup_impl(binop, tcalc_binopdef, binops)
+tcalc_ctx_lookup_impl(relop, tcalc_relopdef, relops)
+tcalc_ctx_lookup_impl(unlop, tcalc_unlopdef, unlops)
+tcalc_ctx_lookup_impl(binlop, tcalc_binlopdef, binlops)
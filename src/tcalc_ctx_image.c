@@ -0,0 +1,384 @@
+#include "tcalc.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * Context image layout
+ *
+ * An image starts with a tcalc_ctx_image_header, which is followed by the
+ * eight definition tables of a frozen context and their hash indexes. Every
+ * location in the image is an offset from its start, so an image can be
+ * mapped at any address.
+ *
+ * Variables and every index are stored exactly as a tcalc_ctx holds them in
+ * memory, and contexts opened from an image point straight into it instead
+ * of copying them. Functions and operators hold function pointers, which
+ * mean nothing outside of the process that wrote them, so they are stored as
+ * tcalc_ctx_image_defs referring to a function by its position in the
+ * builtin function table below followed by the caller's function table, and
+ * resolved back into ordinary definitions when the image is opened.
+ *
+ * The image records the sizes of the structs it stores directly and the byte
+ * order of the writer, and images written by a build with a different layout
+ * are rejected.
+*/
+
+#define TCALC_CTX_IMAGE_MAGIC "TCALCIMG"
+#define TCALC_CTX_IMAGE_VERSION 1
+#define TCALC_CTX_IMAGE_BYTE_ORDER 0x01020304u
+#define TCALC_CTX_IMAGE_ALIGN 16
+#define TCALC_CTX_IMAGE_TABLE_COUNT 8
+
+enum {
+  TCALC_CTX_IMAGE_UNFUNCS,
+  TCALC_CTX_IMAGE_BINFUNCS,
+  TCALC_CTX_IMAGE_VARS,
+  TCALC_CTX_IMAGE_UNOPS,
+  TCALC_CTX_IMAGE_BINOPS,
+  TCALC_CTX_IMAGE_RELOPS,
+  TCALC_CTX_IMAGE_UNLOPS,
+  TCALC_CTX_IMAGE_BINLOPS
+};
+
+typedef struct tcalc_ctx_image_table {
+  uint64_t offset; // of the definitions
+  uint64_t len;
+  uint64_t indexOffset; // of the index slots
+  uint64_t indexCap;
+} tcalc_ctx_image_table;
+
+typedef struct tcalc_ctx_image_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t vardefSize;
+  uint32_t slotSize;
+  uint64_t size; // of the whole image
+  tcalc_ctx_image_table tables[TCALC_CTX_IMAGE_TABLE_COUNT];
+} tcalc_ctx_image_header;
+
+// A function or operator definition of any kind
+typedef struct tcalc_ctx_image_def {
+  char id[TCALC_IDDEF_MAX_STR_SIZE];
+  int32_t prec;
+  int32_t assoc;
+  uint32_t func; // position in the builtin functions followed by the caller's functions
+  uint32_t reserved;
+} tcalc_ctx_image_def;
+
+/**
+ * Every function used by the default contexts. The order of this table is
+ * part of the image format, so functions may only ever be appended to it, and
+ * TCALC_CTX_IMAGE_VERSION must change if any are removed.
+*/
+static const tcalc_anyfunc tcalc_ctx_image_builtins[] = {
+  TCALC_ANYFUNC(tcalc_val_sin), TCALC_ANYFUNC(tcalc_val_cos), TCALC_ANYFUNC(tcalc_val_tan),
+  TCALC_ANYFUNC(tcalc_val_sec), TCALC_ANYFUNC(tcalc_val_csc), TCALC_ANYFUNC(tcalc_val_cot),
+  TCALC_ANYFUNC(tcalc_val_asin), TCALC_ANYFUNC(tcalc_val_acos), TCALC_ANYFUNC(tcalc_val_atan),
+  TCALC_ANYFUNC(tcalc_val_asec), TCALC_ANYFUNC(tcalc_val_acsc), TCALC_ANYFUNC(tcalc_val_acot),
+  TCALC_ANYFUNC(tcalc_val_sinh), TCALC_ANYFUNC(tcalc_val_cosh), TCALC_ANYFUNC(tcalc_val_tanh),
+  TCALC_ANYFUNC(tcalc_val_asinh), TCALC_ANYFUNC(tcalc_val_acosh), TCALC_ANYFUNC(tcalc_val_atanh),
+  TCALC_ANYFUNC(tcalc_val_atan2),
+  TCALC_ANYFUNC(tcalc_val_sin_deg), TCALC_ANYFUNC(tcalc_val_cos_deg), TCALC_ANYFUNC(tcalc_val_tan_deg),
+  TCALC_ANYFUNC(tcalc_val_sec_deg), TCALC_ANYFUNC(tcalc_val_csc_deg), TCALC_ANYFUNC(tcalc_val_cot_deg),
+  TCALC_ANYFUNC(tcalc_val_asin_deg), TCALC_ANYFUNC(tcalc_val_acos_deg), TCALC_ANYFUNC(tcalc_val_atan_deg),
+  TCALC_ANYFUNC(tcalc_val_asec_deg), TCALC_ANYFUNC(tcalc_val_acsc_deg), TCALC_ANYFUNC(tcalc_val_acot_deg),
+  TCALC_ANYFUNC(tcalc_val_sinh_deg), TCALC_ANYFUNC(tcalc_val_cosh_deg), TCALC_ANYFUNC(tcalc_val_tanh_deg),
+  TCALC_ANYFUNC(tcalc_val_asinh_deg), TCALC_ANYFUNC(tcalc_val_acosh_deg), TCALC_ANYFUNC(tcalc_val_atanh_deg),
+  TCALC_ANYFUNC(tcalc_val_atan2_deg),
+  TCALC_ANYFUNC(tcalc_val_log), TCALC_ANYFUNC(tcalc_val_ln), TCALC_ANYFUNC(tcalc_val_exp),
+  TCALC_ANYFUNC(tcalc_val_sqrt), TCALC_ANYFUNC(tcalc_val_cbrt), TCALC_ANYFUNC(tcalc_val_ceil),
+  TCALC_ANYFUNC(tcalc_val_floor), TCALC_ANYFUNC(tcalc_val_round), TCALC_ANYFUNC(tcalc_val_abs),
+  TCALC_ANYFUNC(tcalc_val_pow),
+  TCALC_ANYFUNC(tcalc_val_unary_plus), TCALC_ANYFUNC(tcalc_val_unary_minus),
+  TCALC_ANYFUNC(tcalc_val_multiply), TCALC_ANYFUNC(tcalc_val_divide), TCALC_ANYFUNC(tcalc_val_mod),
+  TCALC_ANYFUNC(tcalc_val_add), TCALC_ANYFUNC(tcalc_val_subtract),
+  TCALC_ANYFUNC(tcalc_val_lt), TCALC_ANYFUNC(tcalc_val_lteq), TCALC_ANYFUNC(tcalc_val_gt),
+  TCALC_ANYFUNC(tcalc_val_gteq), TCALC_ANYFUNC(tcalc_val_equals), TCALC_ANYFUNC(tcalc_val_nequals),
+  TCALC_ANYFUNC(tcalc_val_not), TCALC_ANYFUNC(tcalc_val_equals_l), TCALC_ANYFUNC(tcalc_val_nequals_l),
+  TCALC_ANYFUNC(tcalc_val_and), TCALC_ANYFUNC(tcalc_val_or)
+};
+
+#define TCALC_CTX_IMAGE_BUILTIN_COUNT ((uint32_t)TCALC_ARRAY_SIZE(tcalc_ctx_image_builtins))
+
+static tcalc_err tcalc_ctx_image_funcref(
+  tcalc_anyfunc func, const tcalc_anyfunc* funcs, int32_t funcCount, uint32_t* out
+) {
+  for (uint32_t i = 0; i < TCALC_CTX_IMAGE_BUILTIN_COUNT; i++) {
+    if (tcalc_ctx_image_builtins[i] == func) {
+      *out = i;
+      return TCALC_ERR_OK;
+    }
+  }
+  for (int32_t i = 0; i < funcCount; i++) {
+    if (funcs[i] == func) {
+      *out = TCALC_CTX_IMAGE_BUILTIN_COUNT + (uint32_t)i;
+      return TCALC_ERR_OK;
+    }
+  }
+  return TCALC_ERR_NOT_FOUND;
+}
+
+static tcalc_err tcalc_ctx_image_funcderef(
+  uint32_t ref, const tcalc_anyfunc* funcs, int32_t funcCount, tcalc_anyfunc* out
+) {
+  if (ref < TCALC_CTX_IMAGE_BUILTIN_COUNT) {
+    *out = tcalc_ctx_image_builtins[ref];
+    return TCALC_ERR_OK;
+  }
+  if (ref - TCALC_CTX_IMAGE_BUILTIN_COUNT >= (uint32_t)funcCount)
+    return TCALC_ERR_NOT_FOUND;
+  *out = funcs[ref - TCALC_CTX_IMAGE_BUILTIN_COUNT];
+  return TCALC_ERR_OK;
+}
+
+static size_t tcalc_ctx_image_alignup(size_t n) {
+  return (n + TCALC_CTX_IMAGE_ALIGN - 1) & ~(size_t)(TCALC_CTX_IMAGE_ALIGN - 1);
+}
+
+/**
+ * Lay out the tables of a flat, fully indexed context in an image, filling in
+ * the offsets of the header and returning the size of the whole image
+*/
+static size_t tcalc_ctx_image_layout(const tcalc_ctx* flat, tcalc_ctx_image_header* header) {
+  const size_t lens[TCALC_CTX_IMAGE_TABLE_COUNT] = {
+    flat->unfuncs.len, flat->binfuncs.len, flat->vars.len, flat->unops.len,
+    flat->binops.len, flat->relops.len, flat->unlops.len, flat->binlops.len
+  };
+  const tcalc_ctx_index* indexes[TCALC_CTX_IMAGE_TABLE_COUNT] = {
+    &(flat->unfuncsIndex), &(flat->binfuncsIndex), &(flat->varsIndex), &(flat->unopsIndex),
+    &(flat->binopsIndex), &(flat->relopsIndex), &(flat->unlopsIndex), &(flat->binlopsIndex)
+  };
+
+  size_t size = tcalc_ctx_image_alignup(sizeof(tcalc_ctx_image_header));
+  for (int t = 0; t < TCALC_CTX_IMAGE_TABLE_COUNT; t++) {
+    const size_t defSize = t == TCALC_CTX_IMAGE_VARS ? sizeof(tcalc_vardef) : sizeof(tcalc_ctx_image_def);
+    header->tables[t].offset = size;
+    header->tables[t].len = lens[t];
+    size = tcalc_ctx_image_alignup(size + defSize * lens[t]);
+    header->tables[t].indexOffset = size;
+    header->tables[t].indexCap = indexes[t]->cap;
+    size = tcalc_ctx_image_alignup(size + sizeof(tcalc_ctx_index_slot) * indexes[t]->cap);
+  }
+
+  header->size = size;
+  return size;
+}
+
+#define tcalc_ctx_image_putfuncs(_vec_, _t_) do { \
+    tcalc_ctx_image_def* defs = (tcalc_ctx_image_def*)(image + header.tables[_t_].offset); \
+    TCALC_VEC_FOREACH(flat->_vec_, i) { \
+      memcpy(defs[i].id, flat->_vec_.arr[i].id, sizeof(flat->_vec_.arr[i].id)); \
+      cleanup_on_err(err, tcalc_ctx_image_funcref( \
+        TCALC_ANYFUNC(flat->_vec_.arr[i].func), funcs, funcCount, &(defs[i].func) \
+      )); \
+    } \
+  } while (0)
+
+#define tcalc_ctx_image_putops(_vec_, _t_) do { \
+    tcalc_ctx_image_putfuncs(_vec_, _t_); \
+    tcalc_ctx_image_def* opdefs = (tcalc_ctx_image_def*)(image + header.tables[_t_].offset); \
+    TCALC_VEC_FOREACH(flat->_vec_, i) { \
+      opdefs[i].prec = flat->_vec_.arr[i].prec; \
+      opdefs[i].assoc = (int32_t)flat->_vec_.arr[i].assoc; \
+    } \
+  } while (0)
+
+/**
+ * Copy variables into an image field by field, so that the padding inside
+ * each tcalc_vardef stays zero instead of holding whatever bytes the source
+ * context happened to have there
+*/
+static void tcalc_ctx_image_putvars(tcalc_vardef* dest, const tcalc_vardef* src, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    memcpy(dest[i].id, src[i].id, sizeof(src[i].id));
+    dest[i].val.type = src[i].val.type;
+    if (src[i].val.type == TCALC_VALTYPE_NUM)
+      dest[i].val.as.num = src[i].val.as.num;
+    else
+      dest[i].val.as.boolean = src[i].val.as.boolean;
+    dest[i].immutable = src[i].immutable;
+  }
+}
+
+tcalc_err tcalc_ctx_image_write(
+  const tcalc_ctx* ctx, const tcalc_anyfunc* funcs, int32_t funcCount,
+  void* dest, size_t destCapacity, size_t* outSize
+) {
+  assert(ctx != NULL);
+  assert(outSize != NULL);
+  tcalc_err err = TCALC_ERR_OK;
+
+  // freezing flattens ctx and indexes every one of its tables
+  tcalc_ctx* flat = NULL;
+  ret_on_err(err, tcalc_ctx_freeze(ctx, &flat));
+
+  tcalc_ctx_image_header header;
+  memset(&header, 0, sizeof(header));
+  *outSize = tcalc_ctx_image_layout(flat, &header);
+  cleanup_if(err, dest == NULL || destCapacity < *outSize, TCALC_ERR_NOMEM);
+
+  memcpy(header.magic, TCALC_CTX_IMAGE_MAGIC, sizeof(header.magic));
+  header.version = TCALC_CTX_IMAGE_VERSION;
+  header.byteOrder = TCALC_CTX_IMAGE_BYTE_ORDER;
+  header.vardefSize = (uint32_t)sizeof(tcalc_vardef);
+  header.slotSize = (uint32_t)sizeof(tcalc_ctx_index_slot);
+
+  // zero everything first so that padding bytes are deterministic
+  char* image = (char*)dest;
+  memset(image, 0, *outSize);
+  memcpy(image, &header, sizeof(header));
+
+  tcalc_ctx_image_putfuncs(unfuncs, TCALC_CTX_IMAGE_UNFUNCS);
+  tcalc_ctx_image_putfuncs(binfuncs, TCALC_CTX_IMAGE_BINFUNCS);
+  tcalc_ctx_image_putvars((tcalc_vardef*)(image + header.tables[TCALC_CTX_IMAGE_VARS].offset), flat->vars.arr, flat->vars.len);
+  tcalc_ctx_image_putops(unops, TCALC_CTX_IMAGE_UNOPS);
+  tcalc_ctx_image_putops(binops, TCALC_CTX_IMAGE_BINOPS);
+  tcalc_ctx_image_putops(relops, TCALC_CTX_IMAGE_RELOPS);
+  tcalc_ctx_image_putops(unlops, TCALC_CTX_IMAGE_UNLOPS);
+  tcalc_ctx_image_putops(binlops, TCALC_CTX_IMAGE_BINLOPS);
+
+  const tcalc_ctx_index* indexes[TCALC_CTX_IMAGE_TABLE_COUNT] = {
+    &(flat->unfuncsIndex), &(flat->binfuncsIndex), &(flat->varsIndex), &(flat->unopsIndex),
+    &(flat->binopsIndex), &(flat->relopsIndex), &(flat->unlopsIndex), &(flat->binlopsIndex)
+  };
+  for (int t = 0; t < TCALC_CTX_IMAGE_TABLE_COUNT; t++) {
+    if (indexes[t]->cap > 0)
+      memcpy(image + header.tables[t].indexOffset, indexes[t]->slots, sizeof(tcalc_ctx_index_slot) * indexes[t]->cap);
+  }
+
+  cleanup:
+    tcalc_ctx_free(flat);
+    return err;
+}
+
+/**
+ * Point a table of ctx at the definitions and index stored in an image. The
+ * table is never written through, as contexts opened from images are frozen.
+*/
+#define tcalc_ctx_image_mapvec(_vec_, _index_, _t_) do { \
+    (_vec_).arr = (void*)(bytes + header->tables[_t_].offset); \
+    (_vec_).len = (size_t)header->tables[_t_].len; \
+    (_vec_).cap = (size_t)header->tables[_t_].len; \
+    (_index_).slots = (tcalc_ctx_index_slot*)(bytes + header->tables[_t_].indexOffset); \
+    (_index_).cap = (size_t)header->tables[_t_].indexCap; \
+  } while (0)
+
+// Copy a table of function definitions out of an image, resolving their functions
+#define tcalc_ctx_image_getfuncs(_vec_, _index_, _t_, _functype_) do { \
+    const tcalc_ctx_image_def* defs = (const tcalc_ctx_image_def*)(bytes + header->tables[_t_].offset); \
+    const size_t len = (size_t)header->tables[_t_].len; \
+    (_vec_).arr = tcalc_calloc(ctx->allocator, len + 1, sizeof(*(_vec_).arr)); \
+    cleanup_if(err, (_vec_).arr == NULL, TCALC_ERR_NOMEM); \
+    (_vec_).len = len; \
+    (_vec_).cap = len + 1; \
+    for (size_t i = 0; i < len; i++) { \
+      tcalc_anyfunc func; \
+      memcpy((_vec_).arr[i].id, defs[i].id, sizeof((_vec_).arr[i].id)); \
+      (_vec_).arr[i].id[sizeof((_vec_).arr[i].id) - 1] = '\0'; \
+      cleanup_on_err(err, tcalc_ctx_image_funcderef(defs[i].func, funcs, funcCount, &func)); \
+      (_vec_).arr[i].func = (_functype_)func; \
+    } \
+    (_index_).slots = (tcalc_ctx_index_slot*)(bytes + header->tables[_t_].indexOffset); \
+    (_index_).cap = (size_t)header->tables[_t_].indexCap; \
+  } while (0)
+
+#define tcalc_ctx_image_getops(_vec_, _index_, _t_, _functype_) do { \
+    tcalc_ctx_image_getfuncs(_vec_, _index_, _t_, _functype_); \
+    const tcalc_ctx_image_def* opdefs = (const tcalc_ctx_image_def*)(bytes + header->tables[_t_].offset); \
+    for (size_t i = 0; i < (_vec_).len; i++) { \
+      (_vec_).arr[i].prec = opdefs[i].prec; \
+      (_vec_).arr[i].assoc = (tcalc_assoc)opdefs[i].assoc; \
+    } \
+  } while (0)
+
+static bool tcalc_ctx_image_inbounds(uint64_t offset, uint64_t count, size_t elemSize, size_t size) {
+  return offset <= size && offset % TCALC_CTX_IMAGE_ALIGN == 0 &&
+    count <= (size - offset) / elemSize;
+}
+
+/**
+ * Check that every slot of an index refers to a definition in its table, and
+ * that at least one slot is empty so that probing for a missing id ends
+*/
+static bool tcalc_ctx_image_validindex(const tcalc_ctx_index_slot* slots, uint64_t cap, uint64_t len) {
+  if (cap == 0) return true; // not indexed
+  bool hasEmpty = false;
+  for (uint64_t i = 0; i < cap; i++) {
+    if (slots[i].pos > len) return false;
+    hasEmpty |= slots[i].pos == 0;
+  }
+  return hasEmpty;
+}
+
+static bool tcalc_ctx_image_validvars(const tcalc_vardef* vars, uint64_t len) {
+  for (uint64_t i = 0; i < len; i++) {
+    if (memchr(vars[i].id, '\0', sizeof(vars[i].id)) == NULL)
+      return false;
+  }
+  return true;
+}
+
+tcalc_err tcalc_ctx_image_open(
+  const void* image, size_t size, const tcalc_anyfunc* funcs, int32_t funcCount, tcalc_ctx** out
+) {
+  assert(image != NULL);
+  assert(out != NULL);
+  tcalc_err err = TCALC_ERR_OK;
+  const char* bytes = (const char*)image;
+  const tcalc_ctx_image_header* header = (const tcalc_ctx_image_header*)image;
+
+  reterr_on_true(err, (uintptr_t)image % TCALC_CTX_IMAGE_ALIGN != 0, TCALC_ERR_INVALID_ARG);
+  reterr_on_true(err, size < sizeof(tcalc_ctx_image_header), TCALC_ERR_INVALID_ARG);
+  reterr_on_true(err, memcmp(header->magic, TCALC_CTX_IMAGE_MAGIC, sizeof(header->magic)) != 0, TCALC_ERR_INVALID_ARG);
+  reterr_on_true(err,
+    header->version != TCALC_CTX_IMAGE_VERSION ||
+    header->byteOrder != TCALC_CTX_IMAGE_BYTE_ORDER ||
+    header->vardefSize != sizeof(tcalc_vardef) ||
+    header->slotSize != sizeof(tcalc_ctx_index_slot) ||
+    header->size > size,
+    TCALC_ERR_INVALID_ARG
+  );
+  for (int t = 0; t < TCALC_CTX_IMAGE_TABLE_COUNT; t++) {
+    const tcalc_ctx_image_table table = header->tables[t];
+    const size_t defSize = t == TCALC_CTX_IMAGE_VARS ? sizeof(tcalc_vardef) : sizeof(tcalc_ctx_image_def);
+    reterr_on_true(err, !tcalc_ctx_image_inbounds(table.offset, table.len, defSize, size), TCALC_ERR_INVALID_ARG);
+    reterr_on_true(err, !tcalc_ctx_image_inbounds(table.indexOffset, table.indexCap, sizeof(tcalc_ctx_index_slot), size), TCALC_ERR_INVALID_ARG);
+    // lookups rely on every index being a power of 2 and at most half full
+    reterr_on_true(err, (table.indexCap & (table.indexCap - 1)) != 0 || table.len * 2 > table.indexCap, TCALC_ERR_INVALID_ARG);
+    reterr_on_true(err, !tcalc_ctx_image_validindex(
+      (const tcalc_ctx_index_slot*)(bytes + table.indexOffset), table.indexCap, table.len
+    ), TCALC_ERR_INVALID_ARG);
+  }
+  // variables are used in place rather than copied, so nothing else terminates their ids
+  reterr_on_true(err, !tcalc_ctx_image_validvars(
+    (const tcalc_vardef*)(bytes + header->tables[TCALC_CTX_IMAGE_VARS].offset),
+    header->tables[TCALC_CTX_IMAGE_VARS].len
+  ), TCALC_ERR_INVALID_ARG);
+
+  tcalc_ctx* ctx = NULL;
+  ret_on_err(err, tcalc_ctx_alloc_empty(&ctx));
+  ctx->image = image;
+
+  tcalc_ctx_image_getfuncs(ctx->unfuncs, ctx->unfuncsIndex, TCALC_CTX_IMAGE_UNFUNCS, tcalc_val_unfunc);
+  tcalc_ctx_image_getfuncs(ctx->binfuncs, ctx->binfuncsIndex, TCALC_CTX_IMAGE_BINFUNCS, tcalc_val_binfunc);
+  tcalc_ctx_image_mapvec(ctx->vars, ctx->varsIndex, TCALC_CTX_IMAGE_VARS);
+  tcalc_ctx_image_getops(ctx->unops, ctx->unopsIndex, TCALC_CTX_IMAGE_UNOPS, tcalc_val_unfunc);
+  tcalc_ctx_image_getops(ctx->binops, ctx->binopsIndex, TCALC_CTX_IMAGE_BINOPS, tcalc_val_binfunc);
+  tcalc_ctx_image_getops(ctx->relops, ctx->relopsIndex, TCALC_CTX_IMAGE_RELOPS, tcalc_val_relfunc);
+  tcalc_ctx_image_getops(ctx->unlops, ctx->unlopsIndex, TCALC_CTX_IMAGE_UNLOPS, tcalc_val_unlfunc);
+  tcalc_ctx_image_getops(ctx->binlops, ctx->binlopsIndex, TCALC_CTX_IMAGE_BINLOPS, tcalc_val_binlfunc);
+  ctx->frozen = true;
+
+  *out = ctx;
+  return TCALC_ERR_OK;
+
+  cleanup:
+    tcalc_ctx_free(ctx);
+    return err;
+}
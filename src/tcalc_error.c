@@ -19,8 +19,59 @@ void tcalc_die(const char *err, ...) {
 #define TCALC_ERROR_MAX_SIZE 256
 #define TCALC_ERRSTK_MAX_SIZE 16
 
-int errstksize = 0;
-char errstk[TCALC_ERRSTK_MAX_SIZE][TCALC_ERROR_MAX_SIZE] = {'\0'};
+// A build for a compiler not listed here can define TCALC_THREAD_LOCAL
+// itself, or define it as nothing to share one error stack between every
+// thread.
+#if defined(TCALC_THREAD_LOCAL)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+  #define TCALC_THREAD_LOCAL _Thread_local
+#elif defined(_MSC_VER)
+  #define TCALC_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__)
+  #define TCALC_THREAD_LOCAL __thread
+#else
+  #error "no known thread-local storage class for the error stack, define TCALC_THREAD_LOCAL"
+#endif
+
+typedef enum tcalc_errrec_kind {
+  TCALC_ERRREC_TEXT, // text holds the whole formatted message
+  TCALC_ERRREC_MSG, // msg alone
+  TCALC_ERRREC_TOK, // msg followed by the quoted token text held in text
+  TCALC_ERRREC_I32 // msg is a printf format taking args[0] and args[1]
+} tcalc_errrec_kind;
+
+/**
+ * A single entry of the error stack. Only TCALC_ERRREC_TEXT records are
+ * formatted when they are added; every other kind keeps what is needed to
+ * format itself later, so reporting an error is a handful of stores and, for
+ * token errors, one short memcpy.
+*/
+typedef struct tcalc_errrec {
+  tcalc_errrec_kind kind;
+  tcalc_err code;
+  const char* funcname;
+  const char* msg;
+  int32_t start, end; // token offsets into the expression, -1 when unknown
+  int32_t args[2];
+  int32_t textLen;
+  char text[TCALC_ERROR_MAX_SIZE];
+} tcalc_errrec;
+
+static TCALC_THREAD_LOCAL int errstksize = 0;
+static TCALC_THREAD_LOCAL tcalc_errrec errstk[TCALC_ERRSTK_MAX_SIZE];
+
+static tcalc_errrec* tcalc_errstkpush(const char* funcname, tcalc_errrec_kind kind, tcalc_err code, const char* msg) {
+  if (errstksize >= TCALC_ERRSTK_MAX_SIZE) return NULL;
+  tcalc_errrec* rec = &errstk[errstksize++];
+  rec->kind = kind;
+  rec->code = code;
+  rec->funcname = funcname;
+  rec->msg = msg;
+  rec->start = -1;
+  rec->end = -1;
+  rec->textLen = 0;
+  return rec;
+}
 
 const char* tcalc_strerrcode(tcalc_err err) {
   switch (err) {
@@ -47,6 +98,8 @@ const char* tcalc_strerrcode(tcalc_err err) {
     case TCALC_ERR_FUNC_TOO_MANY_ARGS: return "too many arguments";
     case TCALC_ERR_BAD_CAST: return "bad cast";
     case TCALC_ERR_UNPROCESSED_INPUT: return "unprocessed input";
+    case TCALC_ERR_IMMUTABLE: return "cannot redefine immutable variable";
+    case TCALC_ERR_MAX_DEPTH: return "maximum evaluation depth exceeded";
     case TCALC_ERR_UNIMPLEMENTED: return "unimplemented";
     case TCALC_ERR_UNKNOWN_ID: return "unknown identifier";
     case TCALC_ERR_UNKNOWN: return "unknown";
@@ -65,14 +118,12 @@ void tcalc_errstkclear() {
 
 bool tcalc_errstkadd(const char* funcname, const char* errstr) {
   if (errstksize >= TCALC_ERRSTK_MAX_SIZE) return false;
-  int res = snprintf(errstk[errstksize], TCALC_ERROR_MAX_SIZE, "[%s] %s", funcname, errstr);
-
-  if (res < 0) {
-    errstk[errstksize][0] = '\0';
-    return false;
-  }
+  tcalc_errrec* rec = &errstk[errstksize];
+  int res = snprintf(rec->text, TCALC_ERROR_MAX_SIZE, "[%s] %s", funcname, errstr);
+  if (res < 0) return false;
 
-  errstksize++;
+  tcalc_errstkpush(funcname, TCALC_ERRREC_TEXT, TCALC_ERR_OK, NULL);
+  rec->textLen = TCALC_MIN_UNSAFE(res, TCALC_ERROR_MAX_SIZE - 1);
   return true;
 }
 
@@ -85,16 +136,77 @@ bool tcalc_errstkaddf(const char* funcname, const char* format, ...) {
   int success = vsnprintf(err, TCALC_ERROR_MAX_SIZE, format, args);
   va_end(args);
 
-  if (!success) return false;
+  if (success < 0) return false;
   return tcalc_errstkadd(funcname, err);
 }
 
+bool tcalc_errstkadd_msg(const char* funcname, tcalc_err code, const char* msg) {
+  return tcalc_errstkpush(funcname, TCALC_ERRREC_MSG, code, msg) != NULL;
+}
+
+bool tcalc_errstkadd_i32(const char* funcname, tcalc_err code, const char* format, int32_t a, int32_t b) {
+  tcalc_errrec* rec = tcalc_errstkpush(funcname, TCALC_ERRREC_I32, code, format);
+  if (rec == NULL) return false;
+  rec->args[0] = a;
+  rec->args[1] = b;
+  return true;
+}
+
+bool tcalc_errstkadd_tok(const char* funcname, tcalc_err code, const char* msg, const char* expr, int32_t exprLen, tcalc_token token) {
+  tcalc_errrec* rec = tcalc_errstkpush(funcname, TCALC_ERRREC_TOK, code, msg);
+  if (rec == NULL) return false;
+  rec->start = token.start;
+  rec->end = tcalc_token_xend(expr, exprLen, token);
+  // the text is copied so that the expression does not have to outlive the record
+  if (TCALC_TOKEN_IS_IMPLICIT_MULT(token)) {
+    rec->textLen = tcalc_strcpy_lblb(
+      rec->text, TCALC_ERROR_MAX_SIZE, TCALC_STRLIT_PTR_LEN(TCALC_TOKEN_IMPLICIT_MULT_PRINTF_STR)
+    );
+  } else {
+    rec->textLen = tcalc_strcpy_lblb(
+      rec->text, TCALC_ERROR_MAX_SIZE, tcalc_token_startcp(expr, token), tcalc_token_len(expr, exprLen, token)
+    );
+  }
+  return true;
+}
+
+bool tcalc_errstkpeekinfo(tcalc_err* outCode, int32_t* outStart, int32_t* outEnd) {
+  if (errstksize == 0) return false;
+  const tcalc_errrec* rec = &errstk[errstksize - 1];
+  *outCode = rec->code;
+  *outStart = rec->start;
+  *outEnd = rec->end;
+  return true;
+}
+
 int32_t tcalc_errstkpeek(char* out, int32_t dsize) {
-  if (errstksize == 0) return 0;
-  return tcalc_strcpy_lblb_ntdst(
-    out, dsize,
-    errstk[errstksize - 1], (int32_t)strlen(errstk[errstksize - 1])
-  );
+  if (errstksize == 0 || dsize <= 0) return 0;
+  const tcalc_errrec* rec = &errstk[errstksize - 1];
+
+  int res = 0;
+  switch (rec->kind) {
+    case TCALC_ERRREC_TEXT:
+      return tcalc_strcpy_lblb_ntdst(out, dsize, rec->text, rec->textLen);
+    case TCALC_ERRREC_MSG:
+      res = snprintf(out, (size_t)dsize, "[%s] %s", rec->funcname, rec->msg);
+      break;
+    case TCALC_ERRREC_TOK:
+      res = snprintf(out, (size_t)dsize, "[%s] %s \"%.*s\"", rec->funcname, rec->msg, (int)rec->textLen, rec->text);
+      break;
+    case TCALC_ERRREC_I32: {
+      res = snprintf(out, (size_t)dsize, "[%s] ", rec->funcname);
+      if (res < 0 || res >= dsize) break;
+      const int prefixLen = res;
+      res = snprintf(out + prefixLen, (size_t)(dsize - prefixLen), rec->msg, rec->args[0], rec->args[1]);
+      if (res >= 0) res += prefixLen;
+    } break;
+  }
+
+  if (res < 0) {
+    out[0] = '\0';
+    return 0;
+  }
+  return TCALC_MIN_UNSAFE(res, dsize - 1);
 }
 
 int tcalc_errstkpop() {
@@ -1,5 +1,7 @@
 #include "tcalc.h"
 
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 tcalc_err tcalc_eval(
@@ -15,18 +17,11 @@ tcalc_err tcalc_eval(
   *outTreeNodesCount = 0;
   *outTokensCount = 0;
 
-  tcalc_ctx* ctx = NULL;
-  tcalc_err err = tcalc_ctx_alloc_default(&ctx);
-  if (err) return err;
-
-  err = tcalc_eval_wctx(
+  return tcalc_eval_wctx(
     expr, exprLen, treeNodesBuffer, treeNodesBufferCapacity,
-    tokensBuffer, tokensBufferCapacity, ctx, out,
+    tokensBuffer, tokensBufferCapacity, tcalc_ctx_default(), out,
     outTreeNodesCount, outTokensCount
   );
-
-  tcalc_ctx_free(ctx);
-  return err;
 }
 
 tcalc_err tcalc_eval_wctx(
@@ -48,14 +43,24 @@ tcalc_err tcalc_eval_wctx(
   err = tcalc_tokenize_infix(
     expr, exprLen, tokensBuffer, tokensBufferCapacity, &tokensCount
   );
+  if (err == TCALC_ERR_NOMEM) {
+    // report the sizes both buffers need, so that the caller can retry once
+    tcalc_measure_infix(expr, exprLen, outTokensCount, outTreeNodesCount);
+    return err;
+  }
   if (err) return err;
 
   int32_t treeNodesCount = 0;
   int32_t exprRootInd = 0;
-  err = tcalc_create_exprtree_infix(
-    expr, exprLen, tokensBuffer, tokensCount,
+  err = tcalc_create_exprtree_infix_wctx(
+    expr, exprLen, tokensBuffer, tokensCount, ctx,
     treeNodesBuffer, treeNodesBufferCapacity, &treeNodesCount, &exprRootInd
   );
+  if (err == TCALC_ERR_NOMEM) {
+    *outTreeNodesCount = treeNodesCount;
+    *outTokensCount = tokensCount;
+    return err;
+  }
   if (err) return err;
 
   err = tcalc_eval_exprtree(
@@ -66,3 +71,93 @@ tcalc_err tcalc_eval_wctx(
   *outTokensCount = tokensCount;
   return err;
 }
+
+tcalc_err tcalc_eval_arena(
+  const char* expr, int32_t exprLen, const struct tcalc_ctx* ctx,
+  tcalc_arena* arena, struct tcalc_val* out
+) {
+  assert(out != NULL);
+  *out = (struct tcalc_val){ 0 };
+
+  tcalc_err err = TCALC_ERR_OK;
+  tcalc_token* tokens = NULL;
+  tcalc_exprtree* tree = NULL;
+  int32_t tokensLen = 0, treeLen = 0, exprRootInd = -1;
+  ret_on_err(err, tcalc_create_exprtree_infix_arena(
+    expr, exprLen, ctx, arena, &tokens, &tokensLen, &tree, &treeLen, &exprRootInd
+  ));
+
+  // no path from the root can pass through more nodes than the tree has
+  tcalc_evalframe* frames = (tcalc_evalframe*)tcalc_alloc(
+    tcalc_arena_allocator(arena), sizeof(tcalc_evalframe) * (size_t)treeLen
+  );
+  reterr_on_true(err, frames == NULL, TCALC_ERR_NOMEM);
+  return tcalc_eval_exprtree_stk(
+    expr, exprLen, tree, treeLen, exprRootInd, tokens, tokensLen, ctx, frames,
+    treeLen, out
+  );
+}
+
+tcalc_err tcalc_eval_exprtree_batch(
+  const char* expr, int32_t exprLen, const tcalc_exprtree* exprtree,
+  int32_t exprTreeLen, int32_t exprNodeInd, const tcalc_token* tokens,
+  int32_t tokensLen, const struct tcalc_ctx* ctx, const tcalc_column* columns,
+  int32_t columnCount, size_t rowCount, tcalc_outcolumn out
+) {
+  assert(ctx != NULL);
+  assert(columns != NULL || columnCount == 0);
+
+  tcalc_err err = TCALC_ERR_OK;
+  tcalc_bytecode* bc = NULL;
+  tcalc_column* slotColumns = NULL;
+  struct tcalc_val* scalars = NULL;
+
+  cleanup_on_err(err, tcalc_bytecode_compile(
+    expr, exprLen, exprtree, exprTreeLen, exprNodeInd, tokens, tokensLen, ctx, &bc
+  ));
+
+  const int32_t varCount = tcalc_bytecode_varcount(bc);
+  // calloc(0, ...) may return NULL, so always ask for at least one element
+  slotColumns = (tcalc_column*)tcalc_calloc(ctx->allocator, (size_t)varCount + 1, sizeof(tcalc_column));
+  cleanup_if(err, slotColumns == NULL, TCALC_ERR_NOMEM);
+  scalars = (struct tcalc_val*)tcalc_calloc(ctx->allocator, (size_t)varCount + 1, sizeof(struct tcalc_val));
+  cleanup_if(err, scalars == NULL, TCALC_ERR_NOMEM);
+
+  for (int32_t slot = 0; slot < varCount; slot++) {
+    const char* name = NULL;
+    int32_t nameLen = 0;
+    tcalc_bytecode_getvarname(bc, slot, &name, &nameLen);
+
+    int32_t col = 0;
+    for (; col < columnCount; col++) {
+      if (columns[col].name_len == (size_t)nameLen &&
+          memcmp(columns[col].name, name, (size_t)nameLen) == 0)
+        break;
+    }
+
+    if (col < columnCount) {
+      slotColumns[slot] = columns[col];
+      if (columns[col].type == TCALC_VALTYPE_NUM) {
+        cleanup_if(err, columns[col].as.nums == NULL && rowCount > 0, TCALC_ERR_INVALID_ARG);
+      } else {
+        cleanup_if(err, columns[col].as.bools == NULL && rowCount > 0, TCALC_ERR_INVALID_ARG);
+      }
+    } else {
+      const tcalc_vardef* vardef = tcalc_ctx_findvar(ctx, name, (size_t)nameLen);
+      cleanup_if(err, vardef == NULL, TCALC_ERR_UNKNOWN_ID);
+      slotColumns[slot].type = vardef->val.type; // NULL data reads scalars[slot]
+      scalars[slot] = vardef->val;
+    }
+  }
+
+  err = tcalc_bytecode_eval_batch(bc, slotColumns, scalars, rowCount, out);
+
+  cleanup:
+    if (bc != NULL) {
+      const size_t slotCount = (size_t)tcalc_bytecode_varcount(bc) + 1;
+      tcalc_free(ctx->allocator, scalars, sizeof(struct tcalc_val) * slotCount);
+      tcalc_free(ctx->allocator, slotColumns, sizeof(tcalc_column) * slotCount);
+    }
+    tcalc_bytecode_free(bc);
+    return err;
+}
@@ -22,231 +22,701 @@ static int32_t tcalc_exprtree_func_list_length(tcalc_exprtree* treeArray, int32_
 }
 
 
-tcalc_err tcalc_eval_exprtree(
-  const char* expr, int32_t exprLen,
-  tcalc_exprtree* treeArray, int32_t treeArrayLen, int32_t exprNodeInd,
-  tcalc_token *tokens, int32_t tokensLen,
-  const struct tcalc_ctx* ctx,
+/**
+ * Apply the operator of a binary node to its already evaluated operands
+*/
+static tcalc_err tcalc_eval_binary_node(
+  const char* expr, int32_t exprLen, const tcalc_token* tokens, const struct tcalc_ctx* ctx,
+  tcalc_exprtree_binary_node binnode, tcalc_val operand1, tcalc_val operand2,
   struct tcalc_val* out
 ) {
-  assert(expr != NULL);
-  assert(ctx != NULL);
-  assert(out != NULL);
-  // note that this function not allocate any data in any way
-
   tcalc_err err = TCALC_ERR_OK;
 
-  switch (treeArray[exprNodeInd].type) {
-    case TCALC_EXPRTREE_NODE_TYPE_BINARY: {
-      const tcalc_exprtree_binary_node binnode = treeArray[exprNodeInd].as.binary;
-      tcalc_val operand1 = { 0 }, operand2 = { 0 };
+  if (binnode.tokenIndOImplMult < 0)
+  {
+    tcalc_binopdef binary_op_def;
+    ret_on_err(err, tcalc_ctx_getbinop(ctx, TCALC_STRLIT_PTR_LEN(""), &binary_op_def));
+    out->type = TCALC_VALTYPE_NUM;
+    return binary_op_def.func(operand1, operand2, &(out->as.num));
+  }
+
+  struct tcalc_token opToken = tokens[binnode.tokenIndOImplMult];
+  switch (tokens[binnode.tokenIndOImplMult].type) {
+    case TCALC_TOK_BINOP: {
+      tcalc_binopdef binary_op_def = { 0 };
       ret_on_err(
         err,
-        tcalc_eval_exprtree(
-          expr, exprLen, treeArray, treeArrayLen, binnode.leftTreeInd,
-          tokens, tokensLen, ctx, &operand1
+        tcalc_ctx_getbinop(
+          ctx,
+          tcalc_token_startcp(expr, opToken),
+          tcalc_token_len(expr, exprLen, opToken),
+          &binary_op_def
         )
       );
+
+      out->type = TCALC_VALTYPE_NUM;
+      return binary_op_def.func(operand1, operand2, &(out->as.num));
+    } break;
+    case TCALC_TOK_BINLOP: {
+      tcalc_binlopdef binary_lop_def;
       ret_on_err(
         err,
-        tcalc_eval_exprtree(
-          expr, exprLen, treeArray, treeArrayLen, binnode.rightTreeInd,
-          tokens, tokensLen, ctx, &operand2
+        tcalc_ctx_getbinlop(
+          ctx,
+          tcalc_token_startcp(expr, opToken),
+          tcalc_token_len(expr, exprLen, opToken),
+          &binary_lop_def
         )
       );
 
-      if (binnode.tokenIndOImplMult < 0)
-      {
-        tcalc_binopdef binary_op_def;
-        ret_on_err(err, tcalc_ctx_getbinop(ctx, TCALC_STRLIT_PTR_LEN(""), &binary_op_def));
-        out->type = TCALC_VALTYPE_NUM;
-        return binary_op_def.func(operand1, operand2, &(out->as.num));
-      }
+      out->type = TCALC_VALTYPE_BOOL;
+      return binary_lop_def.func(operand1, operand2, &(out->as.boolean));
+    } break;
+    case TCALC_TOK_RELOP: {
+      tcalc_relopdef relopdef;
+      ret_on_err(
+        err,
+        tcalc_ctx_getrelop(
+          ctx,
+          tcalc_token_startcp(expr, opToken),
+          tcalc_token_len(expr, exprLen, opToken),
+          &relopdef
+        )
+      );
 
-      struct tcalc_token opToken = tokens[binnode.tokenIndOImplMult];
-      switch (tokens[binnode.tokenIndOImplMult].type) {
-        case TCALC_TOK_BINOP: {
-          tcalc_binopdef binary_op_def = { 0 };
-          ret_on_err(
-            err,
-            tcalc_ctx_getbinop(
-              ctx,
-              tcalc_token_startcp(expr, opToken),
-              tcalc_token_len(opToken),
-              &binary_op_def
-            )
-          );
-
-          out->type = TCALC_VALTYPE_NUM;
-          return binary_op_def.func(operand1, operand2, &(out->as.num));
-        } break;
-        case TCALC_TOK_BINLOP: {
-          tcalc_binlopdef binary_lop_def;
-          ret_on_err(
-            err,
-            tcalc_ctx_getbinlop(
-              ctx,
-              tcalc_token_startcp(expr, opToken),
-              tcalc_token_len(opToken),
-              &binary_lop_def
-            )
-          );
-
-          out->type = TCALC_VALTYPE_BOOL;
-          return binary_lop_def.func(operand1, operand2, &(out->as.boolean));
-        } break;
-        case TCALC_TOK_RELOP: {
-          tcalc_relopdef relopdef;
-          ret_on_err(
-            err,
-            tcalc_ctx_getrelop(
-              ctx,
-              tcalc_token_startcp(expr, opToken),
-              tcalc_token_len(opToken),
-              &relopdef
-            )
-          );
-
-          out->type = TCALC_VALTYPE_BOOL;
-          return relopdef.func(operand1, operand2, &(out->as.boolean));
-        } break;
-        case TCALC_TOK_EQOP: {
-          // TODO: Use eqopdef when introduced into tcalc_context struct
-
-          if (operand1.type == TCALC_VALTYPE_NUM && operand2.type == TCALC_VALTYPE_NUM) {
-            tcalc_relopdef relopdef;
-            ret_on_err(
-              err,
-              tcalc_ctx_getrelop(
-                ctx,
-                tcalc_token_startcp(expr, opToken),
-                tcalc_token_len(opToken),
-                &relopdef
-              )
-            );
-            out->type = TCALC_VALTYPE_BOOL;
-            return relopdef.func(operand1, operand2, &(out->as.boolean));
-          } else if (operand1.type == TCALC_VALTYPE_BOOL && operand2.type == TCALC_VALTYPE_BOOL) {
-            tcalc_binlopdef binlopdef;
-            ret_on_err(
-              err,
-              tcalc_ctx_getbinlop(
-                ctx,
-                tcalc_token_startcp(expr, opToken),
-                tcalc_token_len(opToken),
-                &binlopdef
-              )
-            );
-            out->type = TCALC_VALTYPE_BOOL;
-            return binlopdef.func(operand1, operand2, &(out->as.boolean));
-          }
+      out->type = TCALC_VALTYPE_BOOL;
+      return relopdef.func(operand1, operand2, &(out->as.boolean));
+    } break;
+    case TCALC_TOK_EQOP: {
+      // TODO: Use eqopdef when introduced into tcalc_context struct
 
-          return TCALC_ERR_BAD_CAST;
-        } break;
-        default: {
-          return TCALC_ERR_INVALID_ARG;
-        }
+      if (operand1.type == TCALC_VALTYPE_NUM && operand2.type == TCALC_VALTYPE_NUM) {
+        tcalc_relopdef relopdef;
+        ret_on_err(
+          err,
+          tcalc_ctx_getrelop(
+            ctx,
+            tcalc_token_startcp(expr, opToken),
+            tcalc_token_len(expr, exprLen, opToken),
+            &relopdef
+          )
+        );
+        out->type = TCALC_VALTYPE_BOOL;
+        return relopdef.func(operand1, operand2, &(out->as.boolean));
+      } else if (operand1.type == TCALC_VALTYPE_BOOL && operand2.type == TCALC_VALTYPE_BOOL) {
+        tcalc_binlopdef binlopdef;
+        ret_on_err(
+          err,
+          tcalc_ctx_getbinlop(
+            ctx,
+            tcalc_token_startcp(expr, opToken),
+            tcalc_token_len(expr, exprLen, opToken),
+            &binlopdef
+          )
+        );
+        out->type = TCALC_VALTYPE_BOOL;
+        return binlopdef.func(operand1, operand2, &(out->as.boolean));
       }
 
+      return TCALC_ERR_BAD_CAST;
     } break;
-    case TCALC_EXPRTREE_NODE_TYPE_UNARY: {
-      const tcalc_exprtree_unary_node unnode = treeArray[exprNodeInd].as.unary;
-      struct tcalc_token opToken = tokens[unnode.tokenInd];
-      tcalc_val operand = { 0 };
-      ret_on_err(err, tcalc_eval_exprtree(expr, exprLen, treeArray, treeArrayLen, unnode.childTreeInd, tokens, tokensLen, ctx, &operand));
-
-      switch (opToken.type) {
-        case TCALC_TOK_UNOP: {
-          tcalc_unopdef unary_op_def;
-          ret_on_err(err, tcalc_ctx_getunop(ctx, tcalc_token_startcp(expr, opToken), tcalc_token_len(opToken), &unary_op_def));
-
-          out->type = TCALC_VALTYPE_NUM;
-          return unary_op_def.func(operand, &(out->as.num));
-        } break;
-        case TCALC_TOK_UNLOP: {
-          tcalc_unlopdef unary_lop_def;
-          ret_on_err(err, tcalc_ctx_getunlop(ctx, tcalc_token_startcp(expr, opToken), tcalc_token_len(opToken), &unary_lop_def));
-
-          out->type = TCALC_VALTYPE_BOOL;
-          return unary_lop_def.func(operand, &(out->as.boolean));
-        } break;
-        default: {
-          // TODO: More descriptive error
-          return TCALC_ERR_INVALID_ARG;
-        }
+    default: {
+      return TCALC_ERR_INVALID_ARG;
+    }
+  }
+}
+
+/**
+ * Apply the operator of a unary node to its already evaluated operand
+*/
+static tcalc_err tcalc_eval_unary_node(
+  const char* expr, int32_t exprLen, const tcalc_token* tokens, const struct tcalc_ctx* ctx,
+  tcalc_exprtree_unary_node unnode, tcalc_val operand, struct tcalc_val* out
+) {
+  tcalc_err err = TCALC_ERR_OK;
+  struct tcalc_token opToken = tokens[unnode.tokenInd];
+
+  switch (opToken.type) {
+    case TCALC_TOK_UNOP: {
+      tcalc_unopdef unary_op_def;
+      ret_on_err(err, tcalc_ctx_getunop(ctx, tcalc_token_startcp(expr, opToken), tcalc_token_len(expr, exprLen, opToken), &unary_op_def));
+
+      out->type = TCALC_VALTYPE_NUM;
+      return unary_op_def.func(operand, &(out->as.num));
+    } break;
+    case TCALC_TOK_UNLOP: {
+      tcalc_unlopdef unary_lop_def;
+      ret_on_err(err, tcalc_ctx_getunlop(ctx, tcalc_token_startcp(expr, opToken), tcalc_token_len(expr, exprLen, opToken), &unary_lop_def));
+
+      out->type = TCALC_VALTYPE_BOOL;
+      return unary_lop_def.func(operand, &(out->as.boolean));
+    } break;
+    default: {
+      // TODO: More descriptive error
+      return TCALC_ERR_INVALID_ARG;
+    }
+  }
+}
+
+static tcalc_err tcalc_eval_value_node(
+  const char* expr, int32_t exprLen, const tcalc_token* tokens, const struct tcalc_ctx* ctx,
+  tcalc_exprtree_value_node value_node, struct tcalc_val* out
+) {
+  struct tcalc_token token = tokens[value_node.tokenInd];
+  switch (tokens[value_node.tokenInd].type) {
+    case TCALC_TOK_ID: {
+      const tcalc_vardef* vardef = tcalc_ctx_findvar(ctx, tcalc_token_startcp(expr, token), tcalc_token_len(expr, exprLen, token));
+      if (vardef != NULL) {
+        *out = vardef->val;
+        return TCALC_ERR_OK;
       }
+
+      // TODO: ERR
+      return TCALC_ERR_UNKNOWN_ID;
     } break;
-    case TCALC_EXPRTREE_NODE_TYPE_VALUE: {
-      const tcalc_exprtree_value_node value_node = treeArray[exprNodeInd].as.value;
-      struct tcalc_token token = tokens[value_node.tokenInd];
-      switch (tokens[value_node.tokenInd].type) {
-        case TCALC_TOK_ID: {
-          if (tcalc_ctx_hasvar(ctx, tcalc_token_startcp(expr, token), tcalc_token_len(token))) {
-            tcalc_vardef vardef = { 0 };
-            tcalc_ctx_getvar(ctx, tcalc_token_startcp(expr, token), tcalc_token_len(token), &vardef);
-            *out = vardef.val;
-            return TCALC_ERR_OK;
+    case TCALC_TOK_NUM: {
+      *out = TCALC_VAL_INIT_NUM(value_node.num);
+      return TCALC_ERR_OK;
+    } break;
+    default: {
+      // TODO: ERR
+      return TCALC_ERR_INVALID_ARG;
+    }
+  }
+}
+
+/**
+ * Evaluate a VALUE or CONST node, which have no children
+*/
+static tcalc_err tcalc_eval_leaf_node(
+  const char* expr, int32_t exprLen, const tcalc_token* tokens, const struct tcalc_ctx* ctx,
+  const tcalc_exprtree* node, struct tcalc_val* out
+) {
+  if (node->type == TCALC_EXPRTREE_NODE_TYPE_CONST) {
+    *out = node->as.constant.val;
+    return TCALC_ERR_OK;
+  }
+  return tcalc_eval_value_node(expr, exprLen, tokens, ctx, node->as.value, out);
+}
+
+static inline bool tcalc_exprtree_is_leaf(const tcalc_exprtree* node) {
+  return node->type == TCALC_EXPRTREE_NODE_TYPE_VALUE || node->type == TCALC_EXPRTREE_NODE_TYPE_CONST;
+}
+
+// States of the frame of a function node
+enum {
+  TCALC_EVALFRAME_FUNC_START,
+  TCALC_EVALFRAME_UNFUNC_ARG, // waiting on the only argument of a unary function
+  TCALC_EVALFRAME_BINFUNC_ARG1, // waiting on the first argument of a binary function
+  TCALC_EVALFRAME_BINFUNC_ARG2 // waiting on the second argument of a binary function
+};
+
+tcalc_err tcalc_eval_exprtree_stk(
+  const char* expr, int32_t exprLen,
+  tcalc_exprtree* treeArray, int32_t treeArrayLen, int32_t exprNodeInd,
+  tcalc_token *tokens, int32_t tokensLen,
+  const struct tcalc_ctx* ctx,
+  tcalc_evalframe* frames, int32_t framesCapacity,
+  struct tcalc_val* out
+) {
+  assert(expr != NULL);
+  assert(ctx != NULL);
+  assert(frames != NULL || framesCapacity == 0);
+  assert(out != NULL);
+  (void)exprLen;
+  (void)tokensLen;
+  // note that this function does not allocate any data in any way
+
+  tcalc_err err = TCALC_ERR_OK;
+  tcalc_val res = { 0 }; // result of the node which finished most recently
+  int32_t top = 0; // number of frames in use
+
+  // Leaves are evaluated into res in place, as giving them a frame of their
+  // own would only cost another trip around the loop. Any other node gets a
+  // frame pushed, and the loop moves on to it.
+  #define TCALC_EVALFRAME_DESCEND(_nodeInd_) \
+    if (!tcalc_exprtree_is_leaf(&(treeArray[(_nodeInd_)]))) { \
+      reterr_on_true(err, top >= framesCapacity, TCALC_ERR_MAX_DEPTH); \
+      frames[top++] = (tcalc_evalframe){ .nodeInd = (_nodeInd_), .state = 0 }; \
+      continue; \
+    } \
+    ret_on_err(err, tcalc_eval_leaf_node(expr, exprLen, tokens, ctx, &(treeArray[(_nodeInd_)]), &res))
+
+  reterr_on_true(err, framesCapacity < 1, TCALC_ERR_MAX_DEPTH);
+  frames[top++] = (tcalc_evalframe){ .nodeInd = exprNodeInd, .state = 0 };
+
+  // Each iteration works on the top frame until it either pushes a frame for
+  // a child, or finishes the frame's node and leaves its result in res.
+  while (top > 0) {
+    tcalc_evalframe* const frame = &(frames[top - 1]);
+    assert(frame->nodeInd >= 0 && frame->nodeInd < treeArrayLen);
+    const tcalc_exprtree* const node = &(treeArray[frame->nodeInd]);
+
+    switch (node->type) {
+      case TCALC_EXPRTREE_NODE_TYPE_BINARY: {
+        if (frame->state == 0) {
+          frame->state = 1;
+          TCALC_EVALFRAME_DESCEND(node->as.binary.leftTreeInd);
+        }
+        if (frame->state == 1) {
+          frame->state = 2;
+          frame->operand = res;
+          TCALC_EVALFRAME_DESCEND(node->as.binary.rightTreeInd);
+        }
+        ret_on_err(err, tcalc_eval_binary_node(expr, exprLen, tokens, ctx, node->as.binary, frame->operand, res, &res));
+      } break;
+      case TCALC_EXPRTREE_NODE_TYPE_UNARY: {
+        if (frame->state == 0) {
+          frame->state = 1;
+          TCALC_EVALFRAME_DESCEND(node->as.unary.childTreeInd);
+        }
+        ret_on_err(err, tcalc_eval_unary_node(expr, exprLen, tokens, ctx, node->as.unary, res, &res));
+      } break;
+      case TCALC_EXPRTREE_NODE_TYPE_VALUE:
+      case TCALC_EXPRTREE_NODE_TYPE_CONST: {
+        ret_on_err(err, tcalc_eval_leaf_node(expr, exprLen, tokens, ctx, node, &res));
+      } break;
+      case TCALC_EXPRTREE_NODE_TYPE_FUNCARG: {
+        // an argument evaluates to its expression, so reuse the frame for it
+        frame->nodeInd = node->as.funcarg.exprInd;
+        frame->state = 0;
+      } continue;
+      case TCALC_EXPRTREE_NODE_TYPE_FUNC: {
+        const tcalc_exprtree_func_node funcnode = node->as.func;
+        if (frame->state == TCALC_EVALFRAME_FUNC_START) {
+          const tcalc_token nameToken = tokens[funcnode.tokenInd];
+          const int32_t argListLen = tcalc_exprtree_func_list_length(treeArray, treeArrayLen, frame->nodeInd);
+          frame->def.unfunc = tcalc_ctx_findunfunc(ctx, tcalc_token_startcp(expr, nameToken), tcalc_token_len(expr, exprLen, nameToken));
+          if (frame->def.unfunc != NULL) {
+            reterr_on_true(err, argListLen != 1, TCALC_ERR_WRONG_ARITY);
+            frame->state = TCALC_EVALFRAME_UNFUNC_ARG;
+          } else {
+            frame->def.binfunc = tcalc_ctx_findbinfunc(ctx, tcalc_token_startcp(expr, nameToken), tcalc_token_len(expr, exprLen, nameToken));
+            // TODO: Better err
+            reterr_on_true(err, frame->def.binfunc == NULL, TCALC_ERR_UNKNOWN_ID);
+            reterr_on_true(err, argListLen != 2, TCALC_ERR_WRONG_ARITY);
+            frame->state = TCALC_EVALFRAME_BINFUNC_ARG1;
           }
+          TCALC_EVALFRAME_DESCEND(treeArray[funcnode.funcArgHeadInd].as.funcarg.exprInd);
+        }
+        if (frame->state == TCALC_EVALFRAME_BINFUNC_ARG1) {
+          frame->state = TCALC_EVALFRAME_BINFUNC_ARG2;
+          frame->operand = res;
+          const int32_t arg2Ind = treeArray[funcnode.funcArgHeadInd].as.funcarg.nextArgInd;
+          TCALC_EVALFRAME_DESCEND(treeArray[arg2Ind].as.funcarg.exprInd);
+        }
 
-          // TODO: ERR
-          return TCALC_ERR_UNKNOWN_ID;
-        } break;
-        case TCALC_TOK_NUM: {
-          out->type = TCALC_VALTYPE_NUM;
-          return tcalc_lpstrtodouble(tcalc_token_startcp(expr, token), tcalc_token_len(token), &(out->as.num));
-        } break;
-        default: {
-          // TODO: ERR
-          return TCALC_ERR_INVALID_ARG;
+        const tcalc_val arg = res;
+        res.type = TCALC_VALTYPE_NUM;
+        if (frame->state == TCALC_EVALFRAME_UNFUNC_ARG) {
+          ret_on_err(err, frame->def.unfunc->func(arg, &(res.as.num)));
+        } else {
+          ret_on_err(err, frame->def.binfunc->func(frame->operand, arg, &(res.as.num)));
         }
-      }
+      } break;
     }
-    break;
-    case TCALC_EXPRTREE_NODE_TYPE_FUNC: {
-      const tcalc_exprtree_func_node funcnode = treeArray[exprNodeInd].as.func;
-      const tcalc_token nameToken = tokens[funcnode.tokenInd];
-      if (tcalc_ctx_hasunfunc(ctx, tcalc_token_startcp(expr, nameToken), tcalc_token_len(nameToken)))
-      {
-        const int32_t argListLen = tcalc_exprtree_func_list_length(treeArray, treeArrayLen, exprNodeInd);
-        reterr_on_true(err, argListLen != 1, TCALC_ERR_WRONG_ARITY);
-        tcalc_val argVal = { 0 };
-        ret_on_err(err, tcalc_eval_exprtree(expr, exprLen, treeArray, treeArrayLen, funcnode.funcArgHeadInd, tokens, tokensLen, ctx, &argVal));
-
-        tcalc_unfuncdef unfuncdef = { 0 };
-        ret_on_err(err, tcalc_ctx_getunfunc(ctx, tcalc_token_startcp(expr, nameToken), tcalc_token_len(nameToken), &unfuncdef));
-
-
-        out->type = TCALC_VALTYPE_NUM;
-        return unfuncdef.func(argVal, &(out->as.num));
-      }
-      if (tcalc_ctx_hasbinfunc(ctx, tcalc_token_startcp(expr, nameToken), tcalc_token_len(nameToken)))
-      {
-        const int32_t argListLen = tcalc_exprtree_func_list_length(treeArray, treeArrayLen, exprNodeInd);
-        reterr_on_true(err, argListLen != 2, TCALC_ERR_WRONG_ARITY);
-        tcalc_val argVal1 = { 0 };
-        ret_on_err(err, tcalc_eval_exprtree(expr, exprLen, treeArray, treeArrayLen, funcnode.funcArgHeadInd, tokens, tokensLen, ctx, &argVal1));
-        tcalc_val argVal2 = { 0 };
-        ret_on_err(err, tcalc_eval_exprtree(expr, exprLen, treeArray, treeArrayLen, treeArray[funcnode.funcArgHeadInd].as.funcarg.nextArgInd, tokens, tokensLen, ctx, &argVal2));
-
-        tcalc_binfuncdef binfuncdef;
-        ret_on_err(err, tcalc_ctx_getbinfunc(ctx, tcalc_token_startcp(expr, nameToken), tcalc_token_len(nameToken), &binfuncdef));
-
-        out->type = TCALC_VALTYPE_NUM;
-        return binfuncdef.func(argVal1, argVal2, &(out->as.num));
-      }
-      else
-      {
-        // TODO: Better err
-        return TCALC_ERR_UNKNOWN_ID;
+
+    top--; // the top frame's node is finished
+  }
+
+  #undef TCALC_EVALFRAME_DESCEND
+
+  *out = res;
+  return TCALC_ERR_OK;
+}
+
+tcalc_err tcalc_eval_exprtree(
+  const char* expr, int32_t exprLen,
+  tcalc_exprtree* treeArray, int32_t treeArrayLen, int32_t exprNodeInd,
+  tcalc_token *tokens, int32_t tokensLen,
+  const struct tcalc_ctx* ctx,
+  struct tcalc_val* out
+) {
+  assert(ctx != NULL);
+
+  // as with tcalc_exprtree_walk, a tree never needs more frames than nodes
+  if (treeArrayLen <= TCALC_EVAL_STACK_FRAMES) {
+    tcalc_evalframe frames[TCALC_EVAL_STACK_FRAMES];
+    return tcalc_eval_exprtree_stk(
+      expr, exprLen, treeArray, treeArrayLen, exprNodeInd, tokens, tokensLen,
+      ctx, frames, (int32_t)TCALC_ARRAY_SIZE(frames), out
+    );
+  }
+
+  const size_t framesSize = sizeof(tcalc_evalframe) * (size_t)treeArrayLen;
+  tcalc_evalframe* frames = (tcalc_evalframe*)tcalc_alloc(ctx->allocator, framesSize);
+  if (frames == NULL) return TCALC_ERR_NOMEM;
+  const tcalc_err err = tcalc_eval_exprtree_stk(
+    expr, exprLen, treeArray, treeArrayLen, exprNodeInd, tokens, tokensLen,
+    ctx, frames, treeArrayLen, out
+  );
+  tcalc_free(ctx->allocator, frames, framesSize);
+  return err;
+}
+
+/**
+ * Get the field of node referring to its child number childNum, in
+ * evaluation order, or NULL once there are no more children
+*/
+static int32_t* tcalc_exprtree_child_slot(tcalc_exprtree* node, int32_t childNum) {
+  switch (node->type) {
+    case TCALC_EXPRTREE_NODE_TYPE_BINARY:
+      if (childNum == 0) return &(node->as.binary.leftTreeInd);
+      if (childNum == 1) return &(node->as.binary.rightTreeInd);
+      return NULL;
+    case TCALC_EXPRTREE_NODE_TYPE_UNARY:
+      return childNum == 0 ? &(node->as.unary.childTreeInd) : NULL;
+    case TCALC_EXPRTREE_NODE_TYPE_FUNC:
+      return childNum == 0 ? &(node->as.func.funcArgHeadInd) : NULL;
+    case TCALC_EXPRTREE_NODE_TYPE_FUNCARG:
+      if (childNum == 0) return &(node->as.funcarg.exprInd);
+      if (childNum == 1) return &(node->as.funcarg.nextArgInd);
+      return NULL;
+    case TCALC_EXPRTREE_NODE_TYPE_VALUE:
+    case TCALC_EXPRTREE_NODE_TYPE_CONST:
+      return NULL;
+  }
+
+  assert(0); // unreachable
+  return NULL;
+}
+
+tcalc_err tcalc_exprtree_walk(
+  tcalc_exprtree* exprtree, int32_t exprNodeInd, tcalc_exprtree_walkframe* frames,
+  tcalc_exprtree_enterfn enter, tcalc_exprtree_leavefn leave, void* user
+) {
+  assert(exprtree != NULL);
+  assert(frames != NULL);
+  tcalc_err err = TCALC_ERR_OK;
+  bool descend = true;
+  if (enter != NULL) ret_on_err(err, enter(user, exprNodeInd, NULL, &descend));
+  if (!descend) return TCALC_ERR_OK;
+
+  int32_t framesLen = 0;
+  frames[framesLen++] = (tcalc_exprtree_walkframe){ .nodeInd = exprNodeInd, .next = 0, .slot = NULL };
+  while (framesLen > 0) {
+    tcalc_exprtree_walkframe* top = &frames[framesLen - 1];
+    int32_t* childSlot = tcalc_exprtree_child_slot(&exprtree[top->nodeInd], top->next++);
+    if (childSlot != NULL) {
+      const int32_t childInd = *childSlot;
+      if (childInd < 0) continue; // end of a function argument list
+      descend = true;
+      if (enter != NULL) ret_on_err(err, enter(user, childInd, childSlot, &descend));
+      if (descend)
+        frames[framesLen++] = (tcalc_exprtree_walkframe){ .nodeInd = childInd, .next = 0, .slot = childSlot };
+      continue;
+    }
+
+    framesLen--;
+    if (leave != NULL) ret_on_err(err, leave(user, frames[framesLen].nodeInd, frames[framesLen].slot));
+  }
+
+  return TCALC_ERR_OK;
+}
+
+typedef struct tcalc_fold_ctx {
+  const char* expr;
+  int32_t exprLen;
+  tcalc_exprtree* tree;
+  int32_t treeLen;
+  tcalc_token* tokens;
+  int32_t tokensLen;
+  const struct tcalc_ctx* ctx;
+} tcalc_fold_ctx;
+
+static bool tcalc_fold_isconst(const tcalc_fold_ctx* fold, int32_t nodeInd) {
+  return fold->tree[nodeInd].type == TCALC_EXPRTREE_NODE_TYPE_CONST;
+}
+
+/**
+ * Fold the node at nodeInd once all of its children are folded. Children
+ * which could be folded have become TCALC_EXPRTREE_NODE_TYPE_CONST nodes, so
+ * the node is folded as well if every child it has did. Both sides of a
+ * binary node are always folded, even when the left side is not constant.
+*/
+static tcalc_err tcalc_fold_leave(void* user, int32_t nodeInd, int32_t* slot) {
+  (void)slot;
+  const tcalc_fold_ctx* fold = (const tcalc_fold_ctx*)user;
+  tcalc_exprtree* node = &(fold->tree[nodeInd]);
+  bool isConst = true;
+
+  switch (node->type) {
+    case TCALC_EXPRTREE_NODE_TYPE_CONST:
+    case TCALC_EXPRTREE_NODE_TYPE_FUNCARG: // folded as part of its function
+      return TCALC_ERR_OK;
+    case TCALC_EXPRTREE_NODE_TYPE_VALUE: {
+      const tcalc_token token = fold->tokens[node->as.value.tokenInd];
+      if (token.type == TCALC_TOK_ID) {
+        const tcalc_vardef* vardef = tcalc_ctx_findvar(fold->ctx, tcalc_token_startcp(fold->expr, token), tcalc_token_len(fold->expr, fold->exprLen, token));
+        isConst = vardef != NULL && vardef->immutable;
       }
+    } break;
+    case TCALC_EXPRTREE_NODE_TYPE_BINARY:
+      isConst = tcalc_fold_isconst(fold, node->as.binary.leftTreeInd) && tcalc_fold_isconst(fold, node->as.binary.rightTreeInd);
+      break;
+    case TCALC_EXPRTREE_NODE_TYPE_UNARY:
+      isConst = tcalc_fold_isconst(fold, node->as.unary.childTreeInd);
+      break;
+    case TCALC_EXPRTREE_NODE_TYPE_FUNC:
+      for (int32_t argInd = node->as.func.funcArgHeadInd; argInd >= 0 && isConst; argInd = fold->tree[argInd].as.funcarg.nextArgInd)
+        isConst = tcalc_fold_isconst(fold, fold->tree[argInd].as.funcarg.exprInd);
+      break;
+  }
+
+  if (!isConst) return TCALC_ERR_OK;
+
+  // every child is a leaf by now, so the node only takes a single frame. A
+  // node which fails to evaluate is left as it is.
+  tcalc_evalframe evalFrame;
+  tcalc_val val = { 0 };
+  if (tcalc_eval_exprtree_stk(fold->expr, fold->exprLen, fold->tree, fold->treeLen, nodeInd, fold->tokens, fold->tokensLen, fold->ctx, &evalFrame, 1, &val) != TCALC_ERR_OK)
+    return TCALC_ERR_OK;
+
+  node->type = TCALC_EXPRTREE_NODE_TYPE_CONST;
+  node->as.constant.val = val;
+  return TCALC_ERR_OK;
+}
+
+tcalc_err tcalc_fold_exprtree(
+  const char* expr, int32_t exprLen,
+  tcalc_exprtree* treeArray, int32_t treeArrayLen, int32_t exprNodeInd,
+  tcalc_token *tokens, int32_t tokensLen,
+  const struct tcalc_ctx* ctx
+) {
+  assert(ctx != NULL);
+  return tcalc_fold_exprtree_walloc(
+    expr, exprLen, treeArray, treeArrayLen, exprNodeInd, tokens, tokensLen,
+    ctx, ctx->allocator
+  );
+}
+
+tcalc_err tcalc_fold_exprtree_walloc(
+  const char* expr, int32_t exprLen,
+  tcalc_exprtree* treeArray, int32_t treeArrayLen, int32_t exprNodeInd,
+  tcalc_token *tokens, int32_t tokensLen,
+  const struct tcalc_ctx* ctx, const tcalc_allocator* scratch
+) {
+  assert(expr != NULL);
+  assert(ctx != NULL);
+  if (exprNodeInd < 0 || exprNodeInd >= treeArrayLen)
+    return TCALC_ERR_OUT_OF_BOUNDS;
+
+  tcalc_exprtree_walkframe* frames = (tcalc_exprtree_walkframe*)tcalc_alloc(scratch, sizeof(tcalc_exprtree_walkframe) * (size_t)treeArrayLen);
+  if (frames == NULL) return TCALC_ERR_NOMEM;
+
+  tcalc_fold_ctx fold = {
+    .expr = expr,
+    .exprLen = exprLen,
+    .tree = treeArray,
+    .treeLen = treeArrayLen,
+    .tokens = tokens,
+    .tokensLen = tokensLen,
+    .ctx = ctx
+  };
+  const tcalc_err err = tcalc_exprtree_walk(treeArray, exprNodeInd, frames, NULL, tcalc_fold_leave, &fold);
+
+  tcalc_free(scratch, frames, sizeof(tcalc_exprtree_walkframe) * (size_t)treeArrayLen);
+  return err;
+}
+
+/**
+ * Common subexpression elimination
+ *
+ * Nodes are visited in post-order, so the children of a node have already
+ * been replaced by their canonical copies when the node itself is hashed.
+ * Two nodes are then identical exactly when they have the same type, the same
+ * operator or value, and the same (canonical) child indices.
+*/
+
+typedef struct tcalc_cse_ctx {
+  const char* expr;
+  int32_t exprLen;
+  tcalc_exprtree* tree;
+  const tcalc_token* tokens;
+  int32_t* canon; // canonical index of each visited node, -1 if unvisited
+  int32_t* table; // open-addressed node indices, -1 if empty
+  size_t tableMask;
+  int32_t eliminated;
+} tcalc_cse_ctx;
+
+static uint32_t tcalc_cse_hash_bytes(uint32_t hash, const void* data, size_t len) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static uint32_t tcalc_cse_hash_token(const tcalc_cse_ctx* cse, uint32_t hash, int32_t tokenInd) {
+  if (tokenInd < 0) return tcalc_cse_hash_bytes(hash, "", 1); // implicit multiplication
+  const tcalc_token token = cse->tokens[tokenInd];
+  const uint32_t type = token.type;
+  hash = tcalc_cse_hash_bytes(hash, &type, sizeof(type));
+  return tcalc_cse_hash_bytes(hash, tcalc_token_startcp(cse->expr, token), (size_t)tcalc_token_len(cse->expr, cse->exprLen, token));
+}
+
+static uint32_t tcalc_cse_hash_node(const tcalc_cse_ctx* cse, const tcalc_exprtree* node) {
+  uint32_t hash = tcalc_cse_hash_bytes(2166136261u, &(node->type), sizeof(node->type));
+  switch (node->type) {
+    case TCALC_EXPRTREE_NODE_TYPE_BINARY:
+      hash = tcalc_cse_hash_token(cse, hash, node->as.binary.tokenIndOImplMult);
+      hash = tcalc_cse_hash_bytes(hash, &(node->as.binary.leftTreeInd), sizeof(int32_t));
+      return tcalc_cse_hash_bytes(hash, &(node->as.binary.rightTreeInd), sizeof(int32_t));
+    case TCALC_EXPRTREE_NODE_TYPE_UNARY:
+      hash = tcalc_cse_hash_token(cse, hash, node->as.unary.tokenInd);
+      return tcalc_cse_hash_bytes(hash, &(node->as.unary.childTreeInd), sizeof(int32_t));
+    case TCALC_EXPRTREE_NODE_TYPE_VALUE:
+      return tcalc_cse_hash_token(cse, hash, node->as.value.tokenInd);
+    case TCALC_EXPRTREE_NODE_TYPE_FUNC:
+      hash = tcalc_cse_hash_token(cse, hash, node->as.func.tokenInd);
+      return tcalc_cse_hash_bytes(hash, &(node->as.func.funcArgHeadInd), sizeof(int32_t));
+    case TCALC_EXPRTREE_NODE_TYPE_FUNCARG:
+      hash = tcalc_cse_hash_bytes(hash, &(node->as.funcarg.exprInd), sizeof(int32_t));
+      return tcalc_cse_hash_bytes(hash, &(node->as.funcarg.nextArgInd), sizeof(int32_t));
+    case TCALC_EXPRTREE_NODE_TYPE_CONST: {
+      const tcalc_val val = node->as.constant.val;
+      hash = tcalc_cse_hash_bytes(hash, &(val.type), sizeof(val.type));
+      if (val.type == TCALC_VALTYPE_NUM)
+        return tcalc_cse_hash_bytes(hash, &(val.as.num), sizeof(double));
+      return tcalc_cse_hash_bytes(hash, &(val.as.boolean), sizeof(bool));
     }
-    break;
-    case TCALC_EXPRTREE_NODE_TYPE_FUNCARG: {
-      return tcalc_eval_exprtree(expr, exprLen, treeArray, treeArrayLen, treeArray[exprNodeInd].as.funcarg.exprInd, tokens, tokensLen, ctx, out);
+  }
+  return hash;
+}
+
+static bool tcalc_cse_tokens_equal(const tcalc_cse_ctx* cse, int32_t a, int32_t b) {
+  if (a < 0 || b < 0) return a < 0 && b < 0;
+  const tcalc_token ta = cse->tokens[a], tb = cse->tokens[b];
+  return ta.type == tb.type && tcalc_token_len(cse->expr, cse->exprLen, ta) == tcalc_token_len(cse->expr, cse->exprLen, tb) &&
+    memcmp(tcalc_token_startcp(cse->expr, ta), tcalc_token_startcp(cse->expr, tb), (size_t)tcalc_token_len(cse->expr, cse->exprLen, ta)) == 0;
+}
+
+static bool tcalc_cse_nodes_equal(const tcalc_cse_ctx* cse, const tcalc_exprtree* a, const tcalc_exprtree* b) {
+  if (a->type != b->type) return false;
+  switch (a->type) {
+    case TCALC_EXPRTREE_NODE_TYPE_BINARY:
+      return a->as.binary.leftTreeInd == b->as.binary.leftTreeInd &&
+        a->as.binary.rightTreeInd == b->as.binary.rightTreeInd &&
+        tcalc_cse_tokens_equal(cse, a->as.binary.tokenIndOImplMult, b->as.binary.tokenIndOImplMult);
+    case TCALC_EXPRTREE_NODE_TYPE_UNARY:
+      return a->as.unary.childTreeInd == b->as.unary.childTreeInd &&
+        tcalc_cse_tokens_equal(cse, a->as.unary.tokenInd, b->as.unary.tokenInd);
+    case TCALC_EXPRTREE_NODE_TYPE_VALUE:
+      return tcalc_cse_tokens_equal(cse, a->as.value.tokenInd, b->as.value.tokenInd);
+    case TCALC_EXPRTREE_NODE_TYPE_FUNC:
+      return a->as.func.funcArgHeadInd == b->as.func.funcArgHeadInd &&
+        tcalc_cse_tokens_equal(cse, a->as.func.tokenInd, b->as.func.tokenInd);
+    case TCALC_EXPRTREE_NODE_TYPE_FUNCARG:
+      return a->as.funcarg.exprInd == b->as.funcarg.exprInd &&
+        a->as.funcarg.nextArgInd == b->as.funcarg.nextArgInd;
+    case TCALC_EXPRTREE_NODE_TYPE_CONST: {
+      const tcalc_val va = a->as.constant.val, vb = b->as.constant.val;
+      if (va.type != vb.type) return false;
+      if (va.type == TCALC_VALTYPE_NUM)
+        return memcmp(&(va.as.num), &(vb.as.num), sizeof(double)) == 0;
+      return va.as.boolean == vb.as.boolean;
     }
-    break;
   }
+  return false;
+}
 
-  assert(0); // unreachable
-  return TCALC_ERR_INVALID_ARG;
+/**
+ * Find the canonical copy of the node at nodeInd, whose children are already
+ * canonical, adding the node to the table if it is the first of its kind
+*/
+static int32_t tcalc_cse_intern(tcalc_cse_ctx* cse, int32_t nodeInd) {
+  const tcalc_exprtree* node = &(cse->tree[nodeInd]);
+  const uint32_t hash = tcalc_cse_hash_node(cse, node);
+  size_t i = hash & cse->tableMask;
+  for (; cse->table[i] >= 0; i = (i + 1) & cse->tableMask) {
+    const int32_t other = cse->table[i];
+    if (tcalc_cse_nodes_equal(cse, node, &(cse->tree[other]))) {
+      cse->canon[nodeInd] = other;
+      cse->eliminated++;
+      return other;
+    }
+  }
+
+  cse->table[i] = nodeInd;
+  cse->canon[nodeInd] = nodeInd;
+  return nodeInd;
+}
+
+/**
+ * A child which is already merged is replaced by its canonical copy straight
+ * away, without walking it again
+*/
+static tcalc_err tcalc_cse_enter(void* user, int32_t nodeInd, int32_t* slot, bool* outDescend) {
+  tcalc_cse_ctx* cse = (tcalc_cse_ctx*)user;
+  *outDescend = cse->canon[nodeInd] < 0;
+  if (!*outDescend) *slot = cse->canon[nodeInd];
+  return TCALC_ERR_OK;
+}
+
+static tcalc_err tcalc_cse_leave(void* user, int32_t nodeInd, int32_t* slot) {
+  tcalc_cse_ctx* cse = (tcalc_cse_ctx*)user;
+  const int32_t canonInd = tcalc_cse_intern(cse, nodeInd);
+  if (slot != NULL) *slot = canonInd;
+  return TCALC_ERR_OK;
+}
+
+tcalc_err tcalc_cse_exprtree(
+  const char* expr, int32_t exprLen,
+  tcalc_exprtree* treeArray, int32_t treeArrayLen, int32_t exprNodeInd,
+  const tcalc_token *tokens, int32_t tokensLen,
+  int32_t* outEliminated
+) {
+  return tcalc_cse_exprtree_walloc(
+    expr, exprLen, treeArray, treeArrayLen, exprNodeInd, tokens, tokensLen,
+    NULL, outEliminated
+  );
+}
+
+tcalc_err tcalc_cse_exprtree_walloc(
+  const char* expr, int32_t exprLen,
+  tcalc_exprtree* treeArray, int32_t treeArrayLen, int32_t exprNodeInd,
+  const tcalc_token *tokens, int32_t tokensLen,
+  const tcalc_allocator* scratch, int32_t* outEliminated
+) {
+  assert(expr != NULL);
+  assert(treeArray != NULL);
+  assert(tokens != NULL);
+  (void)tokensLen;
+  if (outEliminated != NULL) *outEliminated = 0;
+  if (exprNodeInd < 0 || exprNodeInd >= treeArrayLen)
+    return TCALC_ERR_OUT_OF_BOUNDS;
+
+  // at most treeArrayLen entries, kept at most half full
+  size_t tableCap = 16;
+  while (tableCap < 2 * (size_t)treeArrayLen) tableCap *= 2;
+
+  tcalc_err err = TCALC_ERR_OK;
+  tcalc_cse_ctx cse = {
+    .expr = expr,
+    .exprLen = exprLen,
+    .tree = treeArray,
+    .tokens = tokens,
+    .canon = NULL,
+    .table = NULL,
+    .tableMask = tableCap - 1,
+    .eliminated = 0
+  };
+  cse.canon = (int32_t*)tcalc_alloc(scratch, sizeof(int32_t) * (size_t)treeArrayLen);
+  cse.table = (int32_t*)tcalc_alloc(scratch, sizeof(int32_t) * tableCap);
+  tcalc_exprtree_walkframe* frames = (tcalc_exprtree_walkframe*)tcalc_alloc(scratch, sizeof(tcalc_exprtree_walkframe) * (size_t)treeArrayLen);
+  cleanup_if(err, cse.canon == NULL || cse.table == NULL || frames == NULL, TCALC_ERR_NOMEM);
+  memset(cse.canon, -1, sizeof(int32_t) * (size_t)treeArrayLen);
+  memset(cse.table, -1, sizeof(int32_t) * tableCap);
+
+  // the root is never a duplicate of anything, so its index does not change
+  cleanup_on_err(err, tcalc_exprtree_walk(treeArray, exprNodeInd, frames, tcalc_cse_enter, tcalc_cse_leave, &cse));
+  if (outEliminated != NULL) *outEliminated = cse.eliminated;
+
+  cleanup:
+    // freed in the opposite order, so that an arena can take them all back
+    tcalc_free(scratch, frames, sizeof(tcalc_exprtree_walkframe) * (size_t)treeArrayLen);
+    tcalc_free(scratch, cse.table, sizeof(int32_t) * tableCap);
+    tcalc_free(scratch, cse.canon, sizeof(int32_t) * (size_t)treeArrayLen);
+    return err;
 }
@@ -1,5 +1,7 @@
 #include "tcalc.h"
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 
 void* tcalc_xmalloc(size_t size) {
   void* data = malloc(size);
@@ -18,3 +20,59 @@ void* tcalc_xrealloc(void* ptr, size_t newsize) {
   if (newptr == NULL) tcalc_die("[tcalc_realloc] bad realloc: %d bytes", newsize);
   return newptr;
 }
+
+static void* tcalc_default_alloc(void* user, size_t size) {
+  (void)user;
+  return malloc(size);
+}
+
+static void* tcalc_default_realloc(void* user, void* ptr, size_t oldSize, size_t newSize) {
+  (void)user;
+  (void)oldSize;
+  return realloc(ptr, newSize);
+}
+
+static void tcalc_default_free(void* user, void* ptr, size_t size) {
+  (void)user;
+  (void)size;
+  free(ptr);
+}
+
+static const tcalc_allocator tcalc_default_allocator = {
+  .alloc = tcalc_default_alloc,
+  .realloc = tcalc_default_realloc,
+  .free = tcalc_default_free,
+  .user = NULL
+};
+
+const tcalc_allocator* tcalc_allocator_default(void) {
+  return &tcalc_default_allocator;
+}
+
+void* tcalc_alloc(const tcalc_allocator* allocator, size_t size) {
+  if (allocator == NULL) return malloc(size);
+  return allocator->alloc(allocator->user, size);
+}
+
+void* tcalc_calloc(const tcalc_allocator* allocator, size_t nmemb, size_t size) {
+  if (allocator == NULL) return calloc(nmemb, size);
+  if (size != 0 && nmemb > SIZE_MAX / size) return NULL;
+  void* data = allocator->alloc(allocator->user, nmemb * size);
+  if (data != NULL) memset(data, 0, nmemb * size);
+  return data;
+}
+
+void* tcalc_realloc(const tcalc_allocator* allocator, void* ptr, size_t oldSize, size_t newSize) {
+  if (allocator == NULL) return realloc(ptr, newSize);
+  if (ptr == NULL) return allocator->alloc(allocator->user, newSize);
+  return (allocator->realloc)(allocator->user, ptr, oldSize, newSize);
+}
+
+void tcalc_free(const tcalc_allocator* allocator, void* ptr, size_t size) {
+  if (ptr == NULL) return;
+  if (allocator == NULL) {
+    free(ptr);
+    return;
+  }
+  (allocator->free)(allocator->user, ptr, size);
+}
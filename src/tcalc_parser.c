@@ -1,37 +1,19 @@
 #include "tcalc.h"
 #include <stdbool.h>
 #include <stddef.h>
-#include <string.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <limits.h>
 
 /*
-Syntactical Description of the recursive descent tcalc parser
+Syntactical Description of the tcalc parser
 
 Comments are prepended by a hash (#) symbol
 
 ```
-# lowest precedence, top of parse tree
-
-expression -> term
-
-logic_or -> logic_and ( '||' logic_and )*
-logic_and -> equality ( '&&' equality )*
-equality -> relation ( ( '=' | '==' | '!=' ) relation )*
-relation -> term ( ( '<' | '<=' | '>' | '>=' ) term )*
-
-term -> factor ( ( "+" | "-" ) factor )*
-factor -> unary ( ( "*" | "/" | "%" ) unary )*
-
-# Maybe having logical NOT in the 'unary' rule is weird? I don't know where else
-# to put it though. Perhaps it could go above 'term', since arithmetic expressions
-# cannot be acted on by the Logical NOT operator anyway unlike in C and C-like
-# languages
-
-unary -> ( "+" | "-" | "!" )* exponentiation
-
-exponentiation -> primary ( ( "^" | "**" ) exponentiation )
+expression -> operand ( binary_operator operand )*
+operand -> prefix_operator* primary
 
 primary -> variable | NUMBER | func | ( "(" expression ")" );
 func -> funcname "(" funcargs? ")"
@@ -40,10 +22,56 @@ funcargs -> expression ( "," expression )*
 variable -> IDENTIFIER
 funcname -> IDENTIFIER
 
-# highest precedence, bottom of parse tree
+# binary operators are the binary operators, relation operators, and binary
+# logical operators of the context, along with implicit multiplication, which
+# is the binary operator named "". Equality operators may be defined as either
+# relation or binary logical operators.
+#
+# prefix operators are the unary operators and unary logical operators of the
+# context.
 ```
+
+The grammar itself is flat, and how tightly each operator binds is taken from
+the prec and assoc of its definition in the tcalc_ctx. A prefix operator binds
+to everything after it of higher precedence, or of the same precedence if that
+is right associative. With the default contexts for example, "-2^2" is parsed
+as "-(2^2)", while "-2*2" is parsed as "(-2)*2".
+
+The parser is an operator-precedence (shunting-yard) parser. It works through
+the tokens in a single loop, keeping operators, parentheses and function calls
+that are still open on an explicit stack instead of the C stack, so nesting
+depth is only limited by memory.
 */
 
+typedef enum tcalc_pstk_entry_type {
+  TCALC_PSTK_BINARY, // a binary operator waiting on its right operand
+  TCALC_PSTK_PREFIX, // a prefix operator waiting on its operand
+  TCALC_PSTK_GROUP, // an open "("
+  TCALC_PSTK_FUNC // an open function call
+} tcalc_pstk_entry_type;
+
+typedef struct tcalc_pstk_entry {
+  tcalc_pstk_entry_type type;
+  int prec; // BINARY and PREFIX only
+  int32_t ind; // BINARY: tokenIndOImplMult, PREFIX: token index, FUNC: func node index
+  int32_t argTailInd; // FUNC only, the funcarg node of the argument being parsed
+  int32_t argCount; // FUNC only
+} tcalc_pstk_entry;
+
+// Lazily filled cache of operator definitions, to look up every operator in
+// the context only once per parse. Entries are only valid once their bit is
+// set in known, so that the cache does not have to be cleared for every parse.
+typedef struct tcalc_popcache {
+  uint64_t known; // bit i: entry i has been looked up
+  uint64_t defined; // bit i: entry i is defined in the context
+  tcalc_opdata data[2 * TCALC_OPKIND_COUNT + 1];
+} tcalc_popcache;
+
+// Indices into a tcalc_popcache
+#define TCALC_POPCACHE_BINOP(kind) (kind)
+#define TCALC_POPCACHE_PREFIXOP(kind) (TCALC_OPKIND_COUNT + (kind))
+#define TCALC_POPCACHE_IMPLICIT_MULT (2 * TCALC_OPKIND_COUNT)
+
 typedef struct tcalc_pctx {
   const char* expr;
   int32_t exprLen;
@@ -53,22 +81,21 @@ typedef struct tcalc_pctx {
   tcalc_exprtree *tree;
   int32_t treeLen;
   int32_t treeCap;
-} tcalc_pctx;
 
-typedef tcalc_err (tcalc_parsefunc_func_t)(tcalc_pctx*, int32_t*);
+  const tcalc_ctx* ctx;
+  tcalc_popcache* opcache;
+
+  // both stacks hold at most one entry per token
+  tcalc_pstk_entry* ops;
+  int32_t opsLen;
+  int32_t* operands; // tree indices of finished operands
+  int32_t operandsLen;
+} tcalc_pctx;
 
-static tcalc_err tcalc_parsefunc_expression(tcalc_pctx* pctx, int32_t* outTreeInd);
-static tcalc_err tcalc_parsefunc_logic_or(tcalc_pctx* pctx, int32_t* outTreeInd);
-static tcalc_err tcalc_parsefunc_logic_and(tcalc_pctx* pctx, int32_t* outTreeInd);
-static tcalc_err tcalc_parsefunc_equality(tcalc_pctx* pctx, int32_t* outTreeInd);
-static tcalc_err tcalc_parsefunc_relation(tcalc_pctx* pctx, int32_t* outTreeInd);
-static tcalc_err tcalc_parsefunc_term(tcalc_pctx* pctx, int32_t* outTreeInd);
-static tcalc_err tcalc_parsefunc_factor(tcalc_pctx* pctx, int32_t* outTreeInd);
-static tcalc_err tcalc_parsefunc_exponentiation(tcalc_pctx* pctx, int32_t* outTreeInd);
-static tcalc_err tcalc_parsefunc_unary(tcalc_pctx* pctx, int32_t* outTreeInd);
-static tcalc_err tcalc_parsefunc_primary(tcalc_pctx* pctx, int32_t* outTreeInd);
-static tcalc_err tcalc_parsefunc_func(tcalc_pctx* pctx, int32_t* outTreeInd);
+// Enough for ordinary expressions without reaching for the heap
+#define TCALC_PARSE_INLINE_STACK_CAPACITY 64
 
+static tcalc_err tcalc_parse_expression(tcalc_pctx* pctx, int32_t* outTreeInd);
 static tcalc_err tcalc_pctx_alloc_node(tcalc_pctx *pctx, int32_t *outTreeInd);
 
 tcalc_err tcalc_lex_parse(
@@ -87,12 +114,22 @@ tcalc_err tcalc_lex_parse(
   err = tcalc_tokenize_infix(
     expr, exprLen, tokenBuffer, tokenBufferCapacity, &tokenCount
   );
+  if (err == TCALC_ERR_NOMEM) {
+    // report the sizes both buffers need, so that the caller can retry once
+    tcalc_measure_infix(expr, exprLen, outTokenCount, outTreeNodeCount);
+    return err;
+  }
   if (err) return err;
 
   err = tcalc_create_exprtree_infix(
     expr, exprLen, tokenBuffer, tokenCount, treeBuffer,
     treeBufferCapacity, &treeNodeCount, &exprRootInd
   );
+  if (err == TCALC_ERR_NOMEM) {
+    *outTokenCount = tokenCount;
+    *outTreeNodeCount = treeNodeCount;
+    return err;
+  }
   if (err) return err;
 
   *outTokenCount = tokenCount;
@@ -101,15 +138,91 @@ tcalc_err tcalc_lex_parse(
   return err;
 }
 
+tcalc_err tcalc_create_exprtree_infix_arena(
+  const char* expr, int32_t exprLen, const struct tcalc_ctx* ctx, tcalc_arena* arena,
+  tcalc_token** outTokens, int32_t* outTokensLen, tcalc_exprtree** outTree,
+  int32_t* outTreeLen, int32_t* outExprRootInd
+) {
+  assert(arena != NULL);
+  *outTokens = NULL;
+  *outTokensLen = 0;
+  *outTree = NULL;
+  *outTreeLen = 0;
+  *outExprRootInd = -1;
+  tcalc_err err = TCALC_ERR_OK;
+  const tcalc_allocator* scratch = tcalc_arena_allocator(arena);
+
+  // every token spans at least one character of the expression, and the
+  // unused end of the array is given back once the real count is known
+  reterr_on_true(err, exprLen < 0 || exprLen == INT32_MAX, TCALC_ERR_INVALID_ARG);
+  const int32_t tokensCap = exprLen + 1;
+  tcalc_token* tokens = (tcalc_token*)tcalc_alloc(scratch, sizeof(tcalc_token) * (size_t)tokensCap);
+  reterr_on_true(err, tokens == NULL, TCALC_ERR_NOMEM);
+  int32_t tokensLen = 0;
+  ret_on_err(err, tcalc_tokenize_infix(expr, exprLen, tokens, tokensCap, &tokensLen));
+  tcalc_token* shrunk = (tcalc_token*)tcalc_realloc(
+    scratch, tokens, sizeof(tcalc_token) * (size_t)tokensCap, sizeof(tcalc_token) * ((size_t)tokensLen + 1)
+  );
+  if (shrunk != NULL) tokens = shrunk;
+
+  reterr_on_true(err, tokensLen > (INT32_MAX - 1) / 3, TCALC_ERR_OVERFLOW);
+  const int32_t treeCap = tcalc_exprtree_nodecount(tokens, tokensLen) + 1;
+  tcalc_exprtree* tree = (tcalc_exprtree*)tcalc_alloc(scratch, sizeof(tcalc_exprtree) * (size_t)treeCap);
+  reterr_on_true(err, tree == NULL, TCALC_ERR_NOMEM);
+  int32_t treeLen = 0;
+  ret_on_err(err, tcalc_create_exprtree_infix_walloc(
+    expr, exprLen, tokens, tokensLen, ctx, scratch, tree, treeCap, &treeLen, outExprRootInd
+  ));
+
+  *outTokens = tokens;
+  *outTokensLen = tokensLen;
+  *outTree = tree;
+  *outTreeLen = treeLen;
+  return TCALC_ERR_OK;
+}
+
 tcalc_err tcalc_create_exprtree_infix(
   const char* expr, int32_t exprLen, tcalc_token *tokens, int32_t tokensLen,
   tcalc_exprtree *destBuffer, int32_t destCapacity, int32_t* outDestLength,
   int32_t* outExprRootInd
 ) {
+  return tcalc_create_exprtree_infix_wctx(
+    expr, exprLen, tokens, tokensLen, tcalc_ctx_default(), destBuffer,
+    destCapacity, outDestLength, outExprRootInd
+  );
+}
+
+tcalc_err tcalc_create_exprtree_infix_wctx(
+  const char* expr, int32_t exprLen, tcalc_token *tokens, int32_t tokensLen,
+  const struct tcalc_ctx* ctx, tcalc_exprtree *destBuffer, int32_t destCapacity,
+  int32_t* outDestLength, int32_t* outExprRootInd
+) {
+  assert(ctx != NULL);
+  return tcalc_create_exprtree_infix_walloc(
+    expr, exprLen, tokens, tokensLen, ctx, ctx->allocator, destBuffer,
+    destCapacity, outDestLength, outExprRootInd
+  );
+}
+
+tcalc_err tcalc_create_exprtree_infix_walloc(
+  const char* expr, int32_t exprLen, tcalc_token *tokens, int32_t tokensLen,
+  const struct tcalc_ctx* ctx, const tcalc_allocator* scratch,
+  tcalc_exprtree *destBuffer, int32_t destCapacity,
+  int32_t* outDestLength, int32_t* outExprRootInd
+) {
+  assert(ctx != NULL);
   *outExprRootInd = -1;
   *outDestLength = -1;
   tcalc_err err = TCALC_ERR_OK;
 
+  tcalc_pstk_entry inlineOps[TCALC_PARSE_INLINE_STACK_CAPACITY];
+  int32_t inlineOperands[TCALC_PARSE_INLINE_STACK_CAPACITY];
+  void* heapStacks = NULL;
+  const size_t heapStacksSize = (sizeof(tcalc_pstk_entry) + sizeof(int32_t)) * (size_t)tokensLen;
+  tcalc_popcache opcache;
+  opcache.known = 0;
+  opcache.defined = 0;
+
   tcalc_pctx pctx = {
     .expr = expr,
     .exprLen = exprLen,
@@ -117,16 +230,28 @@ tcalc_err tcalc_create_exprtree_infix(
     .toksLen = tokensLen,
     .tree = destBuffer,
     .treeCap = destCapacity,
-    .treeLen = 0
+    .treeLen = 0,
+    .ctx = ctx,
+    .opcache = &opcache,
+    .ops = inlineOps,
+    .operands = inlineOperands
   };
 
-  err = tcalc_parsefunc_expression(&pctx, outExprRootInd);
+  if (tokensLen > TCALC_PARSE_INLINE_STACK_CAPACITY) {
+    heapStacks = tcalc_alloc(scratch, heapStacksSize);
+    cleanup_if(err, heapStacks == NULL, TCALC_ERR_NOMEM);
+    pctx.ops = (tcalc_pstk_entry*)heapStacks;
+    pctx.operands = (int32_t*)(pctx.ops + tokensLen);
+  }
+
+  cleanup_on_err(err, tcalc_parse_expression(&pctx, outExprRootInd));
 
-  if (err == TCALC_ERR_OK && pctx.i < pctx.toksLen)
+  if (pctx.i < pctx.toksLen)
   {
     err = TCALC_ERR_UNPROCESSED_INPUT;
-    tcalc_errstkaddf(
-      __func__,
+    // reported under the public name rather than that of this variant
+    tcalc_errstkadd_i32(
+      "tcalc_create_exprtree_infix", TCALC_ERR_UNPROCESSED_INPUT,
       "Failed to process all input "
       "(processed %" PRId32 " tokens of %" PRId32 " total tokens)",
       pctx.i,
@@ -134,267 +259,152 @@ tcalc_err tcalc_create_exprtree_infix(
     );
   }
 
+  tcalc_free(scratch, heapStacks, heapStacksSize);
   *outDestLength = pctx.treeLen;
   return err;
-}
-
-static bool tcalc_lbstr_in_ntntstrs(
-  const char* token_str, int32_t tokenLen, const char** nt_ntstrs
-);
-
-static bool tcalc_pctx_should_insert_implicit_mult(const tcalc_pctx* pctx);
-static bool tcalc_pctx_iscurrtype(const tcalc_pctx* pctx, tcalc_token_type type);
-static bool tcalc_pctx_is_curr_tok_in_optlist(
-  const tcalc_pctx* pctx, const char** nt_ntstr_operators
-);
-
-static tcalc_err tcalc_parsefunc_binops_leftassoc(
-  tcalc_pctx* pctx, const char** operators,
-  tcalc_parsefunc_func_t higher_prec_parsefunc, int32_t *outTreeInd
-);
-
-
-/**
- * General function for parsing grammar rules for infix binary operators
- * with the grammar "higher_precedence_nonterminal binary_operators higher_precedence_nonterminal"
- *
- * @param operators a NULL-terminated array of operator strings to match.
-*/
-static tcalc_err tcalc_parsefunc_binops_leftassoc(
-  tcalc_pctx* pctx, const char** operators,
-  tcalc_parsefunc_func_t higher_prec_parsefunc, int32_t *outTreeInd
-) {
-  *outTreeInd = -1;
-  tcalc_err err = TCALC_ERR_OK;
-  const int32_t savedTreeLen = pctx->treeLen;
-  int32_t leftTreeInd = -1;
-  cleanup_on_err(err, higher_prec_parsefunc(pctx, &leftTreeInd));
-
-  while (tcalc_pctx_is_curr_tok_in_optlist(pctx, operators)) {
-    int32_t operatorInd = pctx->i;
-    pctx->i++; // consume current operator
-    cleanup_if(err, pctx->i >= pctx->toksLen, TCALC_ERR_MALFORMED_BINEXP);
-
-    int32_t rightTreeInd = -1;
-    cleanup_on_err(err, higher_prec_parsefunc(pctx, &rightTreeInd));
-
-    int32_t tempTreeInd = -1;
-    cleanup_on_err(err, tcalc_pctx_alloc_node(pctx, &tempTreeInd));
-
-    pctx->tree[tempTreeInd] = (tcalc_exprtree){
-      .type = TCALC_EXPRTREE_NODE_TYPE_BINARY,
-      .as = {
-        .binary = {
-          .tokenIndOImplMult = operatorInd,
-          .leftTreeInd = leftTreeInd,
-          .rightTreeInd = rightTreeInd
-        }
-      }
-    };
-
-    leftTreeInd = tempTreeInd;
-  }
-
-  *outTreeInd = leftTreeInd;
-  return TCALC_ERR_OK;
 
   cleanup:
-    pctx->treeLen = savedTreeLen;
+    tcalc_free(scratch, heapStacks, heapStacksSize);
+    *outExprRootInd = -1;
+    *outDestLength = 0;
+    if (err == TCALC_ERR_NOMEM && pctx.treeLen >= pctx.treeCap) {
+      // report how large destBuffer has to be instead
+      *outDestLength = tcalc_exprtree_nodecount(tokens, tokensLen);
+      tcalc_errstkadd_i32(
+        __func__, TCALC_ERR_NOMEM,
+        "Tree buffer too small (%" PRId32 " nodes needed, capacity of %" PRId32 ")",
+        *outDestLength, destCapacity
+      );
+    }
     return err;
 }
 
-static tcalc_err tcalc_parsefunc_expression(tcalc_pctx* pctx, int32_t *outTreeInd) {
-  return tcalc_parsefunc_logic_or(pctx, outTreeInd);
-}
-
-static tcalc_err tcalc_parsefunc_logic_or(tcalc_pctx* pctx, int32_t *outTreeInd) {
-  const char* operators[] = { "||", NULL };
-  return tcalc_parsefunc_binops_leftassoc(pctx, operators, tcalc_parsefunc_logic_and, outTreeInd);
-}
-
-static tcalc_err tcalc_parsefunc_logic_and(tcalc_pctx* pctx, int32_t *outTreeInd) {
-  const char* operators[] = { "&&", NULL };
-  return tcalc_parsefunc_binops_leftassoc(pctx, operators, tcalc_parsefunc_equality, outTreeInd);
-}
-
-static tcalc_err tcalc_parsefunc_equality(tcalc_pctx* pctx, int32_t *outTreeInd) {
-  const char* operators[] = { "=", "==", "!=", NULL };
-  return tcalc_parsefunc_binops_leftassoc(pctx, operators, tcalc_parsefunc_relation, outTreeInd);
-}
+static bool tcalc_pctx_should_insert_implicit_mult(const tcalc_pctx* pctx);
+static bool tcalc_pctx_iscurrtype(const tcalc_pctx* pctx, tcalc_token_type type);
+static tcalc_err tcalc_pctx_getopdata(
+  tcalc_pctx* pctx, int32_t tokenIndOImplMult, bool prefix, tcalc_opdata* out
+);
+static tcalc_err tcalc_pctx_reduce(tcalc_pctx* pctx, int prec, bool popEqualPrec);
+static tcalc_err tcalc_parse_operand(tcalc_pctx* pctx, bool* outOperandDone);
 
-static tcalc_err tcalc_parsefunc_relation(tcalc_pctx* pctx, int32_t *outTreeInd) {
-  const char* operators[] = { "<", "<=", ">", ">=", NULL };
-  return tcalc_parsefunc_binops_leftassoc(pctx, operators, tcalc_parsefunc_term, outTreeInd);
+static void tcalc_pctx_pushop(tcalc_pctx* pctx, tcalc_pstk_entry entry) {
+  assert(pctx->opsLen < pctx->toksLen);
+  pctx->ops[pctx->opsLen++] = entry;
 }
 
-static tcalc_err tcalc_parsefunc_term(tcalc_pctx* pctx, int32_t *outTreeInd) {
-  const char* operators[] = { "+", "-", NULL };
-  return tcalc_parsefunc_binops_leftassoc(pctx, operators, tcalc_parsefunc_factor, outTreeInd);
+static void tcalc_pctx_pushoperand(tcalc_pctx* pctx, int32_t treeInd) {
+  assert(pctx->operandsLen < pctx->toksLen);
+  pctx->operands[pctx->operandsLen++] = treeInd;
 }
 
-static tcalc_err tcalc_parsefunc_factor(tcalc_pctx* pctx, int32_t *outTreeInd) {
-  *outTreeInd = -1;
-  const int32_t savedTreeLen = pctx->treeLen;
-  const char* operators[] = { "*", "", "/", "%", NULL };
-  int32_t leftTreeInd = -1;
+static tcalc_err tcalc_parse_expression(tcalc_pctx* pctx, int32_t* outTreeInd) {
   tcalc_err err = TCALC_ERR_OK;
-  cleanup_on_err(err, tcalc_parsefunc_unary(pctx, &leftTreeInd));
-
-  while ( tcalc_pctx_is_curr_tok_in_optlist(pctx, operators) ||
-          tcalc_pctx_should_insert_implicit_mult(pctx)) {
-    const int32_t operatorIndOImplMult =
-      tcalc_pctx_should_insert_implicit_mult(pctx) ?  -(pctx->i) : pctx->i++;
-    // ! only consumes current token if we did not insert an implicit multiplication
-    cleanup_if(err, pctx->i >= pctx->toksLen, TCALC_ERR_MALFORMED_BINEXP);
-
-    int32_t rightTreeInd = -1;
-    cleanup_on_err(err, tcalc_parsefunc_unary(pctx, &rightTreeInd));
-
-    int32_t tempTreeInd = -1;
-    cleanup_on_err(err, tcalc_pctx_alloc_node(pctx, &tempTreeInd));
-    pctx->tree[tempTreeInd] = (tcalc_exprtree){
-      .type = TCALC_EXPRTREE_NODE_TYPE_BINARY,
-      .as = {
-        .binary = {
-          .tokenIndOImplMult = operatorIndOImplMult,
-          .leftTreeInd = leftTreeInd,
-          .rightTreeInd = rightTreeInd
-        }
-      }
-    };
-
-    leftTreeInd = tempTreeInd;
-  }
-
-  *outTreeInd = leftTreeInd;
-  return TCALC_ERR_OK;
-
-  cleanup:
-    pctx->treeLen = savedTreeLen;
-    return err;
-}
+  bool operandDone = false; // whether the last operand has been finished
 
-// unary -> ( "+" | "-" | "!" )* exponentiation
-static tcalc_err tcalc_parsefunc_unary(tcalc_pctx* pctx, int32_t *outTreeInd) {
-  const char* operators[] = { "+", "-", "!", NULL };
-  *outTreeInd = -1;
-  const int32_t savedTreeLen = pctx->treeLen;
+  while (true) {
+    if (!operandDone) {
+      ret_on_err(err, tcalc_parse_operand(pctx, &operandDone));
+      continue;
+    }
 
-  tcalc_err err = TCALC_ERR_OK;
-  int32_t unaryHeadInd = -1; // linked-list like structure
-  int32_t unaryTailInd = -1;
-  int32_t primaryTreeInd = -1;
-
-  while (tcalc_pctx_is_curr_tok_in_optlist(pctx, operators)) {
-    const int32_t operatorInd = pctx->i; // non-owning
-    pctx->i++; // consume current operator
-    cleanup_if(err, pctx->i >= pctx->toksLen, TCALC_ERR_MALFORMED_UNEXP);
-
-    int32_t unaryNodeInd = -1;
-    cleanup_on_err(err, tcalc_pctx_alloc_node(pctx, &unaryNodeInd));
-    pctx->tree[unaryNodeInd] = (tcalc_exprtree){
-      .type = TCALC_EXPRTREE_NODE_TYPE_UNARY,
-      .as = { .unary = { .tokenInd = operatorInd, .childTreeInd = -1 }
+    const bool implicitMult = tcalc_pctx_should_insert_implicit_mult(pctx);
+    if (implicitMult || (pctx->i < pctx->toksLen && (
+          pctx->toks[pctx->i].type == TCALC_TOK_BINOP ||
+          pctx->toks[pctx->i].type == TCALC_TOK_RELOP ||
+          pctx->toks[pctx->i].type == TCALC_TOK_EQOP ||
+          pctx->toks[pctx->i].type == TCALC_TOK_BINLOP))) {
+      // implicit multiplications do not consume the current token
+      const int32_t operatorIndOImplMult = implicitMult ? -(pctx->i) : pctx->i;
+      tcalc_opdata opdata;
+      ret_on_err(err, tcalc_pctx_getopdata(pctx, operatorIndOImplMult, false, &opdata));
+      ret_on_err(err, tcalc_pctx_reduce(pctx, opdata.prec, opdata.assoc == TCALC_LEFT_ASSOC));
+      tcalc_pctx_pushop(pctx, (tcalc_pstk_entry){
+        .type = TCALC_PSTK_BINARY, .prec = opdata.prec, .ind = operatorIndOImplMult
+      });
+
+      if (!implicitMult) {
+        pctx->i++; // consume current operator
+        reterr_on_true(err, pctx->i >= pctx->toksLen, TCALC_ERR_MALFORMED_BINEXP);
       }
-    };
-
-    if (unaryTailInd >= 0) {
-      pctx->tree[unaryTailInd].as.unary.childTreeInd = unaryNodeInd;
-      unaryTailInd = unaryNodeInd;
-    } else {
-      unaryTailInd = unaryNodeInd;
-      unaryHeadInd = unaryNodeInd;
+      operandDone = false;
+      continue;
     }
-  }
 
-  cleanup_on_err(err, tcalc_parsefunc_exponentiation(pctx, &primaryTreeInd));
+    // Anything else ends the innermost expression, which is then either the
+    // whole expression, inside of a group, or an argument of a function
+    ret_on_err(err, tcalc_pctx_reduce(pctx, INT_MIN, true));
+    if (pctx->opsLen == 0)
+      break;
 
-  if (unaryTailInd >= 0) {
-    pctx->tree[unaryTailInd].as.unary.childTreeInd = primaryTreeInd;
-  } else {
-    unaryHeadInd = primaryTreeInd;
-  }
+    tcalc_pstk_entry* const top = &(pctx->ops[pctx->opsLen - 1]);
+    if (top->type == TCALC_PSTK_GROUP) {
+      reterr_on_true(err, !tcalc_pctx_iscurrtype(pctx, TCALC_TOK_GRPEND), TCALC_ERR_UNBAL_GRPSYMS);
+      pctx->i++; // consume group end symbol
+      pctx->opsLen--;
+      continue;
+    }
 
-  *outTreeInd = unaryHeadInd;
-  return TCALC_ERR_OK;
+    assert(top->type == TCALC_PSTK_FUNC);
+    pctx->tree[top->argTailInd].as.funcarg.exprInd = pctx->operands[--pctx->operandsLen];
 
-  cleanup:
-    pctx->treeLen = savedTreeLen;
-    return err;
-}
+    if (tcalc_pctx_iscurrtype(pctx, TCALC_TOK_PSEP)) {
+      pctx->i++; // consume parameter separator ','
+      reterr_on_true(err, pctx->i >= pctx->toksLen, TCALC_ERR_MALFORMED_FUNC);
+      reterr_on_true(err, top->argCount >= TCALC_MAX_FUNC_ARG_COUNT, TCALC_ERR_FUNC_TOO_MANY_ARGS);
 
-// exponentiation -> primary ( ( "^" | "**" ) exponentiation )
-static tcalc_err tcalc_parsefunc_exponentiation(tcalc_pctx* pctx, int32_t *outTreeInd) {
-  const char* operators[] = { "^", "**", NULL };
-  *outTreeInd = -1;
-  const int32_t savedTreeLen = pctx->treeLen;
-  tcalc_err err = TCALC_ERR_OK;
-  int32_t treeInd = -1;
-
-  cleanup_on_err(err, tcalc_parsefunc_primary(pctx, &treeInd));
-
-  // note that we use an **if** here instead of a **while** like other cases
-  if (tcalc_pctx_is_curr_tok_in_optlist(pctx, operators)) {
-    const int32_t operatorInd = pctx->i;
-    pctx->i++;
-    cleanup_if(err, pctx->i >= pctx->toksLen, TCALC_ERR_MALFORMED_BINEXP);
-
-    int32_t rstTreeInd = -1;
-    cleanup_on_err(err, tcalc_parsefunc_exponentiation(pctx, &rstTreeInd)); // right recursion
-
-    int32_t tempTreeInd = -1;
-    cleanup_on_err(err, tcalc_pctx_alloc_node(pctx, &tempTreeInd));
-    pctx->tree[tempTreeInd] = (tcalc_exprtree){
-      .type = TCALC_EXPRTREE_NODE_TYPE_BINARY,
-      .as = {
-        .binary = {
-          .tokenIndOImplMult = operatorInd,
-          .leftTreeInd = treeInd,
-          .rightTreeInd = rstTreeInd
-        }
-      }
-    };
+      int32_t argListNodeInd = -1;
+      ret_on_err(err, tcalc_pctx_alloc_node(pctx, &argListNodeInd));
+      pctx->tree[argListNodeInd] = (tcalc_exprtree){
+        .type = TCALC_EXPRTREE_NODE_TYPE_FUNCARG,
+        .as = { .funcarg = { .exprInd = -1, .nextArgInd = -1 } }
+      };
+      pctx->tree[top->argTailInd].as.funcarg.nextArgInd = argListNodeInd;
+      top->argTailInd = argListNodeInd;
+      top->argCount++;
+      operandDone = false;
+      continue;
+    }
 
-    treeInd = tempTreeInd;
+    reterr_on_true(err, !tcalc_pctx_iscurrtype(pctx, TCALC_TOK_GRPEND), TCALC_ERR_UNCLOSED_FUNC);
+    pctx->i++; // consume ending parentheses
+    tcalc_pctx_pushoperand(pctx, top->ind);
+    pctx->opsLen--;
   }
 
-
-  *outTreeInd = treeInd;
-  return err;
-
-  cleanup:
-    pctx->treeLen = savedTreeLen;
-    return err;
+  assert(pctx->operandsLen == 1);
+  *outTreeInd = pctx->operands[--pctx->operandsLen];
+  return TCALC_ERR_OK;
 }
 
-static tcalc_err tcalc_parsefunc_primary(tcalc_pctx* pctx, int32_t *outTreeInd) {
+/**
+ * Take the token at the start of an operand. Sets *outOperandDone once a
+ * primary expression has been read, and otherwise pushes the prefix
+ * operator, group, or function call that the operand starts with.
+*/
+static tcalc_err tcalc_parse_operand(tcalc_pctx* pctx, bool* outOperandDone) {
   tcalc_err err = TCALC_ERR_OK;
-  *outTreeInd = -1;
-  const int32_t savedTreeLen = pctx->treeLen;
-  int32_t nodeTreeInd = -1;
+  *outOperandDone = false;
 
-  // since this is the final main rule, other rules fallthrough to this rule
-  // and we must bounds-check here.
-  cleanup_if(err, pctx->i >= pctx->toksLen, TCALC_ERR_MALFORMED_INPUT);
+  reterr_on_true(err, pctx->i >= pctx->toksLen, TCALC_ERR_MALFORMED_INPUT);
 
   switch (pctx->toks[pctx->i].type)
   {
-    case TCALC_TOK_NUM:
+    case TCALC_TOK_UNOP:
+    case TCALC_TOK_UNLOP:
     {
-      cleanup_on_err(err, tcalc_pctx_alloc_node(pctx, &nodeTreeInd));
-      pctx->tree[nodeTreeInd] = (tcalc_exprtree){
-        .type = TCALC_EXPRTREE_NODE_TYPE_VALUE,
-        .as = { .value = { .tokenInd = pctx->i } }
-      };
-      pctx->i++; // consume number token
+      tcalc_opdata opdata;
+      ret_on_err(err, tcalc_pctx_getopdata(pctx, pctx->i, true, &opdata));
+      tcalc_pctx_pushop(pctx, (tcalc_pstk_entry){
+        .type = TCALC_PSTK_PREFIX, .prec = opdata.prec, .ind = pctx->i
+      });
+      pctx->i++; // consume current operator
+      reterr_on_true(err, pctx->i >= pctx->toksLen, TCALC_ERR_MALFORMED_UNEXP);
     }
     break;
     case TCALC_TOK_GRPSTRT:
     {
+      tcalc_pctx_pushop(pctx, (tcalc_pstk_entry){ .type = TCALC_PSTK_GROUP });
       pctx->i++; // consume group start symbol
-      cleanup_on_err(err, tcalc_parsefunc_expression(pctx, &nodeTreeInd));
-      cleanup_if(err, !tcalc_pctx_iscurrtype(pctx, TCALC_TOK_GRPEND), TCALC_ERR_UNBAL_GRPSYMS);
-      pctx->i++; // consume group end symbol
     }
     break;
     case TCALC_TOK_ID:
@@ -403,121 +413,177 @@ static tcalc_err tcalc_parsefunc_primary(tcalc_pctx* pctx, int32_t *outTreeInd)
       // Otherwise, assume that this ID represents a variable
       if (pctx->i + 1 < pctx->toksLen && pctx->toks[pctx->i + 1].type == TCALC_TOK_GRPSTRT)
       {
-        cleanup_on_err(err, tcalc_parsefunc_func(pctx, &nodeTreeInd));
-      }
-      else
-      {
-        cleanup_on_err(err, tcalc_pctx_alloc_node(pctx, &nodeTreeInd));
-        pctx->tree[nodeTreeInd] = (tcalc_exprtree){
-          .type = TCALC_EXPRTREE_NODE_TYPE_VALUE,
-          .as = { .value = { .tokenInd = pctx->i } }
+        int32_t funcTreeInd = -1;
+        ret_on_err(err, tcalc_pctx_alloc_node(pctx, &funcTreeInd));
+        pctx->tree[funcTreeInd] = (tcalc_exprtree){
+          .type = TCALC_EXPRTREE_NODE_TYPE_FUNC,
+          .as = { .func = { .tokenInd = pctx->i, .funcArgHeadInd = -1 } }
+        };
+        pctx->i += 2; // consume function identifier and opening parentheses
+
+        if (tcalc_pctx_iscurrtype(pctx, TCALC_TOK_GRPEND)) {
+          pctx->i++; // consume ending parentheses
+          tcalc_pctx_pushoperand(pctx, funcTreeInd);
+          *outOperandDone = true;
+          return TCALC_ERR_OK;
+        }
+
+        int32_t argHeadInd = -1;
+        ret_on_err(err, tcalc_pctx_alloc_node(pctx, &argHeadInd));
+        pctx->tree[argHeadInd] = (tcalc_exprtree){
+          .type = TCALC_EXPRTREE_NODE_TYPE_FUNCARG,
+          .as = { .funcarg = { .exprInd = -1, .nextArgInd = -1 } }
         };
-        pctx->i++; // consume identifier token
+        pctx->tree[funcTreeInd].as.func.funcArgHeadInd = argHeadInd;
+        tcalc_pctx_pushop(pctx, (tcalc_pstk_entry){
+          .type = TCALC_PSTK_FUNC, .ind = funcTreeInd, .argTailInd = argHeadInd, .argCount = 0
+        });
+        return TCALC_ERR_OK;
       }
     }
+    // fallthrough
+    case TCALC_TOK_NUM:
+    {
+      // numbers are decoded once here, instead of on every evaluation
+      const tcalc_token token = pctx->toks[pctx->i];
+      double num = 0.0;
+      if (token.type == TCALC_TOK_NUM) {
+        err = tcalc_lpstrtodouble(tcalc_token_startcp(pctx->expr, token), (size_t)tcalc_token_len(pctx->expr, pctx->exprLen, token), &num);
+        if (err) {
+          tcalc_errstkadd_tok(__func__, err, "invalid number", pctx->expr, pctx->exprLen, token);
+          return err;
+        }
+      }
+
+      int32_t nodeTreeInd = -1;
+      ret_on_err(err, tcalc_pctx_alloc_node(pctx, &nodeTreeInd));
+      pctx->tree[nodeTreeInd] = (tcalc_exprtree){
+        .type = TCALC_EXPRTREE_NODE_TYPE_VALUE,
+        .as = { .value = { .tokenInd = pctx->i, .num = num } }
+      };
+      pctx->i++; // consume value token
+      tcalc_pctx_pushoperand(pctx, nodeTreeInd);
+      *outOperandDone = true;
+    }
     break;
     default:
     {
-      err = TCALC_ERR_UNKNOWN_TOKEN;
-      goto cleanup;
+      return TCALC_ERR_UNKNOWN_TOKEN;
     }
     break;
   }
 
-  *outTreeInd = nodeTreeInd;
-  return err;
-
-  cleanup:
-    pctx->treeLen = savedTreeLen;
-    return err;
+  return TCALC_ERR_OK;
 }
 
-static tcalc_err tcalc_parsefunc_func(tcalc_pctx* pctx, int32_t *outTreeInd) {
-  assert(pctx->i < pctx->toksLen);
-  assert(pctx->toks[pctx->i].type == TCALC_TOK_ID);
-
-  *outTreeInd = -1;
-  const int32_t savedTreeLen = pctx->treeLen;
-
+/**
+ * Build the nodes of the prefix and binary operators on top of the stack
+ * which bind tighter than prec, stopping at the innermost open group or
+ * function call. Operators of the same precedence are also built if
+ * popEqualPrec is set.
+*/
+static tcalc_err tcalc_pctx_reduce(tcalc_pctx* pctx, int prec, bool popEqualPrec) {
   tcalc_err err = TCALC_ERR_OK;
 
-  int32_t funcTreeInd = -1;
-  cleanup_on_err(err, tcalc_pctx_alloc_node(pctx, &funcTreeInd));
-  pctx->tree[funcTreeInd] = (tcalc_exprtree){
-    .type = TCALC_EXPRTREE_NODE_TYPE_FUNC,
-    .as = { .func = { .tokenInd = pctx->i, .funcArgHeadInd = -1 } }
-  };
-  pctx->i++; // consume function identifier
-
-  cleanup_if(err, !tcalc_pctx_iscurrtype(pctx, TCALC_TOK_GRPSTRT), TCALC_ERR_UNCALLED_FUNC);
-  pctx->i++; // consume opening parentheses
-
-  int argCount = 0;
-
-  if (!tcalc_pctx_iscurrtype(pctx, TCALC_TOK_GRPEND))
-  {
-    cleanup_on_err(err, tcalc_pctx_alloc_node(pctx, &(pctx->tree[funcTreeInd].as.func.funcArgHeadInd)));
-    int32_t headExprInd = -1;
-    cleanup_on_err(err, tcalc_parsefunc_expression(pctx, &headExprInd));
-    pctx->tree[pctx->tree[funcTreeInd].as.func.funcArgHeadInd] = (tcalc_exprtree){
-      .type = TCALC_EXPRTREE_NODE_TYPE_FUNCARG,
-      .as = { .funcarg = { .exprInd = headExprInd, .nextArgInd = -1 } }
-    };
-
-    int32_t argListTailInd = pctx->tree[funcTreeInd].as.func.funcArgHeadInd;
+  while (pctx->opsLen > 0) {
+    const tcalc_pstk_entry top = pctx->ops[pctx->opsLen - 1];
+    if (top.type != TCALC_PSTK_BINARY && top.type != TCALC_PSTK_PREFIX)
+      break;
+    if (!(top.prec > prec || (top.prec == prec && popEqualPrec)))
+      break;
+
+    int32_t nodeInd = -1;
+    ret_on_err(err, tcalc_pctx_alloc_node(pctx, &nodeInd));
+    if (top.type == TCALC_PSTK_BINARY) {
+      assert(pctx->operandsLen >= 2);
+      pctx->tree[nodeInd] = (tcalc_exprtree){
+        .type = TCALC_EXPRTREE_NODE_TYPE_BINARY,
+        .as = {
+          .binary = {
+            .tokenIndOImplMult = top.ind,
+            .leftTreeInd = pctx->operands[pctx->operandsLen - 2],
+            .rightTreeInd = pctx->operands[pctx->operandsLen - 1]
+          }
+        }
+      };
+      pctx->operandsLen--;
+    } else {
+      assert(pctx->operandsLen >= 1);
+      pctx->tree[nodeInd] = (tcalc_exprtree){
+        .type = TCALC_EXPRTREE_NODE_TYPE_UNARY,
+        .as = { .unary = { .tokenInd = top.ind, .childTreeInd = pctx->operands[pctx->operandsLen - 1] } }
+      };
+    }
 
-    while (tcalc_pctx_iscurrtype(pctx, TCALC_TOK_PSEP))
-    {
-      pctx->i++; // consume parameter separator ','
-      cleanup_if(err, pctx->i >= pctx->toksLen, TCALC_ERR_MALFORMED_FUNC);
-      cleanup_if(err, argCount >= TCALC_MAX_FUNC_ARG_COUNT, TCALC_ERR_FUNC_TOO_MANY_ARGS);
+    pctx->operands[pctx->operandsLen - 1] = nodeInd;
+    pctx->opsLen--;
+  }
 
-      int32_t argListNodeInd = -1;
-      cleanup_on_err(err, tcalc_pctx_alloc_node(pctx, &argListNodeInd));
-      int32_t argExprInd = -1;
-      cleanup_on_err(err, tcalc_parsefunc_expression(pctx, &argExprInd));
-      pctx->tree[argListNodeInd] = (tcalc_exprtree){
-        .type = TCALC_EXPRTREE_NODE_TYPE_FUNCARG,
-        .as = { .funcarg = { .exprInd = argExprInd, .nextArgInd = -1 } }
-      };
+  return TCALC_ERR_OK;
+}
 
-      pctx->tree[argListTailInd].as.funcarg.nextArgInd = argListNodeInd;
-      argListTailInd = argListNodeInd;
-      argCount++;
+/**
+ * Find the precedence and associativity of the operator at tokenIndOImplMult
+ * (or of implicit multiplication if it is negative), as defined in the context
+*/
+static tcalc_err tcalc_pctx_getopdata(
+  tcalc_pctx* pctx, int32_t tokenIndOImplMult, bool prefix, tcalc_opdata* out
+) {
+  const tcalc_token token = tokenIndOImplMult < 0 ?
+    (tcalc_token){ .type = TCALC_TOK_BINOP, .start = 0, .len = 0 } :
+    pctx->toks[tokenIndOImplMult];
+  const int cacheInd =
+    tokenIndOImplMult < 0 ? TCALC_POPCACHE_IMPLICIT_MULT :
+    prefix ? TCALC_POPCACHE_PREFIXOP(token.opkind) :
+    TCALC_POPCACHE_BINOP(token.opkind);
+  const uint64_t cacheBit = UINT64_C(1) << cacheInd;
+  tcalc_popcache* const cache = pctx->opcache;
+
+  if (!(cache->known & cacheBit)) {
+    const char* const name = tokenIndOImplMult < 0 ? "" : tcalc_token_startcp(pctx->expr, token);
+    const size_t nameLen = (size_t)tcalc_token_len(pctx->expr, pctx->exprLen, token);
+    const tcalc_ctx* const ctx = pctx->ctx;
+    cache->known |= cacheBit;
+
+    #define TCALC_POPCACHE_FILL(_def_) do { \
+        if ((_def_) != NULL) { \
+          cache->defined |= cacheBit; \
+          cache->data[cacheInd] = (tcalc_opdata){ .prec = (_def_)->prec, .assoc = (_def_)->assoc }; \
+        } \
+      } while (0)
+
+    switch (token.type) {
+      case TCALC_TOK_UNOP: TCALC_POPCACHE_FILL(tcalc_ctx_findunop(ctx, name, nameLen)); break;
+      case TCALC_TOK_UNLOP: TCALC_POPCACHE_FILL(tcalc_ctx_findunlop(ctx, name, nameLen)); break;
+      case TCALC_TOK_BINOP: TCALC_POPCACHE_FILL(tcalc_ctx_findbinop(ctx, name, nameLen)); break;
+      case TCALC_TOK_RELOP: TCALC_POPCACHE_FILL(tcalc_ctx_findrelop(ctx, name, nameLen)); break;
+      case TCALC_TOK_BINLOP: TCALC_POPCACHE_FILL(tcalc_ctx_findbinlop(ctx, name, nameLen)); break;
+      case TCALC_TOK_EQOP: {
+        TCALC_POPCACHE_FILL(tcalc_ctx_findrelop(ctx, name, nameLen));
+        if (!(cache->defined & cacheBit))
+          TCALC_POPCACHE_FILL(tcalc_ctx_findbinlop(ctx, name, nameLen));
+      } break;
+      default: break;
     }
-  }
 
-  cleanup_if(err, !tcalc_pctx_iscurrtype(pctx, TCALC_TOK_GRPEND), TCALC_ERR_UNCLOSED_FUNC);
-  pctx->i++; // consume ending parentheses
+    #undef TCALC_POPCACHE_FILL
+  }
 
-  *outTreeInd = funcTreeInd;
-  return err;
+  if (!(cache->defined & cacheBit)) {
+    tcalc_errstkadd_tok(
+      __func__, TCALC_ERR_UNKNOWN_TOKEN, "operator not defined in the context", pctx->expr, pctx->exprLen, token
+    );
+    return TCALC_ERR_UNKNOWN_TOKEN;
+  }
 
-  cleanup:
-    pctx->treeLen = savedTreeLen;
-    return err;
+  *out = cache->data[cacheInd];
+  return TCALC_ERR_OK;
 }
 
 static bool tcalc_pctx_iscurrtype(const tcalc_pctx* pctx, tcalc_token_type type){
   return pctx->i < pctx->toksLen && pctx->toks[pctx->i].type == type;
 }
 
-static bool tcalc_lbstr_in_ntntstrs(const char* s, int32_t strl, const char** ntntstrs) {
-  int i = 0;
-  while (ntntstrs[i] != NULL && !tcalc_streq_ntlb(ntntstrs[i], s, strl)) i++;
-  return ntntstrs[i] != NULL;
-}
-
-static bool tcalc_pctx_is_curr_tok_in_optlist(const tcalc_pctx* pctx, const char** nt_ntstr_operators)
-{
-  return pctx->i < pctx->toksLen &&
-    tcalc_lbstr_in_ntntstrs(
-      tcalc_token_startcp(pctx->expr, pctx->toks[pctx->i]),
-      tcalc_token_len(pctx->toks[pctx->i]),
-      nt_ntstr_operators
-    );
-}
-
 static bool tcalc_pctx_should_insert_implicit_mult(const tcalc_pctx* pctx)
 {
   if (!(pctx->i < pctx->toksLen && pctx->i > 0))
@@ -0,0 +1,246 @@
+#include "tcalc.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <assert.h>
+
+/**
+ * A prepared expression is the tcalc_bytecode compiled from an expression,
+ * along with the values currently bound to each of its variable slots and a
+ * stack large enough to run its code on.
+*/
+
+struct tcalc_prepared {
+  const tcalc_allocator* allocator; // that of the context compiled with
+  tcalc_bytecode* bc;
+  struct tcalc_val* vals; // one per variable slot
+  bool* bound; // one per variable slot
+  int32_t unboundCount;
+  struct tcalc_val* stack; // tcalc_bytecode_stacksize(bc) values
+
+  // see tcalc_prepared_bindstore. Before each evaluation, the store's values
+  // of storeSlots are read into storeVals and copied to the slots in prepSlots
+  const tcalc_varstore* store;
+  int32_t storeLen;
+  int32_t* storeSlots;
+  int32_t* prepSlots;
+  struct tcalc_val* storeVals;
+};
+
+/**
+ * Compile a parsed expression into a prepared expression allocated with ctx's
+ * allocator, taking the memory needed along the way from scratch. The tree is
+ * optimized in place.
+*/
+static tcalc_err tcalc_prepared_compile_tree(
+  const char* expr, int32_t exprLen, const tcalc_ctx* ctx, const tcalc_allocator* scratch,
+  tcalc_token* tokens, int32_t tokensLen, tcalc_exprtree* tree, int32_t treeLen,
+  int32_t treeRootInd, tcalc_prepared** out
+) {
+  tcalc_err err = TCALC_ERR_OK;
+  const tcalc_allocator* allocator = ctx->allocator;
+
+  ret_on_err(err, tcalc_fold_exprtree_walloc(
+    expr, exprLen, tree, treeLen, treeRootInd, tokens, tokensLen, ctx, scratch
+  ));
+  ret_on_err(err, tcalc_cse_exprtree_walloc(
+    expr, exprLen, tree, treeLen, treeRootInd, tokens, tokensLen, scratch, NULL
+  ));
+
+  tcalc_prepared* prep = (tcalc_prepared*)tcalc_calloc(allocator, 1, sizeof(tcalc_prepared));
+  reterr_on_true(err, prep == NULL, TCALC_ERR_NOMEM);
+  prep->allocator = allocator;
+
+  cleanup_on_err(err, tcalc_bytecode_compile_walloc(
+    expr, exprLen, tree, treeLen, treeRootInd, tokens, tokensLen, ctx, scratch, &(prep->bc)
+  ));
+
+  const int32_t varCount = tcalc_bytecode_varcount(prep->bc);
+  // calloc(0, ...) may return NULL, so always ask for at least one element
+  prep->vals = (struct tcalc_val*)tcalc_calloc(allocator, (size_t)varCount + 1, sizeof(struct tcalc_val));
+  cleanup_if(err, prep->vals == NULL, TCALC_ERR_NOMEM);
+  prep->bound = (bool*)tcalc_calloc(allocator, (size_t)varCount + 1, sizeof(bool));
+  cleanup_if(err, prep->bound == NULL, TCALC_ERR_NOMEM);
+  prep->stack = (struct tcalc_val*)tcalc_alloc(allocator, sizeof(struct tcalc_val) * (size_t)tcalc_bytecode_stacksize(prep->bc));
+  cleanup_if(err, prep->stack == NULL, TCALC_ERR_NOMEM);
+
+  prep->unboundCount = varCount;
+  for (int32_t slot = 0; slot < varCount; slot++) {
+    const char* name = NULL;
+    int32_t nameLen = 0;
+    tcalc_vardef vardef;
+    tcalc_bytecode_getvarname(prep->bc, slot, &name, &nameLen);
+    if (tcalc_ctx_getvar(ctx, name, (size_t)nameLen, &vardef) == TCALC_ERR_OK)
+      tcalc_prepared_setvar(prep, slot, vardef.val);
+  }
+
+  *out = prep;
+  return TCALC_ERR_OK;
+
+  cleanup:
+    tcalc_prepared_free(prep);
+    return err;
+}
+
+tcalc_err tcalc_prepared_compile(
+  const char* expr, int32_t exprLen, const tcalc_ctx* ctx, tcalc_prepared** out
+) {
+  assert(expr != NULL);
+  assert(ctx != NULL);
+  assert(out != NULL);
+  *out = NULL;
+
+  tcalc_err err = TCALC_ERR_OK;
+  tcalc_token* tokens = NULL;
+  tcalc_exprtree* tree = NULL;
+  const tcalc_allocator* allocator = ctx->allocator;
+
+  // both arrays are allocated at exactly the size that expr needs
+  int32_t tokensCap = 0, treeCap = 0;
+  ret_on_err(err, tcalc_measure_infix(expr, exprLen, &tokensCap, &treeCap));
+  tokensCap++;
+  treeCap++;
+  tokens = (tcalc_token*)tcalc_alloc(allocator, sizeof(tcalc_token) * (size_t)tokensCap);
+  cleanup_if(err, tokens == NULL, TCALC_ERR_NOMEM);
+  tree = (tcalc_exprtree*)tcalc_alloc(allocator, sizeof(tcalc_exprtree) * (size_t)treeCap);
+  cleanup_if(err, tree == NULL, TCALC_ERR_NOMEM);
+
+  int32_t tokensLen = 0;
+  cleanup_on_err(err, tcalc_tokenize_infix(expr, exprLen, tokens, tokensCap, &tokensLen));
+
+  int32_t treeLen = 0, treeRootInd = -1;
+  cleanup_on_err(err, tcalc_create_exprtree_infix_wctx(
+    expr, exprLen, tokens, tokensLen, ctx, tree, treeCap, &treeLen, &treeRootInd
+  ));
+  cleanup_on_err(err, tcalc_prepared_compile_tree(
+    expr, exprLen, ctx, allocator, tokens, tokensLen, tree, treeLen, treeRootInd, out
+  ));
+
+  cleanup:
+    tcalc_free(allocator, tokens, sizeof(tcalc_token) * (size_t)tokensCap);
+    tcalc_free(allocator, tree, sizeof(tcalc_exprtree) * (size_t)treeCap);
+    return err;
+}
+
+tcalc_err tcalc_prepared_compile_arena(
+  const char* expr, int32_t exprLen, const tcalc_ctx* ctx, tcalc_arena* arena,
+  tcalc_prepared** out
+) {
+  assert(expr != NULL);
+  assert(ctx != NULL);
+  assert(out != NULL);
+  *out = NULL;
+
+  tcalc_err err = TCALC_ERR_OK;
+  tcalc_token* tokens = NULL;
+  tcalc_exprtree* tree = NULL;
+  int32_t tokensLen = 0, treeLen = 0, treeRootInd = -1;
+  ret_on_err(err, tcalc_create_exprtree_infix_arena(
+    expr, exprLen, ctx, arena, &tokens, &tokensLen, &tree, &treeLen, &treeRootInd
+  ));
+  return tcalc_prepared_compile_tree(
+    expr, exprLen, ctx, tcalc_arena_allocator(arena), tokens, tokensLen, tree,
+    treeLen, treeRootInd, out
+  );
+}
+
+void tcalc_prepared_free(tcalc_prepared* prep) {
+  if (prep == NULL) return;
+  const size_t slotCount = prep->bc != NULL ? (size_t)tcalc_bytecode_varcount(prep->bc) + 1 : 0;
+  const size_t stackSize = prep->bc != NULL ? (size_t)tcalc_bytecode_stacksize(prep->bc) : 0;
+  tcalc_free(prep->allocator, prep->vals, sizeof(struct tcalc_val) * slotCount);
+  tcalc_free(prep->allocator, prep->bound, sizeof(bool) * slotCount);
+  tcalc_free(prep->allocator, prep->stack, sizeof(struct tcalc_val) * stackSize);
+  tcalc_free(prep->allocator, prep->storeSlots, sizeof(int32_t) * slotCount);
+  tcalc_free(prep->allocator, prep->prepSlots, sizeof(int32_t) * slotCount);
+  tcalc_free(prep->allocator, prep->storeVals, sizeof(struct tcalc_val) * ((size_t)prep->storeLen + 1));
+  tcalc_bytecode_free(prep->bc);
+  tcalc_free(prep->allocator, prep, sizeof(tcalc_prepared));
+}
+
+int32_t tcalc_prepared_varcount(const tcalc_prepared* prep) {
+  return tcalc_bytecode_varcount(prep->bc);
+}
+
+tcalc_err tcalc_prepared_getvarslot(
+  const tcalc_prepared* prep, const char* name, size_t name_len, int32_t* outSlot
+) {
+  return tcalc_bytecode_getvarslot(prep->bc, name, name_len, outSlot);
+}
+
+tcalc_err tcalc_prepared_setvar(tcalc_prepared* prep, int32_t slot, struct tcalc_val val) {
+  if (slot < 0 || slot >= tcalc_bytecode_varcount(prep->bc))
+    return TCALC_ERR_OUT_OF_BOUNDS;
+  prep->vals[slot] = val;
+  if (!prep->bound[slot]) {
+    prep->bound[slot] = true;
+    prep->unboundCount--;
+  }
+  return TCALC_ERR_OK;
+}
+
+tcalc_err tcalc_prepared_bindstore(tcalc_prepared* prep, const tcalc_varstore* store) {
+  tcalc_err err = TCALC_ERR_OK;
+  const int32_t varCount = tcalc_bytecode_varcount(prep->bc);
+  int32_t* storeSlots = NULL;
+  int32_t* prepSlots = NULL;
+  struct tcalc_val* storeVals = NULL;
+  int32_t storeLen = 0;
+
+  if (store != NULL) {
+    storeSlots = (int32_t*)tcalc_alloc(prep->allocator, sizeof(int32_t) * ((size_t)varCount + 1));
+    cleanup_if(err, storeSlots == NULL, TCALC_ERR_NOMEM);
+    prepSlots = (int32_t*)tcalc_alloc(prep->allocator, sizeof(int32_t) * ((size_t)varCount + 1));
+    cleanup_if(err, prepSlots == NULL, TCALC_ERR_NOMEM);
+
+    for (int32_t slot = 0; slot < varCount; slot++) {
+      const char* name = NULL;
+      int32_t nameLen = 0;
+      tcalc_bytecode_getvarname(prep->bc, slot, &name, &nameLen);
+      if (tcalc_varstore_getslot(store, name, (size_t)nameLen, &(storeSlots[storeLen])) == TCALC_ERR_OK)
+        prepSlots[storeLen++] = slot;
+    }
+
+    storeVals = (struct tcalc_val*)tcalc_alloc(prep->allocator, sizeof(struct tcalc_val) * ((size_t)storeLen + 1));
+    cleanup_if(err, storeVals == NULL, TCALC_ERR_NOMEM);
+    cleanup_on_err(err, tcalc_varstore_read(store, storeSlots, storeVals, storeLen));
+    for (int32_t i = 0; i < storeLen; i++)
+      tcalc_prepared_setvar(prep, prepSlots[i], storeVals[i]);
+  }
+
+  tcalc_free(prep->allocator, prep->storeSlots, sizeof(int32_t) * ((size_t)varCount + 1));
+  tcalc_free(prep->allocator, prep->prepSlots, sizeof(int32_t) * ((size_t)varCount + 1));
+  tcalc_free(prep->allocator, prep->storeVals, sizeof(struct tcalc_val) * ((size_t)prep->storeLen + 1));
+  prep->store = store;
+  prep->storeLen = storeLen;
+  prep->storeSlots = storeSlots;
+  prep->prepSlots = prepSlots;
+  prep->storeVals = storeVals;
+  return TCALC_ERR_OK;
+
+  cleanup:
+    tcalc_free(prep->allocator, storeSlots, sizeof(int32_t) * ((size_t)varCount + 1));
+    tcalc_free(prep->allocator, prepSlots, sizeof(int32_t) * ((size_t)varCount + 1));
+    tcalc_free(prep->allocator, storeVals, sizeof(struct tcalc_val) * ((size_t)storeLen + 1));
+    return err;
+}
+
+tcalc_err tcalc_prepared_eval(tcalc_prepared* prep, struct tcalc_val* out) {
+  assert(prep != NULL);
+  assert(out != NULL);
+
+  if (prep->store != NULL) {
+    tcalc_err err = tcalc_varstore_read(prep->store, prep->storeSlots, prep->storeVals, prep->storeLen);
+    if (err) return err;
+    for (int32_t i = 0; i < prep->storeLen; i++)
+      prep->vals[prep->prepSlots[i]] = prep->storeVals[i];
+  }
+
+  // the code reads every slot at least once, so an unbound slot is always an error
+  if (prep->unboundCount > 0)
+    return TCALC_ERR_UNKNOWN_ID;
+  return tcalc_bytecode_eval(
+    prep->bc, prep->vals, prep->stack, tcalc_bytecode_stacksize(prep->bc), out
+  );
+}
@@ -0,0 +1,524 @@
+#include "tcalc.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/**
+ * Array kernels
+ *
+ * Every kernel is compiled once per instruction set, and the widest set the
+ * running CPU supports is picked with __builtin_cpu_supports on the first call
+ * to any kernel. The vectorized versions match the scalar functions in
+ * tcalc_func.c exactly, including the 1e-9 epsilon used for equality and
+ * division by zero.
+ *
+ * Bool arrays are one byte per element holding 0 or 1, the same layout used
+ * by the columns passed to tcalc_eval_exprtree_batch.
+*/
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define TCALC_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define TCALC_SIMD_X86 0
+#endif
+
+#define TCALC_SIMD_EPSILON 1e-9
+
+/**
+ * Scalar kernels. These also finish the rows left over after the last full
+ * vector of each vectorized kernel.
+*/
+
+#define TCALC_SIMD_EQ1(a, b) (fabs((a) - (b)) < TCALC_SIMD_EPSILON)
+
+#define tcalc_simd_scalar_arith_impl(_name_, _op_) \
+  static tcalc_err _name_##_scalar(const double* a, const double* b, double* out, size_t n) { \
+    for (size_t i = 0; i < n; i++) out[i] = a[i] _op_ b[i]; \
+    return TCALC_ERR_OK; \
+  }
+
+tcalc_simd_scalar_arith_impl(tcalc_add_arr, +)
+tcalc_simd_scalar_arith_impl(tcalc_subtract_arr, -)
+tcalc_simd_scalar_arith_impl(tcalc_multiply_arr, *)
+
+static tcalc_err tcalc_divide_arr_scalar(const double* a, const double* b, double* out, size_t n) {
+  bool zero = false;
+  for (size_t i = 0; i < n; i++) {
+    zero |= fabs(b[i]) < TCALC_SIMD_EPSILON;
+    out[i] = a[i] / b[i];
+  }
+  return zero ? TCALC_ERR_DIV_BY_ZERO : TCALC_ERR_OK;
+}
+
+#define tcalc_simd_scalar_rel_impl(_name_, _expr_) \
+  static tcalc_err _name_##_scalar(const double* a, const double* b, bool* out, size_t n) { \
+    for (size_t i = 0; i < n; i++) { \
+      const double x = a[i], y = b[i]; \
+      out[i] = (_expr_); \
+    } \
+    return TCALC_ERR_OK; \
+  }
+
+tcalc_simd_scalar_rel_impl(tcalc_lt_arr, x < y && !TCALC_SIMD_EQ1(x, y))
+tcalc_simd_scalar_rel_impl(tcalc_lteq_arr, x < y || TCALC_SIMD_EQ1(x, y))
+tcalc_simd_scalar_rel_impl(tcalc_gt_arr, x > y && !TCALC_SIMD_EQ1(x, y))
+tcalc_simd_scalar_rel_impl(tcalc_gteq_arr, x > y || TCALC_SIMD_EQ1(x, y))
+tcalc_simd_scalar_rel_impl(tcalc_equals_arr, TCALC_SIMD_EQ1(x, y))
+tcalc_simd_scalar_rel_impl(tcalc_nequals_arr, !TCALC_SIMD_EQ1(x, y))
+
+#define tcalc_simd_scalar_logic_impl(_name_, _op_) \
+  static tcalc_err _name_##_scalar(const bool* a, const bool* b, bool* out, size_t n) { \
+    for (size_t i = 0; i < n; i++) out[i] = a[i] _op_ b[i]; \
+    return TCALC_ERR_OK; \
+  }
+
+tcalc_simd_scalar_logic_impl(tcalc_and_arr, &)
+tcalc_simd_scalar_logic_impl(tcalc_or_arr, |)
+
+static tcalc_err tcalc_not_arr_scalar(const bool* a, bool* out, size_t n) {
+  for (size_t i = 0; i < n; i++) out[i] = !a[i];
+  return TCALC_ERR_OK;
+}
+
+#if TCALC_SIMD_X86
+
+// the bools for each 4-bit comparison mask
+static const uint8_t tcalc_simd_nibble_bools[16][4] = {
+  {0,0,0,0}, {1,0,0,0}, {0,1,0,0}, {1,1,0,0},
+  {0,0,1,0}, {1,0,1,0}, {0,1,1,0}, {1,1,1,0},
+  {0,0,0,1}, {1,0,0,1}, {0,1,0,1}, {1,1,0,1},
+  {0,0,1,1}, {1,0,1,1}, {0,1,1,1}, {1,1,1,1}
+};
+
+/**
+ * Kernel templates
+ *
+ * tcalc_simd_kernels_impl expands to the vectorized version of every kernel
+ * in terms of the TCALC_V_* macros, which are defined for one instruction set
+ * right before each expansion. A comparison result ("mask") is a vector for
+ * SSE2 and AVX2 but a __mmask8 for AVX-512.
+*/
+#define tcalc_simd_arith_impl(_name_, _sfx_, _target_, _vop_, _op_) \
+  __attribute__((target(_target_))) \
+  static tcalc_err _name_##_##_sfx_(const double* a, const double* b, double* out, size_t n) { \
+    size_t i = 0; \
+    for (; i + TCALC_V_WIDTH <= n; i += TCALC_V_WIDTH) \
+      TCALC_V_STORE(out + i, _vop_(TCALC_V_LOAD(a + i), TCALC_V_LOAD(b + i))); \
+    for (; i < n; i++) out[i] = a[i] _op_ b[i]; \
+    return TCALC_ERR_OK; \
+  }
+
+#define tcalc_simd_rel_impl(_name_, _sfx_, _target_, _vexpr_, _expr_) \
+  __attribute__((target(_target_))) \
+  static tcalc_err _name_##_##_sfx_(const double* a, const double* b, bool* out, size_t n) { \
+    const TCALC_V_DBL eps = TCALC_V_SET1(TCALC_SIMD_EPSILON); \
+    size_t i = 0; \
+    for (; i + TCALC_V_WIDTH <= n; i += TCALC_V_WIDTH) { \
+      const TCALC_V_DBL x = TCALC_V_LOAD(a + i), y = TCALC_V_LOAD(b + i); \
+      const TCALC_V_MASK eq = TCALC_V_CMPLT(TCALC_V_ABS(TCALC_V_SUB(x, y)), eps); \
+      (void)eq; \
+      TCALC_V_STORE_BOOLS(out + i, (_vexpr_)); \
+    } \
+    for (; i < n; i++) { \
+      const double x = a[i], y = b[i]; \
+      out[i] = (_expr_); \
+    } \
+    return TCALC_ERR_OK; \
+  }
+
+#define tcalc_simd_logic_impl(_name_, _sfx_, _target_, _vop_, _op_) \
+  __attribute__((target(_target_))) \
+  static tcalc_err _name_##_##_sfx_(const bool* a, const bool* b, bool* out, size_t n) { \
+    size_t i = 0; \
+    for (; i + TCALC_V_BYTES <= n; i += TCALC_V_BYTES) \
+      TCALC_V_STOREI(out + i, _vop_(TCALC_V_LOADI(a + i), TCALC_V_LOADI(b + i))); \
+    for (; i < n; i++) out[i] = a[i] _op_ b[i]; \
+    return TCALC_ERR_OK; \
+  }
+
+#define tcalc_simd_kernels_impl(_sfx_, _target_) \
+  tcalc_simd_arith_impl(tcalc_add_arr, _sfx_, _target_, TCALC_V_ADD, +) \
+  tcalc_simd_arith_impl(tcalc_subtract_arr, _sfx_, _target_, TCALC_V_SUB, -) \
+  tcalc_simd_arith_impl(tcalc_multiply_arr, _sfx_, _target_, TCALC_V_MUL, *) \
+  \
+  __attribute__((target(_target_))) \
+  static tcalc_err tcalc_divide_arr_##_sfx_(const double* a, const double* b, double* out, size_t n) { \
+    const TCALC_V_DBL eps = TCALC_V_SET1(TCALC_SIMD_EPSILON); \
+    TCALC_V_MASK zero = TCALC_V_MASK_NONE; \
+    size_t i = 0; \
+    for (; i + TCALC_V_WIDTH <= n; i += TCALC_V_WIDTH) { \
+      const TCALC_V_DBL y = TCALC_V_LOAD(b + i); \
+      zero = TCALC_V_OR(zero, TCALC_V_CMPLT(TCALC_V_ABS(y), eps)); \
+      TCALC_V_STORE(out + i, TCALC_V_DIV(TCALC_V_LOAD(a + i), y)); \
+    } \
+    if (TCALC_V_ANY(zero)) return TCALC_ERR_DIV_BY_ZERO; \
+    return tcalc_divide_arr_scalar(a + i, b + i, out + i, n - i); \
+  } \
+  \
+  tcalc_simd_rel_impl(tcalc_lt_arr, _sfx_, _target_, \
+    TCALC_V_ANDNOT(eq, TCALC_V_CMPLT(x, y)), x < y && !TCALC_SIMD_EQ1(x, y)) \
+  tcalc_simd_rel_impl(tcalc_lteq_arr, _sfx_, _target_, \
+    TCALC_V_OR(TCALC_V_CMPLT(x, y), eq), x < y || TCALC_SIMD_EQ1(x, y)) \
+  tcalc_simd_rel_impl(tcalc_gt_arr, _sfx_, _target_, \
+    TCALC_V_ANDNOT(eq, TCALC_V_CMPLT(y, x)), x > y && !TCALC_SIMD_EQ1(x, y)) \
+  tcalc_simd_rel_impl(tcalc_gteq_arr, _sfx_, _target_, \
+    TCALC_V_OR(TCALC_V_CMPLT(y, x), eq), x > y || TCALC_SIMD_EQ1(x, y)) \
+  tcalc_simd_rel_impl(tcalc_equals_arr, _sfx_, _target_, eq, TCALC_SIMD_EQ1(x, y)) \
+  tcalc_simd_rel_impl(tcalc_nequals_arr, _sfx_, _target_, \
+    TCALC_V_ANDNOT(eq, TCALC_V_MASK_ALL), !TCALC_SIMD_EQ1(x, y)) \
+  \
+  tcalc_simd_logic_impl(tcalc_and_arr, _sfx_, _target_, TCALC_V_ANDI, &) \
+  tcalc_simd_logic_impl(tcalc_or_arr, _sfx_, _target_, TCALC_V_ORI, |) \
+  \
+  __attribute__((target(_target_))) \
+  static tcalc_err tcalc_not_arr_##_sfx_(const bool* a, bool* out, size_t n) { \
+    size_t i = 0; \
+    for (; i + TCALC_V_BYTES <= n; i += TCALC_V_BYTES) \
+      TCALC_V_STOREI(out + i, TCALC_V_XORI(TCALC_V_LOADI(a + i), TCALC_V_ONESI)); \
+    for (; i < n; i++) out[i] = !a[i]; \
+    return TCALC_ERR_OK; \
+  }
+
+// SSE2
+
+#define TCALC_V_WIDTH 2
+#define TCALC_V_BYTES 16
+#define TCALC_V_DBL __m128d
+#define TCALC_V_MASK __m128d
+#define TCALC_V_LOAD(p) _mm_loadu_pd(p)
+#define TCALC_V_STORE(p, v) _mm_storeu_pd((p), (v))
+#define TCALC_V_SET1(x) _mm_set1_pd(x)
+#define TCALC_V_ADD(a, b) _mm_add_pd((a), (b))
+#define TCALC_V_SUB(a, b) _mm_sub_pd((a), (b))
+#define TCALC_V_MUL(a, b) _mm_mul_pd((a), (b))
+#define TCALC_V_DIV(a, b) _mm_div_pd((a), (b))
+#define TCALC_V_ABS(a) _mm_andnot_pd(_mm_set1_pd(-0.0), (a))
+#define TCALC_V_CMPLT(a, b) _mm_cmplt_pd((a), (b))
+#define TCALC_V_OR(a, b) _mm_or_pd((a), (b))
+#define TCALC_V_ANDNOT(a, b) _mm_andnot_pd((a), (b)) // ~a & b
+#define TCALC_V_MASK_NONE _mm_setzero_pd()
+#define TCALC_V_MASK_ALL _mm_castsi128_pd(_mm_set1_epi32(-1))
+#define TCALC_V_ANY(m) (_mm_movemask_pd(m) != 0)
+#define TCALC_V_STORE_BOOLS(p, m) do { \
+    const int bits = _mm_movemask_pd(m); \
+    (p)[0] = bits & 1; \
+    (p)[1] = (bits >> 1) & 1; \
+  } while (0)
+#define TCALC_V_LOADI(p) _mm_loadu_si128((const __m128i*)(const void*)(p))
+#define TCALC_V_STOREI(p, v) _mm_storeu_si128((__m128i*)(void*)(p), (v))
+#define TCALC_V_ANDI(a, b) _mm_and_si128((a), (b))
+#define TCALC_V_ORI(a, b) _mm_or_si128((a), (b))
+#define TCALC_V_XORI(a, b) _mm_xor_si128((a), (b))
+#define TCALC_V_ONESI _mm_set1_epi8(1)
+
+tcalc_simd_kernels_impl(sse2, "sse2")
+
+#undef TCALC_V_WIDTH
+#undef TCALC_V_BYTES
+#undef TCALC_V_DBL
+#undef TCALC_V_MASK
+#undef TCALC_V_LOAD
+#undef TCALC_V_STORE
+#undef TCALC_V_SET1
+#undef TCALC_V_ADD
+#undef TCALC_V_SUB
+#undef TCALC_V_MUL
+#undef TCALC_V_DIV
+#undef TCALC_V_ABS
+#undef TCALC_V_CMPLT
+#undef TCALC_V_OR
+#undef TCALC_V_ANDNOT
+#undef TCALC_V_MASK_NONE
+#undef TCALC_V_MASK_ALL
+#undef TCALC_V_ANY
+#undef TCALC_V_STORE_BOOLS
+#undef TCALC_V_LOADI
+#undef TCALC_V_STOREI
+#undef TCALC_V_ANDI
+#undef TCALC_V_ORI
+#undef TCALC_V_XORI
+#undef TCALC_V_ONESI
+
+// AVX2
+
+#define TCALC_V_WIDTH 4
+#define TCALC_V_BYTES 32
+#define TCALC_V_DBL __m256d
+#define TCALC_V_MASK __m256d
+#define TCALC_V_LOAD(p) _mm256_loadu_pd(p)
+#define TCALC_V_STORE(p, v) _mm256_storeu_pd((p), (v))
+#define TCALC_V_SET1(x) _mm256_set1_pd(x)
+#define TCALC_V_ADD(a, b) _mm256_add_pd((a), (b))
+#define TCALC_V_SUB(a, b) _mm256_sub_pd((a), (b))
+#define TCALC_V_MUL(a, b) _mm256_mul_pd((a), (b))
+#define TCALC_V_DIV(a, b) _mm256_div_pd((a), (b))
+#define TCALC_V_ABS(a) _mm256_andnot_pd(_mm256_set1_pd(-0.0), (a))
+#define TCALC_V_CMPLT(a, b) _mm256_cmp_pd((a), (b), _CMP_LT_OQ)
+#define TCALC_V_OR(a, b) _mm256_or_pd((a), (b))
+#define TCALC_V_ANDNOT(a, b) _mm256_andnot_pd((a), (b)) // ~a & b
+#define TCALC_V_MASK_NONE _mm256_setzero_pd()
+#define TCALC_V_MASK_ALL _mm256_castsi256_pd(_mm256_set1_epi32(-1))
+#define TCALC_V_ANY(m) (_mm256_movemask_pd(m) != 0)
+#define TCALC_V_STORE_BOOLS(p, m) \
+  memcpy((p), tcalc_simd_nibble_bools[_mm256_movemask_pd(m)], 4)
+#define TCALC_V_LOADI(p) _mm256_loadu_si256((const __m256i*)(const void*)(p))
+#define TCALC_V_STOREI(p, v) _mm256_storeu_si256((__m256i*)(void*)(p), (v))
+#define TCALC_V_ANDI(a, b) _mm256_and_si256((a), (b))
+#define TCALC_V_ORI(a, b) _mm256_or_si256((a), (b))
+#define TCALC_V_XORI(a, b) _mm256_xor_si256((a), (b))
+#define TCALC_V_ONESI _mm256_set1_epi8(1)
+
+tcalc_simd_kernels_impl(avx2, "avx2")
+
+#undef TCALC_V_WIDTH
+#undef TCALC_V_BYTES
+#undef TCALC_V_DBL
+#undef TCALC_V_MASK
+#undef TCALC_V_LOAD
+#undef TCALC_V_STORE
+#undef TCALC_V_SET1
+#undef TCALC_V_ADD
+#undef TCALC_V_SUB
+#undef TCALC_V_MUL
+#undef TCALC_V_DIV
+#undef TCALC_V_ABS
+#undef TCALC_V_CMPLT
+#undef TCALC_V_OR
+#undef TCALC_V_ANDNOT
+#undef TCALC_V_MASK_NONE
+#undef TCALC_V_MASK_ALL
+#undef TCALC_V_ANY
+#undef TCALC_V_STORE_BOOLS
+#undef TCALC_V_LOADI
+#undef TCALC_V_STOREI
+#undef TCALC_V_ANDI
+#undef TCALC_V_ORI
+#undef TCALC_V_XORI
+#undef TCALC_V_ONESI
+
+// AVX-512 (foundation instructions only)
+
+#define TCALC_V_WIDTH 8
+#define TCALC_V_BYTES 64
+#define TCALC_V_DBL __m512d
+#define TCALC_V_MASK __mmask8
+#define TCALC_V_LOAD(p) _mm512_loadu_pd(p)
+#define TCALC_V_STORE(p, v) _mm512_storeu_pd((p), (v))
+#define TCALC_V_SET1(x) _mm512_set1_pd(x)
+#define TCALC_V_ADD(a, b) _mm512_add_pd((a), (b))
+#define TCALC_V_SUB(a, b) _mm512_sub_pd((a), (b))
+#define TCALC_V_MUL(a, b) _mm512_mul_pd((a), (b))
+#define TCALC_V_DIV(a, b) _mm512_div_pd((a), (b))
+#define TCALC_V_ABS(a) _mm512_abs_pd(a)
+#define TCALC_V_CMPLT(a, b) _mm512_cmp_pd_mask((a), (b), _CMP_LT_OQ)
+#define TCALC_V_OR(a, b) ((__mmask8)((a) | (b)))
+#define TCALC_V_ANDNOT(a, b) ((__mmask8)(~(a) & (b)))
+#define TCALC_V_MASK_NONE ((__mmask8)0)
+#define TCALC_V_MASK_ALL ((__mmask8)0xFF)
+#define TCALC_V_ANY(m) ((m) != 0)
+#define TCALC_V_STORE_BOOLS(p, m) do { \
+    const __mmask8 bits = (m); \
+    memcpy((p), tcalc_simd_nibble_bools[bits & 0xF], 4); \
+    memcpy((p) + 4, tcalc_simd_nibble_bools[bits >> 4], 4); \
+  } while (0)
+#define TCALC_V_LOADI(p) _mm512_loadu_si512((const void*)(p))
+#define TCALC_V_STOREI(p, v) _mm512_storeu_si512((void*)(p), (v))
+#define TCALC_V_ANDI(a, b) _mm512_and_si512((a), (b))
+#define TCALC_V_ORI(a, b) _mm512_or_si512((a), (b))
+#define TCALC_V_XORI(a, b) _mm512_xor_si512((a), (b))
+#define TCALC_V_ONESI _mm512_set1_epi32(0x01010101)
+
+tcalc_simd_kernels_impl(avx512, "avx512f")
+
+#undef TCALC_V_WIDTH
+#undef TCALC_V_BYTES
+#undef TCALC_V_DBL
+#undef TCALC_V_MASK
+#undef TCALC_V_LOAD
+#undef TCALC_V_STORE
+#undef TCALC_V_SET1
+#undef TCALC_V_ADD
+#undef TCALC_V_SUB
+#undef TCALC_V_MUL
+#undef TCALC_V_DIV
+#undef TCALC_V_ABS
+#undef TCALC_V_CMPLT
+#undef TCALC_V_OR
+#undef TCALC_V_ANDNOT
+#undef TCALC_V_MASK_NONE
+#undef TCALC_V_MASK_ALL
+#undef TCALC_V_ANY
+#undef TCALC_V_STORE_BOOLS
+#undef TCALC_V_LOADI
+#undef TCALC_V_STOREI
+#undef TCALC_V_ANDI
+#undef TCALC_V_ORI
+#undef TCALC_V_XORI
+#undef TCALC_V_ONESI
+
+#endif
+
+/**
+ * Dispatch
+ *
+ * Each instruction set has a table of its kernels, and the public entry points
+ * call through the table picked for the running CPU. The pick is made once and
+ * cached, and tcalc_simd_setisa can replace it.
+*/
+
+typedef struct tcalc_simd_kernels {
+  tcalc_err (*add)(const double* a, const double* b, double* out, size_t n);
+  tcalc_err (*subtract)(const double* a, const double* b, double* out, size_t n);
+  tcalc_err (*multiply)(const double* a, const double* b, double* out, size_t n);
+  tcalc_err (*divide)(const double* a, const double* b, double* out, size_t n);
+  tcalc_err (*lt)(const double* a, const double* b, bool* out, size_t n);
+  tcalc_err (*lteq)(const double* a, const double* b, bool* out, size_t n);
+  tcalc_err (*gt)(const double* a, const double* b, bool* out, size_t n);
+  tcalc_err (*gteq)(const double* a, const double* b, bool* out, size_t n);
+  tcalc_err (*equals)(const double* a, const double* b, bool* out, size_t n);
+  tcalc_err (*nequals)(const double* a, const double* b, bool* out, size_t n);
+  tcalc_err (*and_)(const bool* a, const bool* b, bool* out, size_t n);
+  tcalc_err (*or_)(const bool* a, const bool* b, bool* out, size_t n);
+  tcalc_err (*not_)(const bool* a, bool* out, size_t n);
+} tcalc_simd_kernels;
+
+#define tcalc_simd_kernels_table(_sfx_) { \
+    tcalc_add_arr_##_sfx_, tcalc_subtract_arr_##_sfx_, \
+    tcalc_multiply_arr_##_sfx_, tcalc_divide_arr_##_sfx_, \
+    tcalc_lt_arr_##_sfx_, tcalc_lteq_arr_##_sfx_, \
+    tcalc_gt_arr_##_sfx_, tcalc_gteq_arr_##_sfx_, \
+    tcalc_equals_arr_##_sfx_, tcalc_nequals_arr_##_sfx_, \
+    tcalc_and_arr_##_sfx_, tcalc_or_arr_##_sfx_, tcalc_not_arr_##_sfx_ \
+  }
+
+static const tcalc_simd_kernels tcalc_simd_scalar_kernels = tcalc_simd_kernels_table(scalar);
+
+#if TCALC_SIMD_X86
+
+static const tcalc_simd_kernels tcalc_simd_sse2_kernels = tcalc_simd_kernels_table(sse2);
+static const tcalc_simd_kernels tcalc_simd_avx2_kernels = tcalc_simd_kernels_table(avx2);
+static const tcalc_simd_kernels tcalc_simd_avx512_kernels = tcalc_simd_kernels_table(avx512);
+
+static bool tcalc_simd_supports(tcalc_simd_isa isa) {
+  switch (isa) {
+    case TCALC_SIMD_ISA_SCALAR: return true;
+    case TCALC_SIMD_ISA_SSE2: return __builtin_cpu_supports("sse2");
+    case TCALC_SIMD_ISA_AVX2: return __builtin_cpu_supports("avx2");
+    case TCALC_SIMD_ISA_AVX512: return __builtin_cpu_supports("avx512f");
+  }
+  return false;
+}
+
+static const tcalc_simd_kernels* tcalc_simd_isa_kernels(tcalc_simd_isa isa) {
+  switch (isa) {
+    case TCALC_SIMD_ISA_SCALAR: return &tcalc_simd_scalar_kernels;
+    case TCALC_SIMD_ISA_SSE2: return &tcalc_simd_sse2_kernels;
+    case TCALC_SIMD_ISA_AVX2: return &tcalc_simd_avx2_kernels;
+    case TCALC_SIMD_ISA_AVX512: return &tcalc_simd_avx512_kernels;
+  }
+  return &tcalc_simd_scalar_kernels;
+}
+
+// the picked instruction set plus one, or 0 before the first kernel runs.
+// Racing first calls all store the same value, so relaxed atomics suffice.
+static int tcalc_simd_active = 0;
+
+tcalc_simd_isa tcalc_simd_getisa(void) {
+  const int active = __atomic_load_n(&tcalc_simd_active, __ATOMIC_RELAXED);
+  if (active != 0) return (tcalc_simd_isa)(active - 1);
+
+  tcalc_simd_isa isa = TCALC_SIMD_ISA_AVX512;
+  while (!tcalc_simd_supports(isa))
+    isa = (tcalc_simd_isa)(isa - 1);
+  __atomic_store_n(&tcalc_simd_active, (int)isa + 1, __ATOMIC_RELAXED);
+  return isa;
+}
+
+tcalc_err tcalc_simd_setisa(tcalc_simd_isa isa) {
+  if (!tcalc_simd_supports(isa)) return TCALC_ERR_INVALID_ARG;
+  __atomic_store_n(&tcalc_simd_active, (int)isa + 1, __ATOMIC_RELAXED);
+  return TCALC_ERR_OK;
+}
+
+#define tcalc_simd_active_kernels() tcalc_simd_isa_kernels(tcalc_simd_getisa())
+
+#else
+
+tcalc_simd_isa tcalc_simd_getisa(void) {
+  return TCALC_SIMD_ISA_SCALAR;
+}
+
+tcalc_err tcalc_simd_setisa(tcalc_simd_isa isa) {
+  return isa == TCALC_SIMD_ISA_SCALAR ? TCALC_ERR_OK : TCALC_ERR_INVALID_ARG;
+}
+
+#define tcalc_simd_active_kernels() (&tcalc_simd_scalar_kernels)
+
+#endif
+
+/**
+ * Public entry points
+*/
+
+#define tcalc_simd_binfunc_impl(_name_, _kernel_) \
+  tcalc_err _name_(const double* a, const double* b, double* out, size_t n) { \
+    return tcalc_simd_active_kernels()->_kernel_(a, b, out, n); \
+  }
+
+tcalc_simd_binfunc_impl(tcalc_add_arr, add)
+tcalc_simd_binfunc_impl(tcalc_subtract_arr, subtract)
+tcalc_simd_binfunc_impl(tcalc_multiply_arr, multiply)
+tcalc_simd_binfunc_impl(tcalc_divide_arr, divide)
+
+#define tcalc_simd_relfunc_impl(_name_, _kernel_) \
+  tcalc_err _name_(const double* a, const double* b, bool* out, size_t n) { \
+    return tcalc_simd_active_kernels()->_kernel_(a, b, out, n); \
+  }
+
+tcalc_simd_relfunc_impl(tcalc_lt_arr, lt)
+tcalc_simd_relfunc_impl(tcalc_lteq_arr, lteq)
+tcalc_simd_relfunc_impl(tcalc_gt_arr, gt)
+tcalc_simd_relfunc_impl(tcalc_gteq_arr, gteq)
+tcalc_simd_relfunc_impl(tcalc_equals_arr, equals)
+tcalc_simd_relfunc_impl(tcalc_nequals_arr, nequals)
+
+tcalc_err tcalc_and_arr(const bool* a, const bool* b, bool* out, size_t n) {
+  return tcalc_simd_active_kernels()->and_(a, b, out, n);
+}
+
+tcalc_err tcalc_or_arr(const bool* a, const bool* b, bool* out, size_t n) {
+  return tcalc_simd_active_kernels()->or_(a, b, out, n);
+}
+
+tcalc_err tcalc_not_arr(const bool* a, bool* out, size_t n) {
+  return tcalc_simd_active_kernels()->not_(a, out, n);
+}
+
+tcalc_err tcalc_negate_arr(const double* a, double* out, size_t n) {
+  // simple enough for the compiler to vectorize on its own
+  for (size_t i = 0; i < n; i++) out[i] = -a[i];
+  return TCALC_ERR_OK;
+}
+
+/**
+ * fmod and pow have no vector instructions, so these only save the per-value
+ * call through a tcalc_val_binfunc pointer
+*/
+
+tcalc_err tcalc_mod_arr(const double* a, const double* b, double* out, size_t n) {
+  tcalc_err err = TCALC_ERR_OK;
+  for (size_t i = 0; i < n; i++)
+    ret_on_err(err, tcalc_mod(a[i], b[i], &(out[i])));
+  return TCALC_ERR_OK;
+}
+
+tcalc_err tcalc_pow_arr(const double* a, const double* b, double* out, size_t n) {
+  tcalc_err err = TCALC_ERR_OK;
+  for (size_t i = 0; i < n; i++)
+    ret_on_err(err, tcalc_pow(a[i], b[i], &(out[i])));
+  return TCALC_ERR_OK;
+}
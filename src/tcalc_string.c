@@ -5,9 +5,10 @@
 #include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <limits.h>
 #include <float.h>
-#include <ctype.h>
+#include <math.h>
 #include <assert.h>
 
 // TODO: Maybe we shouldn't try to emulate strlcpy? It's quite bad
@@ -20,11 +21,10 @@ int32_t tcalc_strcpy_lblb(char *dest, int32_t destCapacity, const char *src, int
 
 int32_t tcalc_strcpy_lblb_ntdst(char* dst, int32_t dstCapacity, const char* src, int32_t srcLen)
 {
-  int32_t copied = tcalc_strcpy_lblb(dst, dstCapacity, src, srcLen);
-  if (copied < dstCapacity)
-    dst[copied + 1] = '\0';
-  else if (copied == dstCapacity && copied > 0)
-    dst[copied--] = '\0';
+  if (dstCapacity <= 0) return 0;
+  // leave room for the null terminator
+  const int32_t copied = tcalc_strcpy_lblb(dst, dstCapacity - 1, src, srcLen);
+  dst[copied] = '\0';
   return copied;
 }
 
@@ -33,51 +33,595 @@ bool tcalc_lpstrisdouble(const char* str, size_t len) {
   return tcalc_lpstrtodouble(str, len, &dummyout) == TCALC_ERR_OK;
 }
 
+/**
+ * Decimal to binary floating point conversion
+ *
+ * tcalc_lpstrtodouble reads up to 19 significant digits into a 64-bit
+ * integer w, so that the number is w * 10^exp10. From there, it takes the
+ * first of these that applies:
+ *
+ * 1. If w and 10^exp10 are both exact doubles, a single multiplication or
+ *    division is correctly rounded by IEEE 754 itself.
+ * 2. The Eisel-Lemire algorithm multiplies w by a 128-bit approximation of
+ *    10^exp10 (tcalc_pow10_128), which almost always pins down the correctly
+ *    rounded result. It reports the rare cases where the approximation is too
+ *    coarse to tell, and cannot handle subnormal results.
+ * 3. Otherwise, every digit is read into a big integer, and the result is
+ *    rounded from its exact quotient or product with a power of ten.
+*/
+
+static tcalc_u128 tcalc_mul_u64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+  __extension__ typedef unsigned __int128 tcalc_uint128;
+  const tcalc_uint128 p = (tcalc_uint128)a * b;
+  return (tcalc_u128){ .hi = (uint64_t)(p >> 64), .lo = (uint64_t)p };
+#else
+  const uint64_t aLo = (uint32_t)a, aHi = a >> 32;
+  const uint64_t bLo = (uint32_t)b, bHi = b >> 32;
+  const uint64_t ll = aLo * bLo, lh = aLo * bHi, hl = aHi * bLo, hh = aHi * bHi;
+  const uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+  return (tcalc_u128){
+    .hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32),
+    .lo = (mid << 32) | (uint32_t)ll
+  };
+#endif
+}
+
+static int tcalc_clz64(uint64_t x) {
+  assert(x != 0);
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_clzll(x);
+#else
+  int n = 0;
+  while (!(x & (UINT64_C(1) << 63))) { x <<= 1; n++; }
+  return n;
+#endif
+}
+
+static double tcalc_double_from_bits(uint64_t bits) {
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+/**
+ * Eisel-Lemire: the correctly rounded magnitude of w * 10^exp10, where w is
+ * nonzero and exp10 is within the range of tcalc_pow10_128. Returns false
+ * when the result cannot be determined this way.
+*/
+static bool tcalc_eisel_lemire(uint64_t w, int32_t exp10, double* out) {
+  assert(w != 0);
+  assert(exp10 >= TCALC_POW10_MIN_EXP10 && exp10 <= TCALC_POW10_MAX_EXP10);
+  const tcalc_u128 pow10 = tcalc_pow10_128[exp10 - TCALC_POW10_MIN_EXP10];
+
+  // normalize w, so that the product has its most significant bit in one of
+  // its top two bits
+  const int clz = tcalc_clz64(w);
+  w <<= clz;
+  // 217706 / 2^16 is just over log2(10)
+  uint64_t exp2 = (uint64_t)(((217706 * exp10) >> 16) + 64 + 1023) - (uint64_t)clz;
+
+  tcalc_u128 x = tcalc_mul_u64(w, pow10.hi);
+  if ((x.hi & 0x1FF) == 0x1FF && x.lo + w < w) {
+    // the bits that are rounded off might carry into the kept ones, so take
+    // the low half of the power of ten into account too
+    const tcalc_u128 y = tcalc_mul_u64(w, pow10.lo);
+    uint64_t mergedHi = x.hi, mergedLo = x.lo + y.hi;
+    if (mergedLo < x.lo) mergedHi++;
+    if ((mergedHi & 0x1FF) == 0x1FF && mergedLo + 1 == 0 && y.lo + w < w)
+      return false;
+    x.hi = mergedHi;
+    x.lo = mergedLo;
+  }
+
+  // keep 54 bits, one more than a double has
+  const uint64_t msb = x.hi >> 63;
+  uint64_t mantissa = x.hi >> (msb + 9);
+  exp2 -= 1 ^ msb;
+
+  // the product may be just below or exactly at a halfway point
+  if (x.lo == 0 && (x.hi & 0x1FF) == 0 && (mantissa & 3) == 1)
+    return false;
+
+  mantissa += mantissa & 1;
+  mantissa >>= 1;
+  if (mantissa >> 53 > 0) {
+    mantissa >>= 1;
+    exp2++;
+  }
+
+  // subnormal, infinite, or out of range
+  if (exp2 - 1 >= 0x7FF - 1)
+    return false;
+
+  *out = tcalc_double_from_bits((exp2 << 52) | (mantissa & ((UINT64_C(1) << 52) - 1)));
+  return true;
+}
+
+/**
+ * The double nearest to m * 2^e2, ties to even. sticky adds a nonzero amount
+ * smaller than 2^e2 to the value being rounded.
+*/
+static double tcalc_round_to_double(uint64_t m, int32_t e2, bool sticky) {
+  assert(m != 0);
+  const int clz = tcalc_clz64(m);
+  m <<= clz;
+  e2 -= clz;
+
+  // a double keeps 53 bits, or fewer if it is subnormal
+  const int32_t leadExp2 = e2 + 63;
+  int32_t drop = 64 - 53;
+  if (leadExp2 < -1022)
+    drop += -1022 - leadExp2;
+  if (drop > 64)
+    return 0.0;
+
+  uint64_t kept = 0;
+  bool half = false, below = sticky;
+  if (drop == 64) {
+    half = (m >> 63) != 0;
+    below |= (m << 1) != 0;
+  } else {
+    kept = m >> drop;
+    half = ((m >> (drop - 1)) & 1) != 0;
+    below |= (m & ((UINT64_C(1) << (drop - 1)) - 1)) != 0;
+  }
+
+  if (half && (below || (kept & 1)))
+    kept++;
+  // exact, or infinite if the value is too large
+  return ldexp((double)kept, e2 + drop);
+}
+
+// Enough for 800 significant digits divided by the smallest power of ten
+// that they may be divided by
+#define TCALC_BIGNUM_LIMBS 130
+#define TCALC_STRTOD_MAX_DIGITS 800
+
+typedef struct tcalc_bignum {
+  uint32_t limbs[TCALC_BIGNUM_LIMBS]; // least significant first
+  int32_t len; // no leading zero limbs
+} tcalc_bignum;
+
+static void tcalc_bignum_muladd(tcalc_bignum* x, uint32_t mul, uint32_t add) {
+  uint64_t carry = add;
+  for (int32_t i = 0; i < x->len; i++) {
+    const uint64_t v = (uint64_t)x->limbs[i] * mul + carry;
+    x->limbs[i] = (uint32_t)v;
+    carry = v >> 32;
+  }
+  if (carry != 0) {
+    assert(x->len < TCALC_BIGNUM_LIMBS);
+    x->limbs[x->len++] = (uint32_t)carry;
+  }
+}
+
+static void tcalc_bignum_mulpow10(tcalc_bignum* x, int32_t exp10) {
+  for (; exp10 >= 9; exp10 -= 9)
+    tcalc_bignum_muladd(x, 1000000000u, 0);
+  uint32_t rest = 1;
+  for (; exp10 > 0; exp10--)
+    rest *= 10;
+  tcalc_bignum_muladd(x, rest, 0);
+}
+
+static void tcalc_bignum_shl(tcalc_bignum* x, int32_t bits) {
+  if (x->len == 0) return;
+  const int32_t limbShift = bits / 32, bitShift = bits % 32;
+  assert(x->len + limbShift + 1 <= TCALC_BIGNUM_LIMBS);
+  x->limbs[x->len + limbShift] = 0;
+  for (int32_t i = x->len - 1; i >= 0; i--) {
+    const uint64_t v = (uint64_t)x->limbs[i] << bitShift;
+    x->limbs[i + limbShift + 1] |= (uint32_t)(v >> 32);
+    x->limbs[i + limbShift] = (uint32_t)v;
+  }
+  for (int32_t i = 0; i < limbShift; i++)
+    x->limbs[i] = 0;
+  x->len += limbShift + 1;
+  while (x->len > 0 && x->limbs[x->len - 1] == 0)
+    x->len--;
+}
+
+static void tcalc_bignum_shr1(tcalc_bignum* x) {
+  for (int32_t i = 0; i < x->len; i++)
+    x->limbs[i] = (x->limbs[i] >> 1) | (i + 1 < x->len ? x->limbs[i + 1] << 31 : 0);
+  if (x->len > 0 && x->limbs[x->len - 1] == 0)
+    x->len--;
+}
+
+static int tcalc_bignum_cmp(const tcalc_bignum* a, const tcalc_bignum* b) {
+  if (a->len != b->len) return a->len < b->len ? -1 : 1;
+  for (int32_t i = a->len - 1; i >= 0; i--) {
+    if (a->limbs[i] != b->limbs[i])
+      return a->limbs[i] < b->limbs[i] ? -1 : 1;
+  }
+  return 0;
+}
+
+// a -= b, where a >= b
+static void tcalc_bignum_sub(tcalc_bignum* a, const tcalc_bignum* b) {
+  int64_t borrow = 0;
+  for (int32_t i = 0; i < a->len; i++) {
+    const int64_t v = (int64_t)a->limbs[i] - (i < b->len ? b->limbs[i] : 0) - borrow;
+    borrow = v < 0;
+    a->limbs[i] = (uint32_t)(v + (borrow << 32));
+  }
+  assert(borrow == 0);
+  while (a->len > 0 && a->limbs[a->len - 1] == 0)
+    a->len--;
+}
+
+static int32_t tcalc_bignum_bitlen(const tcalc_bignum* x) {
+  if (x->len == 0) return 0;
+  return 32 * x->len - (tcalc_clz64(x->limbs[x->len - 1]) - 32);
+}
+
+// The bits of x from bit lsb up to bit lsb + 63
+static uint64_t tcalc_bignum_bits64(const tcalc_bignum* x, int32_t lsb, bool* outSticky) {
+  uint64_t bits = 0;
+  for (int32_t i = 63; i >= 0; i--) {
+    const int32_t bit = lsb + i;
+    bits <<= 1;
+    if (bit >= 0 && bit / 32 < x->len)
+      bits |= (x->limbs[bit / 32] >> (bit % 32)) & 1;
+  }
+
+  *outSticky = false;
+  for (int32_t bit = 0; bit < lsb && !*outSticky; bit++)
+    *outSticky = ((x->limbs[bit / 32] >> (bit % 32)) & 1) != 0;
+  return bits;
+}
+
+/**
+ * The correctly rounded magnitude of the digits of mant (which may hold one
+ * decimal point) times 10^exp10, worked out with big integers
+*/
+static double tcalc_strtod_slow(const char* mant, size_t mantLen, int32_t exp10) {
+  // D is read from at most TCALC_STRTOD_MAX_DIGITS significant digits, and
+  // sticky is set if any of the digits after those is nonzero
+  tcalc_bignum digits = { .len = 0 };
+  int32_t digitCount = 0;
+  bool sticky = false, sawDot = false;
+
+  for (size_t i = 0; i < mantLen; i++) {
+    if (mant[i] == '.') {
+      sawDot = true;
+      continue;
+    }
+
+    const uint32_t d = (uint32_t)(mant[i] - '0');
+    if (digitCount == 0 && d == 0) {
+      if (sawDot) exp10--;
+    } else if (digitCount < TCALC_STRTOD_MAX_DIGITS) {
+      tcalc_bignum_muladd(&digits, 10, d);
+      digitCount++;
+      if (sawDot) exp10--;
+    } else {
+      sticky |= d != 0;
+      if (!sawDot) exp10++;
+    }
+  }
+
+  if (digitCount == 0) return 0.0;
+  if (digitCount + exp10 > 310) return HUGE_VAL;
+  if (digitCount + exp10 < -343) return 0.0;
+
+  if (exp10 >= 0) {
+    tcalc_bignum_mulpow10(&digits, exp10);
+    const int32_t lsb = tcalc_bignum_bitlen(&digits) - 64;
+    bool lowSticky = false;
+    const uint64_t m = tcalc_bignum_bits64(&digits, lsb, &lowSticky);
+    return tcalc_round_to_double(m, lsb, sticky || lowSticky);
+  }
+
+  // Divide digits * 2^shift by 10^-exp10 bit by bit, with shift chosen so
+  // that the quotient takes 63 or 64 bits
+  tcalc_bignum pow10 = { .limbs = { 1 }, .len = 1 };
+  tcalc_bignum_mulpow10(&pow10, -exp10);
+  const int32_t shift = tcalc_bignum_bitlen(&pow10) - tcalc_bignum_bitlen(&digits) + 63;
+  if (shift >= 0)
+    tcalc_bignum_shl(&digits, shift);
+  else
+    tcalc_bignum_shl(&pow10, -shift);
+
+  tcalc_bignum_shl(&pow10, 63);
+  uint64_t quotient = 0;
+  for (int32_t bit = 63; bit >= 0; bit--) {
+    if (tcalc_bignum_cmp(&digits, &pow10) >= 0) {
+      tcalc_bignum_sub(&digits, &pow10);
+      quotient |= UINT64_C(1) << bit;
+    }
+    tcalc_bignum_shr1(&pow10);
+  }
+
+  return tcalc_round_to_double(quotient, -shift, sticky || digits.len > 0);
+}
+
 tcalc_err tcalc_lpstrtodouble(const char* str, size_t len, double* out) {
   assert(str != NULL);
   assert(out != NULL);
   *out = 0.0;
 
-  if (len == 0)
-    return TCALC_ERR_INVALID_ARG;
+  size_t i = 0;
+  const bool negative = len > 0 && str[0] == '-';
+  if (len > 0 && (str[0] == '-' || str[0] == '+'))
+    i++;
 
-  if (str[0] == '-' || str[0] == '+')  {
-    if (str[1] == '.') {
-      if (!isdigit(str[2]))
-        return TCALC_ERR_INVALID_ARG;
+  // the first 19 significant digits, which always fit in 64 bits
+  const size_t mantStart = i;
+  uint64_t w = 0;
+  int32_t wDigits = 0;
+  int64_t exp10 = 0;
+  bool sawDigit = false, sawDot = false, truncated = false;
+
+  for (; i < len; i++) {
+    if (str[i] == '.') {
+      if (sawDot) return TCALC_ERR_INVALID_ARG;
+      sawDot = true;
+    } else if (str[i] >= '0' && str[i] <= '9') {
+      const uint64_t d = (uint64_t)(str[i] - '0');
+      sawDigit = true;
+      if (w == 0 && d == 0) {
+        if (sawDot) exp10--;
+      } else if (wDigits < 19) {
+        w = w * 10 + d;
+        wDigits++;
+        if (sawDot) exp10--;
+      } else {
+        truncated |= d != 0;
+        if (!sawDot) exp10++;
+      }
+    } else {
+      break;
     }
-    else if (!isdigit(str[1])) {
+  }
+
+  if (!sawDigit) return TCALC_ERR_INVALID_ARG;
+  const size_t mantLen = i - mantStart;
+
+  int64_t explicitExp10 = 0;
+  if (i < len && (str[i] == 'e' || str[i] == 'E')) {
+    i++;
+    const bool expNegative = i < len && str[i] == '-';
+    if (i < len && (str[i] == '-' || str[i] == '+'))
+      i++;
+    if (!(i < len && str[i] >= '0' && str[i] <= '9'))
       return TCALC_ERR_INVALID_ARG;
+
+    // far past where every number is zero or infinite, so stop counting
+    for (; i < len && str[i] >= '0' && str[i] <= '9'; i++) {
+      if (explicitExp10 < 100000)
+        explicitExp10 = explicitExp10 * 10 + (str[i] - '0');
     }
+    if (expNegative) explicitExp10 = -explicitExp10;
+    exp10 += explicitExp10;
   }
 
-  int foundDecimal = 0;
-  double decimalMultiplier = 0.1;
-  double sign = str[0] == '-' ? -1.0 : 1.0;
+  if (i != len) return TCALC_ERR_INVALID_ARG;
 
-  for (size_t i = (str[0] == '-' || str[0] == '+'); i < len; i++) {
-    if (str[i] == '.') {
-      if (foundDecimal) return TCALC_ERR_INVALID_ARG;
-      foundDecimal = 1;
-    } else if (isdigit(str[i])) {
-      if (*out >= (DBL_MAX - 9) / 10) {
-        return sign == -1 ? TCALC_ERR_UNDERFLOW : TCALC_ERR_OVERFLOW;
-      }
+  double result = 0.0;
+  if (w == 0) {
+    result = 0.0;
+  } else if (wDigits + exp10 > 310) {
+    return TCALC_ERR_OVERFLOW;
+  } else if (wDigits + exp10 < -343) {
+    result = 0.0;
+  }
+#if FLT_EVAL_METHOD == 0
+  else if (!truncated && w <= (UINT64_C(1) << 53) && exp10 >= -22 && exp10 <= 22) {
+    static const double exactPow10[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    result = exp10 >= 0 ?
+      (double)w * exactPow10[exp10] :
+      (double)w / exactPow10[-exp10];
+  }
+#endif
+  else {
+    double upper = 0.0;
+    // with digits truncated, the number lies between w and w + 1, so both
+    // have to round to the same double
+    const bool fast =
+      exp10 >= TCALC_POW10_MIN_EXP10 &&
+      tcalc_eisel_lemire(w, (int32_t)exp10, &result) &&
+      (!truncated || (tcalc_eisel_lemire(w + 1, (int32_t)exp10, &upper) && upper == result));
+    if (!fast)
+      result = tcalc_strtod_slow(str + mantStart, mantLen, (int32_t)explicitExp10);
+  }
 
-      if (foundDecimal) {
-        *out = *out + (str[i] - '0') * decimalMultiplier;
-        decimalMultiplier /= 10.0;
-      }
-      else {
-        *out = *out * 10.0 + (str[i] - '0');
-      }
+  if (isinf(result))
+    return TCALC_ERR_OVERFLOW;
+  *out = negative ? -result : result;
+  return TCALC_ERR_OK;
+}
+
+/**
+ * Binary to decimal floating point conversion
+ *
+ * tcalc_doubletostr finds the shortest decimal which reads back as the same
+ * double with the Schubfach algorithm (Raffaello Giulietti, "The Schubfach
+ * way to render doubles"). The bounds of the interval of decimals which round
+ * to the double are scaled by a 128-bit power of ten from tcalc_pow10_128,
+ * and the shortest decimal in that interval is picked from the two nearest
+ * candidates of one and of two fewer digits.
+*/
 
+// floor(log2(10^e)), for |e| <= 1233
+static int32_t tcalc_floorlog2pow10(int32_t e) {
+  return (e * 1741647) >> 19;
+}
+
+/**
+ * The 64 high bits of g * cp / 2^64, with the lowest bit set if any of the
+ * bits below them are set (rounding to odd)
+*/
+static uint64_t tcalc_round_to_odd(tcalc_u128 g, uint64_t cp) {
+  const tcalc_u128 x = tcalc_mul_u64(g.lo, cp);
+  const tcalc_u128 y = tcalc_mul_u64(g.hi, cp);
+  const uint64_t z0 = y.lo + x.hi;
+  const uint64_t z1 = y.hi + (z0 < y.lo);
+  return z1 | (z0 > 1);
+}
+
+/**
+ * The shortest decimal digits * 10^exp10 which reads back as the finite,
+ * positive double with the given significand and biased exponent bits
+*/
+static void tcalc_schubfach(uint64_t ieeeSignificand, uint32_t ieeeExponent, uint64_t* outDigits, int32_t* outExp10) {
+  uint64_t c = ieeeSignificand;
+  int32_t q = 1 - 1075;
+  if (ieeeExponent != 0) {
+    c |= UINT64_C(1) << 52;
+    q = (int32_t)ieeeExponent - 1075;
+    // small integers are their own shortest decimal
+    if (q <= 0 && q > -53 && (c & ((UINT64_C(1) << -q) - 1)) == 0) {
+      *outDigits = c >> -q;
+      *outExp10 = 0;
+      return;
+    }
+  }
+
+  const bool acceptBounds = (c & 1) == 0; // ties read back to even
+  // the gap to the next lower double is half as wide at powers of two
+  const bool lowerCloser = ieeeSignificand == 0 && ieeeExponent > 1;
+
+  const uint64_t cbl = 4 * c - 2 + lowerCloser;
+  const uint64_t cb = 4 * c;
+  const uint64_t cbr = 4 * c + 2;
+
+  // floor(log10(2^q)), or floor(log10(3/4 2^q)) when the lower bound is closer
+  const int32_t k = (q * 1262611 - (lowerCloser ? 524031 : 0)) >> 22;
+  const int32_t h = q + tcalc_floorlog2pow10(-k) + 1;
+  assert(h >= 1 && h <= 4);
+
+  // 10^-k rounded up
+  tcalc_u128 g = tcalc_pow10_128[-k - TCALC_POW10_MIN_EXP10];
+  g.lo++;
+  if (g.lo == 0) g.hi++;
+
+  const uint64_t vbl = tcalc_round_to_odd(g, cbl << h);
+  const uint64_t vb = tcalc_round_to_odd(g, cb << h);
+  const uint64_t vbr = tcalc_round_to_odd(g, cbr << h);
+  const uint64_t lower = vbl + !acceptBounds;
+  const uint64_t upper = vbr - !acceptBounds;
+
+  // vb is 4 times the double scaled by 10^-k, so s is its integral part
+  const uint64_t s = vb / 4;
+  if (s >= 10) {
+    // at most one multiple of ten is close enough to the double
+    const uint64_t sp = s / 10;
+    const bool upInside = lower <= 40 * sp;
+    const bool wpInside = 40 * sp + 40 <= upper;
+    if (upInside != wpInside) {
+      *outDigits = sp + wpInside;
+      *outExp10 = k + 1;
+      return;
+    }
+  }
+
+  const bool uInside = lower <= 4 * s;
+  const bool wInside = 4 * s + 4 <= upper;
+  if (uInside != wInside) {
+    *outDigits = s + wInside;
+    *outExp10 = k;
+    return;
+  }
+
+  // both are close enough, so take the nearest one, ties to even
+  const uint64_t mid = 4 * s + 2;
+  const bool roundUp = vb > mid || (vb == mid && (s & 1) != 0);
+  *outDigits = s + roundUp;
+  *outExp10 = k;
+}
+
+tcalc_err tcalc_doubletostr(double num, char* dest, int32_t destCapacity, int32_t* outLen) {
+  assert(dest != NULL);
+  assert(outLen != NULL);
+  *outLen = 0;
+
+  char buf[TCALC_DOUBLESTR_MAX_SIZE];
+  int32_t len = 0;
+
+  uint64_t bits;
+  memcpy(&bits, &num, sizeof(bits));
+  const uint64_t ieeeSignificand = bits & ((UINT64_C(1) << 52) - 1);
+  const uint32_t ieeeExponent = (uint32_t)(bits >> 52) & 0x7FF;
+
+  if (ieeeExponent == 0x7FF && ieeeSignificand != 0) {
+    memcpy(buf, "nan", 3);
+    len = 3;
+  } else {
+    if (bits >> 63)
+      buf[len++] = '-';
+
+    if (ieeeExponent == 0x7FF) {
+      memcpy(buf + len, "inf", 3);
+      len += 3;
+    } else if (ieeeExponent == 0 && ieeeSignificand == 0) {
+      buf[len++] = '0';
     } else {
-      return TCALC_ERR_INVALID_ARG;
+      uint64_t digits = 0;
+      int32_t exp10 = 0;
+      tcalc_schubfach(ieeeSignificand, ieeeExponent, &digits, &exp10);
+      while (digits % 10 == 0) {
+        digits /= 10;
+        exp10++;
+      }
+
+      char digitStr[20];
+      int32_t digitCount = 0;
+      for (uint64_t rest = digits; rest > 0; rest /= 10)
+        digitStr[19 - digitCount++] = (char)('0' + rest % 10);
+      const char* const first = digitStr + 20 - digitCount;
+
+      // the exponent of the number in scientific notation
+      const int32_t sciExp10 = digitCount + exp10 - 1;
+      if (sciExp10 >= 21 || sciExp10 < -6) {
+        // "1.2345e-7"
+        buf[len++] = first[0];
+        if (digitCount > 1) {
+          buf[len++] = '.';
+          memcpy(buf + len, first + 1, (size_t)(digitCount - 1));
+          len += digitCount - 1;
+        }
+        buf[len++] = 'e';
+        uint32_t absExp = (uint32_t)(sciExp10 < 0 ? -sciExp10 : sciExp10);
+        if (sciExp10 < 0) buf[len++] = '-';
+        if (absExp >= 100) buf[len++] = (char)('0' + absExp / 100);
+        if (absExp >= 10) buf[len++] = (char)('0' + absExp / 10 % 10);
+        buf[len++] = (char)('0' + absExp % 10);
+      } else if (exp10 >= 0) {
+        // "12300"
+        memcpy(buf + len, first, (size_t)digitCount);
+        len += digitCount;
+        memset(buf + len, '0', (size_t)exp10);
+        len += exp10;
+      } else if (sciExp10 >= 0) {
+        // "12.3"
+        memcpy(buf + len, first, (size_t)(sciExp10 + 1));
+        len += sciExp10 + 1;
+        buf[len++] = '.';
+        memcpy(buf + len, first + sciExp10 + 1, (size_t)(digitCount - sciExp10 - 1));
+        len += digitCount - sciExp10 - 1;
+      } else {
+        // "0.00123"
+        buf[len++] = '0';
+        buf[len++] = '.';
+        memset(buf + len, '0', (size_t)(-sciExp10 - 1));
+        len += -sciExp10 - 1;
+        memcpy(buf + len, first, (size_t)digitCount);
+        len += digitCount;
+      }
     }
   }
 
-  *out *= sign;
+  assert(len < TCALC_DOUBLESTR_MAX_SIZE);
+  if (len >= destCapacity)
+    return TCALC_ERR_NOMEM;
+  memcpy(dest, buf, (size_t)len);
+  dest[len] = '\0';
+  *outLen = len;
   return TCALC_ERR_OK;
 }
 
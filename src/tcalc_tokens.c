@@ -2,50 +2,215 @@
 
 #include <stdbool.h>
 #include <stddef.h>
-#include <ctype.h>
-#include <stdlib.h>
-#include <string.h>
+#include <stdint.h>
 #include <assert.h>
+#include <inttypes.h>
 
 /**
- * ()[] - Grouping symbols
- * +-/%*^ - Operators
- * 0123456789 - digits
- * . - decimal point
+ * Tokens are read by a DFA over character classes. Every byte of the
+ * expression is mapped to its class through tcalc_lex_charclass, and each
+ * token is the longest run of characters that tcalc_lex_dfa can walk from
+ * TCALC_LEX_START. The state the walk stops in decides the type of the token.
+ *
+ * ()   - Grouping symbols
+ * +-/%*^ ** - Arithmetic operators
+ * == = != < <= > >= - Relational and equality operators
+ * ! && || - Logical operators
+ * 0123456789 . e E - Numbers, with at most one decimal point and an optional
+ *   exponent ("1.5e-3"). An "e" which is not followed by the digits of an
+ *   exponent is not part of the number, so "2e" is still "2" times "e".
  * , - parameter separator
  * abcdefghijklmnopqrstuvwxyz - function and variable names
+ * spaces and tabs - ignored
 */
-const char* TCALC_ALLOWED_CHARS = ",()[]+-*/^%!=<>&|0123456789. abcdefghijklmnopqrstuvwxyz";
-const char* TCALC_SINGLE_TOKENS = ",()[]+-*/^%!=<>";
-const char* TCALC_MULTI_TOKENS[] = {"**", "==", "<=", ">=", "!=", "&&", "||", NULL}; // make sure this remains null terminated
-
-static bool is_valid_tcalc_char(char ch);
-
-static bool tcalc_token_ntstr_eq(
-  const char* expr, struct tcalc_token token, const char* ntstr
-) {
-  return tcalc_streq_ntlb(ntstr, expr + token.start, token.xend - token.start);
-}
-
-static tcalc_err tcalc_next_math_strtoken(
-  const char* expr, int32_t exprLen, int32_t req_start,
-  int32_t* out_start, int32_t* out_xend
-);
-
-static bool tcalc_are_groupsyms_balanced(const char* expr, int32_t exprLen);
 
-static tcalc_err tcalc_tokenize_infix_strtokens(
-  const char* expr, int32_t exprLen, tcalc_token* destBuffer,
-  int32_t destCapacity, int32_t* outDestLen
-);
-
-static tcalc_err tcalc_tokenize_infix_strtokens_assign_types(
-  const char* expr, int32_t exprLen, tcalc_token* tokens, int32_t tokensLen
-);
-
-static bool tcalc_is_identifier(
-  const char* source, int32_t sourceStart, int32_t sourceXEnd, int32_t checkLen
-);
+typedef enum tcalc_lex_charclass_e {
+  TCALC_CC_INVALID,
+  TCALC_CC_BLANK,
+  TCALC_CC_DIGIT,
+  TCALC_CC_DOT,
+  TCALC_CC_LOWER,
+  TCALC_CC_LOWER_E, // "e", which may start an exponent or be part of a name
+  TCALC_CC_UPPER_E, // "E", which may only start an exponent
+  TCALC_CC_PLUS,
+  TCALC_CC_MINUS,
+  TCALC_CC_STAR,
+  TCALC_CC_SLASH,
+  TCALC_CC_PERCENT,
+  TCALC_CC_CARET,
+  TCALC_CC_LPAREN,
+  TCALC_CC_RPAREN,
+  TCALC_CC_COMMA,
+  TCALC_CC_BANG,
+  TCALC_CC_EQ,
+  TCALC_CC_LT,
+  TCALC_CC_GT,
+  TCALC_CC_AMP,
+  TCALC_CC_PIPE,
+  TCALC_CC_COUNT
+} tcalc_lex_charclass_e;
+
+static const uint8_t tcalc_lex_charclass[256] = {
+  [' '] = TCALC_CC_BLANK, ['\t'] = TCALC_CC_BLANK,
+  ['0'] = TCALC_CC_DIGIT, ['1'] = TCALC_CC_DIGIT, ['2'] = TCALC_CC_DIGIT,
+  ['3'] = TCALC_CC_DIGIT, ['4'] = TCALC_CC_DIGIT, ['5'] = TCALC_CC_DIGIT,
+  ['6'] = TCALC_CC_DIGIT, ['7'] = TCALC_CC_DIGIT, ['8'] = TCALC_CC_DIGIT,
+  ['9'] = TCALC_CC_DIGIT,
+  ['.'] = TCALC_CC_DOT,
+  ['a'] = TCALC_CC_LOWER, ['b'] = TCALC_CC_LOWER, ['c'] = TCALC_CC_LOWER,
+  ['d'] = TCALC_CC_LOWER, ['e'] = TCALC_CC_LOWER_E, ['f'] = TCALC_CC_LOWER,
+  ['g'] = TCALC_CC_LOWER, ['h'] = TCALC_CC_LOWER, ['i'] = TCALC_CC_LOWER,
+  ['j'] = TCALC_CC_LOWER, ['k'] = TCALC_CC_LOWER, ['l'] = TCALC_CC_LOWER,
+  ['m'] = TCALC_CC_LOWER, ['n'] = TCALC_CC_LOWER, ['o'] = TCALC_CC_LOWER,
+  ['p'] = TCALC_CC_LOWER, ['q'] = TCALC_CC_LOWER, ['r'] = TCALC_CC_LOWER,
+  ['s'] = TCALC_CC_LOWER, ['t'] = TCALC_CC_LOWER, ['u'] = TCALC_CC_LOWER,
+  ['v'] = TCALC_CC_LOWER, ['w'] = TCALC_CC_LOWER, ['x'] = TCALC_CC_LOWER,
+  ['y'] = TCALC_CC_LOWER, ['z'] = TCALC_CC_LOWER,
+  ['E'] = TCALC_CC_UPPER_E,
+  ['+'] = TCALC_CC_PLUS,
+  ['-'] = TCALC_CC_MINUS,
+  ['*'] = TCALC_CC_STAR,
+  ['/'] = TCALC_CC_SLASH,
+  ['%'] = TCALC_CC_PERCENT,
+  ['^'] = TCALC_CC_CARET,
+  ['('] = TCALC_CC_LPAREN,
+  [')'] = TCALC_CC_RPAREN,
+  [','] = TCALC_CC_COMMA,
+  ['!'] = TCALC_CC_BANG,
+  ['='] = TCALC_CC_EQ,
+  ['<'] = TCALC_CC_LT,
+  ['>'] = TCALC_CC_GT,
+  ['&'] = TCALC_CC_AMP,
+  ['|'] = TCALC_CC_PIPE
+};
+
+typedef enum tcalc_lex_state {
+  TCALC_LEX_STOP, // the current token ends before the current character
+  TCALC_LEX_START,
+  TCALC_LEX_INT, // "12"
+  TCALC_LEX_LEADING_DOT, // ".", which must be followed by a digit
+  TCALC_LEX_FRAC, // "12.", "12.5", ".5"
+  TCALC_LEX_EXP_MARK, // "12e", which is only a number if digits follow
+  TCALC_LEX_EXP_SIGN, // "12e-", which is only a number if digits follow
+  TCALC_LEX_EXP, // "12e5", "12e-5"
+  TCALC_LEX_BAD_NUM, // a number with a second decimal point
+  TCALC_LEX_ID,
+  TCALC_LEX_PLUS,
+  TCALC_LEX_MINUS,
+  TCALC_LEX_STAR,
+  TCALC_LEX_STARSTAR,
+  TCALC_LEX_SLASH,
+  TCALC_LEX_PERCENT,
+  TCALC_LEX_CARET,
+  TCALC_LEX_LPAREN,
+  TCALC_LEX_RPAREN,
+  TCALC_LEX_COMMA,
+  TCALC_LEX_BANG,
+  TCALC_LEX_BANGEQ,
+  TCALC_LEX_EQ,
+  TCALC_LEX_EQEQ,
+  TCALC_LEX_LT,
+  TCALC_LEX_LTEQ,
+  TCALC_LEX_GT,
+  TCALC_LEX_GTEQ,
+  TCALC_LEX_AMP,
+  TCALC_LEX_AMPAMP,
+  TCALC_LEX_PIPE,
+  TCALC_LEX_PIPEPIPE,
+  TCALC_LEX_STATE_COUNT
+} tcalc_lex_state;
+
+// Transitions which are left out go to TCALC_LEX_STOP
+static const uint8_t tcalc_lex_dfa[TCALC_LEX_STATE_COUNT][TCALC_CC_COUNT] = {
+  [TCALC_LEX_START] = {
+    [TCALC_CC_DIGIT] = TCALC_LEX_INT,
+    [TCALC_CC_DOT] = TCALC_LEX_LEADING_DOT,
+    [TCALC_CC_LOWER] = TCALC_LEX_ID,
+    [TCALC_CC_LOWER_E] = TCALC_LEX_ID,
+    [TCALC_CC_PLUS] = TCALC_LEX_PLUS,
+    [TCALC_CC_MINUS] = TCALC_LEX_MINUS,
+    [TCALC_CC_STAR] = TCALC_LEX_STAR,
+    [TCALC_CC_SLASH] = TCALC_LEX_SLASH,
+    [TCALC_CC_PERCENT] = TCALC_LEX_PERCENT,
+    [TCALC_CC_CARET] = TCALC_LEX_CARET,
+    [TCALC_CC_LPAREN] = TCALC_LEX_LPAREN,
+    [TCALC_CC_RPAREN] = TCALC_LEX_RPAREN,
+    [TCALC_CC_COMMA] = TCALC_LEX_COMMA,
+    [TCALC_CC_BANG] = TCALC_LEX_BANG,
+    [TCALC_CC_EQ] = TCALC_LEX_EQ,
+    [TCALC_CC_LT] = TCALC_LEX_LT,
+    [TCALC_CC_GT] = TCALC_LEX_GT,
+    [TCALC_CC_AMP] = TCALC_LEX_AMP,
+    [TCALC_CC_PIPE] = TCALC_LEX_PIPE
+  },
+  [TCALC_LEX_INT] = {
+    [TCALC_CC_DIGIT] = TCALC_LEX_INT, [TCALC_CC_DOT] = TCALC_LEX_FRAC,
+    [TCALC_CC_LOWER_E] = TCALC_LEX_EXP_MARK, [TCALC_CC_UPPER_E] = TCALC_LEX_EXP_MARK
+  },
+  [TCALC_LEX_LEADING_DOT] = { [TCALC_CC_DIGIT] = TCALC_LEX_FRAC },
+  [TCALC_LEX_FRAC] = {
+    [TCALC_CC_DIGIT] = TCALC_LEX_FRAC, [TCALC_CC_DOT] = TCALC_LEX_BAD_NUM,
+    [TCALC_CC_LOWER_E] = TCALC_LEX_EXP_MARK, [TCALC_CC_UPPER_E] = TCALC_LEX_EXP_MARK
+  },
+  [TCALC_LEX_EXP_MARK] = {
+    [TCALC_CC_DIGIT] = TCALC_LEX_EXP, [TCALC_CC_PLUS] = TCALC_LEX_EXP_SIGN,
+    [TCALC_CC_MINUS] = TCALC_LEX_EXP_SIGN
+  },
+  [TCALC_LEX_EXP_SIGN] = { [TCALC_CC_DIGIT] = TCALC_LEX_EXP },
+  [TCALC_LEX_EXP] = { [TCALC_CC_DIGIT] = TCALC_LEX_EXP, [TCALC_CC_DOT] = TCALC_LEX_BAD_NUM },
+  [TCALC_LEX_ID] = { [TCALC_CC_LOWER] = TCALC_LEX_ID, [TCALC_CC_LOWER_E] = TCALC_LEX_ID },
+  [TCALC_LEX_STAR] = { [TCALC_CC_STAR] = TCALC_LEX_STARSTAR },
+  [TCALC_LEX_BANG] = { [TCALC_CC_EQ] = TCALC_LEX_BANGEQ },
+  [TCALC_LEX_EQ] = { [TCALC_CC_EQ] = TCALC_LEX_EQEQ },
+  [TCALC_LEX_LT] = { [TCALC_CC_EQ] = TCALC_LEX_LTEQ },
+  [TCALC_LEX_GT] = { [TCALC_CC_EQ] = TCALC_LEX_GTEQ },
+  [TCALC_LEX_AMP] = { [TCALC_CC_AMP] = TCALC_LEX_AMPAMP },
+  [TCALC_LEX_PIPE] = { [TCALC_CC_PIPE] = TCALC_LEX_PIPEPIPE }
+};
+
+#define TCALC_LEX_REJECT (-1)
+
+// The token read when the DFA stops in each state. States left out of this
+// table do not end a valid token.
+static const struct {
+  int8_t type; // tcalc_token_type, or TCALC_LEX_REJECT
+  uint8_t opkind;
+} tcalc_lex_accept[TCALC_LEX_STATE_COUNT] = {
+  [TCALC_LEX_STOP] = { TCALC_LEX_REJECT, TCALC_OPKIND_NONE },
+  [TCALC_LEX_START] = { TCALC_LEX_REJECT, TCALC_OPKIND_NONE },
+  [TCALC_LEX_INT] = { TCALC_TOK_NUM, TCALC_OPKIND_NONE },
+  [TCALC_LEX_LEADING_DOT] = { TCALC_LEX_REJECT, TCALC_OPKIND_NONE },
+  [TCALC_LEX_FRAC] = { TCALC_TOK_NUM, TCALC_OPKIND_NONE },
+  // the "e" and sign are given back by tcalc_tokenize_infix
+  [TCALC_LEX_EXP_MARK] = { TCALC_TOK_NUM, TCALC_OPKIND_NONE },
+  [TCALC_LEX_EXP_SIGN] = { TCALC_TOK_NUM, TCALC_OPKIND_NONE },
+  [TCALC_LEX_EXP] = { TCALC_TOK_NUM, TCALC_OPKIND_NONE },
+  [TCALC_LEX_BAD_NUM] = { TCALC_LEX_REJECT, TCALC_OPKIND_NONE },
+  [TCALC_LEX_ID] = { TCALC_TOK_ID, TCALC_OPKIND_NONE },
+  // "+" and "-" are made unary by tcalc_tokenize_infix where necessary
+  [TCALC_LEX_PLUS] = { TCALC_TOK_BINOP, TCALC_OPKIND_PLUS },
+  [TCALC_LEX_MINUS] = { TCALC_TOK_BINOP, TCALC_OPKIND_MINUS },
+  [TCALC_LEX_STAR] = { TCALC_TOK_BINOP, TCALC_OPKIND_STAR },
+  [TCALC_LEX_STARSTAR] = { TCALC_TOK_BINOP, TCALC_OPKIND_STARSTAR },
+  [TCALC_LEX_SLASH] = { TCALC_TOK_BINOP, TCALC_OPKIND_SLASH },
+  [TCALC_LEX_PERCENT] = { TCALC_TOK_BINOP, TCALC_OPKIND_PERCENT },
+  [TCALC_LEX_CARET] = { TCALC_TOK_BINOP, TCALC_OPKIND_CARET },
+  [TCALC_LEX_LPAREN] = { TCALC_TOK_GRPSTRT, TCALC_OPKIND_NONE },
+  [TCALC_LEX_RPAREN] = { TCALC_TOK_GRPEND, TCALC_OPKIND_NONE },
+  [TCALC_LEX_COMMA] = { TCALC_TOK_PSEP, TCALC_OPKIND_NONE },
+  [TCALC_LEX_BANG] = { TCALC_TOK_UNLOP, TCALC_OPKIND_BANG },
+  [TCALC_LEX_BANGEQ] = { TCALC_TOK_EQOP, TCALC_OPKIND_BANGEQ },
+  [TCALC_LEX_EQ] = { TCALC_TOK_EQOP, TCALC_OPKIND_EQ },
+  [TCALC_LEX_EQEQ] = { TCALC_TOK_EQOP, TCALC_OPKIND_EQEQ },
+  [TCALC_LEX_LT] = { TCALC_TOK_RELOP, TCALC_OPKIND_LT },
+  [TCALC_LEX_LTEQ] = { TCALC_TOK_RELOP, TCALC_OPKIND_LTEQ },
+  [TCALC_LEX_GT] = { TCALC_TOK_RELOP, TCALC_OPKIND_GT },
+  [TCALC_LEX_GTEQ] = { TCALC_TOK_RELOP, TCALC_OPKIND_GTEQ },
+  [TCALC_LEX_AMP] = { TCALC_LEX_REJECT, TCALC_OPKIND_NONE },
+  [TCALC_LEX_AMPAMP] = { TCALC_TOK_BINLOP, TCALC_OPKIND_AMPAMP },
+  [TCALC_LEX_PIPE] = { TCALC_LEX_REJECT, TCALC_OPKIND_NONE },
+  [TCALC_LEX_PIPEPIPE] = { TCALC_TOK_BINLOP, TCALC_OPKIND_PIPEPIPE }
+};
 
 const char* tcalc_token_type_str(tcalc_token_type token_type) {
   switch (token_type) {
@@ -68,113 +233,57 @@ const char* tcalc_token_type_str(tcalc_token_type token_type) {
 }
 
 
-tcalc_err tcalc_tokenize_infix(
-  const char* expr,
-  int32_t exprLen,
-  tcalc_token* destBuffer,
-  int32_t destCapacity,
-  int32_t* outDestLength
-) {
-  *outDestLength = 0;
-  tcalc_err err = TCALC_ERR_OK;
-
-  if (!tcalc_are_groupsyms_balanced(expr, exprLen)) {
-    tcalc_errstkaddf(__func__, "Unbalanced grouping symbols");
-    return TCALC_ERR_UNBAL_GRPSYMS;
-  }
-
-  ret_on_err(
-    err,
-    tcalc_tokenize_infix_strtokens(expr, exprLen, destBuffer, destCapacity, outDestLength)
-  );
-  err = tcalc_tokenize_infix_strtokens_assign_types(expr, exprLen, destBuffer, *outDestLength);
-  return err;
-}
-
-
 /**
+ * Tree nodes are counted from token types alone. Every operand and operator
+ * token takes a node of its own, as does every "," for the argument after it.
+ * A "(" or identifier right after a number or ")" is preceded by an implicit
+ * multiplication node, and a function call with arguments takes a node for
+ * its first one.
  *
- * Tokenize infix expression and assign token types to each token.
- * Also inserts implicit multiplications where necessary
- *
- * tcalc_tokenize_infix checks for balanced grouping symbols and returns
- * TCALC_ERR_UNBAL_GRPSYMS error upon imbalanced grouping symbols.
- *
- *
- * tcalc_tokenize_infix serves to identify and resolve unary negative and positive signs
- * before they are processed.
- *
+ * The count only depends on the type of the previous token, and on whether a
+ * "(" opened a function call, which is tracked as one more type past the end
+ * of tcalc_token_type. This keeps counting down to a few bit tests per token.
 */
-static tcalc_err tcalc_tokenize_infix_strtokens_assign_types(
-  const char* expr, int32_t exprLen, tcalc_token* tokens, int32_t tokensLen
-) {
-  tcalc_err err = TCALC_ERR_OK;
-  for (int32_t i = 0; i < tokensLen && err == TCALC_ERR_OK; i++) {
-    assert(tokens[i].xend > tokens[i].start); // none of these slices should be 0-length
-    if (tcalc_token_ntstr_eq(expr, tokens[i], "+") ||
-        tcalc_token_ntstr_eq(expr, tokens[i], "-")) {
-      // + and - are unary if they are the first token in an expression,
-      // or are precedded by a '(', unary operator, or binary operator
+#define TCALC_NODECOUNT_CALLSTRT (TCALC_TOK_EOF + 1)
+#define TCALC_NODECOUNT_OWN ( \
+  (1u << TCALC_TOK_NUM) | (1u << TCALC_TOK_ID) | (1u << TCALC_TOK_UNOP) | \
+  (1u << TCALC_TOK_UNLOP) | (1u << TCALC_TOK_BINOP) | (1u << TCALC_TOK_RELOP) | \
+  (1u << TCALC_TOK_EQOP) | (1u << TCALC_TOK_BINLOP) | (1u << TCALC_TOK_PSEP))
+#define TCALC_NODECOUNT_MULT_AFTER ((1u << TCALC_TOK_NUM) | (1u << TCALC_TOK_GRPEND))
+#define TCALC_NODECOUNT_MULT_BEFORE ((1u << TCALC_TOK_GRPSTRT) | (1u << TCALC_TOK_ID))
+
+// the nodes that curr adds after a token of type prev
+static inline uint32_t tcalc_nodecount_step(uint32_t prev, uint32_t curr) {
+  return ((TCALC_NODECOUNT_OWN >> curr) & 1u) +
+    (((TCALC_NODECOUNT_MULT_AFTER >> prev) & (TCALC_NODECOUNT_MULT_BEFORE >> curr)) & 1u) +
+    (uint32_t)(prev == TCALC_NODECOUNT_CALLSTRT && curr != TCALC_TOK_GRPEND);
+}
 
-      if (i == 0 ||
-          tokens[i - 1].type == TCALC_TOK_GRPSTRT ||
-          tokens[i - 1].type == TCALC_TOK_BINOP ||
-          tokens[i - 1].type == TCALC_TOK_UNOP) {
-        tokens[i].type = TCALC_TOK_UNOP;
-      } else {
-        tokens[i].type = TCALC_TOK_BINOP;
-      }
-    } else if ( tcalc_token_ntstr_eq(expr, tokens[i], "*") ||
-                tcalc_token_ntstr_eq(expr, tokens[i], "/") ||
-                tcalc_token_ntstr_eq(expr, tokens[i], "^") ||
-                tcalc_token_ntstr_eq(expr, tokens[i], "**") ||
-                tcalc_token_ntstr_eq(expr, tokens[i], "%")) {
-      tokens[i].type = TCALC_TOK_BINOP;
-    } else if (tcalc_token_ntstr_eq(expr, tokens[i], "(")) {
-      tokens[i].type = TCALC_TOK_GRPSTRT;
-    } else if (tcalc_token_ntstr_eq(expr, tokens[i], ")")) {
-      tokens[i].type = TCALC_TOK_GRPEND;
-    } else if (tcalc_token_ntstr_eq(expr, tokens[i], "==") ||
-              tcalc_token_ntstr_eq(expr, tokens[i], "=") ||
-              tcalc_token_ntstr_eq(expr, tokens[i], "!=")) {
-      tokens[i].type = TCALC_TOK_EQOP;
-    } else if (tcalc_token_ntstr_eq(expr, tokens[i], "<") ||
-              tcalc_token_ntstr_eq(expr, tokens[i], "<=") ||
-              tcalc_token_ntstr_eq(expr, tokens[i], ">") ||
-              tcalc_token_ntstr_eq(expr, tokens[i], ">=")) {
-      tokens[i].type = TCALC_TOK_RELOP;
-    } else if (tcalc_token_ntstr_eq(expr, tokens[i], "&&") ||
-              tcalc_token_ntstr_eq(expr, tokens[i], "||")) {
-      tokens[i].type = TCALC_TOK_BINLOP;
-    } else if (tcalc_token_ntstr_eq(expr, tokens[i], "!")) {
-      tokens[i].type = TCALC_TOK_UNLOP;
-    } else if (tcalc_token_ntstr_eq(expr, tokens[i], ",")) {
-      tokens[i].type = TCALC_TOK_PSEP;
-    } else if (tcalc_lpstrisdouble(expr + tokens[i].start, tcalc_token_len(tokens[i]))) {
-      tokens[i].type = TCALC_TOK_NUM;
-    } else if (tcalc_is_identifier(expr, tokens[i].start, exprLen, tcalc_token_len(tokens[i]))) {
-      tokens[i].type = TCALC_TOK_ID;
-    } else { // could not identify token type, exit
-      err = TCALC_ERR_INVALID_ARG;
-    }
+// the type that the token after curr sees as its previous one
+static inline uint32_t tcalc_nodecount_prev(uint32_t prev, uint32_t curr) {
+  return prev == TCALC_TOK_ID && curr == TCALC_TOK_GRPSTRT ? TCALC_NODECOUNT_CALLSTRT : curr;
+}
+
+int32_t tcalc_exprtree_nodecount(const tcalc_token* tokens, int32_t tokensLen) {
+  uint32_t prev = TCALC_TOK_EOF;
+  int64_t count = 0;
+  for (int32_t i = 0; i < tokensLen; i++) {
+    count += tcalc_nodecount_step(prev, tokens[i].type);
+    prev = tcalc_nodecount_prev(prev, tokens[i].type);
   }
-  return err;
+  return count > INT32_MAX ? INT32_MAX : (int32_t)count;
 }
 
 /**
- * Call and gather all tokens from subsequent calls to tcalc_next_math_strtoken
- * and return them in an array to *out.
- *
- * *out will be allocated with a size of *out_size by tcalc_tokenize_infix_strtokens
- * upon returning TCALC_ERR_OK. If TCALC_ERR_OK is not returned, then *out has not been
- * allocated and does not have to be freed.
+ * Read all tokens of an infix expression in a single pass and assign each of
+ * them its type, checking that parentheses are balanced along the way.
  *
- * This function does NOT check for balanced parenthesis, or any other syntactical
- * errors in that matter. Some other examples of syntactical errors not checked
- * are unknown functions or variables.
+ * Tokens past destCapacity are counted but not stored. If outNodeCount is not
+ * NULL, the tree nodes which the tokens parse into are counted as well. This
+ * is inlined into both of its callers, so that tcalc_tokenize_infix does not
+ * pay for counting nodes.
  *
- * Lexical errors like miswritten numbers or unknown operators/symbols are seen
- * as errors, as according to tcalc_next_math_strtoken.
+ * + and - are unary unless they are preceded by a number, identifier, or ')'.
  *
  * Examples:
  *
@@ -183,170 +292,148 @@ static tcalc_err tcalc_tokenize_infix_strtokens_assign_types(
  *
  * "3+sin(43)"
  * "3", "+", "sin", "(", "43", ")"
- *
- * "     [45 ^ (3 / 2)] *   +11"
- * "[", "45", "^", "(", "3", "/", "2", ")", "]", "*", "+", "11"
 */
-
-static tcalc_err tcalc_tokenize_infix_strtokens(
-  const char* expr, int32_t exprLen, tcalc_token* destBuffer,
-  int32_t destCapacity, int32_t* outDestLen
+static inline tcalc_err tcalc_lex_infix(
+  const char* expr,
+  int32_t exprLen,
+  tcalc_token* destBuffer,
+  int32_t destCapacity,
+  int32_t* outTokensLen,
+  int32_t* outNodeCount
 ) {
-  *outDestLen = 0;
-  int32_t nbTokensProcessed = 0;
+  int32_t tokensLen = 0;
+  int64_t nodeCount = 0;
+  int32_t groupDepth = 0;
+  int32_t i = 0;
+  uint32_t prev = TCALC_TOK_EOF; // a tcalc_token_type, or TCALC_NODECOUNT_CALLSTRT
+
+  while (true) {
+    while (i < exprLen && tcalc_lex_charclass[(unsigned char)expr[i]] == TCALC_CC_BLANK)
+      i++;
+    if (i >= exprLen)
+      break;
+
+    const int32_t start = i;
+    uint8_t state = TCALC_LEX_START;
+    while (i < exprLen) {
+      const uint8_t next = tcalc_lex_dfa[state][tcalc_lex_charclass[(unsigned char)expr[i]]];
+      if (next == TCALC_LEX_STOP)
+        break;
+      state = next;
+      i++;
+    }
 
-  tcalc_err err = TCALC_ERR_OK;
-  tcalc_token token = {0};
+    if (tcalc_lex_accept[state].type == TCALC_LEX_REJECT)
+      return TCALC_ERR_INVALID_ARG;
+    tcalc_token_type type = (tcalc_token_type)tcalc_lex_accept[state].type;
+
+    switch (state) {
+      // an exponent without digits is not part of the number
+      case TCALC_LEX_EXP_MARK: i -= 1; break;
+      case TCALC_LEX_EXP_SIGN: i -= 2; break;
+      case TCALC_LEX_PLUS:
+      case TCALC_LEX_MINUS: {
+        // unary unless it directly follows the end of an operand
+        if (prev != TCALC_TOK_NUM && prev != TCALC_TOK_ID && prev != TCALC_TOK_GRPEND)
+          type = TCALC_TOK_UNOP;
+      } break;
+      case TCALC_LEX_LPAREN: groupDepth++; break;
+      case TCALC_LEX_RPAREN: {
+        if (--groupDepth < 0) {
+          tcalc_errstkadd_tok(
+            "tcalc_tokenize_infix", TCALC_ERR_UNBAL_GRPSYMS, "Unbalanced grouping symbols", expr, exprLen,
+            (tcalc_token){ .type = TCALC_TOK_GRPEND, .start = start, .len = 1 }
+          );
+          return TCALC_ERR_UNBAL_GRPSYMS;
+        }
+      } break;
+    }
 
-  while (nbTokensProcessed < destCapacity && err == TCALC_ERR_OK) {
-    err = tcalc_next_math_strtoken(
-      expr,
-      exprLen,
-      token.xend,
-      &(token.start),
-      &(token.xend)
-    );
-    if (err == TCALC_ERR_OK)
-      destBuffer[nbTokensProcessed++] = token;
+    if (tokensLen < destCapacity) {
+      destBuffer[tokensLen] = (tcalc_token){
+        .start = start,
+        .type = (uint8_t)type,
+        .opkind = tcalc_lex_accept[state].opkind,
+        .len = (uint16_t)(i - start < TCALC_TOKEN_LONG_LEN ? i - start : TCALC_TOKEN_LONG_LEN)
+      };
+    }
+    tokensLen++;
+    if (outNodeCount != NULL) {
+      nodeCount += tcalc_nodecount_step(prev, type);
+      prev = tcalc_nodecount_prev(prev, type);
+    } else {
+      prev = type;
+    }
   }
 
-  if (err == TCALC_ERR_STOP_ITER)
-  {
-    *outDestLen = nbTokensProcessed;
-    err = TCALC_ERR_OK;
-  }
-  else
-  {
-    if (err == TCALC_ERR_OK)
-      err = TCALC_ERR_NOMEM;
+  if (groupDepth != 0) {
+    tcalc_errstkadd_msg("tcalc_tokenize_infix", TCALC_ERR_UNBAL_GRPSYMS, "Unbalanced grouping symbols");
+    return TCALC_ERR_UNBAL_GRPSYMS;
   }
 
-  return err;
+  // leaves room for callers to add one to either count
+  if (tokensLen == INT32_MAX || nodeCount >= INT32_MAX)
+    return TCALC_ERR_OVERFLOW;
+  *outTokensLen = tokensLen;
+  if (outNodeCount != NULL)
+    *outNodeCount = (int32_t)nodeCount;
+  return TCALC_ERR_OK;
 }
 
-/**
- * Simple iterable tokenizing function
- *
- * Only the characters in the string "0123456789. abcdefghijklmnopqrstuvwxyz()[]+-*\/^%"
- * will be recognized (except the backslash ofc). Any other character being present will return an error.
- *
- * All +, -, /, *, ^, %, [, ,], (, ) tokens are immediately read and returned.
- * This even applies to negative numbers. A "-34" will be returned as two separate
- * tokens upon subsequent calls: "-" and "34"
- *
- * All strings of alphabetical lowercase letters will be grouped and returned as one.
- *
- * All whitespace is ignored
- *
- * TCALC_ERR_STOP_ITER is returned when the end of the expression has been reached.
- * If TCALC_ERR_STOP_ITER is returned, then *out is not allocated.
- *
- * TCALC_ERR_OK is returned when a token has been successfully read to *out.
- *
- * Any other error code is an actual lexing error and should be treated as such.
- *
- * This function should really never be called directly, and should be used through
- * tcalc_tokenize_infix_strtokens instead
- *
- * Examples:
- *
- * "32+-34*(5 * 101)"
- * "32", "+", "-", "34", "*", "(", "5", "*", "101", ")"
-*/
-static tcalc_err tcalc_next_math_strtoken(
-  const char* expr, int32_t exprLen, int32_t req_start,
-  int32_t* out_start, int32_t* out_xend
-) {
-  *out_start = req_start;
-  *out_xend = req_start;
-  int32_t start = req_start;
-
-	while (start < exprLen && isblank(expr[start])) // consume all spaces
-		start++;
-  if (start >= exprLen)
-    return TCALC_ERR_STOP_ITER;
-
-  if (!is_valid_tcalc_char(expr[start]))
-    return TCALC_ERR_INVALID_ARG;
-
-  *out_start = start;
-
-  for (int s = 0; TCALC_MULTI_TOKENS[s] != NULL; s++) {
-    if (tcalc_strhaspre(TCALC_MULTI_TOKENS[s], expr + start)) {
-      *out_xend = start + (int32_t)strlen(TCALC_MULTI_TOKENS[s]);
-      return TCALC_ERR_OK;
-    }
+int32_t tcalc_token_longlen(const char* str, int32_t strLen, tcalc_token tok) {
+  assert(tok.len == TCALC_TOKEN_LONG_LEN);
+  // the same walk as tcalc_lex_infix, which is where the token ended
+  int32_t i = tok.start;
+  uint8_t state = TCALC_LEX_START;
+  while (i < strLen) {
+    const uint8_t next = tcalc_lex_dfa[state][tcalc_lex_charclass[(unsigned char)str[i]]];
+    if (next == TCALC_LEX_STOP)
+      break;
+    state = next;
+    i++;
   }
 
-	for (int s = 0; TCALC_SINGLE_TOKENS[s] != '\0'; s++) { // checking for operator and grouping symbols
-		if (expr[start] == TCALC_SINGLE_TOKENS[s]) {
-      *out_xend = start + 1;
-      return TCALC_ERR_OK;
-		}
-	}
-
-
-	if (isdigit(expr[start]) || expr[start] == '.') { // number checking.
-    // lone decimal point
-		if (expr[start] == '.'  && (start + 1 >= exprLen || !isdigit(expr[start + 1]))) {
-      return TCALC_ERR_INVALID_ARG;
-		}
-
-		bool foundDecimal = false;
-    int32_t xend = start;
-
-		while (xend < exprLen && (isdigit(expr[xend]) || expr[xend] == '.')) {
-			if (expr[xend] == '.') {
-				if (foundDecimal) return TCALC_ERR_INVALID_ARG;
-        foundDecimal = true;
-			}
-
-      xend++;
-		}
-
-    *out_xend = xend;
-    return TCALC_ERR_OK;
-	}
-
-  if (islower(expr[start])) { // identifier checking
-    int32_t xend = start;
-    while (xend < exprLen && islower(expr[xend]))
-      xend++;
-    *out_xend = xend;
-    return TCALC_ERR_OK;
+  switch (state) {
+    case TCALC_LEX_EXP_MARK: i -= 1; break;
+    case TCALC_LEX_EXP_SIGN: i -= 2; break;
   }
-
-  assert(0 && "unreachable");
-	return TCALC_ERR_STOP_ITER; // this SHOULD be unreachable
+  return i - tok.start;
 }
 
-static bool is_valid_tcalc_char(char ch) {
-  int i = 0;
-  while (TCALC_ALLOWED_CHARS[i] != '\0' && TCALC_ALLOWED_CHARS[i] != ch)
-    i++;
-  return TCALC_ALLOWED_CHARS[i] != '\0';
-}
-
-/**
- * There's probably a better way to implement this but whatever
-*/
-static bool tcalc_are_groupsyms_balanced(const char* expr, int32_t exprLen) {
-  int nb_parens = 0;
+tcalc_err tcalc_tokenize_infix(
+  const char* expr,
+  int32_t exprLen,
+  tcalc_token* destBuffer,
+  int32_t destCapacity,
+  int32_t* outDestLength
+) {
+  assert(expr != NULL);
+  assert(outDestLength != NULL);
+  *outDestLength = 0;
 
-  for (int32_t i = 0; i < exprLen && nb_parens >= 0; i++) {
-    nb_parens += expr[i] == '(';
-    nb_parens -= expr[i] == ')';
+  tcalc_err err = TCALC_ERR_OK;
+  int32_t tokensLen = 0;
+  ret_on_err(err, tcalc_lex_infix(expr, exprLen, destBuffer, destCapacity, &tokensLen, NULL));
+
+  *outDestLength = tokensLen;
+  if (tokensLen > destCapacity) {
+    tcalc_errstkadd_i32(
+      __func__, TCALC_ERR_NOMEM,
+      "Token buffer too small (%" PRId32 " tokens needed, capacity of %" PRId32 ")",
+      tokensLen, destCapacity
+    );
+    return TCALC_ERR_NOMEM;
   }
-
-  return nb_parens == 0;
+  return TCALC_ERR_OK;
 }
 
-static bool tcalc_is_identifier(
-  const char* source, int32_t sourceStart, int32_t sourceXEnd, int32_t checkLen
-)
-{
-  int32_t i = sourceStart;
-  while (i < sourceXEnd && i < sourceStart + checkLen && islower(source[i]))
-    i++;
-  return i == sourceStart + checkLen;
+tcalc_err tcalc_measure_infix(
+  const char* expr, int32_t exprLen, int32_t* outTokenCount, int32_t* outTreeNodeCount
+) {
+  assert(expr != NULL);
+  assert(outTokenCount != NULL);
+  assert(outTreeNodeCount != NULL);
+  *outTokenCount = 0;
+  *outTreeNodeCount = 0;
+  return tcalc_lex_infix(expr, exprLen, NULL, 0, outTokenCount, outTreeNodeCount);
 }
@@ -10,17 +10,33 @@ const char* tcalc_valtype_str(enum tcalc_valtype type) {
 }
 
 void tcalc_val_fput(FILE* file, const struct tcalc_val val) {
+  tcalc_val_fput_fmt(file, val, TCALC_NUMFMT_FIXED);
+}
+
+void tcalc_val_fputline(FILE* file, const struct tcalc_val val) {
+  tcalc_val_fputline_fmt(file, val, TCALC_NUMFMT_FIXED);
+}
+
+void tcalc_val_fput_fmt(FILE* file, const struct tcalc_val val, tcalc_numfmt numfmt) {
   switch (val.type) {
     case TCALC_VALTYPE_BOOL:
-      fprintf(file, "%s", TCALC_BOOLSTR(val.as.boolean));
-      break;
-    case TCALC_VALTYPE_NUM:
-      fprintf(file, "%f", val.as.num);
+      fputs(TCALC_BOOLSTR(val.as.boolean), file);
       break;
+    case TCALC_VALTYPE_NUM: {
+      if (numfmt == TCALC_NUMFMT_FIXED) {
+        fprintf(file, "%f", val.as.num);
+        break;
+      }
+
+      char buf[TCALC_DOUBLESTR_MAX_SIZE];
+      int32_t len = 0;
+      if (tcalc_doubletostr(val.as.num, buf, (int32_t)sizeof(buf), &len) == TCALC_ERR_OK)
+        fwrite(buf, 1, (size_t)len, file);
+    } break;
   }
 }
 
-void tcalc_val_fputline(FILE* file, const struct tcalc_val val) {
-  tcalc_val_fput(file, val);
+void tcalc_val_fputline_fmt(FILE* file, const struct tcalc_val val, tcalc_numfmt numfmt) {
+  tcalc_val_fput_fmt(file, val, numfmt);
   fputc('\n', file);
 }
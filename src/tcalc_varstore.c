@@ -0,0 +1,220 @@
+#include "tcalc.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * A tcalc_varstore is a seqlock over a fixed array of variable values.
+ *
+ * seq is odd while a writer is updating values and even otherwise. A writer
+ * takes the lock by moving seq from even to odd, stores its values, and moves
+ * seq to the next even number. A reader copies the values it needs between
+ * two loads of seq, and copies them again if seq was odd or changed in the
+ * meantime. Readers never write to the store at all, so they do not contend
+ * with each other no matter how many of them there are.
+ *
+ * Every value is held as two 64-bit words which are only ever accessed
+ * atomically, so a reader that races with a writer reads a torn value rather
+ * than invoking undefined behavior, and then throws it away.
+*/
+
+#if defined(__GNUC__) || defined(__clang__)
+  #define tcalc_atomic_load_relaxed(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+  #define tcalc_atomic_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+  #define tcalc_atomic_store_relaxed(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+  #define tcalc_atomic_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+  #define tcalc_atomic_cas(p, expected, desired) \
+    __atomic_compare_exchange_n((p), &(expected), (desired), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)
+  #define tcalc_atomic_fence_acquire() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+  #define tcalc_atomic_fence_release() __atomic_thread_fence(__ATOMIC_RELEASE)
+  #define tcalc_atomic_pause() ((void)0)
+#elif defined(_MSC_VER)
+  #include <windows.h>
+  // aligned 64-bit volatile accesses are atomic, and the fences below order them
+  #define tcalc_atomic_load_relaxed(p) (*(volatile const uint64_t*)(p))
+  #define tcalc_atomic_load_acquire(p) (MemoryBarrier(), *(volatile const uint64_t*)(p))
+  #define tcalc_atomic_store_relaxed(p, v) (*(volatile uint64_t*)(p) = (v))
+  #define tcalc_atomic_store_release(p, v) (MemoryBarrier(), *(volatile uint64_t*)(p) = (v))
+  #define tcalc_atomic_cas(p, expected, desired) \
+    ((uint64_t)InterlockedCompareExchange64((volatile LONG64*)(p), (LONG64)(desired), (LONG64)(expected)) == (expected))
+  #define tcalc_atomic_fence_acquire() MemoryBarrier()
+  #define tcalc_atomic_fence_release() MemoryBarrier()
+  #define tcalc_atomic_pause() YieldProcessor()
+#else
+  #error "tcalc_varstore needs atomic operations, which are not known for this compiler"
+#endif
+
+// keeps seq, which every reader loads, off of the cache lines that writers store values to
+#define TCALC_VARSTORE_CACHE_LINE_SIZE 64
+
+typedef struct tcalc_varstore_cell {
+  uint64_t type; // enum tcalc_valtype
+  uint64_t bits; // the double or bool value
+} tcalc_varstore_cell;
+
+struct tcalc_varstore {
+  uint64_t seq;
+  char pad[TCALC_VARSTORE_CACHE_LINE_SIZE - sizeof(uint64_t)];
+  tcalc_ctx* names; // vars.arr[slot] is the variable in slot, for its id and index
+  const tcalc_allocator* allocator; // that of the context the store was built from
+  int32_t count;
+  tcalc_varstore_cell* cells;
+};
+
+static tcalc_varstore_cell tcalc_varstore_encode(tcalc_val val) {
+  tcalc_varstore_cell cell = { (uint64_t)val.type, 0 };
+  if (val.type == TCALC_VALTYPE_NUM) {
+    memcpy(&cell.bits, &val.as.num, sizeof(double));
+  } else {
+    cell.bits = val.as.boolean ? 1 : 0;
+  }
+  return cell;
+}
+
+static tcalc_val tcalc_varstore_decode(tcalc_varstore_cell cell) {
+  tcalc_val val = { 0 };
+  val.type = (enum tcalc_valtype)cell.type;
+  if (val.type == TCALC_VALTYPE_NUM) {
+    memcpy(&val.as.num, &cell.bits, sizeof(double));
+  } else {
+    val.as.boolean = cell.bits != 0;
+  }
+  return val;
+}
+
+tcalc_err tcalc_varstore_alloc(const tcalc_ctx* ctx, tcalc_varstore** out) {
+  assert(ctx != NULL);
+  assert(out != NULL);
+  tcalc_err err = TCALC_ERR_OK;
+  tcalc_varstore* store = (tcalc_varstore*)tcalc_calloc(ctx->allocator, 1, sizeof(tcalc_varstore));
+  if (store == NULL) return TCALC_ERR_NOMEM;
+  store->allocator = ctx->allocator;
+
+  // the mutable variables of ctx and its parents, each name only once
+  cleanup_on_err(err, tcalc_ctx_alloc_empty_with(ctx->allocator, &(store->names)));
+  for (const tcalc_ctx* scope = ctx; scope != NULL; scope = scope->parent) {
+    TCALC_VEC_FOREACH(scope->vars, i) {
+      const tcalc_vardef def = scope->vars.arr[i];
+      const size_t idLen = strlen(def.id);
+      if (def.immutable || tcalc_ctx_findvar(ctx, def.id, idLen) != &(scope->vars.arr[i]))
+        continue;
+      cleanup_on_err(err, tcalc_ctx_addvar(store->names, def.id, idLen, def.val));
+    }
+  }
+  cleanup_if(err, store->names->vars.len > INT32_MAX, TCALC_ERR_OVERFLOW);
+  store->count = (int32_t)store->names->vars.len;
+
+  store->cells = (tcalc_varstore_cell*)tcalc_calloc(store->allocator, (size_t)store->count + 1, sizeof(tcalc_varstore_cell));
+  cleanup_if(err, store->cells == NULL, TCALC_ERR_NOMEM);
+  for (int32_t slot = 0; slot < store->count; slot++)
+    store->cells[slot] = tcalc_varstore_encode(store->names->vars.arr[slot].val);
+
+  *out = store;
+  return TCALC_ERR_OK;
+
+  cleanup:
+    tcalc_varstore_free(store);
+    return err;
+}
+
+void tcalc_varstore_free(tcalc_varstore* store) {
+  if (store == NULL) return;
+  tcalc_ctx_free(store->names);
+  tcalc_free(store->allocator, store->cells, sizeof(tcalc_varstore_cell) * ((size_t)store->count + 1));
+  tcalc_free(store->allocator, store, sizeof(tcalc_varstore));
+}
+
+int32_t tcalc_varstore_count(const tcalc_varstore* store) {
+  return store->count;
+}
+
+tcalc_err tcalc_varstore_getslot(
+  const tcalc_varstore* store, const char* name, size_t name_len, int32_t* outSlot
+) {
+  const tcalc_vardef* def = tcalc_ctx_findvar(store->names, name, name_len);
+  if (def == NULL) return TCALC_ERR_NOT_FOUND;
+  *outSlot = (int32_t)(def - store->names->vars.arr);
+  return TCALC_ERR_OK;
+}
+
+tcalc_err tcalc_varstore_setmany(
+  tcalc_varstore* store, const int32_t* slots, const tcalc_val* vals, int32_t count
+) {
+  for (int32_t i = 0; i < count; i++) {
+    if (slots[i] < 0 || slots[i] >= store->count) return TCALC_ERR_OUT_OF_BOUNDS;
+  }
+
+  // lock out other writers by making seq odd
+  uint64_t seq = tcalc_atomic_load_relaxed(&(store->seq));
+  for (;;) {
+    if ((seq & 1) == 0 && tcalc_atomic_cas(&(store->seq), seq, seq + 1))
+      break;
+    tcalc_atomic_pause();
+    seq = tcalc_atomic_load_relaxed(&(store->seq));
+  }
+  // no value store may become visible before seq turned odd
+  tcalc_atomic_fence_release();
+
+  for (int32_t i = 0; i < count; i++) {
+    const tcalc_varstore_cell cell = tcalc_varstore_encode(vals[i]);
+    tcalc_atomic_store_relaxed(&(store->cells[slots[i]].type), cell.type);
+    tcalc_atomic_store_relaxed(&(store->cells[slots[i]].bits), cell.bits);
+  }
+
+  tcalc_atomic_store_release(&(store->seq), seq + 2);
+  return TCALC_ERR_OK;
+}
+
+tcalc_err tcalc_varstore_set(tcalc_varstore* store, int32_t slot, tcalc_val val) {
+  return tcalc_varstore_setmany(store, &slot, &val, 1);
+}
+
+tcalc_err tcalc_varstore_read(
+  const tcalc_varstore* store, const int32_t* slots, tcalc_val* out, int32_t count
+) {
+  for (int32_t i = 0; i < count; i++) {
+    if (slots != NULL && (slots[i] < 0 || slots[i] >= store->count)) return TCALC_ERR_OUT_OF_BOUNDS;
+  }
+  if (slots == NULL && count > store->count) return TCALC_ERR_OUT_OF_BOUNDS;
+
+  for (;;) {
+    const uint64_t before = tcalc_atomic_load_acquire(&(store->seq));
+    if (before & 1) {
+      tcalc_atomic_pause();
+      continue;
+    }
+
+    for (int32_t i = 0; i < count; i++) {
+      const int32_t slot = slots != NULL ? slots[i] : i;
+      tcalc_varstore_cell cell;
+      cell.type = tcalc_atomic_load_relaxed(&(store->cells[slot].type));
+      cell.bits = tcalc_atomic_load_relaxed(&(store->cells[slot].bits));
+      out[i] = tcalc_varstore_decode(cell);
+    }
+
+    // the value loads above may not be reordered after the second load of seq
+    tcalc_atomic_fence_acquire();
+    if (tcalc_atomic_load_relaxed(&(store->seq)) == before)
+      return TCALC_ERR_OK;
+  }
+}
+
+tcalc_err tcalc_varstore_snapshot(const tcalc_varstore* store, tcalc_ctx* ctx) {
+  tcalc_err err = TCALC_ERR_OK;
+  tcalc_val* vals = (tcalc_val*)tcalc_alloc(store->allocator, sizeof(tcalc_val) * ((size_t)store->count + 1));
+  if (vals == NULL) return TCALC_ERR_NOMEM;
+
+  cleanup_on_err(err, tcalc_varstore_read(store, NULL, vals, store->count));
+  for (int32_t slot = 0; slot < store->count; slot++) {
+    const char* id = store->names->vars.arr[slot].id;
+    cleanup_on_err(err, tcalc_ctx_addvar(ctx, id, strlen(id), vals[slot]));
+  }
+
+  cleanup:
+    tcalc_free(store->allocator, vals, sizeof(tcalc_val) * ((size_t)store->count + 1));
+    return err;
+}
@@ -15,7 +15,38 @@ extern int32_t globalTreeNodeBufferLen;
 
 #define TCALC_DBL_ASSERT_DELTA 0.001
 
+/**
+ * Lex and parse expr into the global token and tree node buffers, setting
+ * globalTokenBufferLen and globalTreeNodeBufferLen to the counts used
+*/
+tcalc_err TCalcTestLexParse(const char* expr, int32_t* outRootInd);
+
+/**
+ * An allocator which counts the memory and blocks it hands out and refuses to
+ * go over a limit. Each block is prefixed with its size, to check the sizes
+ * that tcalc gives back when resizing and freeing it.
+*/
+typedef struct tcalc_test_pool {
+  size_t used;
+  size_t limit;
+  int allocs;
+  int badSizes;
+} tcalc_test_pool;
+
+#define TCALC_TEST_POOL_INIT { 0, SIZE_MAX, 0, 0 }
+#define TCALC_TEST_POOL_ALLOCATOR(pool) \
+  { tcalc_test_pool_alloc, tcalc_test_pool_realloc, tcalc_test_pool_free, (pool) }
+
+void* tcalc_test_pool_alloc(void* user, size_t size);
+void* tcalc_test_pool_realloc(void* user, void* ptr, size_t oldSize, size_t newSize);
+void tcalc_test_pool_free(void* user, void* ptr, size_t size);
+
 CuSuite* TCalcEvalGetSuite();
 CuSuite* TCalcTokenizeGetSuite();
+CuSuite* TCalcStringGetSuite();
+CuSuite* TCalcContextGetSuite();
+CuSuite* TCalcBytecodeGetSuite();
+CuSuite* TCalcPreparedGetSuite();
+CuSuite* TCalcBatchGetSuite();
 
 #endif
@@ -3,6 +3,8 @@
 #include "CuTest.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 tcalc_token globalTokenBuffer[TCALC_KIBI(2)];
 int32_t globalTokenBufferCapacity = (int32_t)TCALC_ARRAY_SIZE(globalTokenBuffer);
@@ -12,12 +14,56 @@ tcalc_exprtree globalTreeNodeBuffer[TCALC_KIBI(2)];
 int32_t globalTreeNodeBufferCapacity = (int32_t)TCALC_ARRAY_SIZE(globalTreeNodeBuffer);
 int32_t globalTreeNodeBufferLen;
 
+tcalc_err TCalcTestLexParse(const char* expr, int32_t* outRootInd) {
+  return tcalc_lex_parse(
+    expr, (int32_t)strlen(expr), globalTokenBuffer, globalTokenBufferCapacity,
+    globalTreeNodeBuffer, globalTreeNodeBufferCapacity, &globalTokenBufferLen,
+    &globalTreeNodeBufferLen, outRootInd
+  );
+}
+
+#define TCALC_TEST_POOL_HEADER 16
+
+void* tcalc_test_pool_alloc(void* user, size_t size) {
+  tcalc_test_pool* pool = (tcalc_test_pool*)user;
+  if (size > pool->limit - pool->used) return NULL;
+  char* block = (char*)malloc(TCALC_TEST_POOL_HEADER + size);
+  if (block == NULL) return NULL;
+  memcpy(block, &size, sizeof(size_t));
+  pool->used += size;
+  pool->allocs++;
+  return block + TCALC_TEST_POOL_HEADER;
+}
+
+void tcalc_test_pool_free(void* user, void* ptr, size_t size) {
+  tcalc_test_pool* pool = (tcalc_test_pool*)user;
+  char* block = (char*)ptr - TCALC_TEST_POOL_HEADER;
+  size_t actual;
+  memcpy(&actual, block, sizeof(size_t));
+  if (actual != size) pool->badSizes++;
+  pool->used -= actual;
+  free(block);
+}
+
+void* tcalc_test_pool_realloc(void* user, void* ptr, size_t oldSize, size_t newSize) {
+  void* resized = tcalc_test_pool_alloc(user, newSize);
+  if (resized == NULL) return NULL;
+  memcpy(resized, ptr, oldSize < newSize ? oldSize : newSize);
+  tcalc_test_pool_free(user, ptr, oldSize);
+  return resized;
+}
+
 void RunAllTests() {
     CuString *output = CuStringNew();
     CuSuite* suite = CuSuiteNew();
 
     CuSuiteAddSuite(suite, TCalcEvalGetSuite());
     CuSuiteAddSuite(suite, TCalcTokenizeGetSuite());
+    CuSuiteAddSuite(suite, TCalcStringGetSuite());
+    CuSuiteAddSuite(suite, TCalcContextGetSuite());
+    CuSuiteAddSuite(suite, TCalcBytecodeGetSuite());
+    CuSuiteAddSuite(suite, TCalcPreparedGetSuite());
+    CuSuiteAddSuite(suite, TCalcBatchGetSuite());
 
     CuSuiteRun(suite);
 
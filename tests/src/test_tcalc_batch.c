@@ -0,0 +1,255 @@
+#include "tcalc_tests.h"
+
+#include "CuTest.h"
+
+#include "tcalc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Lex and parse expr, then evaluate it over rowCount rows with ctx
+*/
+static tcalc_err TCalcBatchEval(
+  const char* expr, const tcalc_ctx* ctx, const tcalc_column* columns,
+  int32_t columnCount, size_t rowCount, tcalc_outcolumn out
+) {
+  int32_t rootInd;
+  tcalc_err err = TCalcTestLexParse(expr, &rootInd);
+  if (err) return err;
+
+  return tcalc_eval_exprtree_batch(
+    expr, (int32_t)strlen(expr), globalTreeNodeBuffer, globalTreeNodeBufferLen, rootInd,
+    globalTokenBuffer, globalTokenBufferLen, ctx, columns, columnCount, rowCount, out
+  );
+}
+
+static tcalc_err TCalcBatchToNum(tcalc_val a, double* out) {
+  if (a.type != TCALC_VALTYPE_BOOL) return TCALC_ERR_BAD_CAST;
+  *out = a.as.boolean ? 1.0 : 0.0;
+  return TCALC_ERR_OK;
+}
+
+static tcalc_err TCalcBatchPick(tcalc_val cond, tcalc_val a, double* out) {
+  if (cond.type != TCALC_VALTYPE_BOOL || a.type != TCALC_VALTYPE_NUM) return TCALC_ERR_BAD_CAST;
+  *out = cond.as.boolean ? a.as.num : -a.as.num;
+  return TCALC_ERR_OK;
+}
+
+void TestTCalcBatchMatchesRowByRow(CuTest *tc) {
+  // not a multiple of the tile size, so the last tile is partial
+  const size_t rowCount = 1000;
+  double* price = (double*)malloc(sizeof(double) * rowCount);
+  double* qty = (double*)malloc(sizeof(double) * rowCount);
+  bool* flagged = (bool*)malloc(sizeof(bool) * rowCount);
+  double* nums = (double*)malloc(sizeof(double) * rowCount);
+  bool* bools = (bool*)malloc(sizeof(bool) * rowCount);
+  for (size_t i = 0; i < rowCount; i++) {
+    price[i] = 0.5 * (double)i;
+    qty[i] = (double)(i % 7);
+    flagged[i] = i % 3 == 0;
+  }
+
+  const tcalc_column columns[] = {
+    { TCALC_STRLIT_PTR_LEN("price"), TCALC_VALTYPE_NUM, { .nums = price } },
+    { TCALC_STRLIT_PTR_LEN("qty"), TCALC_VALTYPE_NUM, { .nums = qty } },
+    { TCALC_STRLIT_PTR_LEN("flagged"), TCALC_VALTYPE_BOOL, { .bools = flagged } }
+  };
+
+  const char* numExprs[] = {
+    "price * qty * (1 - discount)",
+    "-price + pow(qty, 2) - 3sin(price)",
+    "(price + 1) / (qty + 1) ^ 2",
+    "tonum(qty > 0) + tonum(flagged)",
+    "price % (qty + 1) - qty ** 0.5"
+  };
+  const char* boolExprs[] = {
+    "price > qty && !flagged",
+    "(qty == 3) != flagged || price <= 10",
+    "flagged == (qty >= 3)"
+  };
+
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("discount"), TCALC_VAL_INIT_NUM(0.25)) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("tonum"), TCalcBatchToNum) == TCALC_ERR_OK);
+
+  for (size_t e = 0; e < TCALC_ARRAY_SIZE(numExprs) + TCALC_ARRAY_SIZE(boolExprs); e++) {
+    const bool isNum = e < TCALC_ARRAY_SIZE(numExprs);
+    const char* expr = isNum ? numExprs[e] : boolExprs[e - TCALC_ARRAY_SIZE(numExprs)];
+    tcalc_outcolumn out = { .type = isNum ? TCALC_VALTYPE_NUM : TCALC_VALTYPE_BOOL };
+    if (isNum) out.as.nums = nums;
+    else out.as.bools = bools;
+    CuAssertTrue(tc, TCalcBatchEval(expr, ctx, columns, (int32_t)TCALC_ARRAY_SIZE(columns), rowCount, out) == TCALC_ERR_OK);
+
+    for (size_t i = 0; i < rowCount; i += 37) {
+      CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("price"), TCALC_VAL_INIT_NUM(price[i])) == TCALC_ERR_OK);
+      CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("qty"), TCALC_VAL_INIT_NUM(qty[i])) == TCALC_ERR_OK);
+      CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("flagged"), TCALC_VAL_INIT_BOOL(flagged[i])) == TCALC_ERR_OK);
+
+      tcalc_val expected = { 0 };
+      int32_t treeNodeCount, tokenCount;
+      CuAssertTrue(tc, tcalc_eval_wctx(
+        expr, (int32_t)strlen(expr), globalTreeNodeBuffer, globalTreeNodeBufferCapacity,
+        globalTokenBuffer, globalTokenBufferCapacity, ctx, &expected,
+        &treeNodeCount, &tokenCount
+      ) == TCALC_ERR_OK);
+
+      if (isNum)
+        CuAssertDblEquals(tc, expected.as.num, nums[i], TCALC_DBL_ASSERT_DELTA);
+      else
+        CuAssertIntEquals(tc, !!expected.as.boolean, !!bools[i]);
+    }
+
+  }
+
+  tcalc_ctx_free(ctx);
+  free(price);
+  free(qty);
+  free(flagged);
+  free(nums);
+  free(bools);
+}
+
+void TestTCalcBatchErrors(CuTest *tc) {
+  const double xs[] = { 1.0, 2.0, 0.0, 4.0 };
+  const bool bs[] = { true, false, true, false };
+  const tcalc_column columns[] = {
+    { TCALC_STRLIT_PTR_LEN("x"), TCALC_VALTYPE_NUM, { .nums = xs } },
+    { TCALC_STRLIT_PTR_LEN("b"), TCALC_VALTYPE_BOOL, { .bools = bs } }
+  };
+  const int32_t columnCount = (int32_t)TCALC_ARRAY_SIZE(columns);
+  double nums[TCALC_ARRAY_SIZE(xs)];
+  bool bools[TCALC_ARRAY_SIZE(xs)];
+  const tcalc_outcolumn numOut = { .type = TCALC_VALTYPE_NUM, .as.nums = nums };
+  const tcalc_outcolumn boolOut = { .type = TCALC_VALTYPE_BOOL, .as.bools = bools };
+  const tcalc_ctx* ctx = tcalc_ctx_default();
+
+  CuAssertTrue(tc, TCalcBatchEval("1 / x", ctx, columns, columnCount, 4, numOut) == TCALC_ERR_DIV_BY_ZERO);
+  CuAssertTrue(tc, TCalcBatchEval("1 / x", ctx, columns, columnCount, 2, numOut) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 0.5, nums[1], TCALC_DBL_ASSERT_DELTA);
+  CuAssertTrue(tc, TCalcBatchEval("x + b", ctx, columns, columnCount, 4, numOut) == TCALC_ERR_BAD_CAST);
+  CuAssertTrue(tc, TCalcBatchEval("x + 1", ctx, columns, columnCount, 4, boolOut) == TCALC_ERR_BAD_CAST);
+  CuAssertTrue(tc, TCalcBatchEval("x + y", ctx, columns, columnCount, 4, numOut) == TCALC_ERR_UNKNOWN_ID);
+  CuAssertTrue(tc, TCalcBatchEval("x * pi", ctx, columns, columnCount, 0, numOut) == TCALC_ERR_OK);
+
+  CuAssertTrue(tc, TCalcBatchEval("b || x < pi", ctx, columns, columnCount, 4, boolOut) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, true, bools[0]);
+  CuAssertIntEquals(tc, true, bools[1]);
+  CuAssertIntEquals(tc, true, bools[2]);
+  CuAssertIntEquals(tc, false, bools[3]);
+}
+
+void TestTCalcBatchBoolArgFuncs(CuTest *tc) {
+  // more than one tile, with bools both computed and read from a column
+  const size_t rowCount = 600;
+  double* xs = (double*)malloc(sizeof(double) * rowCount);
+  bool* flagged = (bool*)malloc(sizeof(bool) * rowCount);
+  double* nums = (double*)malloc(sizeof(double) * rowCount);
+  for (size_t i = 0; i < rowCount; i++) {
+    xs[i] = i % 2 == 0 ? 1.0 : -1.0;
+    flagged[i] = i % 3 == 0;
+  }
+  const tcalc_column columns[] = {
+    { TCALC_STRLIT_PTR_LEN("x"), TCALC_VALTYPE_NUM, { .nums = xs } },
+    { TCALC_STRLIT_PTR_LEN("flagged"), TCALC_VALTYPE_BOOL, { .bools = flagged } }
+  };
+  const int32_t columnCount = (int32_t)TCALC_ARRAY_SIZE(columns);
+  const tcalc_outcolumn out = { .type = TCALC_VALTYPE_NUM, .as.nums = nums };
+
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("tonum"), TCalcBatchToNum) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addbinfunc(ctx, TCALC_STRLIT_PTR_LEN("pick"), TCalcBatchPick) == TCALC_ERR_OK);
+
+  CuAssertTrue(tc, TCalcBatchEval("tonum(x > 0)", ctx, columns, columnCount, rowCount, out) == TCALC_ERR_OK);
+  for (size_t i = 0; i < rowCount; i++)
+    CuAssertDblEquals(tc, xs[i] > 0 ? 1.0 : 0.0, nums[i], TCALC_DBL_ASSERT_DELTA);
+
+  CuAssertTrue(tc, TCalcBatchEval("tonum(flagged)", ctx, columns, columnCount, rowCount, out) == TCALC_ERR_OK);
+  for (size_t i = 0; i < rowCount; i++)
+    CuAssertDblEquals(tc, flagged[i] ? 1.0 : 0.0, nums[i], TCALC_DBL_ASSERT_DELTA);
+
+  CuAssertTrue(tc, TCalcBatchEval("pick(flagged, x)", ctx, columns, columnCount, rowCount, out) == TCALC_ERR_OK);
+  for (size_t i = 0; i < rowCount; i++)
+    CuAssertDblEquals(tc, flagged[i] ? xs[i] : -xs[i], nums[i], TCALC_DBL_ASSERT_DELTA);
+
+  tcalc_ctx_free(ctx);
+  free(xs);
+  free(flagged);
+  free(nums);
+}
+
+/**
+ * Compare every array kernel of the active instruction set against the
+ * scalar functions
+*/
+static void TCalcArrayKernelsCheck(CuTest *tc) {
+  // odd length, so every vector width leaves some elements to the scalar tail
+  enum { LEN = 103 };
+  double a[LEN], b[LEN], nums[LEN];
+  bool la[LEN], lb[LEN], bools[LEN];
+  for (int i = 0; i < LEN; i++) {
+    a[i] = (i % 5) - 2.0;
+    // exactly equal, within epsilon, and clearly apart from a[i]
+    b[i] = i % 3 == 0 ? a[i] : i % 3 == 1 ? a[i] + 1e-12 : 1.5 - (i % 4);
+    la[i] = i % 2 == 0;
+    lb[i] = i % 3 == 0;
+  }
+
+  CuAssertTrue(tc, tcalc_add_arr(a, b, nums, LEN) == TCALC_ERR_OK);
+  for (int i = 0; i < LEN; i++) CuAssertDblEquals(tc, a[i] + b[i], nums[i], 0.0);
+  CuAssertTrue(tc, tcalc_subtract_arr(a, b, nums, LEN) == TCALC_ERR_OK);
+  for (int i = 0; i < LEN; i++) CuAssertDblEquals(tc, a[i] - b[i], nums[i], 0.0);
+  CuAssertTrue(tc, tcalc_multiply_arr(a, b, nums, LEN) == TCALC_ERR_OK);
+  for (int i = 0; i < LEN; i++) CuAssertDblEquals(tc, a[i] * b[i], nums[i], 0.0);
+
+  const struct { tcalc_err (*arr)(const double*, const double*, bool*, size_t); bool (*scalar)(double, double); } rels[] = {
+    { tcalc_lt_arr, tcalc_lt }, { tcalc_lteq_arr, tcalc_lteq },
+    { tcalc_gt_arr, tcalc_gt }, { tcalc_gteq_arr, tcalc_gteq },
+    { tcalc_equals_arr, tcalc_equals }, { tcalc_nequals_arr, tcalc_nequals }
+  };
+  for (size_t r = 0; r < TCALC_ARRAY_SIZE(rels); r++) {
+    CuAssertTrue(tc, rels[r].arr(a, b, bools, LEN) == TCALC_ERR_OK);
+    for (int i = 0; i < LEN; i++) CuAssertIntEquals(tc, rels[r].scalar(a[i], b[i]), bools[i]);
+  }
+
+  CuAssertTrue(tc, tcalc_and_arr(la, lb, bools, LEN) == TCALC_ERR_OK);
+  for (int i = 0; i < LEN; i++) CuAssertIntEquals(tc, la[i] && lb[i], bools[i]);
+  CuAssertTrue(tc, tcalc_or_arr(la, lb, bools, LEN) == TCALC_ERR_OK);
+  for (int i = 0; i < LEN; i++) CuAssertIntEquals(tc, la[i] || lb[i], bools[i]);
+  CuAssertTrue(tc, tcalc_not_arr(la, bools, LEN) == TCALC_ERR_OK);
+  for (int i = 0; i < LEN; i++) CuAssertIntEquals(tc, !la[i], bools[i]);
+
+  // a has zeroes, b has values within epsilon of zero
+  CuAssertTrue(tc, tcalc_divide_arr(b, a, nums, LEN) == TCALC_ERR_DIV_BY_ZERO);
+  CuAssertTrue(tc, tcalc_divide_arr(a, a, nums, 2) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 1.0, nums[1], 0.0);
+  CuAssertTrue(tc, tcalc_divide_arr(a, a, nums, 3) == TCALC_ERR_DIV_BY_ZERO);
+  CuAssertTrue(tc, tcalc_mod_arr(b, a, nums, LEN) == TCALC_ERR_NOT_IN_DOMAIN);
+  CuAssertTrue(tc, tcalc_pow_arr(a, a, nums, LEN) == TCALC_ERR_NOT_IN_DOMAIN);
+}
+
+void TestTCalcArrayKernelsMatchScalar(CuTest *tc) {
+  // run the kernels of every instruction set this CPU has, not just the widest
+  const tcalc_simd_isa picked = tcalc_simd_getisa();
+  const tcalc_simd_isa isas[] = {
+    TCALC_SIMD_ISA_SCALAR, TCALC_SIMD_ISA_SSE2, TCALC_SIMD_ISA_AVX2, TCALC_SIMD_ISA_AVX512
+  };
+  CuAssertTrue(tc, tcalc_simd_setisa(TCALC_SIMD_ISA_SCALAR) == TCALC_ERR_OK);
+  for (size_t i = 0; i < TCALC_ARRAY_SIZE(isas); i++) {
+    if (tcalc_simd_setisa(isas[i]) != TCALC_ERR_OK) continue;
+    CuAssertIntEquals(tc, isas[i], tcalc_simd_getisa());
+    TCalcArrayKernelsCheck(tc);
+  }
+  CuAssertTrue(tc, tcalc_simd_setisa(picked) == TCALC_ERR_OK);
+}
+
+CuSuite* TCalcBatchGetSuite() {
+  CuSuite* suite = CuSuiteNew();
+  SUITE_ADD_TEST(suite, TestTCalcBatchMatchesRowByRow);
+  SUITE_ADD_TEST(suite, TestTCalcBatchErrors);
+  SUITE_ADD_TEST(suite, TestTCalcBatchBoolArgFuncs);
+  SUITE_ADD_TEST(suite, TestTCalcArrayKernelsMatchScalar);
+  return suite;
+}
@@ -0,0 +1,269 @@
+#include "tcalc_tests.h"
+
+#include "CuTest.h"
+
+#include "tcalc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Lex and parse expr, then compile it with ctx into *out
+*/
+static tcalc_err TCalcBytecodeCompile(const char* expr, const tcalc_ctx* ctx, tcalc_bytecode** out) {
+  int32_t rootInd;
+  tcalc_err err = TCalcTestLexParse(expr, &rootInd);
+  if (err) return err;
+
+  return tcalc_bytecode_compile(
+    expr, (int32_t)strlen(expr), globalTreeNodeBuffer, globalTreeNodeBufferLen, rootInd,
+    globalTokenBuffer, globalTokenBufferLen, ctx, out
+  );
+}
+
+void TestTCalcBytecodeMatchesEval(CuTest *tc) {
+  const char* exprs[] = {
+    "2 * 3 ^ ln(2)",
+    "-(2 + 3) * 4 - +5 / 8",
+    "20 % 6 + pow(2, 0.5) * atan(1)",
+    "2 ** 2 ^ 2 ** 2",
+    "5sin(pi / 2)cos(0)",
+    "1 < 2 && 2 <= 2 && 3 > 2 && 3 >= 3",
+    "(1 + 2 == 3) == (4 != 5)",
+    "!(true || false) != !false",
+    "10sin(pi) == 10sin(3pi)",
+    "floor(2.5) + ceil(2.5) + round(2.5) + abs(-2)"
+  };
+
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+
+  for (size_t i = 0; i < TCALC_ARRAY_SIZE(exprs); i++) {
+    tcalc_val expected = { 0 }, actual = { 0 };
+    int32_t treeNodeCount, tokenCount;
+    CuAssertTrue(tc, tcalc_eval_wctx(
+      exprs[i], (int32_t)strlen(exprs[i]), globalTreeNodeBuffer, globalTreeNodeBufferCapacity,
+      globalTokenBuffer, globalTokenBufferCapacity, ctx, &expected,
+      &treeNodeCount, &tokenCount
+    ) == TCALC_ERR_OK);
+
+    tcalc_bytecode* bc = NULL;
+    CuAssertTrue(tc, TCalcBytecodeCompile(exprs[i], ctx, &bc) == TCALC_ERR_OK);
+
+    tcalc_val vars[8];
+    CuAssertTrue(tc, tcalc_bytecode_varcount(bc) <= (int32_t)TCALC_ARRAY_SIZE(vars));
+    for (int32_t slot = 0; slot < tcalc_bytecode_varcount(bc); slot++) {
+      const char* name;
+      int32_t nameLen;
+      tcalc_vardef vardef;
+      CuAssertTrue(tc, tcalc_bytecode_getvarname(bc, slot, &name, &nameLen) == TCALC_ERR_OK);
+      CuAssertTrue(tc, tcalc_ctx_getvar(ctx, name, (size_t)nameLen, &vardef) == TCALC_ERR_OK);
+      vars[slot] = vardef.val;
+    }
+
+    tcalc_val stack[64];
+    CuAssertTrue(tc, tcalc_bytecode_stacksize(bc) <= (int32_t)TCALC_ARRAY_SIZE(stack));
+    CuAssertTrue(tc, tcalc_bytecode_eval(bc, vars, stack, (int32_t)TCALC_ARRAY_SIZE(stack), &actual) == TCALC_ERR_OK);
+    CuAssertIntEquals(tc, expected.type, actual.type);
+    if (expected.type == TCALC_VALTYPE_NUM)
+      CuAssertDblEquals(tc, expected.as.num, actual.as.num, TCALC_DBL_ASSERT_DELTA);
+    else
+      CuAssertIntEquals(tc, !!expected.as.boolean, !!actual.as.boolean);
+    tcalc_bytecode_free(bc);
+  }
+
+  tcalc_ctx_free(ctx);
+}
+
+void TestTCalcBytecodeVarsAndErrors(CuTest *tc) {
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+
+  tcalc_bytecode* bc = NULL;
+  CuAssertTrue(tc, TCalcBytecodeCompile("x / (y - x)", ctx, &bc) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, 2, tcalc_bytecode_varcount(bc));
+  CuAssertIntEquals(tc, 3, tcalc_bytecode_stacksize(bc));
+
+  int32_t x, y;
+  CuAssertTrue(tc, tcalc_bytecode_getvarslot(bc, TCALC_STRLIT_PTR_LEN("x"), &x) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_bytecode_getvarslot(bc, TCALC_STRLIT_PTR_LEN("y"), &y) == TCALC_ERR_OK);
+
+  tcalc_val vars[2];
+  tcalc_val stack[3];
+  tcalc_val res = { 0 };
+  vars[x] = TCALC_VAL_INIT_NUM(3.0);
+  vars[y] = TCALC_VAL_INIT_NUM(9.0);
+  CuAssertTrue(tc, tcalc_bytecode_eval(bc, vars, stack, 3, &res) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 0.5, res.as.num, TCALC_DBL_ASSERT_DELTA);
+
+  CuAssertTrue(tc, tcalc_bytecode_eval(bc, vars, stack, 2, &res) == TCALC_ERR_OUT_OF_BOUNDS);
+
+  vars[y] = TCALC_VAL_INIT_NUM(3.0);
+  CuAssertTrue(tc, tcalc_bytecode_eval(bc, vars, stack, 3, &res) == TCALC_ERR_DIV_BY_ZERO);
+
+  vars[y] = TCALC_VAL_INIT_BOOL(true);
+  CuAssertTrue(tc, tcalc_bytecode_eval(bc, vars, stack, 3, &res) == TCALC_ERR_BAD_CAST);
+  tcalc_bytecode_free(bc);
+
+  CuAssertTrue(tc, TCalcBytecodeCompile("sin(2, 3)", ctx, &bc) == TCALC_ERR_WRONG_ARITY);
+  CuAssertTrue(tc, bc == NULL);
+  CuAssertTrue(tc, TCalcBytecodeCompile("unknownfunc(2)", ctx, &bc) == TCALC_ERR_UNKNOWN_ID);
+  CuAssertTrue(tc, bc == NULL);
+
+  tcalc_ctx_free(ctx);
+}
+
+void TestTCalcBytecodeManyVars(CuTest *tc) {
+  // more variables than the slot index starts out with, each used twice and
+  // named with letters only, since digits would end an identifier
+  enum { VAR_COUNT = 300 };
+  static char expr[VAR_COUNT * 16];
+  size_t exprLen = 0;
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < VAR_COUNT; i++)
+      exprLen += (size_t)snprintf(expr + exprLen, sizeof(expr) - exprLen, "%sv%c%c", exprLen > 0 ? "+" : "", 'a' + i / 26, 'a' + i % 26);
+  }
+
+  tcalc_bytecode* bc = NULL;
+  CuAssertTrue(tc, TCalcBytecodeCompile(expr, tcalc_ctx_default(), &bc) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, VAR_COUNT, tcalc_bytecode_varcount(bc));
+
+  // slots are numbered in order of first use
+  char name[16];
+  for (int i = 0; i < VAR_COUNT; i++) {
+    int32_t slot = -1;
+    const int nameLen = snprintf(name, sizeof(name), "v%c%c", 'a' + i / 26, 'a' + i % 26);
+    CuAssertTrue(tc, tcalc_bytecode_getvarslot(bc, name, (size_t)nameLen, &slot) == TCALC_ERR_OK);
+    CuAssertIntEquals(tc, i, slot);
+
+    const char* slotName = NULL;
+    int32_t slotNameLen = 0;
+    CuAssertTrue(tc, tcalc_bytecode_getvarname(bc, slot, &slotName, &slotNameLen) == TCALC_ERR_OK);
+    CuAssertIntEquals(tc, nameLen, slotNameLen);
+    CuAssertTrue(tc, memcmp(name, slotName, (size_t)nameLen) == 0);
+  }
+  int32_t slot = 0;
+  CuAssertTrue(tc, tcalc_bytecode_getvarslot(bc, TCALC_STRLIT_PTR_LEN("vzz"), &slot) == TCALC_ERR_NOT_FOUND);
+  CuAssertIntEquals(tc, -1, slot);
+  tcalc_bytecode_free(bc);
+}
+
+void TestTCalcBytecodeSharedNodes(CuTest *tc) {
+  const char* expr = "(a + b) ^ 2 / (a + b) + sqrt(a + b) - sin(a + b) * cos(a + b)";
+  const int32_t exprLen = (int32_t)strlen(expr);
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("a"), TCALC_VAL_INIT_NUM(1.5)) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("b"), TCALC_VAL_INIT_NUM(2.0)) == TCALC_ERR_OK);
+
+  int32_t rootInd;
+  CuAssertTrue(tc, TCalcTestLexParse(expr, &rootInd) == TCALC_ERR_OK);
+  const int32_t tokenCount = globalTokenBufferLen, treeNodeCount = globalTreeNodeBufferLen;
+
+  tcalc_val expected = { 0 }, actual = { 0 };
+  CuAssertTrue(tc, tcalc_eval_exprtree(expr, exprLen, globalTreeNodeBuffer, treeNodeCount, rootInd, globalTokenBuffer, tokenCount, ctx, &expected) == TCALC_ERR_OK);
+
+  // (a + b) appears 5 times, so 4 copies of its 3 nodes are merged away,
+  // along with the argument list node shared by sin and cos
+  int32_t eliminated = -1;
+  CuAssertTrue(tc, tcalc_cse_exprtree(expr, exprLen, globalTreeNodeBuffer, treeNodeCount, rootInd, globalTokenBuffer, tokenCount, &eliminated) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, 4 * 3 + 2, eliminated);
+
+  CuAssertTrue(tc, tcalc_eval_exprtree(expr, exprLen, globalTreeNodeBuffer, treeNodeCount, rootInd, globalTokenBuffer, tokenCount, ctx, &actual) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, expected.as.num, actual.as.num, TCALC_DBL_ASSERT_DELTA);
+
+  tcalc_bytecode* bc = NULL;
+  CuAssertTrue(tc, tcalc_bytecode_compile(expr, exprLen, globalTreeNodeBuffer, treeNodeCount, rootInd, globalTokenBuffer, tokenCount, ctx, &bc) == TCALC_ERR_OK);
+  tcalc_val vars[2], stack[16];
+  int32_t slot;
+  CuAssertTrue(tc, tcalc_bytecode_getvarslot(bc, TCALC_STRLIT_PTR_LEN("a"), &slot) == TCALC_ERR_OK);
+  vars[slot] = TCALC_VAL_INIT_NUM(1.5);
+  CuAssertTrue(tc, tcalc_bytecode_getvarslot(bc, TCALC_STRLIT_PTR_LEN("b"), &slot) == TCALC_ERR_OK);
+  vars[slot] = TCALC_VAL_INIT_NUM(2.0);
+
+  // the stack also holds the saved result of (a + b)
+  CuAssertTrue(tc, tcalc_bytecode_eval(bc, vars, stack, tcalc_bytecode_stacksize(bc) - 1, &actual) == TCALC_ERR_OUT_OF_BOUNDS);
+  CuAssertTrue(tc, tcalc_bytecode_eval(bc, vars, stack, tcalc_bytecode_stacksize(bc), &actual) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, expected.as.num, actual.as.num, TCALC_DBL_ASSERT_DELTA);
+
+  double as[300], bs[300], out[300];
+  for (int i = 0; i < 300; i++) {
+    as[i] = 1.5;
+    bs[i] = 2.0;
+  }
+  tcalc_column columns[2];
+  CuAssertTrue(tc, tcalc_bytecode_getvarslot(bc, TCALC_STRLIT_PTR_LEN("a"), &slot) == TCALC_ERR_OK);
+  columns[slot] = (tcalc_column){ .type = TCALC_VALTYPE_NUM, .as.nums = as };
+  CuAssertTrue(tc, tcalc_bytecode_getvarslot(bc, TCALC_STRLIT_PTR_LEN("b"), &slot) == TCALC_ERR_OK);
+  columns[slot] = (tcalc_column){ .type = TCALC_VALTYPE_NUM, .as.nums = bs };
+  CuAssertTrue(tc, tcalc_bytecode_eval_batch(bc, columns, NULL, 300, (tcalc_outcolumn){ .type = TCALC_VALTYPE_NUM, .as.nums = out }) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, expected.as.num, out[0], TCALC_DBL_ASSERT_DELTA);
+  CuAssertDblEquals(tc, expected.as.num, out[299], TCALC_DBL_ASSERT_DELTA);
+
+  tcalc_bytecode_free(bc);
+  tcalc_ctx_free(ctx);
+}
+
+void TestTCalcBytecodeDeepExprtree(CuTest *tc) {
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+
+  // 1 - (1 - (1 - ... 1)), far deeper than the C stack could recurse through.
+  // Every subtraction has its own copy of the leaf on its left, and
+  // tcalc_cse_exprtree merges all of them with the bottom leaf.
+  const int32_t depth = 1000000;
+  const int32_t treeLen = 2 * depth + 1;
+  const char* expr = "1-";
+  tcalc_token tokens[] = {
+    { .type = TCALC_TOK_NUM, .start = 0, .len = 1 },
+    { .type = TCALC_TOK_BINOP, .start = 1, .len = 1 }
+  };
+  tcalc_exprtree* tree = (tcalc_exprtree*)malloc(sizeof(tcalc_exprtree) * (size_t)treeLen);
+  CuAssertPtrNotNull(tc, tree);
+
+  for (int32_t i = 0; i < treeLen; i += 2) {
+    tree[i].type = TCALC_EXPRTREE_NODE_TYPE_VALUE;
+    tree[i].as.value.tokenInd = 0;
+    tree[i].as.value.num = 1.0;
+  }
+  for (int32_t i = 2; i < treeLen; i += 2) {
+    tree[i - 1] = tree[i];
+    tree[i].type = TCALC_EXPRTREE_NODE_TYPE_BINARY;
+    tree[i].as.binary.tokenIndOImplMult = 1;
+    tree[i].as.binary.leftTreeInd = i - 1;
+    tree[i].as.binary.rightTreeInd = i - 2;
+  }
+  const int32_t rootInd = treeLen - 1;
+
+  int32_t eliminated = -1;
+  CuAssertTrue(tc, tcalc_cse_exprtree(expr, 2, tree, treeLen, rootInd, tokens, 2, &eliminated) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, depth, eliminated);
+  CuAssertIntEquals(tc, tree[rootInd].as.binary.leftTreeInd, tree[2].as.binary.rightTreeInd);
+
+  tcalc_bytecode* bc = NULL;
+  CuAssertTrue(tc, tcalc_bytecode_compile(expr, 2, tree, treeLen, rootInd, tokens, 2, ctx, &bc) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, depth + 1, tcalc_bytecode_stacksize(bc));
+
+  tcalc_val* stack = (tcalc_val*)malloc(sizeof(tcalc_val) * (size_t)tcalc_bytecode_stacksize(bc));
+  CuAssertPtrNotNull(tc, stack);
+  tcalc_val res = { 0 };
+  CuAssertTrue(tc, tcalc_bytecode_eval(bc, NULL, stack, tcalc_bytecode_stacksize(bc), &res) == TCALC_ERR_OK);
+  CuAssertTrue(tc, res.type == TCALC_VALTYPE_NUM);
+  CuAssertDblEquals(tc, 1.0, res.as.num, TCALC_DBL_ASSERT_DELTA);
+
+  free(stack);
+  tcalc_bytecode_free(bc);
+  free(tree);
+  tcalc_ctx_free(ctx);
+}
+
+CuSuite* TCalcBytecodeGetSuite() {
+  CuSuite* suite = CuSuiteNew();
+  SUITE_ADD_TEST(suite, TestTCalcBytecodeMatchesEval);
+  SUITE_ADD_TEST(suite, TestTCalcBytecodeVarsAndErrors);
+  SUITE_ADD_TEST(suite, TestTCalcBytecodeManyVars);
+  SUITE_ADD_TEST(suite, TestTCalcBytecodeDeepExprtree);
+  SUITE_ADD_TEST(suite, TestTCalcBytecodeSharedNodes);
+  return suite;
+}
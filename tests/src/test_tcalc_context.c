@@ -0,0 +1,402 @@
+#include "tcalc_tests.h"
+
+#include "CuTest.h"
+
+#include "tcalc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void TestTCalcContextManyVars(CuTest *tc) {
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_empty(&ctx) == TCALC_ERR_OK);
+
+  // enough variables to rebuild the variable index several times
+  const int varCount = 5000;
+  char name[TCALC_IDDEF_MAX_STR_SIZE];
+  for (int i = 0; i < varCount; i++) {
+    snprintf(name, sizeof(name), "v%d", i);
+    CuAssertTrue(tc, tcalc_ctx_addvar(ctx, name, strlen(name), TCALC_VAL_INIT_NUM(i)) == TCALC_ERR_OK);
+  }
+  CuAssertIntEquals(tc, varCount, (int)ctx->vars.len);
+
+  for (int i = 0; i < varCount; i++) {
+    snprintf(name, sizeof(name), "v%d", i);
+    const tcalc_vardef* def = tcalc_ctx_findvar(ctx, name, strlen(name));
+    CuAssertPtrNotNull(tc, def);
+    CuAssertStrEquals(tc, name, def->id);
+    CuAssertDblEquals(tc, (double)i, def->val.as.num, 0.0);
+  }
+
+  // redefining a variable replaces its value rather than adding a definition
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("v42"), TCALC_VAL_INIT_BOOL(true)) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, varCount, (int)ctx->vars.len);
+  tcalc_vardef vardef;
+  CuAssertTrue(tc, tcalc_ctx_getvar(ctx, TCALC_STRLIT_PTR_LEN("v42"), &vardef) == TCALC_ERR_OK);
+  CuAssertTrue(tc, vardef.val.type == TCALC_VALTYPE_BOOL);
+
+  CuAssertPtrEquals(tc, NULL, (void*)tcalc_ctx_findvar(ctx, TCALC_STRLIT_PTR_LEN("v5000")));
+  CuAssertPtrEquals(tc, NULL, (void*)tcalc_ctx_findvar(ctx, TCALC_STRLIT_PTR_LEN("v")));
+  CuAssertPtrEquals(tc, NULL, (void*)tcalc_ctx_findvar(ctx, TCALC_STRLIT_PTR_LEN("")));
+  CuAssertTrue(tc, !tcalc_ctx_hasvar(ctx, TCALC_STRLIT_PTR_LEN("v-1")));
+  CuAssertTrue(tc, tcalc_ctx_getvar(ctx, TCALC_STRLIT_PTR_LEN("v-1"), &vardef) == TCALC_ERR_NOT_FOUND);
+
+  tcalc_ctx_free(ctx);
+}
+
+void TestTCalcContextDefaultLookups(CuTest *tc) {
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+
+  const tcalc_unfuncdef* sin = tcalc_ctx_findunfunc(ctx, TCALC_STRLIT_PTR_LEN("sin"));
+  CuAssertPtrNotNull(tc, sin);
+  CuAssertTrue(tc, sin->func == tcalc_val_sin);
+  CuAssertTrue(tc, tcalc_ctx_findbinfunc(ctx, TCALC_STRLIT_PTR_LEN("sin")) == NULL);
+  CuAssertTrue(tc, tcalc_ctx_findbinfunc(ctx, TCALC_STRLIT_PTR_LEN("pow"))->func == tcalc_val_pow);
+
+  // implicit multiplication is defined as the empty binary operator
+  const tcalc_binopdef* implmult = tcalc_ctx_findbinop(ctx, TCALC_STRLIT_PTR_LEN(""));
+  CuAssertPtrNotNull(tc, implmult);
+  CuAssertTrue(tc, implmult->func == tcalc_val_multiply);
+
+  CuAssertTrue(tc, tcalc_ctx_findrelop(ctx, TCALC_STRLIT_PTR_LEN("<="))->func == tcalc_val_lteq);
+  CuAssertTrue(tc, tcalc_ctx_findbinlop(ctx, TCALC_STRLIT_PTR_LEN("=="))->func == tcalc_val_equals_l);
+  CuAssertTrue(tc, tcalc_ctx_findunlop(ctx, TCALC_STRLIT_PTR_LEN("!"))->func == tcalc_val_not);
+  CuAssertTrue(tc, tcalc_ctx_findunop(ctx, TCALC_STRLIT_PTR_LEN("-"))->func == tcalc_val_unary_minus);
+  CuAssertTrue(tc, tcalc_ctx_findunop(ctx, TCALC_STRLIT_PTR_LEN("*")) == NULL);
+
+  // switching to degrees redefines the trigonometric functions in place
+  const size_t unfuncCount = ctx->unfuncs.len;
+  CuAssertTrue(tc, tcalc_ctx_addtrigdeg(ctx) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, (int)unfuncCount, (int)ctx->unfuncs.len);
+  CuAssertTrue(tc, tcalc_ctx_findunfunc(ctx, TCALC_STRLIT_PTR_LEN("sin"))->func == tcalc_val_sin_deg);
+
+  tcalc_ctx_free(ctx);
+}
+
+void TestTCalcContextStaticDefaults(CuTest *tc) {
+  tcalc_ctx* allocated = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&allocated) == TCALC_ERR_OK);
+
+  // the allocated default context is a copy of the static one
+  const tcalc_ctx* rad = tcalc_ctx_default();
+  CuAssertIntEquals(tc, (int)rad->unfuncs.len, (int)allocated->unfuncs.len);
+  CuAssertIntEquals(tc, (int)rad->binfuncs.len, (int)allocated->binfuncs.len);
+  CuAssertIntEquals(tc, (int)rad->vars.len, (int)allocated->vars.len);
+  CuAssertIntEquals(tc, (int)rad->unops.len, (int)allocated->unops.len);
+  CuAssertIntEquals(tc, (int)rad->binops.len, (int)allocated->binops.len);
+  CuAssertIntEquals(tc, (int)rad->relops.len, (int)allocated->relops.len);
+  CuAssertIntEquals(tc, (int)rad->unlops.len, (int)allocated->unlops.len);
+  CuAssertIntEquals(tc, (int)rad->binlops.len, (int)allocated->binlops.len);
+  TCALC_VEC_FOREACH(rad->unfuncs, i) {
+    CuAssertStrEquals(tc, rad->unfuncs.arr[i].id, allocated->unfuncs.arr[i].id);
+    CuAssertTrue(tc, rad->unfuncs.arr[i].func == allocated->unfuncs.arr[i].func);
+  }
+  tcalc_ctx_free(allocated);
+
+  const tcalc_ctx* deg = tcalc_ctx_default_deg();
+  CuAssertTrue(tc, tcalc_ctx_findunfunc(rad, TCALC_STRLIT_PTR_LEN("arcsin"))->func == tcalc_val_asin);
+  CuAssertTrue(tc, tcalc_ctx_findunfunc(deg, TCALC_STRLIT_PTR_LEN("arcsin"))->func == tcalc_val_asin_deg);
+  CuAssertTrue(tc, tcalc_ctx_findbinfunc(deg, TCALC_STRLIT_PTR_LEN("atan2"))->func == tcalc_val_atan2_deg);
+  CuAssertTrue(tc, tcalc_ctx_findunfunc(deg, TCALC_STRLIT_PTR_LEN("sqrt"))->func == tcalc_val_sqrt);
+  CuAssertTrue(tc, tcalc_ctx_findvar(deg, TCALC_STRLIT_PTR_LEN("pi")) != NULL);
+  CuAssertTrue(tc, tcalc_ctx_findvar(deg, TCALC_STRLIT_PTR_LEN("tau")) == NULL);
+
+  tcalc_val res = { 0 };
+  int32_t treeNodeCount, tokenCount;
+  CuAssertTrue(tc, tcalc_eval_wctx(
+    TCALC_STRLIT_PTR_LEN("sin(90) + cos(180)"), globalTreeNodeBuffer, globalTreeNodeBufferCapacity,
+    globalTokenBuffer, globalTokenBufferCapacity, deg, &res, &treeNodeCount, &tokenCount
+  ) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 0.0, res.as.num, TCALC_DBL_ASSERT_DELTA);
+}
+
+void TestTCalcContextFreezeOverlay(CuTest *tc) {
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("rate"), TCALC_VAL_INIT_NUM(0.5)) == TCALC_ERR_OK);
+
+  tcalc_ctx* frozen = NULL;
+  CuAssertTrue(tc, tcalc_ctx_freeze(ctx, &frozen) == TCALC_ERR_OK);
+  // the frozen copy does not follow later changes to the original
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("rate"), TCALC_VAL_INIT_NUM(2.0)) == TCALC_ERR_OK);
+  tcalc_ctx_free(ctx);
+
+  CuAssertTrue(tc, frozen->frozen);
+  CuAssertTrue(tc, frozen->unfuncsIndex.cap > 0 && frozen->varsIndex.cap > 0 && frozen->binopsIndex.cap > 0);
+  CuAssertDblEquals(tc, 0.5, tcalc_ctx_findvar(frozen, TCALC_STRLIT_PTR_LEN("rate"))->val.as.num, 0.0);
+  CuAssertTrue(tc, tcalc_ctx_addvar(frozen, TCALC_STRLIT_PTR_LEN("rate"), TCALC_VAL_INIT_NUM(1.0)) == TCALC_ERR_IMMUTABLE);
+  CuAssertTrue(tc, tcalc_ctx_addunfunc(frozen, TCALC_STRLIT_PTR_LEN("f"), tcalc_val_abs) == TCALC_ERR_IMMUTABLE);
+  CuAssertTrue(tc, tcalc_ctx_addbinop(frozen, TCALC_STRLIT_PTR_LEN("@"), 1, TCALC_LEFT_ASSOC, tcalc_val_add) == TCALC_ERR_IMMUTABLE);
+
+  tcalc_ctx* a = NULL;
+  tcalc_ctx* b = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_overlay(frozen, &a) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_alloc_overlay(frozen, &b) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(a, TCALC_STRLIT_PTR_LEN("x"), TCALC_VAL_INIT_NUM(3.0)) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(b, TCALC_STRLIT_PTR_LEN("x"), TCALC_VAL_INIT_NUM(4.0)) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(b, TCALC_STRLIT_PTR_LEN("rate"), TCALC_VAL_INIT_NUM(10.0)) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addconst(b, TCALC_STRLIT_PTR_LEN("pi"), TCALC_VAL_INIT_NUM(3.0)) == TCALC_ERR_IMMUTABLE);
+  CuAssertIntEquals(tc, 0, (int)a->unfuncs.len);
+  CuAssertIntEquals(tc, 1, (int)a->vars.len);
+
+  const char* expr = "x * rate + sqrt(4) - pi + pi";
+  tcalc_val res = { 0 };
+  int32_t treeNodeCount, tokenCount;
+  CuAssertTrue(tc, tcalc_eval_wctx(
+    expr, (int32_t)strlen(expr), globalTreeNodeBuffer, globalTreeNodeBufferCapacity,
+    globalTokenBuffer, globalTokenBufferCapacity, a, &res, &treeNodeCount, &tokenCount
+  ) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 3.5, res.as.num, TCALC_DBL_ASSERT_DELTA);
+  CuAssertTrue(tc, tcalc_eval_wctx(
+    expr, (int32_t)strlen(expr), globalTreeNodeBuffer, globalTreeNodeBufferCapacity,
+    globalTokenBuffer, globalTokenBufferCapacity, b, &res, &treeNodeCount, &tokenCount
+  ) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 42.0, res.as.num, TCALC_DBL_ASSERT_DELTA);
+  CuAssertTrue(tc, tcalc_eval_wctx(
+    expr, (int32_t)strlen(expr), globalTreeNodeBuffer, globalTreeNodeBufferCapacity,
+    globalTokenBuffer, globalTokenBufferCapacity, frozen, &res, &treeNodeCount, &tokenCount
+  ) == TCALC_ERR_UNKNOWN_ID);
+
+  // overlays are only allowed on frozen contexts, which the defaults are
+  tcalc_ctx* c = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_overlay(a, &c) == TCALC_ERR_INVALID_ARG);
+  CuAssertTrue(tc, tcalc_ctx_alloc_overlay(tcalc_ctx_default(), &c) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_findunfunc(c, TCALC_STRLIT_PTR_LEN("sin"))->func == tcalc_val_sin);
+
+  // freezing an overlay flattens it
+  tcalc_ctx* flat = NULL;
+  CuAssertTrue(tc, tcalc_ctx_freeze(b, &flat) == TCALC_ERR_OK);
+  CuAssertPtrEquals(tc, NULL, (void*)flat->parent);
+  CuAssertDblEquals(tc, 10.0, tcalc_ctx_findvar(flat, TCALC_STRLIT_PTR_LEN("rate"))->val.as.num, 0.0);
+  CuAssertTrue(tc, tcalc_ctx_findunfunc(flat, TCALC_STRLIT_PTR_LEN("sqrt")) != NULL);
+
+  tcalc_ctx_free(flat);
+  tcalc_ctx_free(c);
+  tcalc_ctx_free(b);
+  tcalc_ctx_free(a);
+  tcalc_ctx_free(frozen);
+}
+
+void TestTCalcContextAddVars(CuTest *tc) {
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_child(tcalc_ctx_default(), &ctx) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("p7"), TCALC_VAL_INIT_BOOL(true)) == TCALC_ERR_OK);
+
+  // every name appears twice, and the second value wins
+  enum { uniqueCount = 20000, count = 2 * uniqueCount };
+  static char nameBufs[uniqueCount][TCALC_IDDEF_MAX_STR_SIZE];
+  static const char* names[count];
+  static size_t nameLens[count];
+  static tcalc_val vals[count];
+  for (int i = 0; i < count; i++) {
+    const int id = i % uniqueCount;
+    snprintf(nameBufs[id], TCALC_IDDEF_MAX_STR_SIZE, "p%d", id);
+    names[i] = nameBufs[id];
+    nameLens[i] = strlen(nameBufs[id]);
+    vals[i] = TCALC_VAL_INIT_NUM(i);
+  }
+  CuAssertTrue(tc, tcalc_ctx_addvars(ctx, names, nameLens, vals, count) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, uniqueCount, (int)ctx->vars.len);
+  for (int id = 0; id < uniqueCount; id++) {
+    const tcalc_vardef* def = tcalc_ctx_findvar(ctx, names[id], nameLens[id]);
+    CuAssertPtrNotNull(tc, def);
+    CuAssertTrue(tc, def->val.type == TCALC_VALTYPE_NUM);
+    CuAssertDblEquals(tc, (double)(id + uniqueCount), def->val.as.num, 0.0);
+  }
+  CuAssertTrue(tc, tcalc_ctx_findvar(ctx, TCALC_STRLIT_PTR_LEN("p20000")) == NULL);
+  CuAssertTrue(tc, tcalc_ctx_addvars(ctx, names, nameLens, vals, 0) == TCALC_ERR_OK);
+
+  // the variables before a failing one stay added
+  const char* withConst[3] = { "q", "pi", "r" };
+  const size_t withConstLens[3] = { 1, 2, 1 };
+  CuAssertTrue(tc, tcalc_ctx_addvars(ctx, withConst, withConstLens, vals, 3) == TCALC_ERR_IMMUTABLE);
+  CuAssertTrue(tc, tcalc_ctx_hasvar(ctx, TCALC_STRLIT_PTR_LEN("q")));
+  CuAssertTrue(tc, !tcalc_ctx_hasvar(ctx, TCALC_STRLIT_PTR_LEN("r")));
+
+  tcalc_ctx* frozen = NULL;
+  CuAssertTrue(tc, tcalc_ctx_freeze(ctx, &frozen) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvars(frozen, names, nameLens, vals, 1) == TCALC_ERR_IMMUTABLE);
+
+  tcalc_ctx_free(frozen);
+  tcalc_ctx_free(ctx);
+}
+
+static tcalc_err tcalc_test_double(tcalc_val a, double* out) {
+  if (a.type != TCALC_VALTYPE_NUM) return TCALC_ERR_BAD_CAST;
+  *out = 2.0 * a.as.num;
+  return TCALC_ERR_OK;
+}
+
+void TestTCalcContextChildren(CuTest *tc) {
+  tcalc_ctx* lib = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_child(tcalc_ctx_default(), &lib) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addunfunc(lib, TCALC_STRLIT_PTR_LEN("double"), tcalc_test_double) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addbinop(lib, TCALC_STRLIT_PTR_LEN("^"), 10, TCALC_LEFT_ASSOC, tcalc_val_pow) == TCALC_ERR_OK);
+
+  tcalc_ctx* tenants[2] = { NULL, NULL };
+  for (int i = 0; i < 2; i++) {
+    CuAssertTrue(tc, tcalc_ctx_alloc_child(lib, &tenants[i]) == TCALC_ERR_OK);
+    CuAssertTrue(tc, tcalc_ctx_addvar(tenants[i], TCALC_STRLIT_PTR_LEN("x"), TCALC_VAL_INIT_NUM(i + 1)) == TCALC_ERR_OK);
+    // a child only holds its own definitions
+    CuAssertIntEquals(tc, 1, (int)tenants[i]->vars.len);
+    CuAssertIntEquals(tc, 0, (int)tenants[i]->unfuncs.len);
+  }
+  CuAssertTrue(tc, tcalc_ctx_addconst(tenants[0], TCALC_STRLIT_PTR_LEN("e"), TCALC_VAL_INIT_NUM(1.0)) == TCALC_ERR_IMMUTABLE);
+  CuAssertTrue(tc, tcalc_ctx_addunfunc(tenants[1], TCALC_STRLIT_PTR_LEN("sqrt"), tcalc_test_double) == TCALC_ERR_OK);
+
+  const char* expr = "double(x) + sqrt(4) + 2^3^2";
+  const double expected[2] = { 2.0 + 2.0 + 64.0, 4.0 + 8.0 + 64.0 };
+  tcalc_val res = { 0 };
+  int32_t treeNodeCount, tokenCount;
+  for (int i = 0; i < 2; i++) {
+    CuAssertTrue(tc, tcalc_eval_wctx(
+      expr, (int32_t)strlen(expr), globalTreeNodeBuffer, globalTreeNodeBufferCapacity,
+      globalTokenBuffer, globalTokenBufferCapacity, tenants[i], &res, &treeNodeCount, &tokenCount
+    ) == TCALC_ERR_OK);
+    CuAssertDblEquals(tc, expected[i], res.as.num, TCALC_DBL_ASSERT_DELTA);
+  }
+
+  // definitions added to a parent later are seen by its children
+  CuAssertTrue(tc, tcalc_ctx_findvar(tenants[0], TCALC_STRLIT_PTR_LEN("y")) == NULL);
+  CuAssertTrue(tc, tcalc_ctx_addvar(lib, TCALC_STRLIT_PTR_LEN("y"), TCALC_VAL_INIT_NUM(7.0)) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 7.0, tcalc_ctx_findvar(tenants[0], TCALC_STRLIT_PTR_LEN("y"))->val.as.num, 0.0);
+  CuAssertTrue(tc, tcalc_ctx_findunfunc(lib, TCALC_STRLIT_PTR_LEN("sqrt"))->func == tcalc_val_sqrt);
+
+  tcalc_ctx_free(tenants[1]);
+  tcalc_ctx_free(tenants[0]);
+  tcalc_ctx_free(lib);
+}
+
+void TestTCalcContextImage(CuTest *tc) {
+  tcalc_ctx* lib = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_child(tcalc_ctx_default(), &lib) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addunfunc(lib, TCALC_STRLIT_PTR_LEN("double"), tcalc_test_double) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(lib, TCALC_STRLIT_PTR_LEN("x"), TCALC_VAL_INIT_NUM(3.0)) == TCALC_ERR_OK);
+
+  size_t size = 0;
+  CuAssertTrue(tc, tcalc_ctx_image_write(lib, NULL, 0, NULL, 0, &size) == TCALC_ERR_NOMEM);
+  CuAssertTrue(tc, size > 0);
+  char* image = (char*)malloc(size);
+  CuAssertPtrNotNull(tc, image);
+  // functions which are not builtin must be listed
+  CuAssertTrue(tc, tcalc_ctx_image_write(lib, NULL, 0, image, size, &size) == TCALC_ERR_NOT_FOUND);
+  const tcalc_anyfunc funcs[1] = { TCALC_ANYFUNC(tcalc_test_double) };
+  CuAssertTrue(tc, tcalc_ctx_image_write(lib, funcs, 1, image, size, &size) == TCALC_ERR_OK);
+
+  // images are relocatable
+  char* moved = (char*)malloc(size);
+  CuAssertPtrNotNull(tc, moved);
+  memcpy(moved, image, size);
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_image_open(moved, size, funcs, 0, &ctx) == TCALC_ERR_NOT_FOUND);
+  CuAssertTrue(tc, tcalc_ctx_image_open(moved, size, funcs, 1, &ctx) == TCALC_ERR_OK);
+  CuAssertTrue(tc, ctx->frozen);
+  CuAssertTrue(tc, ctx->parent == NULL);
+  CuAssertTrue(tc, tcalc_ctx_findunfunc(ctx, TCALC_STRLIT_PTR_LEN("double"))->func == tcalc_test_double);
+  CuAssertTrue(tc, tcalc_ctx_findunfunc(ctx, TCALC_STRLIT_PTR_LEN("sqrt"))->func == tcalc_val_sqrt);
+  CuAssertTrue(tc, tcalc_ctx_findvar(ctx, TCALC_STRLIT_PTR_LEN("pi"))->immutable);
+  CuAssertTrue(tc, tcalc_ctx_findbinop(ctx, TCALC_STRLIT_PTR_LEN("^"))->assoc == TCALC_RIGHT_ASSOC);
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("y"), TCALC_VAL_INIT_NUM(1.0)) == TCALC_ERR_IMMUTABLE);
+
+  tcalc_ctx* overlay = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_overlay(ctx, &overlay) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(overlay, TCALC_STRLIT_PTR_LEN("x"), TCALC_VAL_INIT_NUM(5.0)) == TCALC_ERR_OK);
+  const char* expr = "double(x) + sqrt(4) + 2^3^2";
+  const tcalc_ctx* scopes[2] = { ctx, overlay };
+  const double expected[2] = { 6.0 + 2.0 + 512.0, 10.0 + 2.0 + 512.0 };
+  tcalc_val res = { 0 };
+  int32_t treeNodeCount, tokenCount;
+  for (int i = 0; i < 2; i++) {
+    CuAssertTrue(tc, tcalc_eval_wctx(
+      expr, (int32_t)strlen(expr), globalTreeNodeBuffer, globalTreeNodeBufferCapacity,
+      globalTokenBuffer, globalTokenBufferCapacity, scopes[i], &res, &treeNodeCount, &tokenCount
+    ) == TCALC_ERR_OK);
+    CuAssertDblEquals(tc, expected[i], res.as.num, TCALC_DBL_ASSERT_DELTA);
+  }
+  tcalc_ctx_free(overlay);
+  tcalc_ctx_free(ctx);
+  CuAssertTrue(tc, memcmp(image, moved, size) == 0);
+
+  // the definition of x is written without any bytes besides its fields
+  tcalc_vardef x;
+  memset(&x, 0, sizeof(x));
+  memcpy(x.id, "x", 2);
+  x.val.type = TCALC_VALTYPE_NUM;
+  x.val.as.num = 3.0;
+  size_t xOffset = 0;
+  while (xOffset + sizeof(x) <= size && memcmp(image + xOffset, &x, sizeof(x)) != 0)
+    xOffset++;
+  CuAssertTrue(tc, xOffset + sizeof(x) <= size);
+
+  memset(moved + xOffset, 'x', sizeof(x.id));
+  CuAssertTrue(tc, tcalc_ctx_image_open(moved, size, funcs, 1, &ctx) == TCALC_ERR_INVALID_ARG);
+  memcpy(moved, image, size);
+  moved[0] = 'X';
+  CuAssertTrue(tc, tcalc_ctx_image_open(moved, size, funcs, 1, &ctx) == TCALC_ERR_INVALID_ARG);
+  CuAssertTrue(tc, tcalc_ctx_image_open(image, size - 16, funcs, 1, &ctx) == TCALC_ERR_INVALID_ARG);
+
+  free(moved);
+  free(image);
+  tcalc_ctx_free(lib);
+}
+
+void TestTCalcContextAllocator(CuTest *tc) {
+  tcalc_test_pool pool = TCALC_TEST_POOL_INIT;
+  const tcalc_allocator allocator = TCALC_TEST_POOL_ALLOCATOR(&pool);
+
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_child_with(tcalc_ctx_default(), &allocator, &ctx) == TCALC_ERR_OK);
+  for (int i = 0; i < 100; i++) {
+    char name[TCALC_IDDEF_MAX_STR_SIZE];
+    snprintf(name, sizeof(name), "v%d", i);
+    CuAssertTrue(tc, tcalc_ctx_addvar(ctx, name, strlen(name), TCALC_VAL_INIT_NUM(i)) == TCALC_ERR_OK);
+  }
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("x"), TCALC_VAL_INIT_NUM(1.0)) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("y"), TCALC_VAL_INIT_NUM(99.0)) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addunfunc(ctx, TCALC_STRLIT_PTR_LEN("double"), tcalc_test_double) == TCALC_ERR_OK);
+  const size_t ctxUsed = pool.used;
+  CuAssertTrue(tc, ctxUsed > 100 * sizeof(tcalc_vardef));
+
+  // everything built from the context comes from its allocator too
+  tcalc_ctx* frozen = NULL;
+  CuAssertTrue(tc, tcalc_ctx_freeze(ctx, &frozen) == TCALC_ERR_OK);
+  CuAssertTrue(tc, frozen->allocator == &allocator);
+  tcalc_varstore* store = NULL;
+  CuAssertTrue(tc, tcalc_varstore_alloc(ctx, &store) == TCALC_ERR_OK);
+  tcalc_prepared* prep = NULL;
+  CuAssertTrue(tc, tcalc_prepared_compile(TCALC_STRLIT_PTR_LEN("double(x) + y * pi"), ctx, &prep) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_bindstore(prep, store) == TCALC_ERR_OK);
+  tcalc_val res = { 0 };
+  CuAssertTrue(tc, tcalc_prepared_eval(prep, &res) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 2.0 + 99.0 * TCALC_PI, res.as.num, TCALC_DBL_ASSERT_DELTA);
+  tcalc_prepared_free(prep);
+  tcalc_varstore_free(store);
+  tcalc_ctx_free(frozen);
+  CuAssertTrue(tc, pool.used == ctxUsed);
+
+  // running out of memory is an error, not a crash
+  pool.limit = pool.used;
+  CuAssertTrue(tc, tcalc_ctx_freeze(ctx, &frozen) == TCALC_ERR_NOMEM);
+  CuAssertTrue(tc, tcalc_prepared_compile(TCALC_STRLIT_PTR_LEN("x + y"), ctx, &prep) == TCALC_ERR_NOMEM);
+  CuAssertTrue(tc, pool.used == ctxUsed);
+  pool.limit = SIZE_MAX;
+
+  tcalc_ctx_free(ctx);
+  CuAssertTrue(tc, pool.used == 0);
+  CuAssertIntEquals(tc, 0, pool.badSizes);
+}
+
+CuSuite* TCalcContextGetSuite() {
+  CuSuite* suite = CuSuiteNew();
+  SUITE_ADD_TEST(suite, TestTCalcContextManyVars);
+  SUITE_ADD_TEST(suite, TestTCalcContextDefaultLookups);
+  SUITE_ADD_TEST(suite, TestTCalcContextStaticDefaults);
+  SUITE_ADD_TEST(suite, TestTCalcContextFreezeOverlay);
+  SUITE_ADD_TEST(suite, TestTCalcContextChildren);
+  SUITE_ADD_TEST(suite, TestTCalcContextAddVars);
+  SUITE_ADD_TEST(suite, TestTCalcContextImage);
+  SUITE_ADD_TEST(suite, TestTCalcContextAllocator);
+  return suite;
+}
@@ -2,8 +2,16 @@
 
 #include "tcalc.h"
 
+#include <inttypes.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+
+#ifdef TCALC_TESTS_HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 #define TCALC_EVAL_ASSERT_DELTA 0.0001
 
 static tcalc_err tcalc_eval_gb(const char* expr, int32_t exprLen, tcalc_val* out)
@@ -68,6 +76,10 @@ void TestTCalcEvalSuccesses(CuTest *tc) {
   MAKE_DOUBLE_SUCCESS_TEST(tc, "0000.253", .253);
   MAKE_DOUBLE_SUCCESS_TEST(tc, "   0000.253  ", .253);
   MAKE_DOUBLE_SUCCESS_TEST(tc, " -   0000.253 ( -1 ) ", .253);
+  MAKE_DOUBLE_SUCCESS_TEST(tc, "53e4", 530000.0);
+  MAKE_DOUBLE_SUCCESS_TEST(tc, "1.5E-3 * 2e+3", 3.0);
+  MAKE_DOUBLE_SUCCESS_TEST(tc, "2e", 5.436563);
+  MAKE_DOUBLE_SUCCESS_TEST(tc, "2e^2", 14.778112);
 
   MAKE_DOUBLE_SUCCESS_TEST(tc, "5 + 5", 10.0);
   MAKE_DOUBLE_SUCCESS_TEST(tc, "5 + .5", 5.5);
@@ -93,6 +105,7 @@ void TestTCalcEvalSuccesses(CuTest *tc) {
   MAKE_DOUBLE_SUCCESS_TEST(tc, "5ln(e)", 5.0);
   MAKE_DOUBLE_SUCCESS_TEST(tc, "2^2ln(e)", 4.0);
   MAKE_DOUBLE_SUCCESS_TEST(tc, "2pi", 6.283185);
+  MAKE_DOUBLE_SUCCESS_TEST(tc, "pow(2, -1)", 0.5);
 
   // Boolean Tests
 
@@ -121,7 +134,8 @@ void TestTCalcEvalSuccesses(CuTest *tc) {
 
   MAKE_BOOL_SUCCESS_TEST(tc, "101 == 101", 1);
   MAKE_BOOL_SUCCESS_TEST(tc, "10sin(pi) == 10sin(3pi)", 1);
-  // TODO: Fix this case: MAKE_BOOL_SUCCESS_TEST(tc, "-2^3 < -2^5", 1);
+  MAKE_BOOL_SUCCESS_TEST(tc, "-2^3 < -2^5", 0);
+  MAKE_BOOL_SUCCESS_TEST(tc, "1 > -1 && -1 != +1", 1);
   MAKE_BOOL_SUCCESS_TEST(tc, "2^3 < 2^5", 1);
 }
 
@@ -142,7 +156,7 @@ void TestTCalcEvalFailures(CuTest *tc) {
   CuAssertTrue(tc, tcalc_eval_gb(TCALC_STRLIT_PTR_LEN("\n"), &res) != TCALC_ERR_OK);
   CuAssertTrue(tc, tcalc_eval_gb(TCALC_STRLIT_PTR_LEN("a b c 10d e+"), &res) != TCALC_ERR_OK);
   CuAssertTrue(tc, tcalc_eval_gb(TCALC_STRLIT_PTR_LEN("53.3.4"), &res) != TCALC_ERR_OK);
-  // TODO: Fix this case: CuAssertTrue(tc, tcalc_eval("53e4", &res) != TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_eval_gb(TCALC_STRLIT_PTR_LEN("1e400"), &res) == TCALC_ERR_OVERFLOW);
   CuAssertTrue(tc, tcalc_eval_gb(TCALC_STRLIT_PTR_LEN(".53.3"), &res) != TCALC_ERR_OK);
   CuAssertTrue(tc, tcalc_eval_gb(TCALC_STRLIT_PTR_LEN("."), &res) != TCALC_ERR_OK);
   CuAssertTrue(tc, tcalc_eval_gb(TCALC_STRLIT_PTR_LEN(""), &res) != TCALC_ERR_OK);
@@ -165,9 +179,451 @@ void TestTCalcEvalFailures(CuTest *tc) {
   CuAssertTrue(tc, tcalc_eval_gb(TCALC_STRLIT_PTR_LEN(")"), &res) != TCALC_ERR_OK);
 }
 
+static tcalc_err tcalc_fold_eval_gb(const char* expr, const tcalc_ctx* ctx, int32_t* outRootInd, tcalc_val* out)
+{
+  const int32_t exprLen = (int32_t)strlen(expr);
+  tcalc_err err = TCalcTestLexParse(expr, outRootInd);
+  if (err) return err;
+  const int32_t tokenCount = globalTokenBufferLen, treeNodeCount = globalTreeNodeBufferLen;
+
+  err = tcalc_fold_exprtree(
+    expr, exprLen, globalTreeNodeBuffer, treeNodeCount, *outRootInd,
+    globalTokenBuffer, tokenCount, ctx
+  );
+  if (err) return err;
+
+  return tcalc_eval_exprtree(
+    expr, exprLen, globalTreeNodeBuffer, treeNodeCount, *outRootInd,
+    globalTokenBuffer, tokenCount, ctx, out
+  );
+}
+
+void TestTCalcEvalFoldExprtree(CuTest *tc) {
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("r"), TCALC_VAL_INIT_NUM(3.0)) == TCALC_ERR_OK);
+
+  int32_t rootInd = -1;
+  tcalc_val res = { 0 };
+
+  // everything folds into the root
+  CuAssertTrue(tc, tcalc_fold_eval_gb("sin(pi / 6) * 4 + pow(2, 3)", ctx, &rootInd, &res) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, TCALC_EXPRTREE_NODE_TYPE_CONST, globalTreeNodeBuffer[rootInd].type);
+  CuAssertDblEquals(tc, 10.0, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+
+  CuAssertTrue(tc, tcalc_fold_eval_gb("!false && 1 < 2", ctx, &rootInd, &res) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, TCALC_EXPRTREE_NODE_TYPE_CONST, globalTreeNodeBuffer[rootInd].type);
+  CuAssertTrue(tc, res.type == TCALC_VALTYPE_BOOL && res.as.boolean);
+
+  // only the constant side of a variable expression folds
+  CuAssertTrue(tc, tcalc_fold_eval_gb("2pi * r", ctx, &rootInd, &res) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, TCALC_EXPRTREE_NODE_TYPE_BINARY, globalTreeNodeBuffer[rootInd].type);
+  CuAssertIntEquals(tc, TCALC_EXPRTREE_NODE_TYPE_CONST, globalTreeNodeBuffer[globalTreeNodeBuffer[rootInd].as.binary.leftTreeInd].type);
+  CuAssertIntEquals(tc, TCALC_EXPRTREE_NODE_TYPE_VALUE, globalTreeNodeBuffer[globalTreeNodeBuffer[rootInd].as.binary.rightTreeInd].type);
+  CuAssertDblEquals(tc, 6.0 * TCALC_PI, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+
+  // failing subtrees are kept, so their errors still surface
+  CuAssertTrue(tc, tcalc_fold_eval_gb("1 / 0 + r", ctx, &rootInd, &res) == TCALC_ERR_DIV_BY_ZERO);
+  CuAssertTrue(tc, tcalc_fold_eval_gb("true + 1", ctx, &rootInd, &res) == TCALC_ERR_BAD_CAST);
+
+  // immutable variables
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("pi"), TCALC_VAL_INIT_NUM(3.0)) == TCALC_ERR_IMMUTABLE);
+  CuAssertTrue(tc, tcalc_ctx_addconst(ctx, TCALC_STRLIT_PTR_LEN("r"), TCALC_VAL_INIT_NUM(2.0)) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("r"), TCALC_VAL_INIT_NUM(1.0)) == TCALC_ERR_IMMUTABLE);
+  CuAssertTrue(tc, tcalc_fold_eval_gb("2pi * r", ctx, &rootInd, &res) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, TCALC_EXPRTREE_NODE_TYPE_CONST, globalTreeNodeBuffer[rootInd].type);
+  CuAssertDblEquals(tc, 4.0 * TCALC_PI, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+
+  tcalc_ctx_free(ctx);
+}
+
+typedef struct tcalc_test_walk {
+  enum tcalc_exprtree_node_type left[16]; // types of the nodes left, in order
+  int32_t leftLen;
+  int32_t skipInd; // node whose children are skipped
+  const tcalc_exprtree* tree;
+} tcalc_test_walk;
+
+static tcalc_err tcalc_test_walk_enter(void* user, int32_t nodeInd, int32_t* slot, bool* outDescend) {
+  (void)slot;
+  *outDescend = nodeInd != ((tcalc_test_walk*)user)->skipInd;
+  return TCALC_ERR_OK;
+}
+
+static tcalc_err tcalc_test_walk_leave(void* user, int32_t nodeInd, int32_t* slot) {
+  (void)slot;
+  tcalc_test_walk* walk = (tcalc_test_walk*)user;
+  if (walk->leftLen == (int32_t)TCALC_ARRAY_SIZE(walk->left)) return TCALC_ERR_NOMEM;
+  walk->left[walk->leftLen++] = walk->tree[nodeInd].type;
+  return TCALC_ERR_OK;
+}
+
+void TestTCalcEvalExprtreeWalk(CuTest *tc) {
+  int32_t rootInd;
+  CuAssertTrue(tc, TCalcTestLexParse("1 + max(2, 3)", &rootInd) == TCALC_ERR_OK);
+  tcalc_exprtree_walkframe frames[16];
+  CuAssertTrue(tc, globalTreeNodeBufferLen <= (int32_t)TCALC_ARRAY_SIZE(frames));
+
+  // every node is left after its children, with arguments in order
+  tcalc_test_walk walk = { .leftLen = 0, .skipInd = -1, .tree = globalTreeNodeBuffer };
+  CuAssertTrue(tc, tcalc_exprtree_walk(globalTreeNodeBuffer, rootInd, frames, tcalc_test_walk_enter, tcalc_test_walk_leave, &walk) == TCALC_ERR_OK);
+  const enum tcalc_exprtree_node_type expected[] = {
+    TCALC_EXPRTREE_NODE_TYPE_VALUE, TCALC_EXPRTREE_NODE_TYPE_VALUE, TCALC_EXPRTREE_NODE_TYPE_VALUE,
+    TCALC_EXPRTREE_NODE_TYPE_FUNCARG, TCALC_EXPRTREE_NODE_TYPE_FUNCARG,
+    TCALC_EXPRTREE_NODE_TYPE_FUNC, TCALC_EXPRTREE_NODE_TYPE_BINARY
+  };
+  CuAssertIntEquals(tc, (int)TCALC_ARRAY_SIZE(expected), walk.leftLen);
+  for (size_t i = 0; i < TCALC_ARRAY_SIZE(expected); i++)
+    CuAssertIntEquals(tc, expected[i], walk.left[i]);
+
+  // a skipped node is neither descended into nor left
+  walk.leftLen = 0;
+  walk.skipInd = globalTreeNodeBuffer[rootInd].as.binary.rightTreeInd;
+  CuAssertTrue(tc, tcalc_exprtree_walk(globalTreeNodeBuffer, rootInd, frames, tcalc_test_walk_enter, tcalc_test_walk_leave, &walk) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, 2, walk.leftLen);
+  CuAssertIntEquals(tc, TCALC_EXPRTREE_NODE_TYPE_VALUE, walk.left[0]);
+  CuAssertIntEquals(tc, TCALC_EXPRTREE_NODE_TYPE_BINARY, walk.left[1]);
+
+  // and the walk stops at the first error
+  walk.leftLen = (int32_t)TCALC_ARRAY_SIZE(walk.left) - 1;
+  walk.skipInd = -1;
+  CuAssertTrue(tc, tcalc_exprtree_walk(globalTreeNodeBuffer, rootInd, frames, NULL, tcalc_test_walk_leave, &walk) == TCALC_ERR_NOMEM);
+  CuAssertIntEquals(tc, (int)TCALC_ARRAY_SIZE(walk.left), walk.leftLen);
+}
+
+void TestTCalcEvalFoldDeepExprtree(CuTest *tc) {
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+
+  // a chain of negations far deeper than the C stack could recurse through
+  const int32_t depth = 200000;
+  const char* expr = "-1";
+  tcalc_token tokens[] = {
+    { .type = TCALC_TOK_UNOP, .start = 0, .len = 1 },
+    { .type = TCALC_TOK_NUM, .start = 1, .len = 1 }
+  };
+  tcalc_exprtree* tree = (tcalc_exprtree*)malloc(sizeof(tcalc_exprtree) * (size_t)(depth + 1));
+  CuAssertPtrNotNull(tc, tree);
+
+  tree[0].type = TCALC_EXPRTREE_NODE_TYPE_VALUE;
+  tree[0].as.value.tokenInd = 1;
+  tree[0].as.value.num = 1.0;
+  for (int32_t i = 1; i <= depth; i++) {
+    tree[i].type = TCALC_EXPRTREE_NODE_TYPE_UNARY;
+    tree[i].as.unary.tokenInd = 0;
+    tree[i].as.unary.childTreeInd = i - 1;
+  }
+
+  CuAssertTrue(tc, tcalc_fold_exprtree(expr, 2, tree, depth + 1, depth, tokens, 2, ctx) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, TCALC_EXPRTREE_NODE_TYPE_CONST, tree[depth].type);
+  CuAssertDblEquals(tc, 1.0, tree[depth].as.constant.val.as.num, TCALC_EVAL_ASSERT_DELTA);
+  CuAssertIntEquals(tc, TCALC_EXPRTREE_NODE_TYPE_CONST, tree[depth - 1].type);
+  CuAssertDblEquals(tc, -1.0, tree[depth - 1].as.constant.val.as.num, TCALC_EVAL_ASSERT_DELTA);
+
+  free(tree);
+  tcalc_ctx_free(ctx);
+}
+
+void TestTCalcEvalDeepExprtree(CuTest *tc) {
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+
+  // a chain of negations far deeper than the C stack could recurse through
+  const int32_t depth = 200000;
+  const char* expr = "-1";
+  tcalc_token tokens[] = {
+    { .type = TCALC_TOK_UNOP, .start = 0, .len = 1 },
+    { .type = TCALC_TOK_NUM, .start = 1, .len = 1 }
+  };
+  tcalc_exprtree* tree = (tcalc_exprtree*)malloc(sizeof(tcalc_exprtree) * (size_t)(depth + 1));
+  tcalc_evalframe* frames = (tcalc_evalframe*)malloc(sizeof(tcalc_evalframe) * (size_t)depth);
+  CuAssertPtrNotNull(tc, tree);
+  CuAssertPtrNotNull(tc, frames);
+
+  tree[0].type = TCALC_EXPRTREE_NODE_TYPE_VALUE;
+  tree[0].as.value.tokenInd = 1;
+  tree[0].as.value.num = 1.0;
+  for (int32_t i = 1; i <= depth; i++) {
+    tree[i].type = TCALC_EXPRTREE_NODE_TYPE_UNARY;
+    tree[i].as.unary.tokenInd = 0;
+    tree[i].as.unary.childTreeInd = i - 1;
+  }
+
+  // leaves are evaluated by their parents, so every negation takes one frame
+  tcalc_val res = { 0 };
+  CuAssertTrue(tc, tcalc_eval_exprtree_stk(expr, 2, tree, depth + 1, depth, tokens, 2, ctx, frames, depth, &res) == TCALC_ERR_OK);
+  CuAssertTrue(tc, res.type == TCALC_VALTYPE_NUM);
+  CuAssertDblEquals(tc, 1.0, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+  CuAssertTrue(tc, tcalc_eval_exprtree_stk(expr, 2, tree, depth + 1, depth - 1, tokens, 2, ctx, frames, depth - 1, &res) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, -1.0, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+  CuAssertTrue(tc, tcalc_eval_exprtree_stk(expr, 2, tree, depth + 1, 0, tokens, 2, ctx, frames, 1, &res) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 1.0, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+
+  CuAssertTrue(tc, tcalc_eval_exprtree_stk(expr, 2, tree, depth + 1, depth, tokens, 2, ctx, frames, depth - 1, &res) == TCALC_ERR_MAX_DEPTH);
+
+  // tcalc_eval_exprtree has no depth limit of its own, on either side of the
+  // number of frames it keeps on the C stack
+  CuAssertTrue(tc, tcalc_eval_exprtree(expr, 2, tree, depth + 1, depth, tokens, 2, ctx, &res) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 1.0, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+  CuAssertTrue(tc, tcalc_eval_exprtree(expr, 2, tree, TCALC_EVAL_STACK_FRAMES + 1, TCALC_EVAL_STACK_FRAMES, tokens, 2, ctx, &res) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 1.0, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+  CuAssertTrue(tc, tcalc_eval_exprtree(expr, 2, tree, TCALC_EVAL_STACK_FRAMES, TCALC_EVAL_STACK_FRAMES - 1, tokens, 2, ctx, &res) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, -1.0, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+
+  free(frames);
+  free(tree);
+  tcalc_ctx_free(ctx);
+}
+
+void TestTCalcEvalCtxPrecedence(CuTest *tc) {
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+  int32_t treeNodeCount, tokenCount;
+  tcalc_val res = { 0 };
+
+  CuAssertTrue(tc, tcalc_eval_wctx(TCALC_STRLIT_PTR_LEN("2 + 3 * 4"), globalTreeNodeBuffer, globalTreeNodeBufferCapacity, globalTokenBuffer, globalTokenBufferCapacity, ctx, &res, &treeNodeCount, &tokenCount) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 14.0, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+  CuAssertTrue(tc, tcalc_eval_wctx(TCALC_STRLIT_PTR_LEN("2 ^ -1"), globalTreeNodeBuffer, globalTreeNodeBufferCapacity, globalTokenBuffer, globalTokenBufferCapacity, ctx, &res, &treeNodeCount, &tokenCount) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 0.5, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+
+  // addition binding tighter than multiplication, and subtraction grouping to the right
+  CuAssertTrue(tc, tcalc_ctx_addbinop(ctx, TCALC_STRLIT_PTR_LEN("+"), 20, TCALC_LEFT_ASSOC, tcalc_val_add) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addbinop(ctx, TCALC_STRLIT_PTR_LEN("-"), 8, TCALC_RIGHT_ASSOC, tcalc_val_subtract) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_eval_wctx(TCALC_STRLIT_PTR_LEN("2 + 3 * 4"), globalTreeNodeBuffer, globalTreeNodeBufferCapacity, globalTokenBuffer, globalTokenBufferCapacity, ctx, &res, &treeNodeCount, &tokenCount) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 20.0, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+  CuAssertTrue(tc, tcalc_eval_wctx(TCALC_STRLIT_PTR_LEN("10 - 4 - 3"), globalTreeNodeBuffer, globalTreeNodeBufferCapacity, globalTokenBuffer, globalTokenBufferCapacity, ctx, &res, &treeNodeCount, &tokenCount) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 9.0, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+
+  // operators which the context does not define cannot be parsed
+  tcalc_ctx* emptyCtx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_empty(&emptyCtx) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_eval_wctx(TCALC_STRLIT_PTR_LEN("1 + 2"), globalTreeNodeBuffer, globalTreeNodeBufferCapacity, globalTokenBuffer, globalTokenBufferCapacity, emptyCtx, &res, &treeNodeCount, &tokenCount) == TCALC_ERR_UNKNOWN_TOKEN);
+  tcalc_ctx_free(emptyCtx);
+
+  tcalc_ctx_free(ctx);
+}
+
+void TestTCalcEvalDeepNesting(CuTest *tc) {
+  const int32_t depth = 100000;
+  const int32_t exprCap = 4 * depth + 1;
+  char* expr = (char*)malloc((size_t)exprCap);
+  tcalc_token* tokens = (tcalc_token*)malloc(sizeof(tcalc_token) * (size_t)exprCap);
+  tcalc_exprtree* tree = (tcalc_exprtree*)malloc(sizeof(tcalc_exprtree) * (size_t)exprCap);
+  tcalc_evalframe* frames = (tcalc_evalframe*)malloc(sizeof(tcalc_evalframe) * (size_t)depth);
+  CuAssertPtrNotNull(tc, expr);
+  CuAssertPtrNotNull(tc, tokens);
+  CuAssertPtrNotNull(tc, tree);
+  CuAssertPtrNotNull(tc, frames);
+  int32_t exprLen, tokensLen, treeLen, rootInd;
+  tcalc_val res = { 0 };
+
+  // deeply nested groups
+  exprLen = 0;
+  for (int32_t i = 0; i < depth; i++) expr[exprLen++] = '(';
+  expr[exprLen++] = '2';
+  for (int32_t i = 0; i < depth; i++) expr[exprLen++] = ')';
+  CuAssertTrue(tc, tcalc_lex_parse(expr, exprLen, tokens, exprCap, tree, exprCap, &tokensLen, &treeLen, &rootInd) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, 1, treeLen);
+
+  // deeply nested function calls and negations
+  exprLen = 0;
+  for (int32_t i = 0; i < depth / 4; i++) {
+    memcpy(expr + exprLen, "-abs(", 5);
+    exprLen += 5;
+  }
+  expr[exprLen++] = '2';
+  for (int32_t i = 0; i < depth / 4; i++) expr[exprLen++] = ')';
+  CuAssertTrue(tc, tcalc_lex_parse(expr, exprLen, tokens, exprCap, tree, exprCap, &tokensLen, &treeLen, &rootInd) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_eval_exprtree_stk(expr, exprLen, tree, treeLen, rootInd, tokens, tokensLen, tcalc_ctx_default(), frames, depth, &res) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, -2.0, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+
+  // a long chain of left associative operators
+  exprLen = 0;
+  for (int32_t i = 0; i < depth / 2; i++) {
+    memcpy(expr + exprLen, "1+", 2);
+    exprLen += 2;
+  }
+  expr[exprLen++] = '1';
+  CuAssertTrue(tc, tcalc_lex_parse(expr, exprLen, tokens, exprCap, tree, exprCap, &tokensLen, &treeLen, &rootInd) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, TCALC_EXPRTREE_NODE_TYPE_VALUE, tree[tree[rootInd].as.binary.rightTreeInd].type);
+  CuAssertTrue(tc, tcalc_eval_exprtree_stk(expr, exprLen, tree, treeLen, rootInd, tokens, tokensLen, tcalc_ctx_default(), frames, depth, &res) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, depth / 2 + 1, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+
+  // 0-(0-(...1)), evaluated through every entry point which picks its own
+  // number of frames
+  exprLen = 0;
+  for (int32_t i = 0; i < 5000; i++) {
+    memcpy(expr + exprLen, "0-(", 3);
+    exprLen += 3;
+  }
+  expr[exprLen++] = '1';
+  for (int32_t i = 0; i < 5000; i++) expr[exprLen++] = ')';
+  CuAssertTrue(tc, tcalc_eval(expr, exprLen, tree, exprCap, tokens, exprCap, &res, &treeLen, &tokensLen) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 1.0, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+  res.as.num = 0.0;
+  CuAssertTrue(tc, tcalc_eval_wctx(expr, exprLen, tree, exprCap, tokens, exprCap, tcalc_ctx_default(), &res, &treeLen, &tokensLen) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 1.0, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+  tcalc_arena* arena = NULL;
+  CuAssertTrue(tc, tcalc_arena_alloc(NULL, 0, &arena) == TCALC_ERR_OK);
+  res.as.num = 0.0;
+  CuAssertTrue(tc, tcalc_eval_arena(expr, exprLen, tcalc_ctx_default(), arena, &res) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 1.0, res.as.num, TCALC_EVAL_ASSERT_DELTA);
+  tcalc_arena_free(arena);
+
+  free(frames);
+  free(tree);
+  free(tokens);
+  free(expr);
+}
+
+void TestTCalcEvalErrorStack(CuTest *tc) {
+  tcalc_val res = TCALC_VAL_INIT_NUM(0.0);
+  char msg[256];
+  tcalc_err code;
+  int32_t start, end;
+
+  tcalc_errstkclear();
+  CuAssertTrue(tc, !tcalc_errstkpeekinfo(&code, &start, &end));
+  CuAssertIntEquals(tc, 0, tcalc_errstkpeek(msg, (int32_t)sizeof(msg)));
+
+  CuAssertTrue(tc, tcalc_eval_gb(TCALC_STRLIT_PTR_LEN("1 + 2)"), &res) == TCALC_ERR_UNBAL_GRPSYMS);
+  CuAssertIntEquals(tc, 1, tcalc_errstksize());
+  CuAssertTrue(tc, tcalc_errstkpeekinfo(&code, &start, &end));
+  CuAssertIntEquals(tc, TCALC_ERR_UNBAL_GRPSYMS, code);
+  CuAssertIntEquals(tc, 5, start);
+  CuAssertIntEquals(tc, 6, end);
+  CuAssertIntEquals(tc, (int)strlen(msg), tcalc_errstkpeek(msg, (int32_t)sizeof(msg)));
+  CuAssertStrEquals(tc, "[tcalc_tokenize_infix] Unbalanced grouping symbols \")\"", msg);
+
+  // messages are truncated to the destination
+  CuAssertIntEquals(tc, 7, tcalc_errstkpeek(msg, 8));
+  CuAssertStrEquals(tc, "[tcalc_", msg);
+  tcalc_errstkclear();
+
+  CuAssertTrue(tc, tcalc_eval_gb(TCALC_STRLIT_PTR_LEN("1 2"), &res) == TCALC_ERR_UNPROCESSED_INPUT);
+  CuAssertTrue(tc, tcalc_errstkpeekinfo(&code, &start, &end));
+  CuAssertIntEquals(tc, TCALC_ERR_UNPROCESSED_INPUT, code);
+  CuAssertIntEquals(tc, -1, start);
+  tcalc_errstkpeek(msg, (int32_t)sizeof(msg));
+  CuAssertTrue(tc, strstr(msg, "processed 1 tokens of 2 total tokens") != NULL);
+  tcalc_errstkclear();
+
+  CuAssertTrue(tc, tcalc_errstkaddf("test", "%d %s", 42, "things"));
+  CuAssertTrue(tc, tcalc_errstkpeekinfo(&code, &start, &end));
+  CuAssertIntEquals(tc, TCALC_ERR_OK, code);
+  tcalc_errstkpeek(msg, (int32_t)sizeof(msg));
+  CuAssertStrEquals(tc, "[test] 42 things", msg);
+  tcalc_errstkclear();
+}
+
+#ifdef TCALC_TESTS_HAVE_PTHREADS
+typedef struct tcalc_test_errstk_thread_args {
+  tcalc_err code; // the only code this thread adds to its error stack
+  int failures;
+} tcalc_test_errstk_thread_args;
+
+static void* tcalc_test_errstk_thread(void* arg) {
+  tcalc_test_errstk_thread_args* args = (tcalc_test_errstk_thread_args*)arg;
+  for (int round = 0; round < 10000; round++) {
+    if (tcalc_errstksize() != 0) args->failures++;
+    tcalc_errstkadd_msg("tcalc_test_errstk_thread", args->code, "first");
+    tcalc_errstkadd_i32("tcalc_test_errstk_thread", args->code, "%" PRId32 " of %" PRId32, 2, 2);
+
+    tcalc_err code = TCALC_ERR_OK;
+    int32_t start, end;
+    if (tcalc_errstksize() != 2 || !tcalc_errstkpeekinfo(&code, &start, &end) || code != args->code)
+      args->failures++;
+    tcalc_errstkclear();
+  }
+  return NULL;
+}
+
+void TestTCalcEvalErrorStackThreads(CuTest *tc) {
+  tcalc_errstkclear();
+  CuAssertTrue(tc, tcalc_errstkadd_msg("test", TCALC_ERR_NOMEM, "main thread"));
+
+  // both threads fill and clear their stacks at the same time, and neither
+  // should ever see the errors of the other or of this thread
+  tcalc_test_errstk_thread_args args[2] = {
+    { .code = TCALC_ERR_UNKNOWN_ID, .failures = 0 },
+    { .code = TCALC_ERR_DIV_BY_ZERO, .failures = 0 }
+  };
+  pthread_t threads[2];
+  for (int i = 0; i < 2; i++)
+    CuAssertIntEquals(tc, 0, pthread_create(&threads[i], NULL, tcalc_test_errstk_thread, &args[i]));
+  for (int i = 0; i < 2; i++)
+    CuAssertIntEquals(tc, 0, pthread_join(threads[i], NULL));
+  CuAssertIntEquals(tc, 0, args[0].failures);
+  CuAssertIntEquals(tc, 0, args[1].failures);
+
+  tcalc_err code;
+  int32_t start, end;
+  CuAssertIntEquals(tc, 1, tcalc_errstksize());
+  CuAssertTrue(tc, tcalc_errstkpeekinfo(&code, &start, &end));
+  CuAssertIntEquals(tc, TCALC_ERR_NOMEM, code);
+  tcalc_errstkclear();
+}
+#endif
+
+void TestTCalcEvalArena(CuTest *tc) {
+  tcalc_test_pool pool = TCALC_TEST_POOL_INIT;
+  const tcalc_allocator allocator = TCALC_TEST_POOL_ALLOCATOR(&pool);
+  tcalc_arena* arena = NULL;
+  CuAssertTrue(tc, tcalc_arena_alloc(&allocator, 0, &arena) == TCALC_ERR_OK);
+
+  // long enough for the parser to need more than its inline stacks
+  static char longExpr[4096];
+  int32_t longLen = 0;
+  for (int i = 0; i < 200; i++) longLen += snprintf(longExpr + longLen, sizeof(longExpr) - (size_t)longLen, "(");
+  longLen += snprintf(longExpr + longLen, sizeof(longExpr) - (size_t)longLen, "1");
+  for (int i = 0; i < 200; i++) longLen += snprintf(longExpr + longLen, sizeof(longExpr) - (size_t)longLen, " + 1)");
+
+  const char* exprs[] = { "2 * 3 ^ ln(2)", "(sin(5))^2 + (cos(5))^2", "pow(2, 10) - 1", longExpr, "1 +" };
+  const tcalc_ctx* ctx = tcalc_ctx_default();
+  int allocsAfterFirstRound = 0;
+  for (int round = 0; round < 3; round++) {
+    for (size_t i = 0; i < TCALC_ARRAY_SIZE(exprs); i++) {
+      const int32_t exprLen = (int32_t)strlen(exprs[i]);
+      tcalc_val expected = { 0 }, actual = { 0 };
+      const tcalc_err expectedErr = tcalc_eval_gb(exprs[i], exprLen, &expected);
+      CuAssertIntEquals(tc, expectedErr, tcalc_eval_arena(exprs[i], exprLen, ctx, arena, &actual));
+      if (expectedErr == TCALC_ERR_OK)
+        CuAssertDblEquals(tc, expected.as.num, actual.as.num, TCALC_DBL_ASSERT_DELTA);
+      tcalc_arena_reset(arena);
+    }
+    if (round == 0) allocsAfterFirstRound = pool.allocs;
+  }
+  // the arena stops allocating once it has grown to fit every expression
+  CuAssertTrue(tc, allocsAfterFirstRound > 0);
+  CuAssertIntEquals(tc, allocsAfterFirstRound, pool.allocs);
+
+  // memory is aligned, and the last block can be resized in place
+  const tcalc_allocator* arenaAllocator = tcalc_arena_allocator(arena);
+  char* block = (char*)tcalc_alloc(arenaAllocator, 3);
+  CuAssertTrue(tc, ((uintptr_t)block % 16) == 0);
+  CuAssertPtrEquals(tc, block, tcalc_realloc(arenaAllocator, block, 3, 100));
+  tcalc_free(arenaAllocator, block, 100);
+  CuAssertPtrEquals(tc, block, tcalc_arena_push(arena, 1));
+
+  tcalc_arena_free(arena);
+  CuAssertTrue(tc, pool.used == 0);
+  CuAssertIntEquals(tc, 0, pool.badSizes);
+}
+
 CuSuite* TCalcEvalGetSuite() {
   CuSuite* suite = CuSuiteNew();
   SUITE_ADD_TEST(suite, TestTCalcEvalSuccesses);
   SUITE_ADD_TEST(suite, TestTCalcEvalFailures);
+  SUITE_ADD_TEST(suite, TestTCalcEvalFoldExprtree);
+  SUITE_ADD_TEST(suite, TestTCalcEvalExprtreeWalk);
+  SUITE_ADD_TEST(suite, TestTCalcEvalFoldDeepExprtree);
+  SUITE_ADD_TEST(suite, TestTCalcEvalDeepExprtree);
+  SUITE_ADD_TEST(suite, TestTCalcEvalCtxPrecedence);
+  SUITE_ADD_TEST(suite, TestTCalcEvalDeepNesting);
+  SUITE_ADD_TEST(suite, TestTCalcEvalErrorStack);
+#ifdef TCALC_TESTS_HAVE_PTHREADS
+  SUITE_ADD_TEST(suite, TestTCalcEvalErrorStackThreads);
+#endif
+  SUITE_ADD_TEST(suite, TestTCalcEvalArena);
   return suite;
 }
@@ -0,0 +1,287 @@
+#include "tcalc_tests.h"
+
+#include "CuTest.h"
+
+#include "tcalc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef TCALC_TESTS_HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+void TestTCalcPreparedMatchesEval(CuTest *tc) {
+  const char* exprs[] = {
+    "2 * 3 ^ ln(2)",
+    "(sin(5))^2 + (cos(5))^2",
+    "23 + arcsin(0.5) * (1 / 4)",
+    "-10 ^ 2",
+    "2 ** 2 ^ 2 ** 2",
+    "2^2ln(e)",
+    "2pi",
+    "pow(2, 10) - 1",
+    "false || !true && true",
+    "(5 <= 5) || (true || true) && false",
+    "10sin(pi) == 10sin(3pi)",
+    "true != false"
+  };
+
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+  tcalc_arena* arena = NULL;
+  CuAssertTrue(tc, tcalc_arena_alloc(NULL, 0, &arena) == TCALC_ERR_OK);
+
+  for (size_t i = 0; i < TCALC_ARRAY_SIZE(exprs); i++) {
+    const int32_t exprLen = (int32_t)strlen(exprs[i]);
+    tcalc_val expected = { 0 }, actual = { 0 };
+    int32_t treeNodeCount, tokenCount;
+    CuAssertTrue(tc, tcalc_eval_wctx(
+      exprs[i], exprLen, globalTreeNodeBuffer, globalTreeNodeBufferCapacity,
+      globalTokenBuffer, globalTokenBufferCapacity, ctx, &expected,
+      &treeNodeCount, &tokenCount
+    ) == TCALC_ERR_OK);
+
+    tcalc_prepared* prep = NULL;
+    CuAssertTrue(tc, tcalc_prepared_compile(exprs[i], exprLen, ctx, &prep) == TCALC_ERR_OK);
+    CuAssertTrue(tc, tcalc_prepared_eval(prep, &actual) == TCALC_ERR_OK);
+    CuAssertIntEquals(tc, expected.type, actual.type);
+    if (expected.type == TCALC_VALTYPE_NUM)
+      CuAssertDblEquals(tc, expected.as.num, actual.as.num, TCALC_DBL_ASSERT_DELTA);
+    else
+      CuAssertIntEquals(tc, !!expected.as.boolean, !!actual.as.boolean);
+    tcalc_prepared_free(prep);
+
+    // compiling with scratch memory from an arena gives the same code
+    CuAssertTrue(tc, tcalc_prepared_compile_arena(exprs[i], exprLen, ctx, arena, &prep) == TCALC_ERR_OK);
+    tcalc_arena_reset(arena);
+    CuAssertTrue(tc, tcalc_prepared_eval(prep, &actual) == TCALC_ERR_OK);
+    CuAssertIntEquals(tc, expected.type, actual.type);
+    if (expected.type == TCALC_VALTYPE_NUM)
+      CuAssertDblEquals(tc, expected.as.num, actual.as.num, TCALC_DBL_ASSERT_DELTA);
+    tcalc_prepared_free(prep);
+  }
+
+  tcalc_arena_free(arena);
+  tcalc_ctx_free(ctx);
+}
+
+void TestTCalcPreparedVarSlots(CuTest *tc) {
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+
+  tcalc_prepared* prep = NULL;
+  CuAssertTrue(tc, tcalc_prepared_compile(TCALC_STRLIT_PTR_LEN("price * qty * (1 - discount) + 0pi"), ctx, &prep) == TCALC_ERR_OK);
+  // pi is immutable, so it is folded away instead of taking a slot
+  CuAssertIntEquals(tc, 3, tcalc_prepared_varcount(prep));
+
+  int32_t price, qty, discount, missing;
+  CuAssertTrue(tc, tcalc_prepared_getvarslot(prep, TCALC_STRLIT_PTR_LEN("price"), &price) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_getvarslot(prep, TCALC_STRLIT_PTR_LEN("qty"), &qty) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_getvarslot(prep, TCALC_STRLIT_PTR_LEN("discount"), &discount) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_getvarslot(prep, TCALC_STRLIT_PTR_LEN("missing"), &missing) == TCALC_ERR_NOT_FOUND);
+
+  tcalc_val res = { 0 };
+  CuAssertTrue(tc, tcalc_prepared_eval(prep, &res) == TCALC_ERR_UNKNOWN_ID);
+
+  for (int i = 1; i <= 10; i++) {
+    CuAssertTrue(tc, tcalc_prepared_setvar(prep, price, TCALC_VAL_INIT_NUM(2.5 * i)) == TCALC_ERR_OK);
+    CuAssertTrue(tc, tcalc_prepared_setvar(prep, qty, TCALC_VAL_INIT_NUM(i)) == TCALC_ERR_OK);
+    CuAssertTrue(tc, tcalc_prepared_setvar(prep, discount, TCALC_VAL_INIT_NUM(0.25)) == TCALC_ERR_OK);
+    CuAssertTrue(tc, tcalc_prepared_eval(prep, &res) == TCALC_ERR_OK);
+    CuAssertTrue(tc, res.type == TCALC_VALTYPE_NUM);
+    CuAssertDblEquals(tc, 2.5 * i * i * 0.75, res.as.num, TCALC_DBL_ASSERT_DELTA);
+  }
+
+  CuAssertTrue(tc, tcalc_prepared_setvar(prep, discount, TCALC_VAL_INIT_BOOL(true)) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_eval(prep, &res) == TCALC_ERR_BAD_CAST);
+  CuAssertTrue(tc, tcalc_prepared_setvar(prep, 3, TCALC_VAL_INIT_NUM(0.0)) == TCALC_ERR_OUT_OF_BOUNDS);
+
+  tcalc_prepared_free(prep);
+  tcalc_ctx_free(ctx);
+}
+
+void TestTCalcPreparedCompileFailures(CuTest *tc) {
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_default(&ctx) == TCALC_ERR_OK);
+
+  tcalc_prepared* prep = NULL;
+  CuAssertTrue(tc, tcalc_prepared_compile(TCALC_STRLIT_PTR_LEN("unknownfunc(2)"), ctx, &prep) == TCALC_ERR_UNKNOWN_ID);
+  CuAssertTrue(tc, prep == NULL);
+  CuAssertTrue(tc, tcalc_prepared_compile(TCALC_STRLIT_PTR_LEN("sin(1, 2)"), ctx, &prep) != TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_compile(TCALC_STRLIT_PTR_LEN("(1 + 2"), ctx, &prep) != TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_compile(TCALC_STRLIT_PTR_LEN(""), ctx, &prep) != TCALC_ERR_OK);
+
+  tcalc_ctx_free(ctx);
+}
+
+void TestTCalcPreparedDeepExpr(CuTest *tc) {
+  // x-(x-(...x)), which folding, merging, and compiling all have to walk
+  // without recursing once per level
+  const int32_t depth = 1000000;
+  char* expr = (char*)malloc((size_t)depth * 4 + 1);
+  CuAssertPtrNotNull(tc, expr);
+  int32_t exprLen = 0;
+  for (int32_t i = 0; i < depth; i++) {
+    memcpy(expr + exprLen, "x-(", 3);
+    exprLen += 3;
+  }
+  expr[exprLen++] = 'x';
+  for (int32_t i = 0; i < depth; i++) expr[exprLen++] = ')';
+
+  tcalc_prepared* prep = NULL;
+  CuAssertTrue(tc, tcalc_prepared_compile(expr, exprLen, tcalc_ctx_default(), &prep) == TCALC_ERR_OK);
+  int32_t x;
+  CuAssertTrue(tc, tcalc_prepared_getvarslot(prep, TCALC_STRLIT_PTR_LEN("x"), &x) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_setvar(prep, x, TCALC_VAL_INIT_NUM(1.0)) == TCALC_ERR_OK);
+
+  tcalc_val res = { 0 };
+  CuAssertTrue(tc, tcalc_prepared_eval(prep, &res) == TCALC_ERR_OK);
+  CuAssertTrue(tc, res.type == TCALC_VALTYPE_NUM);
+  CuAssertDblEquals(tc, 1.0, res.as.num, TCALC_DBL_ASSERT_DELTA);
+
+  tcalc_prepared_free(prep);
+  free(expr);
+}
+
+void TestTCalcPreparedVarStore(CuTest *tc) {
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_child(tcalc_ctx_default(), &ctx) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("bid"), TCALC_VAL_INIT_NUM(99.0)) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("ask"), TCALC_VAL_INIT_NUM(101.0)) == TCALC_ERR_OK);
+
+  tcalc_varstore* store = NULL;
+  CuAssertTrue(tc, tcalc_varstore_alloc(ctx, &store) == TCALC_ERR_OK);
+  // the constants of the default context are not part of the store
+  CuAssertIntEquals(tc, 2, tcalc_varstore_count(store));
+  int32_t bid, ask, pi;
+  CuAssertTrue(tc, tcalc_varstore_getslot(store, TCALC_STRLIT_PTR_LEN("bid"), &bid) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_varstore_getslot(store, TCALC_STRLIT_PTR_LEN("ask"), &ask) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_varstore_getslot(store, TCALC_STRLIT_PTR_LEN("pi"), &pi) == TCALC_ERR_NOT_FOUND);
+
+  tcalc_prepared* prep = NULL;
+  CuAssertTrue(tc, tcalc_prepared_compile(TCALC_STRLIT_PTR_LEN("(bid + ask) / 2 * qty"), ctx, &prep) == TCALC_ERR_OK);
+  int32_t qty;
+  CuAssertTrue(tc, tcalc_prepared_getvarslot(prep, TCALC_STRLIT_PTR_LEN("qty"), &qty) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_setvar(prep, qty, TCALC_VAL_INIT_NUM(10.0)) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_bindstore(prep, store) == TCALC_ERR_OK);
+
+  tcalc_val res = { 0 };
+  CuAssertTrue(tc, tcalc_prepared_eval(prep, &res) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 1000.0, res.as.num, TCALC_DBL_ASSERT_DELTA);
+
+  // every evaluation reads the store's current values
+  const int32_t slots[2] = { bid, ask };
+  const tcalc_val quote[2] = { TCALC_VAL_INIT_NUM(49.0), TCALC_VAL_INIT_NUM(51.0) };
+  CuAssertTrue(tc, tcalc_varstore_setmany(store, slots, quote, 2) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_eval(prep, &res) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 500.0, res.as.num, TCALC_DBL_ASSERT_DELTA);
+
+  CuAssertTrue(tc, tcalc_varstore_set(store, ask, TCALC_VAL_INIT_BOOL(true)) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_eval(prep, &res) == TCALC_ERR_BAD_CAST);
+  CuAssertTrue(tc, tcalc_varstore_set(store, 2, TCALC_VAL_INIT_NUM(0.0)) == TCALC_ERR_OUT_OF_BOUNDS);
+
+  tcalc_val vals[2];
+  CuAssertTrue(tc, tcalc_varstore_read(store, NULL, vals, 2) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 49.0, vals[bid].as.num, 0.0);
+  CuAssertTrue(tc, vals[ask].type == TCALC_VALTYPE_BOOL && vals[ask].as.boolean);
+
+  // unbinding keeps the last values read
+  CuAssertTrue(tc, tcalc_prepared_bindstore(prep, NULL) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_varstore_set(store, ask, TCALC_VAL_INIT_NUM(0.0)) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_eval(prep, &res) == TCALC_ERR_BAD_CAST);
+
+  // snapshots go into a context, here one that shadows ctx
+  tcalc_ctx* snap = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_child(ctx, &snap) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_varstore_snapshot(store, snap) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 49.0, tcalc_ctx_findvar(snap, TCALC_STRLIT_PTR_LEN("bid"))->val.as.num, 0.0);
+  CuAssertDblEquals(tc, 99.0, tcalc_ctx_findvar(ctx, TCALC_STRLIT_PTR_LEN("bid"))->val.as.num, 0.0);
+
+  tcalc_ctx_free(snap);
+  tcalc_prepared_free(prep);
+  tcalc_varstore_free(store);
+  tcalc_ctx_free(ctx);
+}
+
+#ifdef TCALC_TESTS_HAVE_PTHREADS
+#define TCALC_TEST_VARSTORE_WRITES 200000
+
+typedef struct tcalc_test_varstore_reader_args {
+  const tcalc_varstore* store;
+  tcalc_prepared* prep; // bound to store, evaluates bid + ask
+  int32_t slots[2]; // bid and ask
+  int torn; // reads which saw bid and ask from different writes
+  int reads;
+} tcalc_test_varstore_reader_args;
+
+/**
+ * Read the store until the writer's last write shows up. Every write keeps
+ * bid + ask at 0, and bid only ever goes up.
+*/
+static void* tcalc_test_varstore_reader(void* arg) {
+  tcalc_test_varstore_reader_args* args = (tcalc_test_varstore_reader_args*)arg;
+  double lastBid = 0.0;
+  while (lastBid < TCALC_TEST_VARSTORE_WRITES) {
+    tcalc_val vals[2];
+    if (tcalc_varstore_read(args->store, args->slots, vals, 2) != TCALC_ERR_OK ||
+        vals[0].type != TCALC_VALTYPE_NUM || vals[1].type != TCALC_VALTYPE_NUM ||
+        vals[0].as.num + vals[1].as.num != 0.0 || vals[0].as.num < lastBid) {
+      args->torn++;
+      break;
+    }
+    lastBid = vals[0].as.num;
+
+    tcalc_val res = { 0 };
+    if (tcalc_prepared_eval(args->prep, &res) != TCALC_ERR_OK || res.as.num != 0.0) {
+      args->torn++;
+      break;
+    }
+    args->reads++;
+  }
+  return NULL;
+}
+
+void TestTCalcPreparedVarStoreRace(CuTest *tc) {
+  tcalc_ctx* ctx = NULL;
+  CuAssertTrue(tc, tcalc_ctx_alloc_child(tcalc_ctx_default(), &ctx) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("bid"), TCALC_VAL_INIT_NUM(0.0)) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_ctx_addvar(ctx, TCALC_STRLIT_PTR_LEN("ask"), TCALC_VAL_INIT_NUM(0.0)) == TCALC_ERR_OK);
+
+  tcalc_test_varstore_reader_args args = { .torn = 0, .reads = 0 };
+  tcalc_varstore* store = NULL;
+  CuAssertTrue(tc, tcalc_varstore_alloc(ctx, &store) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_varstore_getslot(store, TCALC_STRLIT_PTR_LEN("bid"), &args.slots[0]) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_varstore_getslot(store, TCALC_STRLIT_PTR_LEN("ask"), &args.slots[1]) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_compile(TCALC_STRLIT_PTR_LEN("bid + ask"), ctx, &args.prep) == TCALC_ERR_OK);
+  CuAssertTrue(tc, tcalc_prepared_bindstore(args.prep, store) == TCALC_ERR_OK);
+  args.store = store;
+
+  pthread_t reader;
+  CuAssertIntEquals(tc, 0, pthread_create(&reader, NULL, tcalc_test_varstore_reader, &args));
+  for (int i = 1; i <= TCALC_TEST_VARSTORE_WRITES; i++) {
+    const tcalc_val quote[2] = { TCALC_VAL_INIT_NUM((double)i), TCALC_VAL_INIT_NUM(-(double)i) };
+    CuAssertTrue(tc, tcalc_varstore_setmany(store, args.slots, quote, 2) == TCALC_ERR_OK);
+  }
+  CuAssertIntEquals(tc, 0, pthread_join(reader, NULL));
+  CuAssertIntEquals(tc, 0, args.torn);
+  CuAssertTrue(tc, args.reads > 0);
+
+  tcalc_prepared_free(args.prep);
+  tcalc_varstore_free(store);
+  tcalc_ctx_free(ctx);
+}
+#endif
+
+CuSuite* TCalcPreparedGetSuite() {
+  CuSuite* suite = CuSuiteNew();
+  SUITE_ADD_TEST(suite, TestTCalcPreparedMatchesEval);
+  SUITE_ADD_TEST(suite, TestTCalcPreparedVarSlots);
+  SUITE_ADD_TEST(suite, TestTCalcPreparedCompileFailures);
+  SUITE_ADD_TEST(suite, TestTCalcPreparedDeepExpr);
+  SUITE_ADD_TEST(suite, TestTCalcPreparedVarStore);
+#ifdef TCALC_TESTS_HAVE_PTHREADS
+  SUITE_ADD_TEST(suite, TestTCalcPreparedVarStoreRace);
+#endif
+  return suite;
+}
@@ -1,6 +1,8 @@
 #include "tcalc_tests.h"
 #include "tcalc.h"
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
 void TestTCalcStrToDouble(CuTest* tc) {
   double out;
@@ -18,7 +20,7 @@ void TestTCalcStrToDouble(CuTest* tc) {
 
   err = tcalc_lpstrtodouble(TCALC_STRLIT_PTR_LEN(".034"), &out);
   CuAssertTrue(tc, err == TCALC_ERR_OK);
-  CuAssertDblEquals(tc, out, 34.0, TCALC_DBL_ASSERT_DELTA);
+  CuAssertDblEquals(tc, out, 0.034, TCALC_DBL_ASSERT_DELTA);
 
   err = tcalc_lpstrtodouble(TCALC_STRLIT_PTR_LEN("2349."), &out);
   CuAssertTrue(tc, err == TCALC_ERR_OK);
@@ -41,6 +43,95 @@ void TestTCalcStrToDouble(CuTest* tc) {
   CuAssertDblEquals(tc, out, -0.249, TCALC_DBL_ASSERT_DELTA);
 }
 
+void TestTCalcStrToDoubleExact(CuTest* tc) {
+  // every one of these must decode to exactly the double the compiler
+  // rounds the same literal to
+  #define TCALC_STRTODOUBLE_EXACT(_lit_) do { \
+      double out = -1.0; \
+      CuAssertTrue(tc, tcalc_lpstrtodouble(TCALC_STRLIT_PTR_LEN(#_lit_), &out) == TCALC_ERR_OK); \
+      CuAssertTrue(tc, out == _lit_); \
+    } while (0)
+
+  TCALC_STRTODOUBLE_EXACT(0.1);
+  TCALC_STRTODOUBLE_EXACT(0.3);
+  TCALC_STRTODOUBLE_EXACT(123456.789);
+  TCALC_STRTODOUBLE_EXACT(6.02214076e23);
+  TCALC_STRTODOUBLE_EXACT(1E-9);
+  TCALC_STRTODOUBLE_EXACT(1e23);
+  TCALC_STRTODOUBLE_EXACT(9007199254740993); // halfway, rounds down to even
+  TCALC_STRTODOUBLE_EXACT(9007199254740995); // halfway, rounds up to even
+  TCALC_STRTODOUBLE_EXACT(1.7976931348623157e308);
+  TCALC_STRTODOUBLE_EXACT(2.2250738585072011e-308); // subnormal
+  TCALC_STRTODOUBLE_EXACT(4.9406564584124654e-324);
+  TCALC_STRTODOUBLE_EXACT(123456789012345678901234567890.0);
+  TCALC_STRTODOUBLE_EXACT(0.1000000000000000055511151231257827021181583404541015625);
+  TCALC_STRTODOUBLE_EXACT(2.4703282292062328e-324); // just over halfway to the smallest subnormal
+
+  #undef TCALC_STRTODOUBLE_EXACT
+
+  double out = 1.0;
+  CuAssertTrue(tc, tcalc_lpstrtodouble(TCALC_STRLIT_PTR_LEN("1e-400"), &out) == TCALC_ERR_OK);
+  CuAssertTrue(tc, out == 0.0);
+
+  // exactly halfway between 0 and the smallest subnormal, so it rounds to even.
+  // As a C literal it would make the compiler warn about truncating to zero.
+  const char* halfMinSubnormal = "2.4703282292062327208828439643411068618252990130716238221279284125033775363510437593264991818081799618989828234772285886546332835517796989819938739800539093906315035659515570226392290858392449105184435931802849936536152500319370457678249219365623669863658480757001585769269903706311928279558551332927834338409351978015531246597263579574622766465272827220056374006485499977096599470454020828166226237857393450736339007967761930577506740176324673600968951340535537458516661134223766678604162159680461914467291840300530057530849048765391711386591646239524912623653881879636239373280423891018672348497668235089863388587925628302755995657524455507255189313690836254779186948667994968324049705821028513185451396213837722826145437693412532098591327667236328125e-324";
+  out = 1.0;
+  CuAssertTrue(tc, tcalc_lpstrtodouble(halfMinSubnormal, strlen(halfMinSubnormal), &out) == TCALC_ERR_OK);
+  CuAssertTrue(tc, out == 0.0);
+  CuAssertTrue(tc, tcalc_lpstrtodouble(TCALC_STRLIT_PTR_LEN("1.8e308"), &out) == TCALC_ERR_OVERFLOW);
+  CuAssertTrue(tc, tcalc_lpstrtodouble(TCALC_STRLIT_PTR_LEN("1e99999999999"), &out) == TCALC_ERR_OVERFLOW);
+
+  const char* invalid[] = { "", "-", ".", "1e", "1e+", "e5", "1.2.3", "1e5.5", "1x", "--1" };
+  for (size_t i = 0; i < TCALC_ARRAY_SIZE(invalid); i++)
+    CuAssertTrue(tc, tcalc_lpstrtodouble(invalid[i], strlen(invalid[i]), &out) == TCALC_ERR_INVALID_ARG);
+}
+
+void TestTCalcDoubleToStr(CuTest* tc) {
+  const struct { double num; const char* str; } cases[] = {
+    { 0.0, "0" },
+    { -0.0, "-0" },
+    { 1.0, "1" },
+    { -2.5, "-2.5" },
+    { 0.1, "0.1" },
+    { 0.1 + 0.2, "0.30000000000000004" },
+    { 1.0 / 3.0, "0.3333333333333333" },
+    { 1e-6, "0.000001" },
+    { 1e-9, "1e-9" },
+    { 123456.789, "123456.789" },
+    { 1e20, "100000000000000000000" },
+    { 1e21, "1e21" },
+    { 6.02214076e23, "6.02214076e23" },
+    { 9007199254740993.0, "9007199254740992" },
+    { 5.9604644775390625e-8, "5.960464477539063e-8" },
+    { 1.7976931348623157e308, "1.7976931348623157e308" },
+    { 2.2250738585072014e-308, "2.2250738585072014e-308" },
+    { 4.9406564584124654e-324, "5e-324" },
+    { HUGE_VAL, "inf" },
+    { -HUGE_VAL, "-inf" }
+  };
+
+  for (size_t i = 0; i < TCALC_ARRAY_SIZE(cases); i++) {
+    char buf[TCALC_DOUBLESTR_MAX_SIZE];
+    int32_t len = 0;
+    CuAssertTrue(tc, tcalc_doubletostr(cases[i].num, buf, (int32_t)sizeof(buf), &len) == TCALC_ERR_OK);
+    CuAssertStrEquals(tc, cases[i].str, buf);
+    CuAssertIntEquals(tc, (int)strlen(cases[i].str), len);
+
+    double back = 0.0;
+    if (isfinite(cases[i].num)) {
+      CuAssertTrue(tc, tcalc_lpstrtodouble(buf, (size_t)len, &back) == TCALC_ERR_OK);
+      CuAssertTrue(tc, memcmp(&back, &(cases[i].num), sizeof(double)) == 0);
+    }
+  }
+
+  char small[4];
+  int32_t len = -1;
+  CuAssertTrue(tc, tcalc_doubletostr(12.5, small, (int32_t)sizeof(small), &len) == TCALC_ERR_NOMEM);
+  CuAssertTrue(tc, tcalc_doubletostr(125, small, (int32_t)sizeof(small), &len) == TCALC_ERR_OK);
+  CuAssertStrEquals(tc, "125", small);
+}
+
 void TestTCalcStrHasPrefix(CuTest* tc) {
   CuAssertTrue(tc, tcalc_strhaspre("**", "**5+3"));
   CuAssertTrue(tc, tcalc_strhaspre("pre", "prefix"));
@@ -54,9 +145,11 @@ void TestTCalcStrHasPrefix(CuTest* tc) {
   CuAssertTrue(tc, !tcalc_strhaspre("trivial", ""));
 }
 
-CuSuite* TCalcStringSuite() {
+CuSuite* TCalcStringGetSuite() {
   CuSuite* suite = CuSuiteNew();
   SUITE_ADD_TEST(suite, TestTCalcStrToDouble);
+  SUITE_ADD_TEST(suite, TestTCalcStrToDoubleExact);
+  SUITE_ADD_TEST(suite, TestTCalcDoubleToStr);
   SUITE_ADD_TEST(suite, TestTCalcStrHasPrefix);
   return suite;
 }
@@ -6,8 +6,196 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+void TestTCalcTokenizeTypes(CuTest *tc) {
+  const char* expr = "-2.5x**y <= .5 && !(f(a, 3.) != +b)\t|| c = d % 1";
+  const struct { tcalc_token_type type; tcalc_opkind opkind; const char* str; } expected[] = {
+    { TCALC_TOK_UNOP, TCALC_OPKIND_MINUS, "-" },
+    { TCALC_TOK_NUM, TCALC_OPKIND_NONE, "2.5" },
+    { TCALC_TOK_ID, TCALC_OPKIND_NONE, "x" },
+    { TCALC_TOK_BINOP, TCALC_OPKIND_STARSTAR, "**" },
+    { TCALC_TOK_ID, TCALC_OPKIND_NONE, "y" },
+    { TCALC_TOK_RELOP, TCALC_OPKIND_LTEQ, "<=" },
+    { TCALC_TOK_NUM, TCALC_OPKIND_NONE, ".5" },
+    { TCALC_TOK_BINLOP, TCALC_OPKIND_AMPAMP, "&&" },
+    { TCALC_TOK_UNLOP, TCALC_OPKIND_BANG, "!" },
+    { TCALC_TOK_GRPSTRT, TCALC_OPKIND_NONE, "(" },
+    { TCALC_TOK_ID, TCALC_OPKIND_NONE, "f" },
+    { TCALC_TOK_GRPSTRT, TCALC_OPKIND_NONE, "(" },
+    { TCALC_TOK_ID, TCALC_OPKIND_NONE, "a" },
+    { TCALC_TOK_PSEP, TCALC_OPKIND_NONE, "," },
+    { TCALC_TOK_NUM, TCALC_OPKIND_NONE, "3." },
+    { TCALC_TOK_GRPEND, TCALC_OPKIND_NONE, ")" },
+    { TCALC_TOK_EQOP, TCALC_OPKIND_BANGEQ, "!=" },
+    { TCALC_TOK_UNOP, TCALC_OPKIND_PLUS, "+" },
+    { TCALC_TOK_ID, TCALC_OPKIND_NONE, "b" },
+    { TCALC_TOK_GRPEND, TCALC_OPKIND_NONE, ")" },
+    { TCALC_TOK_BINLOP, TCALC_OPKIND_PIPEPIPE, "||" },
+    { TCALC_TOK_ID, TCALC_OPKIND_NONE, "c" },
+    { TCALC_TOK_EQOP, TCALC_OPKIND_EQ, "=" },
+    { TCALC_TOK_ID, TCALC_OPKIND_NONE, "d" },
+    { TCALC_TOK_BINOP, TCALC_OPKIND_PERCENT, "%" },
+    { TCALC_TOK_NUM, TCALC_OPKIND_NONE, "1" }
+  };
+
+  int32_t tokensLen = 0;
+  CuAssertTrue(tc, tcalc_tokenize_infix(expr, (int32_t)strlen(expr), globalTokenBuffer, globalTokenBufferCapacity, &tokensLen) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, (int)TCALC_ARRAY_SIZE(expected), tokensLen);
+  for (int32_t i = 0; i < tokensLen; i++) {
+    CuAssertIntEquals(tc, expected[i].type, globalTokenBuffer[i].type);
+    CuAssertIntEquals(tc, expected[i].opkind, globalTokenBuffer[i].opkind);
+    CuAssertTrue(tc, tcalc_streq_ntlb(expected[i].str, tcalc_token_startcp(expr, globalTokenBuffer[i]), tcalc_token_len(expr, (int32_t)strlen(expr), globalTokenBuffer[i])));
+  }
+}
+
+void TestTCalcTokenizeExponents(CuTest *tc) {
+  const char* expr = "1e5 2.5E-3 .5e+2 2e 3e-x 4ex 6E";
+  const struct { tcalc_token_type type; const char* str; } expected[] = {
+    { TCALC_TOK_NUM, "1e5" },
+    { TCALC_TOK_NUM, "2.5E-3" },
+    { TCALC_TOK_NUM, ".5e+2" },
+    // an "e" without exponent digits is left to be an identifier
+    { TCALC_TOK_NUM, "2" },
+    { TCALC_TOK_ID, "e" },
+    { TCALC_TOK_NUM, "3" },
+    { TCALC_TOK_ID, "e" },
+    { TCALC_TOK_BINOP, "-" },
+    { TCALC_TOK_ID, "x" },
+    { TCALC_TOK_NUM, "4" },
+    { TCALC_TOK_ID, "ex" },
+    { TCALC_TOK_NUM, "6" }
+  };
+
+  int32_t tokensLen = 0;
+  // the final "E" is not an identifier
+  CuAssertTrue(tc, tcalc_tokenize_infix(expr, (int32_t)strlen(expr), globalTokenBuffer, globalTokenBufferCapacity, &tokensLen) == TCALC_ERR_INVALID_ARG);
+  CuAssertTrue(tc, tcalc_tokenize_infix(expr, (int32_t)strlen(expr) - 1, globalTokenBuffer, globalTokenBufferCapacity, &tokensLen) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, (int)TCALC_ARRAY_SIZE(expected), tokensLen);
+  for (int32_t i = 0; i < tokensLen; i++) {
+    CuAssertIntEquals(tc, expected[i].type, globalTokenBuffer[i].type);
+    CuAssertTrue(tc, tcalc_streq_ntlb(expected[i].str, tcalc_token_startcp(expr, globalTokenBuffer[i]), tcalc_token_len(expr, (int32_t)strlen(expr), globalTokenBuffer[i])));
+  }
+}
+
+void TestTCalcTokenizeFailures(CuTest *tc) {
+  const char* invalid[] = { "1.2.3", "1e5.5", ".", "1 & 2", "a | b", "[1]", "2 $ 3", "x\n", "ABC" };
+  for (size_t i = 0; i < TCALC_ARRAY_SIZE(invalid); i++) {
+    int32_t tokensLen = 0;
+    CuAssertTrue(tc, tcalc_tokenize_infix(invalid[i], (int32_t)strlen(invalid[i]), globalTokenBuffer, globalTokenBufferCapacity, &tokensLen) == TCALC_ERR_INVALID_ARG);
+  }
+
+  const char* unbalanced[] = { "(", ")(", "(1 + 2))", "sin(2" };
+  for (size_t i = 0; i < TCALC_ARRAY_SIZE(unbalanced); i++) {
+    int32_t tokensLen = 0;
+    CuAssertTrue(tc, tcalc_tokenize_infix(unbalanced[i], (int32_t)strlen(unbalanced[i]), globalTokenBuffer, globalTokenBufferCapacity, &tokensLen) == TCALC_ERR_UNBAL_GRPSYMS);
+  }
+
+  int32_t tokensLen = -1;
+  CuAssertTrue(tc, tcalc_tokenize_infix(TCALC_STRLIT_PTR_LEN("1 + 2"), globalTokenBuffer, 2, &tokensLen) == TCALC_ERR_NOMEM);
+  CuAssertTrue(tc, tcalc_tokenize_infix(TCALC_STRLIT_PTR_LEN("1 + 2"), globalTokenBuffer, 3, &tokensLen) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, 3, tokensLen);
+  CuAssertTrue(tc, tcalc_tokenize_infix(TCALC_STRLIT_PTR_LEN(" \t "), globalTokenBuffer, 0, &tokensLen) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, 0, tokensLen);
+}
+
+void TestTCalcTokenizeMeasure(CuTest *tc) {
+  const char* exprs[] = {
+    "1", "-2.5 + 3", "2x", "2(3)(4)", "(1 + 2)x", "sin(x) + cos(2pi)", "f(1, 2)",
+    "f(g(1), -h(2, 3), 4)x", "!(x < 2) || y >= 3 && x != y", "2 ** -(3) % 4", "pi()"
+  };
+  for (size_t i = 0; i < TCALC_ARRAY_SIZE(exprs); i++) {
+    const int32_t exprLen = (int32_t)strlen(exprs[i]);
+    int32_t tokensLen = 0, treeLen = 0, rootInd = 0;
+    int32_t measuredTokens = 0, measuredNodes = 0;
+    CuAssertTrue(tc, tcalc_measure_infix(exprs[i], exprLen, &measuredTokens, &measuredNodes) == TCALC_ERR_OK);
+    CuAssertTrue(tc, tcalc_tokenize_infix(exprs[i], exprLen, globalTokenBuffer, globalTokenBufferCapacity, &tokensLen) == TCALC_ERR_OK);
+    CuAssertIntEquals(tc, tokensLen, measuredTokens);
+
+    // a tree of exactly the measured size is large enough, and one node less is not
+    CuAssertTrue(tc, tcalc_create_exprtree_infix(exprs[i], exprLen, globalTokenBuffer, tokensLen, globalTreeNodeBuffer, measuredNodes, &treeLen, &rootInd) == TCALC_ERR_OK);
+    CuAssertIntEquals(tc, treeLen, measuredNodes);
+    CuAssertIntEquals(tc, treeLen, tcalc_exprtree_nodecount(globalTokenBuffer, tokensLen));
+    CuAssertTrue(tc, tcalc_create_exprtree_infix(exprs[i], exprLen, globalTokenBuffer, tokensLen, globalTreeNodeBuffer, measuredNodes - 1, &treeLen, &rootInd) == TCALC_ERR_NOMEM);
+    CuAssertIntEquals(tc, measuredNodes, treeLen);
+  }
+
+  // undersized buffers report the sizes which they need
+  int32_t tokensLen = 0, treeLen = 0, rootInd = 0;
+  CuAssertTrue(tc, tcalc_tokenize_infix(TCALC_STRLIT_PTR_LEN("1 + 2x"), globalTokenBuffer, 2, &tokensLen) == TCALC_ERR_NOMEM);
+  CuAssertIntEquals(tc, 4, tokensLen);
+  CuAssertTrue(tc, tcalc_lex_parse(TCALC_STRLIT_PTR_LEN("1 + 2x"), globalTokenBuffer, 2, globalTreeNodeBuffer, globalTreeNodeBufferCapacity, &tokensLen, &treeLen, &rootInd) == TCALC_ERR_NOMEM);
+  CuAssertIntEquals(tc, 4, tokensLen);
+  CuAssertIntEquals(tc, 5, treeLen);
+  CuAssertTrue(tc, tcalc_lex_parse(TCALC_STRLIT_PTR_LEN("1 + 2x"), globalTokenBuffer, globalTokenBufferCapacity, globalTreeNodeBuffer, 1, &tokensLen, &treeLen, &rootInd) == TCALC_ERR_NOMEM);
+  CuAssertIntEquals(tc, 4, tokensLen);
+  CuAssertIntEquals(tc, 5, treeLen);
+
+  tcalc_val val = { 0 };
+  CuAssertTrue(tc, tcalc_eval(TCALC_STRLIT_PTR_LEN("sin(1)"), globalTreeNodeBuffer, 0, globalTokenBuffer, 0, &val, &treeLen, &tokensLen) == TCALC_ERR_NOMEM);
+  CuAssertIntEquals(tc, 4, tokensLen);
+  CuAssertIntEquals(tc, 3, treeLen);
+  CuAssertTrue(tc, tcalc_eval(TCALC_STRLIT_PTR_LEN("sin(1)"), globalTreeNodeBuffer, treeLen, globalTokenBuffer, tokensLen, &val, &treeLen, &tokensLen) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 0.8414709848, val.as.num, TCALC_DBL_ASSERT_DELTA);
+
+  int32_t measuredTokens = 0, measuredNodes = 0;
+  CuAssertTrue(tc, tcalc_measure_infix(TCALC_STRLIT_PTR_LEN("(1 + 2"), &measuredTokens, &measuredNodes) == TCALC_ERR_UNBAL_GRPSYMS);
+  CuAssertTrue(tc, tcalc_measure_infix(TCALC_STRLIT_PTR_LEN("1 $ 2"), &measuredTokens, &measuredNodes) == TCALC_ERR_INVALID_ARG);
+}
+
+void TestTCalcTokenizeLongTokens(CuTest *tc) {
+  CuAssertIntEquals(tc, 8, (int)sizeof(tcalc_token));
+
+  // a number too long for the packed length, which is found again from expr
+  const int32_t numLen = TCALC_TOKEN_LONG_LEN + 5;
+  const int32_t exprLen = numLen + 4;
+  char* expr = (char*)malloc((size_t)exprLen);
+  CuAssertPtrNotNull(tc, expr);
+  memset(expr, '0', (size_t)numLen);
+  expr[numLen - 1] = '1';
+  memcpy(expr + numLen, " + 1", 4);
+
+  int32_t tokensLen = 0;
+  CuAssertTrue(tc, tcalc_tokenize_infix(expr, exprLen, globalTokenBuffer, globalTokenBufferCapacity, &tokensLen) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, 3, tokensLen);
+  CuAssertIntEquals(tc, TCALC_TOKEN_LONG_LEN, (int32_t)globalTokenBuffer[0].len);
+  CuAssertIntEquals(tc, numLen, tcalc_token_len(expr, exprLen, globalTokenBuffer[0]));
+  CuAssertIntEquals(tc, numLen + 1, globalTokenBuffer[1].start);
+
+  tcalc_val val = { 0 };
+  int32_t treeLen = 0;
+  CuAssertTrue(tc, tcalc_eval(expr, exprLen, globalTreeNodeBuffer, globalTreeNodeBufferCapacity, globalTokenBuffer, globalTokenBufferCapacity, &val, &treeLen, &tokensLen) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 2.0, val.as.num, TCALC_DBL_ASSERT_DELTA);
+
+  free(expr);
+
+  // the same number ending the expression, followed by more digits which are
+  // past the end of it
+  const int32_t tailExprLen = 4 + numLen;
+  char* tailExpr = (char*)malloc((size_t)tailExprLen + 2);
+  CuAssertPtrNotNull(tc, tailExpr);
+  memcpy(tailExpr, "1 + ", 4);
+  memset(tailExpr + 4, '0', (size_t)numLen);
+  tailExpr[tailExprLen - 1] = '1';
+  memcpy(tailExpr + tailExprLen, "99", 2);
+
+  CuAssertTrue(tc, tcalc_tokenize_infix(tailExpr, tailExprLen, globalTokenBuffer, globalTokenBufferCapacity, &tokensLen) == TCALC_ERR_OK);
+  CuAssertIntEquals(tc, 3, tokensLen);
+  CuAssertIntEquals(tc, TCALC_TOKEN_LONG_LEN, (int32_t)globalTokenBuffer[2].len);
+  CuAssertIntEquals(tc, numLen, tcalc_token_len(tailExpr, tailExprLen, globalTokenBuffer[2]));
+  CuAssertIntEquals(tc, tailExprLen, tcalc_token_xend(tailExpr, tailExprLen, globalTokenBuffer[2]));
+
+  CuAssertTrue(tc, tcalc_eval(tailExpr, tailExprLen, globalTreeNodeBuffer, globalTreeNodeBufferCapacity, globalTokenBuffer, globalTokenBufferCapacity, &val, &treeLen, &tokensLen) == TCALC_ERR_OK);
+  CuAssertDblEquals(tc, 2.0, val.as.num, TCALC_DBL_ASSERT_DELTA);
+  free(tailExpr);
+}
 
 CuSuite* TCalcTokenizeGetSuite() {
   CuSuite* suite = CuSuiteNew();
+  SUITE_ADD_TEST(suite, TestTCalcTokenizeTypes);
+  SUITE_ADD_TEST(suite, TestTCalcTokenizeExponents);
+  SUITE_ADD_TEST(suite, TestTCalcTokenizeFailures);
+  SUITE_ADD_TEST(suite, TestTCalcTokenizeMeasure);
+  SUITE_ADD_TEST(suite, TestTCalcTokenizeLongTokens);
   return suite;
 }